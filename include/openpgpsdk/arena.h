@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** \file
+ */
+
+#ifndef OPS_ARENA_H
+#define OPS_ARENA_H
+
+#include <sys/types.h>
+
+/** Default size of each block carved up by an ops_arena_t */
+#define OPS_ARENA_DEFAULT_BLOCK_SIZE	(64*1024)
+
+/** ops_arena_t
+ */
+typedef struct ops_arena ops_arena_t;
+
+ops_arena_t *ops_arena_new(size_t block_size);
+void ops_arena_free(ops_arena_t *arena);
+void *ops_arena_alloc(ops_arena_t *arena,size_t length);
+void *ops_arena_memdup(ops_arena_t *arena,const void *src,size_t length);
+size_t ops_arena_get_allocated(const ops_arena_t *arena);
+void ops_arena_adopt(ops_arena_t *arena,ops_arena_t *other);
+
+#endif
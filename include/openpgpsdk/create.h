@@ -41,12 +41,16 @@ struct ops_create_info
     {
     ops_writer_info_t winfo;
     ops_error_t *errors;	/*!< an error stack */
+    ops_writer_info_t *spare_winfo; /*!< popped writer nodes, linked by
+				      next, for ops_writer_push() to
+				      reuse */
     };
 
 void ops_prepare_parent_info(ops_create_info_t *parent_info,
                              ops_writer_info_t *winfo);
 ops_create_info_t *ops_create_info_new(void);
 void ops_create_info_delete(ops_create_info_t *info);
+void ops_create_info_reset(ops_create_info_t *info);
 
 ops_memory_t* ops_write_mem_from_file(const char *filename, int* errnum);
 int ops_write_file_from_buf(const char *filename, const char* buf, const size_t len, const ops_boolean_t overwrite);
@@ -109,6 +109,7 @@ void ops_hash_sha512(ops_hash_t *hash);
 void ops_hash_sha384(ops_hash_t *hash);
 void ops_hash_sha224(ops_hash_t *hash);
 void ops_hash_any(ops_hash_t *hash,ops_hash_algorithm_t alg);
+void ops_hash_dup(ops_hash_t *dst,const ops_hash_t *src);
 ops_hash_algorithm_t ops_hash_algorithm_from_text(const char *hash);
 const char *ops_text_from_hash(ops_hash_t *hash);
 unsigned ops_hash_size(ops_hash_algorithm_t alg);
@@ -116,6 +117,7 @@ unsigned ops_hash(unsigned char *out,ops_hash_algorithm_t alg,const void *in,
 		  size_t length);
 
 void ops_hash_add_int(ops_hash_t *hash,unsigned n,unsigned length);
+void ops_hash_add_public_key(ops_hash_t *hash,const ops_public_key_t *key);
 
 ops_boolean_t ops_dsa_verify(const unsigned char *hash,size_t hash_length,
 			     const ops_dsa_signature_t *sig,
@@ -94,15 +94,24 @@ typedef enum
 /** ops_errcode_name_map_t */
 typedef ops_map_t ops_errcode_name_map_t;
 
-/** one entry in a linked list of errors */
+typedef struct ops_error_index ops_error_index_t;
+
+/** one entry in a linked list of errors. The same error with the same
+ * comment from the same place is only entered once, and counted after
+ * that. */
 typedef struct ops_error
     {
     ops_errcode_t errcode;
     int sys_errno; /*!< irrelevent unless errcode == OPS_E_SYSTEM_ERROR */
     char *comment;
+    const char *fmt; /*!< the format comment was made from */
     const char *file;
     int line;
+    unsigned count; /*!< how many times it was pushed */
     struct ops_error *next;
+    struct ops_error *prev; /*!< the entry above, kept by ops_push_error() */
+    struct ops_error *same_hash; /*!< the next in its index slot */
+    ops_error_index_t *index; /*!< set in the top entry only */
     } ops_error_t;
 
 char *ops_errcode(const ops_errcode_t errcode);
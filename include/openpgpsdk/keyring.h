@@ -27,24 +27,62 @@
 
 #include "packet.h"
 #include "memory.h"
+#include "arena.h"
 
 typedef struct ops_keydata ops_keydata_t;
 
 /** \struct ops_keyring_t
  * A keyring
+ *
+ * The keys, and everything they own apart from their key material, are
+ * allocated from the keyring's arena, so a key's address does not
+ * change as the keyring grows and ops_keyring_free() releases them
+ * in bulk.
  */
 
 typedef struct
     {
     int nkeys; // while we are constructing a key, this is the offset
     int nkeys_allocated;
-    ops_keydata_t *keys;
+    ops_keydata_t **keys;
+    ops_arena_t *arena;
+    unsigned *id_index;		/*!< open hash table of key positions+1,
+				  by the IDs of the keys and of their
+				  subkeys */
+    unsigned char *id_filter;	/*!< Bloom filter of the IDs in id_index,
+				  in the same allocation */
+    unsigned id_index_size;
+    unsigned nids;		/*!< entries in id_index */
+    int nindexed;		/*!< keys [0,nindexed) are in id_index */
+    ops_boolean_t compact;	/*!< if set before reading, public keys are
+				  held in a compact form, see
+				  ops_keyring_new_compact_keydata() */
+    struct ops_verify_cache *verify_cache; /*!< if set, consulted and
+					     filled in when signatures are
+					     checked against this keyring;
+					     not owned by the keyring */
     } ops_keyring_t;    
 
+/** ops_keyring_import_result_t
+ * What ops_keyring_import() did
+ */
+typedef struct
+    {
+    unsigned new_keys;		/*!< keys that weren't already present */
+    unsigned updated_keys;	/*!< existing keys that gained packets */
+    unsigned unchanged_keys;	/*!< keys that were already present in full */
+    unsigned new_user_ids;	/*!< User IDs added to existing keys */
+    unsigned new_packets;	/*!< packets (of any kind) added to existing
+				  keys */
+    } ops_keyring_import_result_t;
+
 const ops_keydata_t *
 ops_keyring_find_key_by_id(const ops_keyring_t *keyring,
 			   const unsigned char keyid[OPS_KEY_ID_SIZE]);
 const ops_keydata_t *
+ops_keyring_find_key_by_subkey_id(const ops_keyring_t *keyring,
+				  const unsigned char keyid[OPS_KEY_ID_SIZE]);
+const ops_keydata_t *
 ops_keyring_find_key_by_userid(const ops_keyring_t *keyring,
 			       const char* userid);
 void ops_keydata_free(ops_keydata_t *key);
@@ -62,6 +100,11 @@ ops_secret_key_t *ops_decrypt_secret_key_from_data(const ops_keydata_t *key,
 
 ops_boolean_t ops_keyring_read_from_file(ops_keyring_t *keyring, const ops_boolean_t armour, const char *filename);
 ops_boolean_t ops_keyring_read_from_mem(ops_keyring_t *keyring, const ops_boolean_t armour, ops_memory_t *mem);
+ops_boolean_t ops_keyring_read_from_file_parallel(ops_keyring_t *keyring, const ops_boolean_t armour, const char *filename, unsigned nthreads);
+
+void ops_keyring_import(ops_keyring_t *keyring, ops_keyring_t *from, ops_create_info_t *journal, ops_keyring_import_result_t *result);
+ops_boolean_t ops_keyring_import_from_mem(ops_keyring_t *keyring, const ops_boolean_t armour, ops_memory_t *mem, ops_create_info_t *journal, ops_keyring_import_result_t *result);
+ops_boolean_t ops_keyring_import_from_file(ops_keyring_t *keyring, const ops_boolean_t armour, const char *filename, ops_keyring_import_result_t *result);
 
 char *ops_malloc_passphrase(char *passphrase);
 char *ops_get_passphrase(void);
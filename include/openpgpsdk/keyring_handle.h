@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** \file
+ * \brief A keyring shared between threads, replaced by publishing
+ * immutable snapshots of it.
+ */
+
+#ifndef OPS_KEYRING_HANDLE_H
+#define OPS_KEYRING_HANDLE_H
+
+#include "keyring.h"
+
+/** ops_keyring_handle_t
+ */
+typedef struct ops_keyring_handle ops_keyring_handle_t;
+
+/** ops_keyring_reader_t
+ * A thread's registration with an ops_keyring_handle_t
+ */
+typedef struct ops_keyring_reader ops_keyring_reader_t;
+
+ops_keyring_handle_t *ops_keyring_handle_new(ops_keyring_t *keyring);
+void ops_keyring_handle_free(ops_keyring_handle_t *handle);
+
+ops_keyring_reader_t *ops_keyring_reader_new(ops_keyring_handle_t *handle);
+void ops_keyring_reader_free(ops_keyring_reader_t *reader);
+const ops_keyring_t *ops_keyring_reader_enter(ops_keyring_reader_t *reader);
+void ops_keyring_reader_exit(ops_keyring_reader_t *reader);
+
+void ops_keyring_handle_publish(ops_keyring_handle_t *handle,
+				ops_keyring_t *keyring);
+ops_boolean_t ops_keyring_handle_reload_from_file(ops_keyring_handle_t *handle,
+						  const ops_boolean_t armour,
+						  const char *filename);
+ops_boolean_t ops_keyring_handle_import(ops_keyring_handle_t *handle,
+					ops_keyring_t *from,
+					ops_keyring_import_result_t *result);
+ops_boolean_t ops_keyring_handle_import_from_file(ops_keyring_handle_t *handle,
+						  const ops_boolean_t armour,
+						  const char *filename,
+						  ops_keyring_import_result_t *result);
+unsigned ops_keyring_handle_collect(ops_keyring_handle_t *handle);
+
+#endif
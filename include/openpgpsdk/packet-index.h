@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file
+ * \brief Where each packet in a file is, found without parsing them
+ */
+
+#ifndef OPS_PACKET_INDEX_H
+#define OPS_PACKET_INDEX_H
+
+#include <sys/types.h>
+
+#include "packet.h"
+#include "errors.h"
+#include "create.h"
+
+/** ops_packet_index_entry_t
+ * Where one top-level packet is
+ */
+typedef struct
+    {
+    ops_content_tag_t	tag;		/*!< the packet's tag */
+    ops_boolean_t	partial;	/*!< the body is in partial length
+					  chunks, each with a length of
+					  its own */
+    off_t		header_offset;	/*!< offset of the packet's tag */
+    off_t		body_offset;	/*!< offset of the body, after
+					  the header */
+    off_t		length;		/*!< length of the body, not
+					  counting the lengths of partial
+					  chunks */
+    } ops_packet_index_entry_t;
+
+/** ops_packet_index_t
+ */
+typedef struct ops_packet_index ops_packet_index_t;
+
+ops_packet_index_t *ops_packet_index_new(void);
+void ops_packet_index_free(ops_packet_index_t *index);
+ops_boolean_t ops_packet_index_build(ops_packet_index_t *index,int fd,
+				     ops_error_t **errors);
+unsigned ops_packet_index_count(const ops_packet_index_t *index);
+const ops_packet_index_entry_t *
+ops_packet_index_get(const ops_packet_index_t *index,unsigned n);
+ops_boolean_t ops_packet_index_write(const ops_packet_index_t *index,
+				     ops_create_info_t *cinfo);
+ops_boolean_t ops_packet_index_read(ops_packet_index_t *index,
+				    const unsigned char *data,size_t length);
+
+#endif
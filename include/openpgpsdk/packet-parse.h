@@ -105,6 +105,7 @@ typedef void ops_reader_destroyer_t(ops_reader_info_t *rinfo);
 
 ops_parse_info_t *ops_parse_info_new(void);
 void ops_parse_info_delete(ops_parse_info_t *pinfo);
+void ops_parse_info_reset(ops_parse_info_t *pinfo);
 ops_error_t *ops_parse_info_get_errors(ops_parse_info_t *pinfo);
 ops_crypt_t *ops_parse_get_decrypt(ops_parse_info_t *pinfo);
 
@@ -132,6 +133,12 @@ int ops_parse_errs(ops_parse_info_t *parse_info,ops_ulong_list_t *errs);
 
 void ops_parse_and_validate(ops_parse_info_t *parse_info);
 
+/** The default for ops_parse_set_body_size() */
+#define OPS_DEFAULT_BODY_SIZE	8192
+
+void ops_parse_borrow_bodies(ops_parse_info_t *pinfo,ops_boolean_t borrow);
+void ops_parse_set_body_size(ops_parse_info_t *pinfo,size_t size);
+void ops_parse_keys_only(ops_parse_info_t *pinfo,ops_boolean_t keys_only);
 void ops_parse_options(ops_parse_info_t *pinfo,ops_content_tag_t tag,
 		       ops_parse_type_t type);
 
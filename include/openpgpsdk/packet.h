@@ -250,6 +250,10 @@ typedef struct
 						  used with v3 keys. */
     ops_public_key_algorithm_t	algorithm;	/*!< Public Key Algorithm type */
     ops_public_key_union_t	key;		/*!< Public Key Parameters */
+    unsigned char		*serialised;	/*!< the key as it is hashed for fingerprints and key signatures
+						  (0x99, two octets of length, then the key), or NULL.  Made by
+						  ops_public_key_serialise() and freed with the key. */
+    unsigned			serialised_length;
     } ops_public_key_t;
 
 /** Structure to hold data for one RSA secret key
@@ -479,8 +483,10 @@ typedef struct
     ops_signature_union_t	signature;	/*!< signature parameters */
     size_t			v4_hashed_data_length;
     unsigned char* 		v4_hashed_data;
+    unsigned char		key_flags;	/*!< first octet of the key flags subpacket */
     ops_boolean_t		creation_time_set:1;
     ops_boolean_t		signer_id_set:1;
+    ops_boolean_t		key_flags_set:1;
     } ops_signature_info_t;
 
 /** Struct used when parsing a signature */
@@ -693,13 +699,27 @@ typedef struct
     time_t			modification_time;
     } ops_literal_data_header_t;
 
-/** ops_literal_data_body_t */
+/** ops_literal_data_body_t
+ * Part of a Literal Data packet's body, at most the parse's body size
+ * long, see ops_parse_set_body_size()
+ */
 typedef struct
     {
     unsigned			length;
-    unsigned char		data[8192];
+    unsigned char		*data; /*!< only valid during the callback */
     } ops_literal_data_body_t;
 
+/** ops_literal_data_slice_t
+ * Part of a Literal Data packet's body, borrowed from the parser's input
+ * where it can be, instead of being copied into an
+ * ops_literal_data_body_t
+ */
+typedef struct
+    {
+    const unsigned char		*ptr; /*!< only valid during the callback */
+    size_t			len;
+    } ops_literal_data_slice_t;
+
 /** ops_mdc_t */
 typedef struct
     {
@@ -743,7 +763,7 @@ typedef struct
 typedef struct
     {
     unsigned			length;
-    unsigned char		data[8192]; // \todo fix hard-coded value?
+    unsigned char		*data; /*!< only valid during the callback */
     } ops_signed_cleartext_body_t;
 
 /** ops_signed_cleartext_trailer_t */
@@ -831,7 +851,7 @@ typedef struct
 typedef struct
     {
     unsigned			length;
-    unsigned char		data[8192]; // \todo parameterise this!
+    unsigned char		*data; /*!< only valid during the callback */
     } ops_se_data_body_t;
 
 /** ops_get_secret_key_t */
@@ -875,6 +895,7 @@ typedef union
     ops_ss_unknown_t	 	ss_unknown;
     ops_literal_data_header_t	literal_data_header;
     ops_literal_data_body_t	literal_data_body;
+    ops_literal_data_slice_t	literal_data_slice;
 	ops_mdc_t				mdc;
     ops_ss_features_t		ss_features;
     ops_ss_signature_target_t ss_signature_target;
@@ -917,6 +938,7 @@ void ops_keyid(unsigned char keyid[OPS_KEY_ID_SIZE],
 	       const ops_public_key_t *key);
 void ops_fingerprint(ops_fingerprint_t *fp,const ops_public_key_t *key);
 void ops_public_key_free(ops_public_key_t *key);
+void ops_public_key_serialise(ops_public_key_t *key);
 void ops_user_id_free(ops_user_id_t *id);
 void ops_user_attribute_free(ops_user_attribute_t *att);
 void ops_signature_free(ops_signature_t *sig);
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file
+ * \brief Parsing a buffer of independent packets on several threads
+ */
+
+#ifndef OPS_PARSE_PARALLEL_H
+#define OPS_PARSE_PARALLEL_H
+
+#include "packet-parse.h"
+
+/** Roughly how many bytes of packets each worker takes at a time, by
+    default */
+#define OPS_PARALLEL_SPAN_SIZE	(64*1024)
+
+int ops_parse_parallel(ops_parse_info_t *pinfo,const void *buffer,
+		       size_t length,unsigned nthreads,size_t span_size);
+
+#endif
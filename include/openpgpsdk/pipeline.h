@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/** \file
+ * \brief Reading and writing files on their own threads, so that disk
+ * latency overlaps with hashing and the rest of the work
+ */
+
+#ifndef OPS_PIPELINE_H
+#define OPS_PIPELINE_H
+
+#include "packet-parse.h"
+#include "create.h"
+
+/** Default number of buffers kept in flight by a pipelined file */
+#define OPS_PIPELINE_DEFAULT_BUFFERS	4
+/** Default size of each of those buffers */
+#define OPS_PIPELINE_DEFAULT_BUFFER_SIZE	(1 << 20)
+
+/** ops_prefetch_t
+ * An fd read ahead by a thread of its own
+ */
+typedef struct ops_prefetch ops_prefetch_t;
+
+ops_prefetch_t *ops_prefetch_new(int fd,unsigned nbuffers,size_t buffer_size);
+int ops_prefetch_read(ops_prefetch_t *prefetch,const unsigned char **data);
+int ops_prefetch_get_errno(ops_prefetch_t *prefetch);
+void ops_prefetch_free(ops_prefetch_t *prefetch);
+
+void ops_reader_set_fd_pipelined(ops_parse_info_t *pinfo,int fd,
+				 unsigned nbuffers,size_t buffer_size);
+void ops_writer_set_fd_pipelined(ops_create_info_t *info,int fd,
+				 unsigned nbuffers,size_t buffer_size);
+
+#endif
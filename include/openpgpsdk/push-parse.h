@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file
+ * \brief Parsing input that is handed over a piece at a time
+ *
+ * Literal data is passed to the callback as it arrives. Every other
+ * packet is held until it is all here before it is parsed, so a
+ * Compressed or encrypted packet, or one whose length runs to the end
+ * of the input, is held whole. So is any packet while packets are
+ * being accumulated.
+ */
+
+#ifndef OPS_PUSH_PARSE_H
+#define OPS_PUSH_PARSE_H
+
+#include "packet-parse.h"
+
+/** ops_push_parser_t
+ */
+typedef struct ops_push_parser ops_push_parser_t;
+
+ops_push_parser_t *ops_push_parser_new(ops_parse_cb_t *cb,void *arg);
+void ops_push_parser_free(ops_push_parser_t *push);
+ops_parse_info_t *ops_push_parser_get_pinfo(ops_push_parser_t *push);
+ops_boolean_t ops_push_parser_feed(ops_push_parser_t *push,const void *buf,
+				   size_t length);
+ops_boolean_t ops_push_parser_finish(ops_push_parser_t *push);
+
+#endif
@@ -67,6 +67,10 @@ void ops_teardown_memory_read(ops_parse_info_t *pinfo, ops_memory_t *mem);
 
 // file writing
 int ops_setup_file_write(ops_create_info_t **cinfo, const char* filename, ops_boolean_t allow_overwrite);
+int ops_setup_file_write_pipelined(ops_create_info_t **cinfo,
+				   const char* filename,
+				   ops_boolean_t allow_overwrite,
+				   unsigned nbuffers,size_t buffer_size);
 void ops_teardown_file_write(ops_create_info_t *cinfo, int fd);
 
 // file appending
@@ -76,6 +80,11 @@ void ops_teardown_file_append(ops_create_info_t *cinfo, int fd);
 // file reading
 int ops_setup_file_read(ops_parse_info_t **pinfo, const char *filename, void* arg,
                         ops_parse_cb_return_t callback(const ops_parser_content_t *, ops_parse_cb_info_t *), ops_boolean_t accumulate);
+int ops_setup_file_read_pipelined(ops_parse_info_t **pinfo,
+				  const char *filename,void* arg,
+				  ops_parse_cb_return_t callback(const ops_parser_content_t *, ops_parse_cb_info_t *),
+				  ops_boolean_t accumulate,
+				  unsigned nbuffers,size_t buffer_size);
 void ops_teardown_file_read(ops_parse_info_t *pinfo, int fd);
 
 ops_boolean_t ops_reader_set_accumulate(ops_parse_info_t* pinfo, ops_boolean_t state);
@@ -88,8 +88,10 @@ void ops_signature_add_primary_user_id(ops_create_signature_t *sig,
 
 // Standard Interface
 ops_boolean_t ops_sign_file_as_cleartext(const char* input_filename, const char* output_filename, const ops_secret_key_t *skey, const ops_boolean_t overwrite);
+ops_boolean_t ops_sign_file_as_cleartext_pipelined(const char* input_filename, const char* output_filename, const ops_secret_key_t *skey, const ops_boolean_t overwrite, unsigned nbuffers, size_t buffer_size);
 ops_boolean_t ops_sign_buf_as_cleartext(const char* input, const size_t len, ops_memory_t** output, const ops_secret_key_t *skey);
 ops_boolean_t ops_sign_file(const char* input_filename, const char* output_filename, const ops_secret_key_t *skey, const ops_boolean_t use_armour, const ops_boolean_t overwrite);
+ops_boolean_t ops_sign_file_pipelined(const char* input_filename, const char* output_filename, const ops_secret_key_t *skey, const ops_boolean_t use_armour, const ops_boolean_t overwrite, unsigned nbuffers, size_t buffer_size);
 ops_memory_t * ops_sign_buf(const void* input, const size_t input_len, const ops_sig_type_t sig_type,  const ops_secret_key_t *skey, const ops_boolean_t use_armour);
 ops_boolean_t ops_writer_push_signed(ops_create_info_t *cinfo, const ops_sig_type_t sig_type, const ops_secret_key_t *skey);
 
@@ -141,6 +141,7 @@ enum ops_content_tag_t
     OPS_PTAG_CT_SE_IP_DATA_HEADER	=0x300+13,
     OPS_PTAG_CT_SE_IP_DATA_BODY		=0x300+14,
     OPS_PTAG_CT_ENCRYPTED_PK_SESSION_KEY=0x300+15,
+    OPS_PTAG_CT_LITERAL_DATA_SLICE	=0x300+16, // see ops_parse_borrow_bodies()
 
     /* commands to the callback */
     OPS_PARSER_CMD_GET_SK_PASSPHRASE	=0x400,
@@ -50,5 +50,6 @@ void hexdump(const unsigned char *src,size_t length);
 #define OPS_ARRAY_SIZE(a)	(sizeof(a)/sizeof(*(a)))
 
 void *ops_mallocz(size_t n);
+unsigned ops_default_nthreads(void);
 
 #endif
@@ -20,6 +20,9 @@
  */
 
 
+#ifndef OPS_VALIDATE_H
+#define OPS_VALIDATE_H
+
 typedef struct
     {
     unsigned int valid_count;
@@ -39,6 +42,10 @@ ops_boolean_t ops_validate_key_signatures(ops_validate_result_t *result,
 ops_boolean_t ops_validate_all_signatures(ops_validate_result_t *result,
                                  const ops_keyring_t *ring,
                                  ops_parse_cb_return_t (const ops_parser_content_t *, ops_parse_cb_info_t *));
+ops_boolean_t ops_validate_all_signatures_parallel(ops_validate_result_t *result,
+                                 const ops_keyring_t *ring,
+                                 ops_parse_cb_return_t (const ops_parser_content_t *, ops_parse_cb_info_t *),
+				 unsigned nthreads,unsigned chunk_keys);
 
 void ops_keydata_reader_set(ops_parse_info_t *pinfo,
 			     const ops_keydata_t *key);
@@ -70,19 +77,16 @@ typedef struct
     ops_parse_cb_return_t (*cb_get_passphrase) (const ops_parser_content_t *, ops_parse_cb_info_t *);
     } validate_key_cb_arg_t;
 
-/** Struct use with the validate_data_cb callback */
+/** Struct use with the validate_data_cb callback
+ *
+ * The signed data is never held here: literal data is hashed by the
+ * parser as it streams past, using the hash started by each one-pass
+ * signature, and signed cleartext is hashed by the dearmouring reader.
+ */
 typedef struct validate_data_cb_arg
     {
-    enum
-        {
-        LITERAL_DATA,
-        SIGNED_CLEARTEXT
-        } use; /*<! this is set to indicate what kind of data we have */
-    union
-        {
-        ops_literal_data_body_t literal_data_body; /*<! Used to hold Literal Data */
-        ops_signed_cleartext_body_t signed_cleartext_body; /*<! Used to hold Signed Cleartext */
-        } data; /*<! the data itself */
+    ops_hash_t *cleartext_hash; /*<! hash of signed cleartext, from its
+				  trailer, until a signature uses it */
     unsigned char hash[OPS_MAX_HASH_SIZE]; /*<! the hash */
     const ops_keyring_t *keyring; /*<! keyring to use */
     validate_reader_arg_t *rarg; /*<! reader-specific arg */
@@ -97,6 +101,47 @@ ops_parse_cb_return_t
 ops_validate_key_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo);
 
 ops_boolean_t ops_validate_file(ops_validate_result_t* result, const char* filename, const int armoured, const ops_keyring_t* keyring);
+ops_boolean_t ops_validate_file_pipelined(ops_validate_result_t* result, const char* filename, const int armoured, const ops_keyring_t* keyring, unsigned nbuffers, size_t buffer_size);
 ops_boolean_t ops_validate_mem(ops_validate_result_t *result, ops_memory_t* mem, const int armoured, const ops_keyring_t* keyring);
 
+/** ops_validate_source_t
+ * Where ops_validate_detached() reads something from
+ */
+typedef struct
+    {
+    const unsigned char *buffer; /*!< the data, if fd is negative */
+    size_t length;		/*!< its length */
+    int fd;			/*!< if not negative, the data is read from
+				  here, from its current position to EOF */
+    } ops_validate_source_t;
+
+ops_boolean_t ops_validate_detached(ops_validate_result_t *result,
+				    const ops_validate_source_t *data,
+				    const ops_validate_source_t *signature,
+				    const int armoured,
+				    const ops_keyring_t *keyring);
+ops_boolean_t ops_validate_detached_file(ops_validate_result_t *result,
+					 const char *data_filename,
+					 const char *signature_filename,
+					 const int armoured,
+					 const ops_keyring_t *keyring);
+
+/** ops_validate_context_t
+ * A detached signature, parsed and ready to be checked against data
+ */
+typedef struct ops_validate_context ops_validate_context_t;
+
+ops_validate_context_t *
+ops_validate_context_new(const ops_validate_source_t *signature,
+			 const int armoured,const ops_keyring_t *keyring);
+void ops_validate_context_free(ops_validate_context_t *context);
+ops_boolean_t ops_validate_context_check(ops_validate_result_t *result,
+					 const ops_validate_context_t *context,
+					 const ops_validate_source_t *data);
+ops_boolean_t ops_validate_context_check_hash(ops_validate_result_t *result,
+					      const ops_validate_context_t *context,
+					      const ops_hash_t *hash);
+
+#endif
+
 // EOF
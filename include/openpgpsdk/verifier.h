@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/** \file
+ * \brief Verification of many detached signatures against one keyring
+ */
+
+#ifndef OPS_VERIFIER_H
+#define OPS_VERIFIER_H
+
+#include "keyring.h"
+#include "packet-parse.h"
+#include "validate.h"
+
+/** ops_verifier_t
+ */
+typedef struct ops_verifier ops_verifier_t;
+
+/** ops_verify_job_t
+ * One piece of data and its detached signature, for ops_verifier_run()
+ *
+ * The data and the signature are each read from a file, if their
+ * filename is set, or else from their source.
+ */
+typedef struct
+    {
+    const char *data_filename;	/*!< the signed data's file, or NULL */
+    ops_validate_source_t data;	/*!< the signed data, if no filename */
+    const char *signature_filename; /*!< the signature's file, or NULL */
+    ops_validate_source_t signature; /*!< the signature, if no filename */
+    ops_boolean_t armoured;	/*!< the signature is armoured */
+
+    /* Filled in by ops_verifier_run() */
+    ops_boolean_t valid;	/*!< as returned by ops_validate_detached() */
+    ops_validate_result_t *result; /*!< details of each signature, to be
+				     freed with ops_validate_result_free() */
+    int sys_errno;		/*!< if a file couldn't be opened, why;
+				  else 0 */
+    unsigned long usecs;	/*!< how long the job took, in
+				  microseconds */
+    } ops_verify_job_t;
+
+ops_verifier_t *ops_verifier_new(ops_keyring_t *keyring,unsigned nthreads);
+void ops_verifier_free(ops_verifier_t *verifier);
+const ops_keyring_t *ops_verifier_get_keyring(const ops_verifier_t *verifier);
+void ops_verifier_run(ops_verifier_t *verifier,ops_verify_job_t *jobs,
+		      unsigned njobs);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** \file
+ * \brief A cache of signature verification results
+ */
+
+#ifndef OPS_VERIFY_CACHE_H
+#define OPS_VERIFY_CACHE_H
+
+#include "packet.h"
+
+/** Default number of results an ops_verify_cache_t keeps in memory */
+#define OPS_VERIFY_CACHE_DEFAULT_CAPACITY	4096
+
+/** ops_verify_cache_t
+ */
+typedef struct ops_verify_cache ops_verify_cache_t;
+
+ops_verify_cache_t *ops_verify_cache_new(unsigned capacity);
+void ops_verify_cache_free(ops_verify_cache_t *cache);
+ops_boolean_t ops_verify_cache_open_file(ops_verify_cache_t *cache,
+					 const char *filename);
+ops_boolean_t ops_verify_cache_lookup(ops_verify_cache_t *cache,
+				      const ops_signature_t *sig,
+				      const ops_fingerprint_t *signer,
+				      const unsigned char *digest,
+				      unsigned digest_length,
+				      ops_boolean_t *valid);
+void ops_verify_cache_store(ops_verify_cache_t *cache,
+			    const ops_signature_t *sig,
+			    const ops_fingerprint_t *signer,
+			    const unsigned char *digest,
+			    unsigned digest_length,
+			    ops_boolean_t valid);
+void ops_verify_cache_invalidate_signer(ops_verify_cache_t *cache,
+					const ops_fingerprint_t *signer);
+void ops_verify_cache_get_stats(const ops_verify_cache_t *cache,
+				unsigned long *hits,unsigned long *misses);
+
+#endif
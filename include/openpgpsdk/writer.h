@@ -95,6 +95,7 @@ ops_boolean_t ops_write_mpi(const BIGNUM *bn,ops_create_info_t *opt);
 ops_boolean_t ops_write_encrypted_mpi(const BIGNUM *bn, ops_crypt_t* crypt, ops_create_info_t *info);
 
 void writer_info_delete(ops_writer_info_t *winfo);
+void writer_stack_delete(ops_create_info_t *info);
 ops_boolean_t writer_info_finalise(ops_error_t **errors, ops_writer_info_t *winfo);
 
 #endif
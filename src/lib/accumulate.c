@@ -38,8 +38,22 @@
 typedef struct
     {
     ops_keyring_t *keyring;
+    ops_keydata_t *staging;	/*!< public key being read into a compact
+				  keyring */
     } accumulate_arg_t;
 
+// Move a completed key from staging into the keyring, in compact form
+static void flush_staging(accumulate_arg_t *arg)
+    {
+    if(!arg->staging)
+	return;
+
+    ++arg->keyring->nkeys;
+    ops_keyring_new_compact_keydata(arg->keyring,arg->staging);
+    ops_keydata_free(arg->staging);
+    arg->staging=NULL;
+    }
+
 /**
  * \ingroup Core_Callbacks
  */
@@ -52,8 +66,10 @@ accumulate_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo)
     ops_keydata_t *cur=NULL;
     const ops_public_key_t *pkey;
 
-    if(keyring->nkeys >= 0)
-	cur=&keyring->keys[keyring->nkeys];
+    if(arg->staging)
+	cur=arg->staging;
+    else if(keyring->nkeys >= 0)
+	cur=keyring->keys[keyring->nkeys];
 
     switch(content_->tag)
 	{
@@ -61,28 +77,45 @@ accumulate_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo)
     case OPS_PTAG_CT_SECRET_KEY:
     case OPS_PTAG_CT_ENCRYPTED_SECRET_KEY:
 	//	printf("New key\n");
-	++keyring->nkeys;
-	EXPAND_ARRAY(keyring,keys);
+	flush_staging(arg);
+	if(keyring->compact && content_->tag == OPS_PTAG_CT_PUBLIC_KEY)
+	    {
+	    // built on the heap, then compacted once it is complete
+	    cur=arg->staging=ops_keydata_new();
+	    }
+	else
+	    {
+	    ++keyring->nkeys;
+	    cur=ops_keyring_new_keydata(keyring);
+	    }
 
 	if(content_->tag == OPS_PTAG_CT_PUBLIC_KEY)
 	    pkey=&content->public_key;
 	else
 	    pkey=&content->secret_key.public_key;
 
-	memset(&keyring->keys[keyring->nkeys],'\0',
-	       sizeof keyring->keys[keyring->nkeys]);
+	ops_keyid(cur->key_id,pkey);
+	ops_fingerprint(&cur->fingerprint,pkey);
 
-	ops_keyid(keyring->keys[keyring->nkeys].key_id,pkey);
-	ops_fingerprint(&keyring->keys[keyring->nkeys].fingerprint,pkey);
-
-	keyring->keys[keyring->nkeys].type=content_->tag;
+	cur->type=content_->tag;
 
 	if(content_->tag == OPS_PTAG_CT_PUBLIC_KEY)
-	    keyring->keys[keyring->nkeys].key.pkey=*pkey;
+	    cur->key.pkey=*pkey;
 	else
-	    keyring->keys[keyring->nkeys].key.skey=content->secret_key;
+	    cur->key.skey=content->secret_key;
 	return OPS_KEEP_MEMORY;
 
+    case OPS_PTAG_CT_PUBLIC_SUBKEY:
+	// only its ID is kept; the packet is added as any other is
+	if(cur)
+	    {
+	    unsigned char keyid[OPS_KEY_ID_SIZE];
+
+	    ops_keyid(keyid,&content->public_key);
+	    ops_add_subkey_id_to_keydata(cur,keyid);
+	    }
+	break;
+
     case OPS_PTAG_CT_USER_ID:
 	//	printf("User ID: %s\n",content->user_id.user_id);
         if (!cur)
@@ -103,18 +136,13 @@ accumulate_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo)
 	return OPS_KEEP_MEMORY;
 
     case OPS_PARSER_ERROR:
-	fprintf(stderr,"Error: %s\n",content->error.error);
-	assert(0);
+	// Not every parser error is on the stack yet; the caller gets it
+	// there rather than on stderr
+	OPS_ERROR_1(cbinfo->errors,OPS_E_FAIL,"%s",content->error.error);
 	break;
 
     case OPS_PARSER_ERRCODE:
-	switch(content->errcode.errcode)
-	    {
-	default:
-	    fprintf(stderr,"parse error: %s\n",
-		    ops_errcode(content->errcode.errcode));
-	    //assert(0);
-	    }
+	// Already on the stack, for the caller to deal with
 	break;
 
     default:
@@ -157,8 +185,11 @@ int ops_parse_and_accumulate(ops_keyring_t *keyring,
     parse_info->rinfo.accumulate=ops_true;
 
     rtn=ops_parse(parse_info);
+    flush_staging(&arg);
     ++keyring->nkeys;
 
+    ops_keyring_index_update(keyring);
+
     return rtn;
     }
 
@@ -193,5 +224,5 @@ void ops_dump_keyring(const ops_keyring_t *keyring)
     int n;
 
     for(n=0 ; n < keyring->nkeys ; ++n)
-	dump_one_keydata(&keyring->keys[n]);
+	dump_one_keydata(keyring->keys[n]);
     }
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** \file
+ * \brief Region allocator used to hold long-lived, bulk-freed data such
+ * as the contents of a keyring.
+ */
+
+#include <openpgpsdk/arena.h>
+#include <openpgpsdk/util.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <openpgpsdk/final.h>
+
+// all allocations are rounded up to this, which suits any scalar type
+#define ARENA_ALIGN	16
+#define ARENA_ROUND(n)	(((n)+ARENA_ALIGN-1)&~(size_t)(ARENA_ALIGN-1))
+
+typedef struct arena_block
+    {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    } arena_block_t;
+
+// keep the first byte handed out from each block aligned
+#define BLOCK_HEADER_SIZE	ARENA_ROUND(sizeof(arena_block_t))
+#define BLOCK_DATA(b)		((unsigned char *)(b)+BLOCK_HEADER_SIZE)
+
+struct ops_arena
+    {
+    arena_block_t *blocks;	/*!< current block is first */
+    size_t block_size;
+    size_t allocated;		/*!< total bytes obtained from malloc() */
+    };
+
+static arena_block_t *block_new(ops_arena_t *arena,size_t size)
+    {
+    arena_block_t *block=malloc(BLOCK_HEADER_SIZE+size);
+
+    assert(block);
+    block->next=NULL;
+    block->size=size;
+    block->used=0;
+    arena->allocated+=BLOCK_HEADER_SIZE+size;
+
+    return block;
+    }
+
+/**
+   \ingroup HighLevel_Memory
+   \brief Create a new arena
+   \param block_size Size of the blocks the arena obtains from malloc(),
+   or 0 for OPS_ARENA_DEFAULT_BLOCK_SIZE
+   \return New arena
+   \note Everything allocated from the arena is released at once by
+   ops_arena_free(); individual allocations are never freed or moved.
+*/
+ops_arena_t *ops_arena_new(size_t block_size)
+    {
+    ops_arena_t *arena=ops_mallocz(sizeof *arena);
+
+    if(!block_size)
+	block_size=OPS_ARENA_DEFAULT_BLOCK_SIZE;
+    arena->block_size=ARENA_ROUND(block_size);
+
+    return arena;
+    }
+
+/**
+   \ingroup HighLevel_Memory
+   \brief Release an arena and everything allocated from it
+   \param arena Arena to free (may be NULL)
+*/
+void ops_arena_free(ops_arena_t *arena)
+    {
+    arena_block_t *block;
+    arena_block_t *next;
+
+    if(!arena)
+	return;
+
+    for(block=arena->blocks ; block ; block=next)
+	{
+	next=block->next;
+	free(block);
+	}
+    free(arena);
+    }
+
+/**
+   \ingroup HighLevel_Memory
+   \brief Allocate zeroed memory from an arena
+   \param arena Arena to allocate from
+   \param length Number of bytes required
+   \return Pointer to memory, which remains valid until the arena is freed
+*/
+void *ops_arena_alloc(ops_arena_t *arena,size_t length)
+    {
+    arena_block_t *block=arena->blocks;
+    unsigned char *p;
+
+    length=ARENA_ROUND(length ? length : 1);
+
+    if(!block || block->size-block->used < length)
+	{
+	if(length > arena->block_size/4)
+	    {
+	    // Large allocations get a block of their own, placed behind
+	    // the current one so its free space isn't wasted
+	    block=block_new(arena,length);
+	    if(arena->blocks)
+		{
+		block->next=arena->blocks->next;
+		arena->blocks->next=block;
+		}
+	    else
+		arena->blocks=block;
+	    }
+	else
+	    {
+	    block=block_new(arena,arena->block_size);
+	    block->next=arena->blocks;
+	    arena->blocks=block;
+	    }
+	}
+
+    p=BLOCK_DATA(block)+block->used;
+    block->used+=length;
+    memset(p,'\0',length);
+
+    return p;
+    }
+
+/**
+   \ingroup HighLevel_Memory
+   \brief Copy data into an arena
+   \param arena Arena to allocate from
+   \param src Data to copy
+   \param length Length of data
+   \return Pointer to the copy
+*/
+void *ops_arena_memdup(ops_arena_t *arena,const void *src,size_t length)
+    {
+    void *p=ops_arena_alloc(arena,length);
+
+    memcpy(p,src,length);
+    return p;
+    }
+
+/**
+   \ingroup HighLevel_Memory
+   \brief Total memory an arena has obtained from the system
+   \param arena Arena
+   \return Number of bytes, including block overhead
+*/
+size_t ops_arena_get_allocated(const ops_arena_t *arena)
+    { return arena ? arena->allocated : 0; }
+
+/**
+   \ingroup HighLevel_Memory
+   \brief Move all memory from one arena into another
+   \param arena Arena to receive the memory
+   \param other Arena to empty; this is freed
+   \note Pointers into other remain valid, and are now released by
+   ops_arena_free(arena).
+*/
+void ops_arena_adopt(ops_arena_t *arena,ops_arena_t *other)
+    {
+    arena_block_t *last;
+
+    if(!other)
+	return;
+
+    if(other->blocks)
+	{
+	for(last=other->blocks ; last->next ; last=last->next)
+	    ;
+	// keep our current block at the head of the list
+	if(arena->blocks)
+	    {
+	    last->next=arena->blocks->next;
+	    arena->blocks->next=other->blocks;
+	    }
+	else
+	    arena->blocks=other->blocks;
+	}
+    arena->allocated+=other->allocated;
+
+    free(other);
+    }
+
+// eof
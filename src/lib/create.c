@@ -167,6 +167,8 @@ void ops_fast_create_rsa_public_key(ops_public_key_t *key,time_t time,
     key->algorithm=OPS_PKA_RSA;
     key->key.rsa.n=n;
     key->key.rsa.e=e;
+    key->serialised=NULL;
+    key->serialised_length=0;
     }
 
 /* Note that we support v3 keys here because they're needed for
@@ -438,14 +440,18 @@ ops_boolean_t ops_write_transferable_public_key(const ops_keydata_t *keydata,
 						ops_boolean_t armoured,
 						ops_create_info_t *info)
     {
+    const ops_public_key_t *pkey=ops_get_public_key_from_data(keydata);
     ops_boolean_t rtn;
     unsigned int i=0,j=0;
 
+    if (!pkey)
+        return ops_false;
+
     if (armoured)
         { ops_writer_push_armoured(info, OPS_PGP_PUBLIC_KEY_BLOCK); }
 
     // public key
-    rtn=ops_write_struct_public_key(&keydata->key.skey.public_key,info);
+    rtn=ops_write_struct_public_key(pkey,info);
     if (rtn!=ops_true)
         return rtn;
 
@@ -800,6 +806,7 @@ void ops_prepare_parent_info(ops_create_info_t *parent_info,
     {
     parent_info->winfo = *winfo->next;
     parent_info->errors = NULL;
+    parent_info->spare_winfo = NULL;
     }
 
 /**
@@ -825,10 +832,41 @@ ops_create_info_t *ops_create_info_new(void)
  */
 void ops_create_info_delete(ops_create_info_t *info)
     {
-    writer_info_delete(&info->winfo);
+    ops_writer_info_t *spare;
+
+    writer_stack_delete(info);
+    while((spare=info->spare_winfo))
+	{
+	info->spare_winfo=spare->next;
+	free(spare);
+	}
     free(info);
     }
 
+/**
+ * \ingroup Core_Create
+ * \brief Return an ops_create_info_t structure to its state when new.
+ *
+ * Any writers are destroyed and the errors are freed, but the nodes of
+ * the writer stack are kept for the writers of the next use.
+ *
+ * \param info the structure to be reset.
+ * \note Writers that have not been closed are destroyed without being
+ * finalised, so what they still hold is never written. Call
+ * ops_writer_close() first to keep it.
+ */
+void ops_create_info_reset(ops_create_info_t *info)
+    {
+    ops_writer_info_t *winfo;
+
+    for(winfo=&info->winfo ; winfo ; winfo=winfo->next)
+	winfo->finaliser=NULL;
+    writer_stack_delete(info);
+    memset(&info->winfo,'\0',sizeof info->winfo);
+    ops_free_errors(info->errors);
+    info->errors=NULL;
+    }
+
 /** 
  \ingroup Core_Create
  \brief Calculate the checksum for a session key
@@ -984,8 +1022,8 @@ ops_pk_session_key_t *ops_create_pk_session_key(const ops_keydata_t *key)
         fprintf(stderr,"\n");
         }
 
-    assert(key->key.pkey.algorithm == OPS_PKA_RSA);
-    session_key->algorithm=key->key.pkey.algorithm;
+    assert(pub_key->algorithm == OPS_PKA_RSA);
+    session_key->algorithm=pub_key->algorithm;
 
     // \todo allow user to specify other algorithm
     session_key->symmetric_algorithm=OPS_SA_CAST5;
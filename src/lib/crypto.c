@@ -301,6 +301,7 @@ ops_boolean_t ops_decrypt_file(const char* input_filename,
         perror(input_filename);
         return ops_false;
         }
+    ops_parse_borrow_bodies(pinfo, ops_true);
 
     // setup output filename
 
@@ -424,6 +425,7 @@ callback_write_parsed(const ops_parser_content_t *content_,
         break;
 
     case OPS_PTAG_CT_LITERAL_DATA_BODY:
+    case OPS_PTAG_CT_LITERAL_DATA_SLICE:
         return callback_literal_data(content_, cbinfo);
 	break;
 
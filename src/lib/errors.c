@@ -30,6 +30,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef WIN32
 #define vsnprintf _vsnprintf
@@ -40,6 +41,27 @@
 
 #define ERRNAME(code)	{ code, #code }
 
+// Longest comment kept with an error
+#define MAX_COMMENT	128
+
+// Slots in the index of an error stack
+#define INDEX_SIZE	64
+
+// A stack with fewer entries than this is walked rather than indexed
+#define INDEX_MIN	8
+
+/*
+ * An index of an error stack by where and why each error was raised,
+ * so a repeat is found without walking the stack. It hangs off the top
+ * entry. Entries joined on below the bottom one it knows of, as
+ * ops_move_errors() does, are added the next time an error is pushed.
+ */
+struct ops_error_index
+    {
+    ops_error_t *slots[INDEX_SIZE];
+    ops_error_t *last;		/*!< the lowest entry indexed */
+    };
+
 static ops_errcode_name_map_t errcode_name_map[] = 
     {
     ERRNAME(OPS_E_OK),
@@ -101,6 +123,148 @@ char *ops_errcode(const ops_errcode_t errcode)
     return(ops_str_from_map((int) errcode, (ops_map_t *) errcode_name_map));
     }
 
+static unsigned error_hash(int line,const char *fmt)
+    {
+    return ((unsigned)line*31+(unsigned)((size_t)fmt >> 3))%INDEX_SIZE;
+    }
+
+/*
+ * Find the entry that an error repeats: one raised from the same place,
+ * with the same format and, unless comment is NULL, the same comment.
+ * Without an index, the stack is walked from stack.
+ */
+static ops_error_t *find_error(ops_error_t *stack,
+			       const ops_error_index_t *index,
+			       ops_errcode_t errcode,int sys_errno,
+			       const char *file,int line,const char *fmt,
+			       const char *comment)
+    {
+    ops_error_t *err;
+
+    for(err=index ? index->slots[error_hash(line,fmt)] : stack ; err ;
+	err=index ? err->same_hash : err->next)
+	if(err->fmt == fmt && err->line == line && err->errcode == errcode
+	   && err->sys_errno == sys_errno
+	   && (err->file == file || !strcmp(err->file,file))
+	   && (!comment || !strcmp(err->comment,comment)))
+	    return err;
+    return NULL;
+    }
+
+static void unlink_error(ops_error_t **errstack,ops_error_index_t *index,
+			 ops_error_t *err)
+    {
+    if(err->prev)
+	err->prev->next=err->next;
+    else
+	*errstack=err->next;
+    if(err->next)
+	err->next->prev=err->prev;
+    else if(index)
+	index->last=err->prev;
+    }
+
+// Put an entry on top of the stack, handing it the index
+static void push_entry(ops_error_t **errstack,ops_error_index_t *index,
+		       ops_error_t *err)
+    {
+    ops_error_t *top=*errstack;
+
+    err->prev=NULL;
+    err->next=top;
+    if(top)
+	{
+	top->prev=err;
+	top->index=NULL;
+	}
+    else if(index)
+	index->last=err;
+    err->index=index;
+    *errstack=err;
+    }
+
+/*
+ * Index the entries below the lowest one the index knows of, merging
+ * any that repeat one above into it. They may carry an index of their
+ * own from when they were a stack's top.
+ */
+static void index_below(ops_error_t **errstack,ops_error_index_t *index,
+			ops_error_t *err)
+    {
+    while(err)
+	{
+	ops_error_t *next=err->next;
+	ops_error_t *found;
+	unsigned h;
+
+	free(err->index);
+	err->index=NULL;
+	found=find_error(NULL,index,err->errcode,err->sys_errno,err->file,
+			 err->line,err->fmt,err->comment);
+	if(found)
+	    {
+	    found->count+=err->count;
+	    free(err);
+	    }
+	else
+	    {
+	    err->prev=index->last;
+	    if(err->prev)
+		err->prev->next=err;
+	    else
+		*errstack=err;
+	    err->next=NULL;
+	    index->last=err;
+
+	    h=error_hash(err->line,err->fmt);
+	    err->same_hash=index->slots[h];
+	    index->slots[h]=err;
+	    }
+	err=next;
+	}
+    if(index->last)
+	index->last->next=NULL;
+    }
+
+/*
+ * The stack's index, made once the stack is long enough to need one, or
+ * has had entries joined on, which may repeat those above. Returns NULL
+ * while it is short.
+ */
+static ops_error_index_t *stack_index(ops_error_t **errstack)
+    {
+    ops_error_t *top=*errstack;
+    ops_error_t *prev;
+    ops_error_t *err;
+    ops_error_index_t *index;
+    ops_boolean_t joined=ops_false;
+    unsigned n;
+
+    if(top && top->index)
+	{
+	index=top->index;
+	if(index->last->next)
+	    index_below(errstack,index,index->last->next);
+	return index;
+	}
+
+    for(n=0,prev=NULL,err=top ; err && n < INDEX_MIN ;
+	prev=err,err=err->next,++n)
+	if(err->prev != prev)
+	    joined=ops_true;
+    if(n < INDEX_MIN && !joined)
+	return NULL;
+
+    index=ops_mallocz(sizeof *index);
+    if(top)
+	{
+	*errstack=NULL;
+	index_below(errstack,index,top);
+	(*errstack)->index=index;
+	}
+    return index;
+    }
+
 /** 
  * \ingroup Core_Errors
  * \brief Pushes the given error on the given errorstack
@@ -111,39 +275,82 @@ char *ops_errcode(const ops_errcode_t errcode)
  * \param line Line in source file where error occurred
  * \param fmt Comment
  *
+ * If the stack already has this error, with the same comment, from
+ * this line, it is counted there and moved to the top instead. Input
+ * that makes the same error over and over, such as a keyring full of
+ * keys in an unsupported algorithm, costs one entry rather than one
+ * per occurrence. A long stack is indexed, so a repeat is found without
+ * walking it. Repeats are matched on fmt, which should be a constant,
+ * and only formatted and compared if it has conversions.
  */
 
 void ops_push_error(ops_error_t **errstack,ops_errcode_t errcode,int sys_errno,
 		const char *file,int line,const char *fmt,...)
     {
-    // first get the varargs and generate the comment
-    char *comment;
-    int maxbuf=128;
+    char buf[MAX_COMMENT+1];
+    const char *comment=fmt;
+    size_t length;
     va_list args;
+    ops_error_index_t *index;
     ops_error_t *err;
-    
-    comment=malloc(maxbuf+1);
-    assert(comment);
+    unsigned h;
 
-    va_start(args, fmt);
-    vsnprintf(comment,maxbuf+1,fmt,args);
-    va_end(args);
+    index=stack_index(errstack);
 
-    // alloc a new error and add it to the top of the stack
+    // Only a comment with something to substitute needs formatting, and
+    // comparing, and only if the format has been pushed from here before
+    err=find_error(*errstack,index,errcode,sys_errno,file,line,fmt,NULL);
+    if(strchr(fmt,'%'))
+	{
+	va_start(args, fmt);
+	vsnprintf(buf,sizeof buf,fmt,args);
+	va_end(args);
+	comment=buf;
+	if(err)
+	    err=find_error(*errstack,index,errcode,sys_errno,file,line,fmt,
+			   comment);
+	}
+    if(err)
+	{
+	++err->count;
+	if(err != *errstack)
+	    {
+	    unlink_error(errstack,index,err);
+	    push_entry(errstack,index,err);
+	    }
+	return;
+	}
 
-    err=malloc(sizeof(ops_error_t));
-    assert(err);
+    length=strlen(comment);
+    if(length > MAX_COMMENT)
+	length=MAX_COMMENT;
 
-    err->next=*errstack;
-    *errstack=err;
+    // alloc a new error, with its comment, and add it to the top of
+    // the stack
+
+    err=malloc(sizeof *err+length+1);
+    assert(err);
 
     // fill in the details
     err->errcode=errcode;
     err->sys_errno=sys_errno;
     err->file=file;
     err->line=line;
+    err->fmt=fmt;
+    err->count=1;
+    err->same_hash=NULL;
 
-    err->comment=comment;
+    err->comment=(char *)(err+1);
+    memcpy(err->comment,comment,length);
+    err->comment[length]='\0';
+
+    if(index)
+	{
+	h=error_hash(line,fmt);
+	err->same_hash=index->slots[h];
+	index->slots[h]=err;
+	}
+    push_entry(errstack,index,err);
     }
 
 /**
@@ -155,10 +362,13 @@ void ops_print_error(ops_error_t *err)
     {
     printf("%s:%d: ",err->file,err->line);
     if(err->errcode==OPS_E_SYSTEM_ERROR)
-	printf("system error %d returned from %s()\n",err->sys_errno,
+	printf("system error %d returned from %s()",err->sys_errno,
 	       err->comment);
     else
-	printf("%s, %s\n",ops_errcode(err->errcode),err->comment);
+	printf("%s, %s",ops_errcode(err->errcode),err->comment);
+    if(err->count > 1)
+	printf(" (%u times)",err->count);
+    printf("\n");
     }
 
 /**
@@ -202,7 +412,7 @@ void ops_free_errors(ops_error_t *errstack)
     ops_error_t *next;
     while(errstack!=NULL) {
         next=errstack->next;
-        free(errstack->comment);
+        free(errstack->index);
         free(errstack);
         errstack=next;
     }
@@ -78,32 +78,81 @@ void ops_fingerprint(ops_fingerprint_t *fp,const ops_public_key_t *key)
 	}
     else
 	{
-	ops_memory_t *mem=ops_memory_new();
 	ops_hash_t sha1;
-	size_t l;
-
-	ops_build_public_key(mem,key,ops_false);
 
     if (debug)
         { fprintf(stderr,"--- creating key fingerprint\n"); }
 
 	ops_hash_sha1(&sha1);
 	sha1.init(&sha1);
-
-	l=ops_memory_get_length(mem);
-
-	ops_hash_add_int(&sha1,0x99,1);
-	ops_hash_add_int(&sha1,l,2);
-	sha1.add(&sha1,ops_memory_get_data(mem),l);
+	ops_hash_add_public_key(&sha1,key);
 	sha1.finish(&sha1,fp->fingerprint);
 
     if (debug)
         { fprintf(stderr,"--- finished creating key fingerprint\n"); }
 
 	fp->length=20;
+	}
+    }
+
+/**
+ * \ingroup Core_Keys
+ * \brief Store the serialised form of a public key in the key
+ * \param key The key, whose public parameters must all be set
+ *
+ * This is what ops_hash_add_public_key() adds to a hash. Once it is
+ * stored, every fingerprint and key signature computed for the key
+ * uses it rather than serialising the key again. The parser stores
+ * every key it reads as it was read instead.
+ *
+ * \note The parameters of the key must not be changed afterwards.
+ */
+void ops_public_key_serialise(ops_public_key_t *key)
+    {
+    ops_memory_t *mem=ops_memory_new();
+    size_t l;
+
+    ops_build_public_key(mem,key,ops_false);
+    l=ops_memory_get_length(mem);
 
-	ops_memory_free(mem);
+    free(key->serialised);
+    key->serialised=malloc(3+l);
+    key->serialised[0]=0x99;
+    key->serialised[1]=l >> 8;
+    key->serialised[2]=l;
+    memcpy(key->serialised+3,ops_memory_get_data(mem),l);
+    key->serialised_length=3+l;
+
+    ops_memory_free(mem);
+    }
+
+/**
+ * \ingroup Core_Keys
+ * \brief Add a public key to a hash, as it is hashed for v4
+ * fingerprints and for key signatures
+ * \param hash The hash
+ * \param key The key
+ */
+void ops_hash_add_public_key(ops_hash_t *hash,const ops_public_key_t *key)
+    {
+    ops_memory_t *mem;
+    size_t l;
+
+    if(key->serialised)
+	{
+	hash->add(hash,key->serialised,key->serialised_length);
+	return;
 	}
+
+    mem=ops_memory_new();
+    ops_build_public_key(mem,key,ops_false);
+
+    l=ops_memory_get_length(mem);
+    ops_hash_add_int(hash,0x99,1);
+    ops_hash_add_int(hash,l,2);
+    hash->add(hash,ops_memory_get_data(mem),l);
+
+    ops_memory_free(mem);
     }
 
 /**
@@ -31,6 +31,7 @@
 #include <openpgpsdk/validate.h>
 #include <openpgpsdk/signature.h>
 #include <openpgpsdk/readerwriter.h>
+#include <openpgpsdk/verify_cache.h>
 #include <openpgpsdk/defs.h>
 
 #include "keyring_local.h"
@@ -44,9 +45,19 @@
 #endif
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include <openpgpsdk/final.h>
 
+#ifdef __GNUC__
+# define COMPARE_AND_SWAP(p,o,n)	__sync_bool_compare_and_swap(p,o,n)
+#else
+# define COMPARE_AND_SWAP(p,o,n)	(*(p) == (o) ? (*(p)=(n),1) : 0)
+#endif
+
 /**
    \ingroup HighLevel_Keyring
    
@@ -61,28 +72,53 @@ ops_keydata_t *ops_keydata_new(void)
     { return ops_mallocz(sizeof(ops_keydata_t)); }
 
 
+// Frees the key material of a keydata structure.
+static void keydata_key_free(ops_keydata_t *keydata)
+    {
+    if(keydata->compact)
+	{
+	if(keydata->decoded)
+	    {
+	    ops_public_key_free(keydata->decoded);
+	    free(keydata->decoded);
+	    keydata->decoded=NULL;
+	    }
+	}
+    else if(keydata->type == OPS_PTAG_CT_PUBLIC_KEY)
+	ops_public_key_free(&keydata->key.pkey);
+    else
+	ops_secret_key_free(&keydata->key.skey);
+    }
+
 // Frees the content of a keydata structure, but not the keydata itself.
 static void keydata_internal_free(ops_keydata_t *keydata)
     {
     unsigned n;
 
-    for(n=0 ; n < keydata->nuids ; ++n)
-	ops_user_id_free(&keydata->uids[n]);
-    free(keydata->uids);
+    // anything in an arena goes when the arena does
+    if(!keydata->arena)
+	{
+	for(n=0 ; n < keydata->nuids ; ++n)
+	    ops_user_id_free(&keydata->uids[n]);
+	free(keydata->uids);
+
+	for(n=0 ; n < keydata->npackets ; ++n)
+	    ops_packet_free(&keydata->packets[n]);
+	free(keydata->packets);
+
+	free(keydata->sigs);
+	free(keydata->subkey_ids);
+	}
     keydata->uids=NULL;
     keydata->nuids=0;
-
-    for(n=0 ; n < keydata->npackets ; ++n)
-	ops_packet_free(&keydata->packets[n]);
-    free(keydata->packets);
     keydata->packets=NULL;
     keydata->npackets=0;
+    keydata->sigs=NULL;
+    keydata->nsigs=0;
+    keydata->subkey_ids=NULL;
+    keydata->nsubkey_ids=0;
 
-    if(keydata->type == OPS_PTAG_CT_PUBLIC_KEY)
-	ops_public_key_free(&keydata->key.pkey);
-    else
-	ops_secret_key_free(&keydata->key.skey);
-
+    keydata_key_free(keydata);
     }
 
 /**
@@ -94,13 +130,66 @@ static void keydata_internal_free(ops_keydata_t *keydata)
 
  \note This frees the keydata itself, as well as any other memory
        alloc-ed by it.
+
+ \note Keys belonging to a keyring must not be freed individually;
+       use ops_keyring_free() instead.
 */
 void ops_keydata_free(ops_keydata_t *keydata)
     {
+    assert(!keydata->arena);
     keydata_internal_free(keydata);
     free(keydata);
     }
 
+static ops_parse_cb_return_t
+cb_decode_public_key(const ops_parser_content_t *content_,
+		     ops_parse_cb_info_t *cbinfo)
+    {
+    ops_public_key_t *pkey=ops_parse_cb_get_arg(cbinfo);
+
+    if(content_->tag != OPS_PTAG_CT_PUBLIC_KEY || pkey->algorithm)
+	return OPS_RELEASE_MEMORY;
+
+    *pkey=content_->content.public_key;
+    return OPS_KEEP_MEMORY;
+    }
+
+// Decode a compact key's public key from its key packet, the first time
+// it is wanted. Returns NULL if the packet can't be parsed.
+static const ops_public_key_t *decode_public_key(const ops_keydata_t *keydata)
+    {
+    // the decoded key is a cache, so this doesn't really change keydata
+    ops_keydata_t *key=(ops_keydata_t *)keydata;
+    ops_public_key_t *pkey;
+    ops_parse_info_t *pinfo;
+
+    if(key->decoded)
+	return key->decoded;
+
+    pkey=ops_mallocz(sizeof *pkey);
+    pinfo=ops_parse_info_new();
+    ops_parse_options(pinfo,OPS_PTAG_SS_ALL,OPS_PARSE_PARSED);
+    ops_reader_set_memory(pinfo,key->packets[0].raw,key->packets[0].length);
+    ops_parse_cb_set(pinfo,cb_decode_public_key,pkey);
+    ops_parse(pinfo);
+    ops_parse_info_delete(pinfo);
+
+    if(!pkey->algorithm)
+	{
+	free(pkey);
+	return NULL;
+	}
+
+    // other threads may be reading the same keyring
+    if(!COMPARE_AND_SWAP(&key->decoded,NULL,pkey))
+	{
+	ops_public_key_free(pkey);
+	free(pkey);
+	}
+
+    return key->decoded;
+    }
+
 /**
  \ingroup HighLevel_KeyGeneral
 
@@ -110,11 +199,16 @@ void ops_keydata_free(ops_keydata_t *keydata)
   \return Pointer to public key
 
   \note This is not a copy, do not free it after use.
+
+  \note The key material of a key in a compact keyring is decoded by
+  the first call to this. If that fails, NULL is returned.
 */
 
 const ops_public_key_t *
 ops_get_public_key_from_data(const ops_keydata_t *keydata)
     {
+    if(keydata->compact)
+	return decode_public_key(keydata);
     if(keydata->type == OPS_PTAG_CT_PUBLIC_KEY)
 	return &keydata->key.pkey;
     return &keydata->key.skey.public_key;
@@ -325,7 +419,9 @@ ops_boolean_t ops_is_key_supported(const ops_keydata_t *keydata)
     {
     if(keydata->type == OPS_PTAG_CT_PUBLIC_KEY)
 	{
-        if(keydata->key.pkey.algorithm == OPS_PKA_RSA)
+	const ops_public_key_t *pkey=ops_get_public_key_from_data(keydata);
+
+        if(pkey && pkey->algorithm == OPS_PKA_RSA)
             return ops_true;
         }
     return ops_false;
@@ -361,7 +457,7 @@ const ops_keydata_t* ops_keyring_get_key_by_index(const ops_keyring_t *keyring,
     {
     if (index >= keyring->nkeys)
         return NULL;
-    return &keyring->keys[index]; 
+    return keyring->keys[index]; 
     }
 
 // \todo check where userid pointers are copied
@@ -411,7 +507,7 @@ ops_user_id_t* ops_add_userid_to_keydata(ops_keydata_t* keydata, const ops_user_
     {
     ops_user_id_t* new_uid=NULL;
 
-    EXPAND_ARRAY(keydata, uids);
+    EXPAND_ARENA_ARRAY(keydata, uids);
 
     // initialise new entry in array
     new_uid=&keydata->uids[keydata->nuids];
@@ -419,7 +515,11 @@ ops_user_id_t* ops_add_userid_to_keydata(ops_keydata_t* keydata, const ops_user_
     new_uid->user_id=NULL;
 
     // now copy it
-    ops_copy_userid(new_uid,userid);
+    if(keydata->arena)
+	new_uid->user_id=ops_arena_memdup(keydata->arena,userid->user_id,
+					  strlen((char *)userid->user_id)+1);
+    else
+	ops_copy_userid(new_uid,userid);
     keydata->nuids++;
 
     return new_uid;
@@ -436,7 +536,7 @@ ops_packet_t* ops_add_packet_to_keydata(ops_keydata_t* keydata, const ops_packet
     {
     ops_packet_t* new_pkt=NULL;
 
-    EXPAND_ARRAY(keydata, packets);
+    EXPAND_ARENA_ARRAY(keydata, packets);
 
     // initialise new entry in array
     new_pkt=&keydata->packets[keydata->npackets];
@@ -444,12 +544,33 @@ ops_packet_t* ops_add_packet_to_keydata(ops_keydata_t* keydata, const ops_packet
     new_pkt->raw=NULL;
 
     // now copy it
-    ops_copy_packet(new_pkt, packet);
+    if(keydata->arena)
+	{
+	new_pkt->length=packet->length;
+	new_pkt->raw=ops_arena_memdup(keydata->arena,packet->raw,
+				      packet->length);
+	}
+    else
+	ops_copy_packet(new_pkt, packet);
     keydata->npackets++;
 
     return new_pkt;
     }
 
+/**
+\ingroup Core_Keys
+\brief Record the ID of one of a key's public subkeys
+\param keydata Key the subkey belongs to
+\param keyid ID of the subkey
+*/
+void ops_add_subkey_id_to_keydata(ops_keydata_t *keydata,
+				  const unsigned char *keyid)
+    {
+    EXPAND_ARENA_ARRAY(keydata,subkey_ids);
+    memcpy(keydata->subkey_ids[keydata->nsubkey_ids++].id,keyid,
+	   OPS_KEY_ID_SIZE);
+    }
+
 /**
 \ingroup Core_Keys
 \brief Add signed User ID to key
@@ -471,7 +592,7 @@ void ops_add_signed_userid_to_keydata(ops_keydata_t* keydata, const ops_user_id_
      */
 
     // and add ptr to it from the sigs array
-    EXPAND_ARRAY(keydata, sigs);
+    EXPAND_ARENA_ARRAY(keydata, sigs);
 
     // setup new entry in array
 
@@ -552,6 +673,320 @@ void ops_keydata_init(ops_keydata_t* keydata, const ops_content_tag_t type)
     keydata->type=type;
     }
 
+/**
+   \ingroup Core_Keys
+   \brief Allocate a new key in a keyring
+   \param keyring Keyring to which the key will belong
+   \return New, zeroed key, stored at keyring->keys[keyring->nkeys]
+
+   \note The caller is responsible for updating keyring->nkeys. The key
+   is allocated from the keyring's arena, which is created on first use,
+   and so is only freed by ops_keyring_free().
+*/
+ops_keydata_t *ops_keyring_new_keydata(ops_keyring_t *keyring)
+    {
+    ops_keydata_t *keydata;
+
+    if(!keyring->arena)
+	keyring->arena=ops_arena_new(0);
+
+    EXPAND_ARRAY(keyring,keys);
+
+    keydata=ops_arena_alloc(keyring->arena,sizeof *keydata);
+    keydata->arena=keyring->arena;
+    keyring->keys[keyring->nkeys]=keydata;
+
+    return keydata;
+    }
+
+/* Key ID index */
+
+/*
+ * The IDs of a key's public subkeys are indexed beside its own, and
+ * lead to the key's position just as its own does.
+ */
+
+// Key IDs are the low bits of a hash, so any four bytes will do
+#define KEYID_HASH(id)	(((unsigned)(id)[4] << 24)|((id)[5] << 16)|((id)[6] << 8)|(id)[7])
+
+/*
+ * The index carries a blocked Bloom filter of the IDs in it. Each ID
+ * sets three bits in a single cache line sized block, so most lookups
+ * of an ID that isn't there read just that line and never probe the
+ * table.
+ */
+#define FILTER_BLOCK_SIZE	64
+#define FILTER_BLOCKS(size)	((size)/32)	// 16 bits per table slot
+// KEYID_HASH picks the block, the other four bytes the bits within it
+#define KEYID_FILTER_BITS(id)	(((unsigned)(id)[0] << 24)|((id)[1] << 16)|((id)[2] << 8)|(id)[3])
+
+static unsigned char *filter_block(const ops_keyring_t *keyring,
+				   const unsigned char *keyid)
+    {
+    unsigned mask=FILTER_BLOCKS(keyring->id_index_size)-1;
+
+    return keyring->id_filter+(KEYID_HASH(keyid)&mask)*FILTER_BLOCK_SIZE;
+    }
+
+static void filter_insert(ops_keyring_t *keyring,const unsigned char *keyid)
+    {
+    unsigned char *block=filter_block(keyring,keyid);
+    unsigned bits=KEYID_FILTER_BITS(keyid);
+    int k;
+
+    for(k=0 ; k < 3 ; ++k,bits >>= 9)
+	block[(bits&511) >> 3]|=1 << (bits&7);
+    }
+
+// Returns ops_false if no indexed key has this ID
+static ops_boolean_t filter_may_contain(const ops_keyring_t *keyring,
+					const unsigned char *keyid)
+    {
+    const unsigned char *block=filter_block(keyring,keyid);
+    unsigned bits=KEYID_FILTER_BITS(keyid);
+    int k;
+
+    for(k=0 ; k < 3 ; ++k,bits >>= 9)
+	if(!(block[(bits&511) >> 3]&(1 << (bits&7))))
+	    return ops_false;
+
+    return ops_true;
+    }
+
+// Does key have this ID: its own if subkey is ops_false, else a subkey's?
+static ops_boolean_t key_has_id(const ops_keydata_t *key,
+				const unsigned char *keyid,
+				ops_boolean_t subkey)
+    {
+    unsigned n;
+
+    if(!subkey)
+	return !memcmp(key->key_id,keyid,OPS_KEY_ID_SIZE);
+
+    for(n=0 ; n < key->nsubkey_ids ; ++n)
+	if(!memcmp(key->subkey_ids[n].id,keyid,OPS_KEY_ID_SIZE))
+	    return ops_true;
+
+    return ops_false;
+    }
+
+// Index keyid, the ID of the key at position n or of one of its subkeys
+static void index_insert(ops_keyring_t *keyring,int n,
+			 const unsigned char *keyid,ops_boolean_t subkey)
+    {
+    unsigned mask=keyring->id_index_size-1;
+    unsigned slot;
+
+    filter_insert(keyring,keyid);
+    for(slot=KEYID_HASH(keyid)&mask ; keyring->id_index[slot] ;
+	slot=(slot+1)&mask)
+	// keep the first of any duplicates, as a linear search would
+	if(key_has_id(keyring->keys[keyring->id_index[slot]-1],keyid,subkey))
+	    return;
+    keyring->id_index[slot]=n+1;
+    ++keyring->nids;
+    }
+
+static void index_insert_key(ops_keyring_t *keyring,int n)
+    {
+    const ops_keydata_t *key=keyring->keys[n];
+    unsigned m;
+
+    index_insert(keyring,n,key->key_id,ops_false);
+    for(m=0 ; m < key->nsubkey_ids ; ++m)
+	index_insert(keyring,n,key->subkey_ids[m].id,ops_true);
+    }
+
+// Replace the index with an empty one big enough for nids IDs
+static void index_resize(ops_keyring_t *keyring,unsigned nids)
+    {
+    unsigned size=keyring->id_index_size ? keyring->id_index_size : 64;
+    size_t filter_offset;
+
+    // keep the table no more than half full
+    while(size < nids*2)
+	size*=2;
+    // the filter follows the table, with room to align its blocks
+    filter_offset=size*sizeof *keyring->id_index;
+    free(keyring->id_index);
+    keyring->id_index=ops_mallocz(filter_offset
+				  +FILTER_BLOCKS(size)*FILTER_BLOCK_SIZE
+				  +FILTER_BLOCK_SIZE-1);
+    filter_offset+=-((size_t)keyring->id_index+filter_offset)
+	&(FILTER_BLOCK_SIZE-1);
+    keyring->id_filter=(unsigned char *)keyring->id_index+filter_offset;
+    keyring->id_index_size=size;
+    keyring->nids=0;
+    keyring->nindexed=0;
+    }
+
+/**
+   \ingroup Core_Keys
+   \brief Add any keys not yet indexed to the keyring's key ID index
+   \param keyring Keyring
+*/
+void ops_keyring_index_update(ops_keyring_t *keyring)
+    {
+    unsigned nids=keyring->nids;
+    int n;
+
+    if(keyring->nindexed == keyring->nkeys)
+	return;
+
+    for(n=keyring->nindexed ; n < keyring->nkeys ; ++n)
+	nids+=1+keyring->keys[n]->nsubkey_ids;
+    if(nids*2 > keyring->id_index_size)
+	index_resize(keyring,nids);
+
+    for(n=keyring->nindexed ; n < keyring->nkeys ; ++n)
+	index_insert_key(keyring,n);
+    keyring->nindexed=keyring->nkeys;
+    }
+
+// Index the subkey IDs from the first'th on of the key at pos, which a
+// merge has added
+static void index_new_subkeys(ops_keyring_t *keyring,int pos,unsigned first)
+    {
+    const ops_keydata_t *key=keyring->keys[pos];
+    unsigned n;
+
+    if(pos >= keyring->nindexed || first == key->nsubkey_ids)
+	return;
+
+    if((keyring->nids+key->nsubkey_ids-first)*2 > keyring->id_index_size)
+	{
+	// every key goes into a bigger index
+	index_resize(keyring,keyring->nids+key->nsubkey_ids-first);
+	ops_keyring_index_update(keyring);
+	return;
+	}
+
+    for(n=first ; n < key->nsubkey_ids ; ++n)
+	index_insert(keyring,pos,key->subkey_ids[n].id,ops_true);
+    }
+
+// Returns the position of the first key with this ID as its own, or as
+// a subkey's if subkey is set, or -1
+static int index_find(const ops_keyring_t *keyring,const unsigned char *keyid,
+		      ops_boolean_t subkey)
+    {
+    unsigned mask=keyring->id_index_size-1;
+    unsigned slot;
+
+    if(!keyring->id_index || !filter_may_contain(keyring,keyid))
+	return -1;
+
+    for(slot=KEYID_HASH(keyid)&mask ; keyring->id_index[slot] ;
+	slot=(slot+1)&mask)
+	if(key_has_id(keyring->keys[keyring->id_index[slot]-1],keyid,subkey))
+	    return keyring->id_index[slot]-1;
+
+    return -1;
+    }
+
+/*
+ * Decode the packet header at p, which has left bytes available.
+ * Returns ops_false if the header is truncated, or its length is
+ * partial or indeterminate, or the body runs past the end of the data.
+ */
+static ops_boolean_t packet_header(const unsigned char *p,size_t left,
+				   unsigned *tag,size_t *hlen,size_t *blen)
+    {
+    ops_length_type_t type;
+
+    // partial body lengths don't occur in keyrings
+    return ops_decode_packet_header(p,left,tag,hlen,blen,&type) > 0
+	&& type == OPS_LENGTH_FIXED && *blen <= left-*hlen;
+    }
+
+/**
+   \ingroup Core_Keys
+   \brief Allocate a compact copy of a public key in a keyring
+   \param keyring Keyring to which the key will belong
+   \param from Key to copy, which may belong to anything
+   \return New key, stored at keyring->keys[keyring->nkeys]
+
+   \note As with ops_keyring_new_keydata(), the caller is responsible
+   for updating keyring->nkeys.
+
+   The new key is allocated without room for the decoded key material,
+   which ops_get_public_key_from_data() parses from the key packet when
+   it is first asked for. Its packets are copied into a single run of
+   the arena, each followed by a zero byte, so that User IDs can point
+   at the bodies of their packets rather than being held separately,
+   and every array is allocated at exactly the size it needs.
+*/
+ops_keydata_t *ops_keyring_new_compact_keydata(ops_keyring_t *keyring,
+					       const ops_keydata_t *from)
+    {
+    ops_keydata_t *keydata;
+    unsigned char *raw;
+    size_t total=0;
+    unsigned nuids=0;
+    unsigned n;
+
+    assert(from->type == OPS_PTAG_CT_PUBLIC_KEY);
+
+    if(!keyring->arena)
+	keyring->arena=ops_arena_new(0);
+
+    EXPAND_ARRAY(keyring,keys);
+
+    keydata=ops_arena_alloc(keyring->arena,COMPACT_KEYDATA_SIZE);
+    keydata->arena=keyring->arena;
+    keydata->compact=ops_true;
+    memcpy(keydata->key_id,from->key_id,sizeof keydata->key_id);
+    keydata->fingerprint=from->fingerprint;
+    keydata->type=from->type;
+
+    for(n=0 ; n < from->npackets ; ++n)
+	total+=from->packets[n].length+1;
+    raw=ops_arena_alloc(keyring->arena,total);
+
+    keydata->packets=ops_arena_alloc(keyring->arena,
+				     from->npackets*sizeof *keydata->packets);
+    keydata->npackets=keydata->npackets_allocated=from->npackets;
+    keydata->uids=ops_arena_alloc(keyring->arena,
+				  from->nuids*sizeof *keydata->uids);
+    keydata->nuids=keydata->nuids_allocated=from->nuids;
+    keydata->subkey_ids=ops_arena_alloc(keyring->arena,
+			from->nsubkey_ids*sizeof *keydata->subkey_ids);
+    keydata->nsubkey_ids=keydata->nsubkey_ids_allocated=from->nsubkey_ids;
+    for(n=0 ; n < from->nsubkey_ids ; ++n)
+	keydata->subkey_ids[n]=from->subkey_ids[n];
+
+    for(n=0 ; n < from->npackets ; ++n)
+	{
+	const ops_packet_t *packet=&from->packets[n];
+	unsigned tag;
+	size_t hlen;
+	size_t blen;
+
+	memcpy(raw,packet->raw,packet->length);
+	keydata->packets[n].raw=raw;
+	keydata->packets[n].length=packet->length;
+
+	// the arena zeroed the byte after it, which terminates the User ID
+	if(nuids < from->nuids
+	   && packet_header(raw,packet->length,&tag,&hlen,&blen)
+	   && tag == OPS_PTAG_CT_USER_ID
+	   && !strcmp((char *)from->uids[nuids].user_id,(char *)raw+hlen))
+	    keydata->uids[nuids++].user_id=raw+hlen;
+
+	raw+=packet->length+1;
+	}
+
+    // User IDs without a matching packet must be held separately
+    for(n=nuids ; n < from->nuids ; ++n)
+	keydata->uids[n].user_id=ops_arena_memdup(keydata->arena,
+				  from->uids[n].user_id,
+				  strlen((char *)from->uids[n].user_id)+1);
+
+    keyring->keys[keyring->nkeys]=keydata;
+
+    return keydata;
+    }
+
 /** 
     Example Usage:
     \code
@@ -623,6 +1058,8 @@ ops_boolean_t ops_keyring_read_from_file(ops_keyring_t *keyring, const ops_boole
 
     //    ops_parse_options(pinfo,OPS_PTAG_SS_ALL,OPS_PARSE_RAW);
     ops_parse_options(pinfo,OPS_PTAG_SS_ALL,OPS_PARSE_PARSED);
+    // only the raw signature packets are kept
+    ops_parse_keys_only(pinfo,ops_true);
 
     fd=open(filename,O_RDONLY | O_BINARY);
     if(fd < 0)
@@ -700,6 +1137,7 @@ ops_boolean_t ops_keyring_read_from_mem(ops_keyring_t *keyring, const ops_boolea
     ops_setup_memory_read(&pinfo, mem, NULL, cb_keyring_read,
 			  OPS_ACCUMULATE_NO);
     ops_parse_options(pinfo,OPS_PTAG_SS_ALL,OPS_PARSE_PARSED);
+    ops_parse_keys_only(pinfo,ops_true);
 
     if (armour)
         { ops_reader_push_dearmour(pinfo); }
@@ -725,6 +1163,839 @@ ops_boolean_t ops_keyring_read_from_mem(ops_keyring_t *keyring, const ops_boolea
     return res;
     }
 
+/* Parallel keyring reading */
+
+// A run of whole transferable keys, read by one worker
+typedef struct
+    {
+    const unsigned char *buffer;
+    size_t length;
+    ops_keyring_t keyring;	/*!< keys read from this span */
+    ops_parse_info_t *pinfo;	/*!< kept so errors are reported in order */
+    int ok;
+    } keyring_span_t;
+
+// Read keys from memory into span->keyring. Runs in a worker thread.
+static void *read_keyring_span(void *arg)
+    {
+    keyring_span_t *span=arg;
+
+    span->pinfo=ops_parse_info_new();
+    ops_parse_options(span->pinfo,OPS_PTAG_SS_ALL,OPS_PARSE_PARSED);
+    ops_parse_keys_only(span->pinfo,ops_true);
+    ops_reader_set_memory(span->pinfo,span->buffer,span->length);
+    ops_parse_cb_set(span->pinfo,cb_keyring_read,NULL);
+
+    span->ok=ops_parse_and_accumulate(&span->keyring,span->pinfo);
+
+    return NULL;
+    }
+
+/*
+ * Walk the packet headers in buffer, recording the offset of every
+ * public or secret key packet, each of which starts a transferable
+ * key. Returns ops_false if the framing is anything we can't skip
+ * over without parsing, in which case the caller must read serially.
+ */
+static ops_boolean_t find_key_boundaries(const unsigned char *buffer,
+					 size_t length,size_t **offsets,
+					 unsigned *noffsets)
+    {
+    size_t pos=0;
+    unsigned allocated=0;
+
+    *offsets=NULL;
+    *noffsets=0;
+
+    while(pos < length)
+	{
+	unsigned tag;
+	size_t hlen;
+	size_t blen;
+
+	if(!packet_header(&buffer[pos],length-pos,&tag,&hlen,&blen))
+	    {
+	    free(*offsets);
+	    *offsets=NULL;
+	    *noffsets=0;
+	    return ops_false;
+	    }
+
+	if(tag == OPS_PTAG_CT_PUBLIC_KEY || tag == OPS_PTAG_CT_SECRET_KEY)
+	    {
+	    if(*noffsets == allocated)
+		{
+		allocated=allocated*2+10;
+		*offsets=realloc(*offsets,allocated*sizeof **offsets);
+		}
+	    (*offsets)[(*noffsets)++]=pos;
+	    }
+
+	pos+=hlen+blen;
+	}
+
+    return ops_true;
+    }
+
+// Move all keys from part onto the end of keyring, emptying part
+static void merge_keyring(ops_keyring_t *keyring,ops_keyring_t *part)
+    {
+    int n;
+
+    if(!part->arena)
+	return;
+    if(!keyring->arena)
+	keyring->arena=ops_arena_new(0);
+
+    for(n=0 ; n < part->nkeys ; ++n)
+	{
+	EXPAND_ARRAY(keyring,keys);
+	part->keys[n]->arena=keyring->arena;
+	keyring->keys[keyring->nkeys++]=part->keys[n];
+	}
+    ops_arena_adopt(keyring->arena,part->arena);
+
+    free(part->keys);
+    free(part->id_index);
+    memset(part,'\0',sizeof *part);
+    }
+
+/**
+   \ingroup HighLevel_KeyringRead
+   
+   \brief Reads a keyring from a file, using several threads
+   
+   \param keyring Pointer to an existing ops_keyring_t struct
+   \param armour ops_true if file is armoured; else ops_false
+   \param filename Filename of keyring to be read
+   \param nthreads Number of threads to use, or 0 for one per CPU
+
+   \return ops true if OK; ops_false on error
+
+   The file is scanned once to find where each transferable key
+   starts. The keys are then divided into runs of roughly equal size,
+   which are parsed concurrently, and the resulting keys added to the
+   keyring in the order they appear in the file.
+
+   \note Armoured keyrings, and files whose packet framing can't be
+   walked without parsing them, are read serially exactly as
+   ops_keyring_read_from_file() would.
+
+   \note Keys are appended to any already in keyring.
+
+   \sa ops_keyring_read_from_file()
+   \sa ops_keyring_free()
+*/
+ops_boolean_t ops_keyring_read_from_file_parallel(ops_keyring_t *keyring,
+						  const ops_boolean_t armour,
+						  const char *filename,
+						  unsigned nthreads)
+    {
+    unsigned char *buffer;
+    struct stat st;
+    size_t length;
+    size_t *offsets=NULL;
+    unsigned noffsets=0;
+    keyring_span_t *spans;
+    unsigned nspans;
+    unsigned n;
+    size_t start;
+    ops_boolean_t res=ops_true;
+    int fd;
+
+    if(!nthreads)
+	nthreads=ops_default_nthreads();
+
+    if(armour || nthreads == 1)
+	return ops_keyring_read_from_file(keyring,armour,filename);
+
+    fd=open(filename,O_RDONLY | O_BINARY);
+    if(fd < 0)
+        {
+        perror(filename);
+        return ops_false;
+        }
+    if(fstat(fd,&st) < 0)
+	{
+	perror(filename);
+	close(fd);
+	return ops_false;
+	}
+
+    length=st.st_size;
+    buffer=malloc(length ? length : 1);
+    for(start=0 ; start < length ; )
+	{
+	ssize_t r=read(fd,buffer+start,length-start);
+
+	if(r < 0)
+	    {
+	    perror(filename);
+	    close(fd);
+	    free(buffer);
+	    return ops_false;
+	    }
+	if(r == 0)
+	    break;
+	start+=r;
+	}
+    close(fd);
+    length=start;
+
+    if(!find_key_boundaries(buffer,length,&offsets,&noffsets) || !noffsets)
+	nspans=1;
+    else
+	nspans=nthreads < noffsets ? nthreads : noffsets;
+
+    spans=ops_mallocz(nspans*sizeof *spans);
+
+    // Split at the key boundary nearest to an even share of the bytes.
+    // Anything before the first key goes to the first span.
+    for(n=0,start=0 ; n < nspans ; ++n)
+	{
+	size_t end=length;
+
+	if(n+1 < nspans)
+	    {
+	    size_t target=start+(length-start)/(nspans-n);
+	    unsigned k;
+
+	    for(k=0 ; k < noffsets && offsets[k] <= target ; ++k)
+		;
+	    if(k < noffsets && offsets[k] > start)
+		end=offsets[k];
+	    }
+	spans[n].buffer=buffer+start;
+	spans[n].keyring.compact=keyring->compact;
+	spans[n].length=end-start;
+	start=end;
+	}
+    free(offsets);
+
+#ifdef HAVE_PTHREAD_H
+    {
+    pthread_t *threads=malloc(nspans*sizeof *threads);
+    ops_boolean_t *started=ops_mallocz(nspans*sizeof *started);
+
+    // the calling thread reads the first span itself
+    for(n=1 ; n < nspans ; ++n)
+	started[n]=!pthread_create(&threads[n],NULL,read_keyring_span,
+				   &spans[n]);
+    read_keyring_span(&spans[0]);
+    for(n=1 ; n < nspans ; ++n)
+	{
+	if(started[n])
+	    pthread_join(threads[n],NULL);
+	else
+	    read_keyring_span(&spans[n]);
+	}
+
+    free(started);
+    free(threads);
+    }
+#else
+    for(n=0 ; n < nspans ; ++n)
+	read_keyring_span(&spans[n]);
+#endif
+
+    for(n=0 ; n < nspans ; ++n)
+	{
+	if(!spans[n].ok)
+	    res=ops_false;
+	ops_print_errors(ops_parse_info_get_errors(spans[n].pinfo));
+	ops_parse_info_delete(spans[n].pinfo);
+	merge_keyring(keyring,&spans[n].keyring);
+	}
+    ops_keyring_index_update(keyring);
+
+    free(spans);
+    free(buffer);
+
+    return res;
+    }
+
+/* Incremental import */
+
+// Does this packet start a block (key, subkey or User ID) within a key?
+static ops_boolean_t is_block_header(const ops_packet_t *packet,
+				     unsigned *tag)
+    {
+    size_t hlen;
+    size_t blen;
+
+    if(!packet_header(packet->raw,packet->length,tag,&hlen,&blen))
+	return ops_false;
+
+    switch(*tag)
+	{
+    case OPS_PTAG_CT_PUBLIC_KEY:
+    case OPS_PTAG_CT_SECRET_KEY:
+    case OPS_PTAG_CT_PUBLIC_SUBKEY:
+    case OPS_PTAG_CT_SECRET_SUBKEY:
+    case OPS_PTAG_CT_USER_ID:
+    case OPS_PTAG_CT_USER_ATTRIBUTE:
+	return ops_true;
+
+    default:
+	return ops_false;
+	}
+    }
+
+// Returns the index of the first packet after the block starting at start
+static unsigned block_end(const ops_keydata_t *key,unsigned start)
+    {
+    unsigned tag;
+
+    for(++start ; start < key->npackets ; ++start)
+	if(is_block_header(&key->packets[start],&tag))
+	    break;
+
+    return start;
+    }
+
+static ops_boolean_t packets_equal(const ops_packet_t *a,
+				   const ops_packet_t *b)
+    {
+    return a->length == b->length && !memcmp(a->raw,b->raw,a->length);
+    }
+
+/*
+ * Find the block in key whose header is identical to header. The
+ * primary key's block is never matched this way. Returns ops_false if
+ * there is no such block.
+ */
+static ops_boolean_t find_block(const ops_keydata_t *key,
+				const ops_packet_t *header,unsigned *start,
+				unsigned *end)
+    {
+    unsigned n;
+
+    for(n=block_end(key,0) ; n < key->npackets ; n=block_end(key,n))
+	if(packets_equal(&key->packets[n],header))
+	    {
+	    *start=n;
+	    *end=block_end(key,n);
+	    return ops_true;
+	    }
+
+    return ops_false;
+    }
+
+// Insert a copy of packet into key so that it becomes packets[pos]
+static void insert_packet(ops_keydata_t *key,unsigned pos,
+			  const ops_packet_t *packet)
+    {
+    ops_packet_t copy;
+
+    ops_add_packet_to_keydata(key,packet);
+    copy=key->packets[key->npackets-1];
+    memmove(&key->packets[pos+1],&key->packets[pos],
+	    (key->npackets-1-pos)*sizeof *key->packets);
+    key->packets[pos]=copy;
+    }
+
+// Add the User ID carried by a raw User ID packet to key's list of them
+static void add_userid_from_packet(ops_keydata_t *key,
+				   const ops_packet_t *packet)
+    {
+    ops_user_id_t uid;
+    unsigned tag;
+    size_t hlen;
+    size_t blen;
+
+    packet_header(packet->raw,packet->length,&tag,&hlen,&blen);
+    uid.user_id=ops_mallocz(blen+1);
+    memcpy(uid.user_id,packet->raw+hlen,blen);
+    ops_add_userid_to_keydata(key,&uid);
+    free(uid.user_id);
+    }
+
+/*
+ * Merge the packets of from, which is the same key as to, into to.
+ * Blocks (the primary key, each User ID or attribute and each subkey,
+ * with the signatures that follow them) are matched on their header
+ * packet, and any packet not already in the matching block is added
+ * to its end. New User IDs go after the existing ones, new subkeys at
+ * the end, and the IDs of new subkeys after those of to's. Returns the
+ * number of packets added.
+ */
+static unsigned merge_key(ops_keydata_t *to,const ops_keydata_t *from,
+			  ops_keyring_import_result_t *result)
+    {
+    unsigned added=0;
+    unsigned fstart;
+    unsigned fend;
+    unsigned id;
+
+    for(fstart=0 ; fstart < from->npackets ; fstart=fend)
+	{
+	const ops_packet_t *header=&from->packets[fstart];
+	unsigned start;
+	unsigned end;
+	unsigned tag=OPS_PTAG_CT_RESERVED;
+	unsigned n;
+
+	fend=block_end(from,fstart);
+
+	if(fstart == 0)
+	    {
+	    start=0;
+	    end=block_end(to,0);
+	    }
+	else if(!find_block(to,header,&start,&end))
+	    {
+	    // a block we don't have: add it whole
+	    is_block_header(header,&tag);
+	    if(tag == OPS_PTAG_CT_USER_ID || tag == OPS_PTAG_CT_USER_ATTRIBUTE)
+		{
+		// before the first subkey
+		for(start=block_end(to,0) ; start < to->npackets ;
+		    start=block_end(to,start))
+		    {
+		    unsigned ttag;
+
+		    is_block_header(&to->packets[start],&ttag);
+		    if(ttag != OPS_PTAG_CT_USER_ID
+		       && ttag != OPS_PTAG_CT_USER_ATTRIBUTE)
+			break;
+		    }
+		}
+	    else
+		start=to->npackets;
+
+	    for(n=fstart ; n < fend ; ++n)
+		insert_packet(to,start+n-fstart,&from->packets[n]);
+	    added+=fend-fstart;
+
+	    if(tag == OPS_PTAG_CT_USER_ID)
+		{
+		add_userid_from_packet(to,header);
+		++result->new_user_ids;
+		}
+	    continue;
+	    }
+
+	// a block we have: add whatever it's missing
+	for(n=fstart+1 ; n < fend ; ++n)
+	    {
+	    unsigned m;
+
+	    for(m=start+1 ; m < end ; ++m)
+		if(packets_equal(&to->packets[m],&from->packets[n]))
+		    break;
+	    if(m < end)
+		continue;
+	    insert_packet(to,end++,&from->packets[n]);
+	    ++added;
+	    }
+	}
+
+    // the IDs of any subkeys that were new
+    for(id=0 ; id < from->nsubkey_ids ; ++id)
+	if(!key_has_id(to,from->subkey_ids[id].id,ops_true))
+	    ops_add_subkey_id_to_keydata(to,from->subkey_ids[id].id);
+
+    result->new_packets+=added;
+    return added;
+    }
+
+// Whether merge_key() would add any of from's packets to to
+static ops_boolean_t merge_adds_packets(const ops_keydata_t *to,
+					const ops_keydata_t *from)
+    {
+    unsigned fstart;
+    unsigned fend;
+
+    for(fstart=0 ; fstart < from->npackets ; fstart=fend)
+	{
+	unsigned start;
+	unsigned end;
+	unsigned n;
+
+	fend=block_end(from,fstart);
+
+	if(fstart == 0)
+	    {
+	    start=0;
+	    end=block_end(to,0);
+	    }
+	else if(!find_block(to,&from->packets[fstart],&start,&end))
+	    return ops_true;
+
+	for(n=fstart+1 ; n < fend ; ++n)
+	    {
+	    unsigned m;
+
+	    for(m=start+1 ; m < end ; ++m)
+		if(packets_equal(&to->packets[m],&from->packets[n]))
+		    break;
+	    if(m == end)
+		return ops_true;
+	    }
+	}
+
+    return ops_false;
+    }
+
+// Move from, a key belonging to another keyring, onto the end of keyring
+static void take_key(ops_keyring_t *keyring,ops_keydata_t *from)
+    {
+    ops_keydata_t *to;
+    unsigned n;
+
+    if(from->compact
+       || (keyring->compact && from->type == OPS_PTAG_CT_PUBLIC_KEY))
+	{
+	// the key material will be decoded again if it is wanted
+	ops_keyring_new_compact_keydata(keyring,from);
+	keydata_key_free(from);
+	++keyring->nkeys;
+	return;
+	}
+
+    to=ops_keyring_new_keydata(keyring);
+
+    memcpy(to->key_id,from->key_id,sizeof to->key_id);
+    to->fingerprint=from->fingerprint;
+    to->type=from->type;
+    // this takes ownership of the key material
+    to->key=from->key;
+
+    for(n=0 ; n < from->nuids ; ++n)
+	ops_add_userid_to_keydata(to,&from->uids[n]);
+    for(n=0 ; n < from->npackets ; ++n)
+	ops_add_packet_to_keydata(to,&from->packets[n]);
+    for(n=0 ; n < from->nsubkey_ids ; ++n)
+	ops_add_subkey_id_to_keydata(to,from->subkey_ids[n].id);
+
+    ++keyring->nkeys;
+    }
+
+// Add a copy of key, which may belong to another keyring, to the end of
+// keyring. Returns NULL if its packets can't be read back.
+static ops_keydata_t *copy_key(ops_keyring_t *keyring,const ops_keydata_t *key)
+    {
+    ops_keyring_t one;
+    ops_memory_t *mem;
+    ops_keydata_t *copy=NULL;
+    unsigned n;
+
+    if(key->compact)
+	{
+	copy=ops_keyring_new_compact_keydata(keyring,key);
+	++keyring->nkeys;
+	return copy;
+	}
+
+    // the key material is decoded afresh, so the copy owns its own
+    mem=ops_memory_new();
+    for(n=0 ; n < key->npackets ; ++n)
+	ops_memory_add(mem,key->packets[n].raw,key->packets[n].length);
+    memset(&one,'\0',sizeof one);
+    if(ops_keyring_read_from_mem(&one,ops_false,mem) && one.nkeys == 1)
+	{
+	take_key(keyring,one.keys[0]);
+	one.keys[0]=NULL;
+	copy=keyring->keys[keyring->nkeys-1];
+	}
+    ops_keyring_free(&one);
+    ops_memory_free(mem);
+
+    return copy;
+    }
+
+/*
+ * Merge from into keyring, as ops_keyring_import() describes. If
+ * shared is not NULL, keyring was made from it by ops_keyring_share(),
+ * and a key the two still have in common is copied before anything is
+ * merged into it. The copy takes its place in keyring, and the shared
+ * key is added to *replaced.
+ */
+static void import_keys(ops_keyring_t *keyring,ops_keyring_t *from,
+			ops_create_info_t *journal,
+			ops_keyring_import_result_t *result,
+			const ops_keyring_t *shared,
+			ops_keydata_t ***replaced,unsigned *nreplaced)
+    {
+    ops_keyring_import_result_t dummy;
+    int n;
+
+    if(!result)
+	result=&dummy;
+    memset(result,'\0',sizeof *result);
+
+    ops_keyring_index_update(keyring);
+
+    for(n=0 ; n < from->nkeys ; ++n)
+	{
+	ops_keydata_t *key=from->keys[n];
+	ops_keydata_t *existing=NULL;
+	int pos=index_find(keyring,key->key_id,ops_false);
+	unsigned nsubkeys;
+	unsigned m;
+
+	// a clash of key IDs alone doesn't make it the same key
+	for( ; pos >= 0 && pos < keyring->nkeys ; ++pos)
+	    if(!memcmp(keyring->keys[pos]->key_id,key->key_id,
+		       OPS_KEY_ID_SIZE)
+	       && keyring->keys[pos]->fingerprint.length
+	          == key->fingerprint.length
+	       && !memcmp(keyring->keys[pos]->fingerprint.fingerprint,
+			  key->fingerprint.fingerprint,
+			  key->fingerprint.length))
+		{
+		existing=keyring->keys[pos];
+		break;
+		}
+	// any that a merge adds go in the index after these
+	nsubkeys=existing ? existing->nsubkey_ids : 0;
+
+	if(existing && shared && pos < shared->nkeys
+	   && existing == shared->keys[pos])
+	    {
+	    ops_keydata_t *copy;
+
+	    // only copy a key that the merge will change
+	    if(!merge_adds_packets(existing,key))
+		{
+		++result->unchanged_keys;
+		continue;
+		}
+	    // the copy goes on the end, and is moved into place
+	    copy=copy_key(keyring,existing);
+	    if(!copy)
+		{
+		++result->unchanged_keys;
+		continue;
+		}
+	    --keyring->nkeys;
+	    merge_key(copy,key,result);
+	    keyring->keys[pos]=copy;
+	    *replaced=realloc(*replaced,(*nreplaced+1)*sizeof **replaced);
+	    (*replaced)[(*nreplaced)++]=existing;
+	    existing=copy;
+	    // the index is this keyring's own
+	    index_new_subkeys(keyring,pos,nsubkeys);
+	    ++result->updated_keys;
+	    if(keyring->verify_cache)
+		ops_verify_cache_invalidate_signer(keyring->verify_cache,
+						   &existing->fingerprint);
+	    }
+	else if(!existing)
+	    {
+	    take_key(keyring,key);
+	    ops_keyring_index_update(keyring);
+	    from->keys[n]=NULL;
+	    ++result->new_keys;
+	    }
+	else if(merge_key(existing,key,result))
+	    {
+	    index_new_subkeys(keyring,pos,nsubkeys);
+	    ++result->updated_keys;
+	    if(keyring->verify_cache)
+		ops_verify_cache_invalidate_signer(keyring->verify_cache,
+						   &existing->fingerprint);
+	    }
+	else
+	    {
+	    ++result->unchanged_keys;
+	    continue;
+	    }
+
+	if(journal)
+	    for(m=0 ; m < key->npackets ; ++m)
+		ops_write(key->packets[m].raw,key->packets[m].length,journal);
+	}
+
+    ops_keyring_free(from);
+    }
+
+/**
+   \ingroup HighLevel_KeyringRead
+
+   \brief Merges the keys of one keyring into another
+
+   \param keyring Keyring to be added to
+   \param from Keyring whose keys are to be imported. This is emptied.
+   \param journal If not NULL, the packets of every key that added
+   anything to keyring are written here
+   \param result If not NULL, set to a summary of what was imported
+
+   Keys are matched on their fingerprint. A key not already present is
+   added to the end of keyring; for one that is, any User IDs,
+   signatures and subkeys it is missing are merged into it, so that
+   importing the same keys twice leaves keyring unchanged. The key ID
+   index is kept up to date as keys are added, so this costs in
+   proportion to the size of from, not of keyring.
+
+   Using a writer from ops_setup_file_append() as the journal keeps a
+   keyring file up to date without rewriting it. Reading such a file
+   back with ops_keyring_import_from_file() merges the repeated keys.
+
+   If keyring has a verification cache, the cached results for
+   signatures made by any key that gains packets are dropped, since
+   they may include a revocation.
+
+   \sa ops_keyring_import_from_mem()
+   \sa ops_keyring_import_from_file()
+*/
+void ops_keyring_import(ops_keyring_t *keyring,ops_keyring_t *from,
+			ops_create_info_t *journal,
+			ops_keyring_import_result_t *result)
+    { import_keys(keyring,from,journal,result,NULL,NULL,NULL); }
+
+/**
+   \ingroup Core_Keys
+   \brief Makes a keyring that shares the keys of another
+   \param keyring Empty keyring to fill in
+   \param from Keyring whose keys are shared, which must not be changed
+
+   \note keyring has its own list and index of the keys, but the keys
+   themselves, and the arena they are allocated from, are from's. New
+   keys go into that arena too. Keys may be added to keyring by
+   ops_keyring_import_shared(), and it must be freed with
+   ops_keyring_free_shared(), unless it outlasts from, in which case
+   ops_keyring_free() frees all of it.
+*/
+void ops_keyring_share(ops_keyring_t *keyring,const ops_keyring_t *from)
+    {
+    size_t filter_offset;
+
+    memset(keyring,'\0',sizeof *keyring);
+    keyring->compact=from->compact;
+    keyring->verify_cache=from->verify_cache;
+    keyring->arena=from->arena;
+
+    keyring->nkeys=keyring->nkeys_allocated=from->nkeys;
+    keyring->keys=malloc(from->nkeys*sizeof *keyring->keys+1);
+    memcpy(keyring->keys,from->keys,from->nkeys*sizeof *keyring->keys);
+
+    if(!from->id_index)
+	return;
+    filter_offset=from->id_index_size*sizeof *keyring->id_index;
+    keyring->id_index=malloc(filter_offset
+			     +FILTER_BLOCKS(from->id_index_size)
+			     *FILTER_BLOCK_SIZE+FILTER_BLOCK_SIZE-1);
+    memcpy(keyring->id_index,from->id_index,filter_offset);
+    filter_offset+=-((size_t)keyring->id_index+filter_offset)
+	&(FILTER_BLOCK_SIZE-1);
+    keyring->id_filter=(unsigned char *)keyring->id_index+filter_offset;
+    memcpy(keyring->id_filter,from->id_filter,
+	   FILTER_BLOCKS(from->id_index_size)*FILTER_BLOCK_SIZE);
+    keyring->id_index_size=from->id_index_size;
+    keyring->nids=from->nids;
+    keyring->nindexed=from->nindexed;
+    }
+
+/**
+   \ingroup Core_Keys
+   \brief Merges keys into a keyring made by ops_keyring_share()
+   \param keyring Keyring to be added to
+   \param shared The keyring it shares keys with, which is left unchanged
+   \param from Keys to import. This is emptied.
+   \param result If not NULL, set to a summary of what was imported
+   \param replaced Set to a malloc()ed list of the shared keys that a
+   changed copy took the place of in keyring, or left alone if none did
+   \param nreplaced Incremented by the number of keys added to *replaced
+
+   \note This works as ops_keyring_import() does, except that a shared
+   key is copied before anything is merged into it. Only the keys that
+   change are copied.
+*/
+void ops_keyring_import_shared(ops_keyring_t *keyring,
+			       const ops_keyring_t *shared,
+			       ops_keyring_t *from,
+			       ops_keyring_import_result_t *result,
+			       ops_keydata_t ***replaced,unsigned *nreplaced)
+    { import_keys(keyring,from,NULL,result,shared,replaced,nreplaced); }
+
+/**
+   \ingroup Core_Keys
+   \brief Frees a keyring whose keys a keyring made from it by
+   ops_keyring_share() has kept
+   \param keyring Keyring to free
+   \param replaced Its keys that weren't kept, which are freed
+   \param nreplaced How many of them there are
+
+   \note The arena, and the keys that were kept, are left to the
+   keyring that kept them.
+*/
+void ops_keyring_free_shared(ops_keyring_t *keyring,ops_keydata_t **replaced,
+			     unsigned nreplaced)
+    {
+    unsigned n;
+
+    for(n=0 ; n < nreplaced ; ++n)
+	keydata_key_free(replaced[n]);
+    free(keyring->keys);
+    free(keyring->id_index);
+    memset(keyring,'\0',sizeof *keyring);
+    }
+
+/**
+   \ingroup HighLevel_KeyringRead
+
+   \brief Imports keys from memory into an existing keyring
+
+   \param keyring Keyring to be added to
+   \param armour ops_true if the keys are armoured; else ops_false
+   \param mem Keys to be imported
+   \param journal If not NULL, where to write the keys that changed keyring
+   \param result If not NULL, set to a summary of what was imported
+
+   \return ops_true if OK; ops_false on error
+
+   \sa ops_keyring_import()
+*/
+ops_boolean_t ops_keyring_import_from_mem(ops_keyring_t *keyring,
+					  const ops_boolean_t armour,
+					  ops_memory_t *mem,
+					  ops_create_info_t *journal,
+					  ops_keyring_import_result_t *result)
+    {
+    ops_keyring_t from;
+    ops_boolean_t res;
+
+    memset(&from,'\0',sizeof from);
+    res=ops_keyring_read_from_mem(&from,armour,mem);
+    ops_keyring_import(keyring,&from,journal,result);
+
+    return res;
+    }
+
+/**
+   \ingroup HighLevel_KeyringRead
+
+   \brief Imports keys from a file into an existing keyring
+
+   \param keyring Keyring to be added to
+   \param armour ops_true if file is armoured; else ops_false
+   \param filename File to be imported
+   \param result If not NULL, set to a summary of what was imported
+
+   \return ops_true if OK; ops_false on error
+
+   \note Unlike ops_keyring_read_from_file(), this never adds a key
+   twice, so it can be used to load a keyring that has had keys
+   appended to it by ops_keyring_import().
+
+   \sa ops_keyring_import()
+*/
+ops_boolean_t ops_keyring_import_from_file(ops_keyring_t *keyring,
+					   const ops_boolean_t armour,
+					   const char *filename,
+					   ops_keyring_import_result_t *result)
+    {
+    ops_keyring_t from;
+    ops_boolean_t res;
+
+    memset(&from,'\0',sizeof from);
+    res=ops_keyring_read_from_file(&from,armour,filename);
+    ops_keyring_import(keyring,&from,NULL,result);
+
+    return res;
+    }
+
 /**
    \ingroup HighLevel_KeyringRead
  
@@ -738,13 +2009,55 @@ void ops_keyring_free(ops_keyring_t *keyring)
     {
     int i;
 
+    // Only the key material lives outside the arena. Keys taken by
+    // ops_keyring_import() have been set to NULL.
     for (i = 0; i < keyring->nkeys; i++)
-        keydata_internal_free(&keyring->keys[i]);
+	if(keyring->keys[i])
+	    keydata_key_free(keyring->keys[i]);
 
     free(keyring->keys);
+    ops_arena_free(keyring->arena);
+    free(keyring->id_index);
     keyring->keys=NULL;
+    keyring->arena=NULL;
     keyring->nkeys=0;
     keyring->nkeys_allocated=0;
+    keyring->id_index=NULL;
+    keyring->id_filter=NULL;
+    keyring->id_index_size=0;
+    keyring->nids=0;
+    keyring->nindexed=0;
+    }
+
+// The first key with this ID as its own, or as a subkey's if subkey is
+// set
+static const ops_keydata_t *find_key(const ops_keyring_t *keyring,
+				     const unsigned char *keyid,
+				     ops_boolean_t subkey)
+    {
+    int first=0;
+    int n;
+
+    if (!keyring)
+        return NULL;
+
+    if(keyring->id_index)
+	{
+	if(keyring->nindexed == keyring->nkeys)
+	    {
+	    n=index_find(keyring,keyid,subkey);
+	    return n < 0 ? NULL : keyring->keys[n];
+	    }
+	// only keys added since the index was updated can match
+	if(!filter_may_contain(keyring,keyid))
+	    first=keyring->nindexed;
+	}
+
+    for(n=first ; n < keyring->nkeys ; ++n)
+	if(key_has_id(keyring->keys[n],keyid,subkey))
+	    return keyring->keys[n];
+
+    return NULL;
     }
 
 /**
@@ -773,20 +2086,29 @@ void ops_keyring_free(ops_keyring_t *keyring)
 const ops_keydata_t *
 ops_keyring_find_key_by_id(const ops_keyring_t *keyring,
 			   const unsigned char keyid[OPS_KEY_ID_SIZE])
-    {
-    int n;
+    { return find_key(keyring,keyid,ops_false); }
 
-    if (!keyring)
-        return NULL;
+/**
+   \ingroup HighLevel_KeyringFind
 
-    for(n=0 ; n < keyring->nkeys ; ++n)
-        {
-        if(!memcmp(keyring->keys[n].key_id,keyid,OPS_KEY_ID_SIZE))
-            return &keyring->keys[n];
-        }
+   \brief Finds the key a public subkey belongs to, from the subkey's
+   Key ID
 
-    return NULL;
-    }
+   \param keyring Keyring to be searched
+   \param keyid ID of the subkey
+
+   \return Pointer to the key, if found; NULL, if not found
+
+   \note The key returned is the primary key, and its key material is
+   not the subkey's. Secret subkeys are read as keys in their own right,
+   and are found with ops_keyring_find_key_by_id().
+
+   \sa ops_keyring_find_key_by_id()
+*/
+const ops_keydata_t *
+ops_keyring_find_key_by_subkey_id(const ops_keyring_t *keyring,
+				  const unsigned char keyid[OPS_KEY_ID_SIZE])
+    { return find_key(keyring,keyid,ops_true); }
 
 /**
    \ingroup HighLevel_KeyringFind
@@ -822,11 +2144,11 @@ ops_keyring_find_key_by_userid(const ops_keyring_t *keyring,
 
     for(n=0 ; n < keyring->nkeys ; ++n)
         {
-        for(i=0; i<keyring->keys[n].nuids; i++)
+        for(i=0; i<keyring->keys[n]->nuids; i++)
             {
-            //printf("[%d][%d] userid %s\n",n,i,keyring->keys[n].uids[i].user_id);
-            if(!strncmp((char *)keyring->keys[n].uids[i].user_id,userid,strlen(userid)))
-                return &keyring->keys[n];
+            //printf("[%d][%d] userid %s\n",n,i,keyring->keys[n]->uids[i].user_id);
+            if(!strncmp((char *)keyring->keys[n]->uids[i].user_id,userid,strlen(userid)))
+                return keyring->keys[n];
             }
         }
 
@@ -867,8 +2189,9 @@ ops_keyring_list(const ops_keyring_t* keyring)
     ops_keydata_t* key;
 
     printf ("%d keys\n", keyring->nkeys);
-    for(n=0,key=&keyring->keys[n] ; n < keyring->nkeys ; ++n,++key)
+    for(n=0 ; n < keyring->nkeys ; ++n)
 	{
+	key=keyring->keys[n];
 	for(i=0; i<key->nuids; i++)
 	    {
 	    if (ops_is_key_secret(key))
@@ -0,0 +1,577 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** \file
+ * \brief A keyring which many threads can search while it is being
+ * reloaded or updated.
+ *
+ * Readers never see a keyring change underneath them: each read runs
+ * against a snapshot, and updates build a new snapshot and publish it
+ * in one step. A snapshot that has been replaced is freed once every
+ * reader that might still be using it has left, which is tracked by
+ * having each reader record the update epoch at which it entered.
+ *
+ * An import doesn't copy the whole keyring: the new snapshot shares
+ * the keys, and the arena they are in, with the one it replaces, and
+ * only the keys the import changes are copied before being changed.
+ * The keys they replace are freed with the old snapshot. Replaced keys
+ * are left in the arena until there are as many of them as there are
+ * keys, when the next import makes a fresh copy of the keyring.
+ */
+
+#include <openpgpsdk/keyring_handle.h>
+#include <openpgpsdk/util.h>
+#include <openpgpsdk/memory.h>
+#include <openpgpsdk/verify_cache.h>
+
+#include "keyring_local.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include <openpgpsdk/final.h>
+
+#ifdef HAVE_PTHREAD_H
+# define LOCK(h)	pthread_mutex_lock(&(h)->lock)
+# define UNLOCK(h)	pthread_mutex_unlock(&(h)->lock)
+#else
+# define LOCK(h)
+# define UNLOCK(h)
+#endif
+
+#ifdef __GNUC__
+# define MEMORY_BARRIER()	__sync_synchronize()
+#else
+# define MEMORY_BARRIER()
+#endif
+
+struct ops_keyring_reader
+    {
+    ops_keyring_handle_t *handle;
+    volatile unsigned long epoch; /*!< epoch when the current read began,
+				    or 0 if not reading */
+    ops_boolean_t in_use;
+    ops_keyring_reader_t *next;
+    };
+
+// A snapshot that has been replaced but may still have readers
+typedef struct retired
+    {
+    ops_keyring_t *keyring;
+    unsigned long epoch;	/*!< the epoch during which it was replaced */
+    ops_boolean_t shared;	/*!< the snapshot that replaced it shares
+				  its arena and keys */
+    ops_keydata_t **replaced;	/*!< the keys it didn't share */
+    unsigned nreplaced;
+    struct retired *next;
+    } retired_t;
+
+struct ops_keyring_handle
+    {
+    ops_keyring_t * volatile current;
+    volatile unsigned long epoch; /*!< incremented by every update */
+    ops_keyring_reader_t *readers;
+    retired_t *retired;		/*!< oldest first, as they must be freed */
+    unsigned stale;		/*!< keys replaced in the current arena */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;	/*!< held by updates and while readers are
+				  registered */
+#endif
+    };
+
+// Move the contents of keyring into a new heap-allocated keyring
+static ops_keyring_t *take_keyring(ops_keyring_t *keyring)
+    {
+    ops_keyring_t *taken=ops_mallocz(sizeof *taken);
+
+    if(keyring)
+	{
+	*taken=*keyring;
+	memset(keyring,'\0',sizeof *keyring);
+	}
+    ops_keyring_index_update(taken);
+
+    return taken;
+    }
+
+static void keyring_delete(ops_keyring_t *keyring)
+    {
+    ops_keyring_free(keyring);
+    free(keyring);
+    }
+
+// Make a separate copy of src in dst, by parsing its packets again
+static ops_boolean_t copy_keyring(ops_keyring_t *dst,const ops_keyring_t *src)
+    {
+    ops_memory_t *mem=ops_memory_new();
+    ops_boolean_t res;
+    int n;
+    unsigned m;
+
+    dst->compact=src->compact;
+    dst->verify_cache=src->verify_cache;
+    for(n=0 ; n < src->nkeys ; ++n)
+	for(m=0 ; m < src->keys[n]->npackets ; ++m)
+	    ops_memory_add(mem,src->keys[n]->packets[m].raw,
+			   src->keys[n]->packets[m].length);
+
+    res=ops_keyring_read_from_mem(dst,ops_false,mem);
+    ops_memory_free(mem);
+
+    return res;
+    }
+
+// Drop the cached verification results of every key in keyring that
+// isn't in old exactly as it is
+static void forget_changed_signers(ops_verify_cache_t *cache,
+				   const ops_keyring_t *old,
+				   const ops_keyring_t *keyring)
+    {
+    int n;
+
+    for(n=0 ; n < keyring->nkeys ; ++n)
+	{
+	const ops_keydata_t *key=keyring->keys[n];
+	const ops_keydata_t *was=ops_keyring_find_key_by_id(old,key->key_id);
+
+	if(!was || was->npackets != key->npackets)
+	    ops_verify_cache_invalidate_signer(cache,&key->fingerprint);
+	}
+    }
+
+static void retired_delete(retired_t *retired)
+    {
+    if(retired->shared)
+	{
+	ops_keyring_free_shared(retired->keyring,retired->replaced,
+				retired->nreplaced);
+	free(retired->keyring);
+	}
+    else
+	keyring_delete(retired->keyring);
+    free(retired->replaced);
+    free(retired);
+    }
+
+// Free any retired snapshots no reader can be using. Call with the lock held.
+static unsigned collect(ops_keyring_handle_t *handle)
+    {
+    const ops_keyring_reader_t *reader;
+    retired_t **pretired;
+    unsigned long oldest=0;
+    unsigned freed=0;
+
+    MEMORY_BARRIER();
+    for(reader=handle->readers ; reader ; reader=reader->next)
+	{
+	unsigned long epoch=reader->epoch;
+
+	if(epoch && (!oldest || epoch < oldest))
+	    oldest=epoch;
+	}
+
+    // a reader that entered after a snapshot was replaced can't have it,
+    // nor any replaced before it
+    for(pretired=&handle->retired ; *pretired ; )
+	{
+	retired_t *retired=*pretired;
+
+	if(oldest && retired->epoch >= oldest)
+	    break;
+	*pretired=retired->next;
+	retired_delete(retired);
+	++freed;
+	}
+
+    return freed;
+    }
+
+/*
+ * Make keyring the current snapshot. Call with the lock held. If
+ * shared, keyring was made from the current snapshot by
+ * ops_keyring_share(), and replaced is what that snapshot has that
+ * keyring doesn't; else keyring shares nothing with it.
+ */
+static void publish(ops_keyring_handle_t *handle,ops_keyring_t *keyring,
+		    ops_boolean_t shared,ops_keydata_t **replaced,
+		    unsigned nreplaced)
+    {
+    retired_t *retired=ops_mallocz(sizeof *retired);
+    retired_t **plast;
+
+    retired->keyring=handle->current;
+    retired->epoch=handle->epoch;
+    retired->shared=shared;
+    retired->replaced=replaced;
+    retired->nreplaced=nreplaced;
+    for(plast=&handle->retired ; *plast ; plast=&(*plast)->next)
+	;
+    *plast=retired;
+    handle->stale=shared ? handle->stale+nreplaced : 0;
+
+    handle->current=keyring;
+    MEMORY_BARRIER();
+    ++handle->epoch;
+
+    collect(handle);
+    }
+
+/**
+   \ingroup HighLevel_KeyringFind
+
+   \brief Creates a keyring that can be shared between threads
+
+   \param keyring Initial contents, which are moved into the handle, so
+   that keyring is left empty. May be NULL.
+
+   \return New handle, to be freed with ops_keyring_handle_free()
+
+   \note Each thread that searches the keyring needs its own
+   ops_keyring_reader_t, from ops_keyring_reader_new().
+*/
+ops_keyring_handle_t *ops_keyring_handle_new(ops_keyring_t *keyring)
+    {
+    ops_keyring_handle_t *handle=ops_mallocz(sizeof *handle);
+
+    handle->current=take_keyring(keyring);
+    handle->epoch=1;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&handle->lock,NULL);
+#endif
+
+    return handle;
+    }
+
+/**
+   \ingroup HighLevel_KeyringFind
+
+   \brief Frees a shared keyring, and all its readers
+
+   \param handle Handle to free
+
+   \note No thread may be reading the keyring.
+*/
+void ops_keyring_handle_free(ops_keyring_handle_t *handle)
+    {
+    while(handle->readers)
+	{
+	ops_keyring_reader_t *next=handle->readers->next;
+
+	assert(!handle->readers->epoch);
+	free(handle->readers);
+	handle->readers=next;
+	}
+    collect(handle);
+    assert(!handle->retired);
+
+    keyring_delete(handle->current);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&handle->lock);
+#endif
+    free(handle);
+    }
+
+/**
+   \ingroup HighLevel_KeyringFind
+
+   \brief Registers a thread to read a shared keyring
+
+   \param handle Shared keyring
+
+   \return Reader for use by one thread at a time
+*/
+ops_keyring_reader_t *ops_keyring_reader_new(ops_keyring_handle_t *handle)
+    {
+    ops_keyring_reader_t *reader;
+
+    LOCK(handle);
+    for(reader=handle->readers ; reader ; reader=reader->next)
+	if(!reader->in_use)
+	    break;
+    if(!reader)
+	{
+	reader=ops_mallocz(sizeof *reader);
+	reader->handle=handle;
+	reader->next=handle->readers;
+	handle->readers=reader;
+	}
+    reader->in_use=ops_true;
+    UNLOCK(handle);
+
+    return reader;
+    }
+
+/**
+   \ingroup HighLevel_KeyringFind
+
+   \brief Unregisters a reader
+
+   \param reader Reader, which must not be inside a read
+
+   \note The reader's memory is kept for reuse, and only freed by
+   ops_keyring_handle_free().
+*/
+void ops_keyring_reader_free(ops_keyring_reader_t *reader)
+    {
+    ops_keyring_handle_t *handle=reader->handle;
+
+    assert(!reader->epoch);
+    LOCK(handle);
+    reader->in_use=ops_false;
+    UNLOCK(handle);
+    }
+
+/**
+   \ingroup HighLevel_KeyringFind
+
+   \brief Starts a read of a shared keyring
+
+   \param reader This thread's reader
+
+   \return The current snapshot of the keyring. It stays valid, and
+   unchanged, until ops_keyring_reader_exit() is called, however many
+   updates are published meanwhile.
+
+   \note This never waits for a lock. Reads must not be nested, and
+   should be kept short, since snapshots cannot be freed while a reader
+   that might be using them is inside a read.
+
+   Example code:
+   \code
+   const ops_keyring_t *keyring=ops_keyring_reader_enter(reader);
+   const ops_keydata_t *key=ops_keyring_find_key_by_id(keyring,keyid);
+   ...
+   ops_keyring_reader_exit(reader);
+   \endcode
+*/
+const ops_keyring_t *ops_keyring_reader_enter(ops_keyring_reader_t *reader)
+    {
+    ops_keyring_handle_t *handle=reader->handle;
+
+    assert(!reader->epoch);
+    reader->epoch=handle->epoch;
+    // the epoch must be visible to updates before we look at the snapshot
+    MEMORY_BARRIER();
+
+    return handle->current;
+    }
+
+/**
+   \ingroup HighLevel_KeyringFind
+
+   \brief Ends a read of a shared keyring
+
+   \param reader This thread's reader
+
+   \note The snapshot returned by ops_keyring_reader_enter() must not
+   be used after this.
+*/
+void ops_keyring_reader_exit(ops_keyring_reader_t *reader)
+    {
+    MEMORY_BARRIER();
+    reader->epoch=0;
+    }
+
+/**
+   \ingroup HighLevel_KeyringFind
+
+   \brief Replaces the contents of a shared keyring
+
+   \param handle Shared keyring
+   \param keyring New contents, which are moved into the handle, so
+   that keyring is left empty
+
+   \note Readers already inside a read carry on with the old contents,
+   which are freed once they have all left.
+*/
+void ops_keyring_handle_publish(ops_keyring_handle_t *handle,
+				ops_keyring_t *keyring)
+    {
+    ops_keyring_t *taken=take_keyring(keyring);
+
+    LOCK(handle);
+    publish(handle,taken,ops_false,NULL,0);
+    UNLOCK(handle);
+    }
+
+/**
+   \ingroup HighLevel_KeyringRead
+
+   \brief Replaces the contents of a shared keyring with those of a file
+
+   \param handle Shared keyring
+   \param armour ops_true if file is armoured; else ops_false
+   \param filename Keyring file
+
+   \return ops_true if OK. On error, the shared keyring is left unchanged
+   and ops_false is returned.
+
+   \note The new contents keep the current snapshot's verification
+   cache, less the results for signers whose keys have changed.
+*/
+ops_boolean_t ops_keyring_handle_reload_from_file(ops_keyring_handle_t *handle,
+						  const ops_boolean_t armour,
+						  const char *filename)
+    {
+    ops_keyring_t keyring;
+
+    memset(&keyring,'\0',sizeof keyring);
+    if(!ops_keyring_read_from_file_parallel(&keyring,armour,filename,0))
+	{
+	ops_keyring_free(&keyring);
+	return ops_false;
+	}
+
+    LOCK(handle);
+    keyring.verify_cache=handle->current->verify_cache;
+    if(keyring.verify_cache)
+	forget_changed_signers(keyring.verify_cache,handle->current,&keyring);
+    publish(handle,take_keyring(&keyring),ops_false,NULL,0);
+    UNLOCK(handle);
+
+    return ops_true;
+    }
+
+/**
+   \ingroup HighLevel_KeyringRead
+
+   \brief Merges keys into a shared keyring
+
+   \param handle Shared keyring
+   \param from Keys to import, as for ops_keyring_import(). This is emptied.
+   \param result If not NULL, set to a summary of what was imported
+
+   \return ops_true if OK; ops_false on error
+
+   \note The new snapshot shares the current one's keys, and only those
+   that the import changes are copied, so the cost under the lock is
+   in proportion to the size of from, apart from copying the list and
+   index of the keys. Once as many keys have been replaced as the
+   keyring holds, the next import copies the whole keyring instead, so
+   that the old versions can be freed. Nothing is published if the
+   keys were all already present.
+
+   \sa ops_keyring_import()
+*/
+ops_boolean_t ops_keyring_handle_import(ops_keyring_handle_t *handle,
+					ops_keyring_t *from,
+					ops_keyring_import_result_t *result)
+    {
+    ops_keyring_import_result_t dummy;
+    ops_keyring_t keyring;
+    ops_keydata_t **replaced=NULL;
+    unsigned nreplaced=0;
+    ops_boolean_t shared;
+
+    if(!result)
+	result=&dummy;
+
+    memset(&keyring,'\0',sizeof keyring);
+
+    LOCK(handle);
+    shared=handle->stale <= (unsigned)handle->current->nkeys;
+    if(shared)
+	{
+	ops_keyring_share(&keyring,handle->current);
+	ops_keyring_import_shared(&keyring,handle->current,from,result,
+				  &replaced,&nreplaced);
+	}
+    else if(copy_keyring(&keyring,handle->current))
+	ops_keyring_import(&keyring,from,NULL,result);
+    else
+	{
+	UNLOCK(handle);
+	ops_keyring_free(&keyring);
+	ops_keyring_free(from);
+	return ops_false;
+	}
+
+    if(result->new_keys || result->updated_keys)
+	publish(handle,take_keyring(&keyring),shared,replaced,nreplaced);
+    else if(shared)
+	// no keys were added, so it has nothing of its own
+	ops_keyring_free_shared(&keyring,NULL,0);
+    else
+	ops_keyring_free(&keyring);
+    UNLOCK(handle);
+
+    return ops_true;
+    }
+
+/**
+   \ingroup HighLevel_KeyringRead
+
+   \brief Merges keys from a file into a shared keyring
+
+   \param handle Shared keyring
+   \param armour ops_true if file is armoured; else ops_false
+   \param filename File of keys to import
+   \param result If not NULL, set to a summary of what was imported
+
+   \return ops_true if OK; ops_false on error
+
+   \sa ops_keyring_handle_import()
+*/
+ops_boolean_t ops_keyring_handle_import_from_file(ops_keyring_handle_t *handle,
+						  const ops_boolean_t armour,
+						  const char *filename,
+						  ops_keyring_import_result_t *result)
+    {
+    ops_keyring_t from;
+
+    memset(&from,'\0',sizeof from);
+    if(!ops_keyring_read_from_file(&from,armour,filename))
+	{
+	ops_keyring_free(&from);
+	return ops_false;
+	}
+
+    return ops_keyring_handle_import(handle,&from,result);
+    }
+
+/**
+   \ingroup HighLevel_KeyringFind
+
+   \brief Frees replaced snapshots that no reader is using any more
+
+   \param handle Shared keyring
+
+   \return Number of snapshots freed
+
+   \note Updates do this themselves, but a snapshot which still had
+   readers when it was replaced is not freed until the next update, or
+   until this is called.
+*/
+unsigned ops_keyring_handle_collect(ops_keyring_handle_t *handle)
+    {
+    unsigned freed;
+
+    LOCK(handle);
+    freed=collect(handle);
+    UNLOCK(handle);
+
+    return freed;
+    }
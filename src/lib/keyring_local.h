@@ -23,6 +23,9 @@
  */
 
 #include <openpgpsdk/packet.h>
+#include <openpgpsdk/keyring.h>
+
+#include <stddef.h>
 
 #define DECLARE_ARRAY(type,arr)	unsigned n##arr; unsigned n##arr##_allocated; type *arr
 #define EXPAND_ARRAY(str,arr) do if(str->n##arr == str->n##arr##_allocated) \
@@ -30,6 +33,18 @@
 				str->n##arr##_allocated=str->n##arr##_allocated*2+10; \
 				str->arr=realloc(str->arr,str->n##arr##_allocated*sizeof *str->arr); \
 				} while(0)
+/* As EXPAND_ARRAY, but takes the new array from an arena when the
+   structure has one. The old array is simply left in the arena. */
+#define EXPAND_ARENA_ARRAY(str,arr) do if(!str->arena) \
+				EXPAND_ARRAY(str,arr); \
+			    else if(str->n##arr == str->n##arr##_allocated) \
+				{ \
+				void *old_=str->arr; \
+				str->n##arr##_allocated=str->n##arr##_allocated*2+10; \
+				str->arr=ops_arena_alloc(str->arena,str->n##arr##_allocated*sizeof *str->arr); \
+				if(str->n##arr) \
+				    memcpy(str->arr,old_,str->n##arr*sizeof *str->arr); \
+				} while(0)
 
 /** ops_keydata_key_t
  */
@@ -47,6 +62,12 @@ typedef struct
     ops_packet_t* packet;
     } sigpacket_t;
 
+/** subkey_id_t */
+typedef struct
+    {
+    unsigned char id[OPS_KEY_ID_SIZE];
+    } subkey_id_t;
+
 // XXX: gonna have to expand this to hold onto subkeys, too...
 /** \struct ops_keydata
  * \todo expand to hold onto subkeys
@@ -56,8 +77,35 @@ struct ops_keydata
     DECLARE_ARRAY(ops_user_id_t,uids);
     DECLARE_ARRAY(ops_packet_t,packets);
     DECLARE_ARRAY(sigpacket_t, sigs);
+    DECLARE_ARRAY(subkey_id_t,subkey_ids); /*!< of the public subkeys among
+					     packets */
     unsigned char key_id[8];
     ops_fingerprint_t fingerprint;
     ops_content_tag_t type;
-    ops_keydata_key_t key;
+    ops_arena_t *arena;		/*!< owning keyring's arena, or NULL if
+				  this key was allocated on its own */
+    ops_boolean_t compact;	/*!< allocated without key, see
+				  COMPACT_KEYDATA_SIZE */
+    ops_public_key_t * volatile decoded; /*!< a compact key's public key,
+					   once something has asked for it */
+    ops_keydata_key_t key;	/*!< must be last */
     };
+
+/* A compact key is a public key whose key material is only decoded, into
+   decoded, when it is needed. It has no room for key. */
+#define COMPACT_KEYDATA_SIZE	offsetof(struct ops_keydata,key)
+
+ops_keydata_t *ops_keyring_new_keydata(ops_keyring_t *keyring);
+ops_keydata_t *ops_keyring_new_compact_keydata(ops_keyring_t *keyring,
+					       const ops_keydata_t *from);
+void ops_add_subkey_id_to_keydata(ops_keydata_t *keydata,
+				  const unsigned char *keyid);
+void ops_keyring_index_update(ops_keyring_t *keyring);
+void ops_keyring_share(ops_keyring_t *keyring,const ops_keyring_t *from);
+void ops_keyring_import_shared(ops_keyring_t *keyring,
+			       const ops_keyring_t *shared,
+			       ops_keyring_t *from,
+			       ops_keyring_import_result_t *result,
+			       ops_keydata_t ***replaced,unsigned *nreplaced);
+void ops_keyring_free_shared(ops_keyring_t *keyring,ops_keydata_t **replaced,
+			     unsigned nreplaced);
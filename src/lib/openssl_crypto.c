@@ -27,8 +27,10 @@
 #include <openssl/dsa.h>
 #include <openssl/rsa.h>
 #include <openssl/err.h>
+#include <openssl/crypto.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <openpgpsdk/configure.h>
 #include <openpgpsdk/crypto.h>
@@ -37,6 +39,10 @@
 #include "keyring_local.h"
 #include <openpgpsdk/std_print.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #include <openpgpsdk/final.h>
 
 static int debug=0;
@@ -381,6 +387,47 @@ void ops_hash_sha224(ops_hash_t *hash)
     *hash=sha224;
     }
 
+/**
+   \ingroup Core_Hashes
+   \brief Copies a hash part way through, so both copies can go on
+   \param dst Hash to initialise as a copy
+   \param src Hash that has been initialised but not finished
+   \note dst must be finished separately from src.
+*/
+void ops_hash_dup(ops_hash_t *dst,const ops_hash_t *src)
+    {
+    size_t size;
+
+    switch(src->algorithm)
+	{
+    case OPS_HASH_MD5:
+	size=sizeof(MD5_CTX);
+	break;
+
+    case OPS_HASH_SHA1:
+	size=sizeof(SHA_CTX);
+	break;
+
+    case OPS_HASH_SHA224:
+    case OPS_HASH_SHA256:
+	size=sizeof(SHA256_CTX);
+	break;
+
+    case OPS_HASH_SHA384:
+    case OPS_HASH_SHA512:
+	size=sizeof(SHA512_CTX);
+	break;
+
+    default:
+	assert(0);
+	return;
+	}
+
+    *dst=*src;
+    dst->data=malloc(size);
+    memcpy(dst->data,src->data,size);
+    }
+
 ops_boolean_t ops_dsa_verify(const unsigned char *hash,size_t hash_length,
 			     const ops_dsa_signature_t *sig,
 			     const ops_dsa_public_key_t *dsa)
@@ -584,10 +631,79 @@ int ops_rsa_public_encrypt(unsigned char *out,const unsigned char *in,
     return n;
     }
 
+/*
+ * OpenSSL before 1.1.0 is only safe on several threads at once if it
+ * is given locks and a way to tell threads apart. The SDK's parallel
+ * functions use it from several threads, so unless the application
+ * has already done so, these are installed by ops_crypto_init().
+ */
+#if defined(HAVE_PTHREAD_H) && OPENSSL_VERSION_NUMBER < 0x10100000L
+#define OPS_OPENSSL_LOCKS
+
+static pthread_mutex_t *openssl_locks;
+
+static void openssl_lock(int mode,int n,const char *file,int line)
+    {
+    OPS_USED(file);
+    OPS_USED(line);
+
+    if(mode&CRYPTO_LOCK)
+	pthread_mutex_lock(&openssl_locks[n]);
+    else
+	pthread_mutex_unlock(&openssl_locks[n]);
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+static void openssl_thread_id(CRYPTO_THREADID *id)
+    { CRYPTO_THREADID_set_pointer(id,(void *)pthread_self()); }
+#else
+static unsigned long openssl_thread_id(void)
+    { return (unsigned long)pthread_self(); }
+#endif
+
+static void openssl_locks_init(void)
+    {
+    int n;
+
+    if(openssl_locks || CRYPTO_get_locking_callback())
+	return;
+
+    openssl_locks=malloc(CRYPTO_num_locks()*sizeof *openssl_locks);
+    for(n=0 ; n < CRYPTO_num_locks() ; ++n)
+	pthread_mutex_init(&openssl_locks[n],NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+    CRYPTO_THREADID_set_callback(openssl_thread_id);
+#else
+    CRYPTO_set_id_callback(openssl_thread_id);
+#endif
+    CRYPTO_set_locking_callback(openssl_lock);
+    }
+
+static void openssl_locks_finish(void)
+    {
+    int n;
+
+    if(!openssl_locks)
+	return;
+
+    CRYPTO_set_locking_callback(NULL);
+#if OPENSSL_VERSION_NUMBER < 0x10000000L
+    CRYPTO_set_id_callback(NULL);
+#endif
+    for(n=0 ; n < CRYPTO_num_locks() ; ++n)
+	pthread_mutex_destroy(&openssl_locks[n]);
+    free(openssl_locks);
+    openssl_locks=NULL;
+    }
+#endif
+
 /**
    \ingroup Core_Crypto
    \brief initialises openssl
    \note Would usually call ops_init() instead
+   \note With OpenSSL before 1.1.0, this installs the locking and
+   thread ID callbacks OpenSSL needs to be used from several threads,
+   unless the application has installed its own first.
    \sa ops_init()
 */
 void ops_crypto_init()
@@ -596,6 +712,9 @@ void ops_crypto_init()
     CRYPTO_malloc_debug_init();
     CRYPTO_dbg_set_options(V_CRYPTO_MDEBUG_ALL);
     CRYPTO_mem_ctrl(CRYPTO_MEM_CHECK_ON);
+#endif
+#ifdef OPS_OPENSSL_LOCKS
+    openssl_locks_init();
 #endif
     }
 
@@ -612,6 +731,9 @@ void ops_crypto_finish()
     //    ERR_remove_state(0);
 #ifdef DMALLOC
     CRYPTO_mem_leaks_fp(stderr);
+#endif
+#ifdef OPS_OPENSSL_LOCKS
+    openssl_locks_finish();
 #endif
     }
 
@@ -658,6 +780,8 @@ ops_boolean_t ops_rsa_generate_keypair(const int numbits, const unsigned long e,
 
     skey->public_key.key.rsa.n=BN_dup(rsa->n);
     skey->public_key.key.rsa.e=BN_dup(rsa->e);
+    skey->public_key.serialised=NULL;
+    skey->public_key.serialised_length=0;
 
     skey->s2k_usage=OPS_S2KU_ENCRYPTED_AND_HASHED;
     skey->s2k_specifier=OPS_S2KS_SALTED;
@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** \file
+ * \brief Indexing the packets in a file by walking their headers.
+ *
+ * Only the headers are read. Each body, and each partial chunk of one,
+ * is skipped by seeking past it, so indexing a file costs a read per
+ * few headers however big the packets are.
+ */
+
+#include <openpgpsdk/packet-index.h>
+#include <openpgpsdk/util.h>
+#include <openpgpsdk/writer.h>
+#include "keyring_local.h"
+#include "parse_local.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include <openpgpsdk/final.h>
+
+// The serialised form is MAGIC, then one RECORD_SIZE record per entry
+#define MAGIC		"OPSI\001"
+#define MAGIC_SIZE	5
+#define RECORD_SIZE	(1+1+3*8)
+
+#define RECORD_PARTIAL	0x01
+
+struct ops_packet_index
+    {
+    DECLARE_ARRAY(ops_packet_index_entry_t,entries);
+    };
+
+// A window on the file, so that nearby headers take one read between them
+typedef struct
+    {
+    int fd;
+    off_t start;		/*!< file offset of buf[0] */
+    size_t length;		/*!< bytes of the file in buf */
+    unsigned char buf[8192];
+    } header_scan_t;
+
+/*
+ * Point *p at the n bytes at offset, which must be no more than a
+ * header's worth. Returns 1 if they're there, 0 if the file ends first,
+ * or -1 on error.
+ */
+static int scan_get(header_scan_t *scan,off_t offset,size_t n,
+		    const unsigned char **p,ops_error_t **errors)
+    {
+    if(offset < scan->start || offset+(off_t)n > scan->start+(off_t)scan->length)
+	{
+	if(lseek(scan->fd,offset,SEEK_SET) == (off_t)-1)
+	    {
+	    OPS_SYSTEM_ERROR_1(errors,OPS_E_R_READ_FAILED,"lseek",
+			       "Can't seek to offset %lu",(unsigned long)offset);
+	    return -1;
+	    }
+	scan->start=offset;
+	scan->length=0;
+	while(scan->length < n)
+	    {
+	    int r=read(scan->fd,scan->buf+scan->length,
+		       sizeof scan->buf-scan->length);
+
+	    if(r < 0)
+		{
+		OPS_SYSTEM_ERROR_1(errors,OPS_E_R_READ_FAILED,"read",
+				   "Can't read at offset %lu",
+				   (unsigned long)offset);
+		return -1;
+		}
+	    if(r == 0)
+		return 0;
+	    scan->length+=r;
+	    }
+	}
+
+    *p=scan->buf+(offset-scan->start);
+    return 1;
+    }
+
+// As scan_get(), but the file ending counts as an error
+static ops_boolean_t scan_need(header_scan_t *scan,off_t offset,size_t n,
+			       const unsigned char **p,ops_error_t **errors)
+    {
+    int r=scan_get(scan,offset,n,p,errors);
+
+    if(r == 0)
+	OPS_ERROR(errors,OPS_E_R_EARLY_EOF,"Packet header cut short");
+    return r > 0;
+    }
+
+/*
+ * Decode the packet header at offset, or if chunk is set the length of
+ * a partial chunk, reading as much of it as it turns out to need.
+ */
+static ops_boolean_t scan_length(header_scan_t *scan,off_t offset,
+				 ops_boolean_t chunk,unsigned *tag,
+				 size_t *hlen,size_t *blen,
+				 ops_length_type_t *type,ops_error_t **errors)
+    {
+    const unsigned char *p;
+    size_t n;
+    int r;
+
+    for(n=1 ; ; n=*hlen)
+	{
+	if(!scan_need(scan,offset,n,&p,errors))
+	    return ops_false;
+	r=chunk ? ops_decode_new_length(p,n,hlen,blen,type)
+	    : ops_decode_packet_header(p,n,tag,hlen,blen,type);
+	if(r)
+	    return r > 0;
+	}
+    }
+
+/*
+ * Index the packet whose tag is at entry->header_offset, following its
+ * partial chunks, if any. size is the size of the file, or -1 if that
+ * isn't known. *next is set to the offset after it.
+ */
+static ops_boolean_t index_packet(ops_packet_index_entry_t *entry,off_t size,
+				  header_scan_t *scan,off_t *next,
+				  ops_error_t **errors)
+    {
+    unsigned tag;
+    size_t hlen;
+    size_t blen;
+    ops_length_type_t type;
+    off_t pos;
+
+    if(!scan_length(scan,entry->header_offset,ops_false,&tag,&hlen,&blen,
+		    &type,errors))
+	return ops_false;
+    entry->tag=tag;
+    entry->body_offset=entry->header_offset+hlen;
+
+    if(type == OPS_LENGTH_INDETERMINATE)
+	{
+	// runs to the end of the file
+	if(size < 0)
+	    {
+	    OPS_ERROR(errors,OPS_E_R_UNSUPPORTED,
+		      "Indeterminate length packet in a file of unknown size");
+	    return ops_false;
+	    }
+	entry->length=size-entry->body_offset;
+	*next=size;
+	return ops_true;
+	}
+
+    entry->length=blen;
+    pos=entry->body_offset+blen;
+    while(type == OPS_LENGTH_PARTIAL)
+	{
+	entry->partial=ops_true;
+	if(!scan_length(scan,pos,ops_true,&tag,&hlen,&blen,&type,errors))
+	    return ops_false;
+	entry->length+=blen;
+	pos+=hlen+blen;
+	}
+
+    *next=pos;
+    return ops_true;
+    }
+
+/**
+   \ingroup Core_ReadPackets
+   \brief Creates an empty packet index
+   \return New index
+   \sa ops_packet_index_build(), ops_packet_index_read()
+*/
+ops_packet_index_t *ops_packet_index_new(void)
+    { return ops_mallocz(sizeof(ops_packet_index_t)); }
+
+/**
+   \ingroup Core_ReadPackets
+   \brief Frees a packet index
+   \param index Index to free
+*/
+void ops_packet_index_free(ops_packet_index_t *index)
+    {
+    free(index->entries);
+    free(index);
+    }
+
+/**
+   \ingroup Core_ReadPackets
+   \brief Indexes the top-level packets in a file, without parsing them
+
+   The packets from the fd's current position to the end of the file
+   are found by reading their headers alone, seeking past each body, or
+   each partial chunk of it. Their tags, offsets and lengths are added
+   to index. Nothing inside a packet, such as the packets in a
+   compressed or encrypted one, is indexed.
+
+   To parse one of the packets, seek to its header_offset and parse
+   from there.
+
+   \param index Index to add the packets to
+   \param fd File to index; it must be seekable
+   \param errors Where to put any errors
+   \return ops_true if the whole file was indexed; ops_false on error,
+   in which case the packets before the error are in index
+   \note The fd is left at an unspecified position.
+
+   Example code:
+   \code
+   ops_packet_index_t *index=ops_packet_index_new();
+   ops_error_t *errors=NULL;
+   unsigned n;
+
+   if(ops_packet_index_build(index,fd,&errors))
+       for(n=0 ; n < ops_packet_index_count(index) ; ++n)
+           {
+           const ops_packet_index_entry_t *entry=ops_packet_index_get(index,n);
+
+           if(entry->tag == OPS_PTAG_CT_LITERAL_DATA)
+               ...
+           }
+   ops_print_errors(errors);
+   ops_free_errors(errors);
+   ops_packet_index_free(index);
+   \endcode
+*/
+ops_boolean_t ops_packet_index_build(ops_packet_index_t *index,int fd,
+				     ops_error_t **errors)
+    {
+    header_scan_t *scan=ops_mallocz(sizeof *scan);
+    struct stat st;
+    off_t size=-1;
+    off_t pos;
+    ops_boolean_t ok=ops_true;
+
+    scan->fd=fd;
+    if(fstat(fd,&st) == 0 && S_ISREG(st.st_mode))
+	size=st.st_size;
+
+    pos=lseek(fd,0,SEEK_CUR);
+    if(pos == (off_t)-1)
+	{
+	OPS_SYSTEM_ERROR_1(errors,OPS_E_R_READ_FAILED,"lseek","%s",
+			   "Can't index a file that can't be seeked");
+	free(scan);
+	return ops_false;
+	}
+
+    for( ; ; )
+	{
+	ops_packet_index_entry_t entry;
+	const unsigned char *p;
+	int r;
+
+	if((r=scan_get(scan,pos,1,&p,errors)) <= 0)
+	    {
+	    ok=r == 0;
+	    break;
+	    }
+	if(!(p[0]&OPS_PTAG_ALWAYS_SET))
+	    {
+	    OPS_ERROR_1(errors,OPS_E_R_BAD_FORMAT,
+			"Not a packet tag at offset %lu",(unsigned long)pos);
+	    ok=ops_false;
+	    break;
+	    }
+
+	memset(&entry,'\0',sizeof entry);
+	entry.header_offset=pos;
+	ok=index_packet(&entry,size,scan,&pos,errors);
+	if(!ok)
+	    break;
+
+	if(size >= 0 && pos > size)
+	    {
+	    OPS_ERROR_1(errors,OPS_E_R_EARLY_EOF,
+			"Packet at offset %lu runs past the end of the file",
+			(unsigned long)entry.header_offset);
+	    ok=ops_false;
+	    break;
+	    }
+
+	EXPAND_ARRAY(index,entries);
+	index->entries[index->nentries++]=entry;
+	}
+
+    free(scan);
+    return ok;
+    }
+
+/**
+   \ingroup Core_ReadPackets
+   \brief Returns the number of packets in an index
+   \param index Index
+   \return Number of entries
+*/
+unsigned ops_packet_index_count(const ops_packet_index_t *index)
+    { return index->nentries; }
+
+/**
+   \ingroup Core_ReadPackets
+   \brief Returns one packet's entry in an index
+   \param index Index
+   \param n Which entry, counting from 0 in file order
+   \return The entry, or NULL if there are no more than n
+   \note This is not a copy, do not free it.
+*/
+const ops_packet_index_entry_t *
+ops_packet_index_get(const ops_packet_index_t *index,unsigned n)
+    { return n < index->nentries ? &index->entries[n] : NULL; }
+
+static ops_boolean_t write_offset(off_t offset,ops_create_info_t *cinfo)
+    {
+    unsigned long long n=offset;
+
+    return ops_write_scalar((unsigned)(n >> 32),4,cinfo)
+	&& ops_write_scalar((unsigned)(n&0xffffffff),4,cinfo);
+    }
+
+static off_t read_offset(const unsigned char *p)
+    {
+    unsigned long long n=0;
+    unsigned i;
+
+    for(i=0 ; i < 8 ; ++i)
+	n=(n << 8)|p[i];
+    return (off_t)n;
+    }
+
+/**
+   \ingroup Core_ReadPackets
+   \brief Writes out an index, so that it can be read back later
+   \param index Index to write
+   \param cinfo Where to write it
+   \return ops_true if OK; else ops_false
+   \sa ops_packet_index_read()
+*/
+ops_boolean_t ops_packet_index_write(const ops_packet_index_t *index,
+				     ops_create_info_t *cinfo)
+    {
+    unsigned n;
+
+    if(!ops_write(MAGIC,MAGIC_SIZE,cinfo))
+	return ops_false;
+
+    for(n=0 ; n < index->nentries ; ++n)
+	{
+	const ops_packet_index_entry_t *entry=&index->entries[n];
+
+	if(!ops_write_scalar(entry->tag,1,cinfo)
+	   || !ops_write_scalar(entry->partial ? RECORD_PARTIAL : 0,1,cinfo)
+	   || !write_offset(entry->header_offset,cinfo)
+	   || !write_offset(entry->body_offset,cinfo)
+	   || !write_offset(entry->length,cinfo))
+	    return ops_false;
+	}
+
+    return ops_true;
+    }
+
+/**
+   \ingroup Core_ReadPackets
+   \brief Reads an index written by ops_packet_index_write()
+   \param index Index to add the entries to
+   \param data The written index
+   \param length Its length
+   \return ops_true if OK; ops_false if data isn't a whole index, in
+   which case index is unchanged
+*/
+ops_boolean_t ops_packet_index_read(ops_packet_index_t *index,
+				    const unsigned char *data,size_t length)
+    {
+    size_t pos;
+
+    if(length < MAGIC_SIZE || memcmp(data,MAGIC,MAGIC_SIZE)
+       || (length-MAGIC_SIZE)%RECORD_SIZE)
+	return ops_false;
+
+    for(pos=MAGIC_SIZE ; pos < length ; pos+=RECORD_SIZE)
+	{
+	const unsigned char *record=&data[pos];
+	ops_packet_index_entry_t *entry;
+
+	EXPAND_ARRAY(index,entries);
+	entry=&index->entries[index->nentries++];
+	entry->tag=record[0];
+	entry->partial=(record[1]&RECORD_PARTIAL) != 0;
+	entry->header_offset=read_offset(&record[2]);
+	entry->body_offset=read_offset(&record[10]);
+	entry->length=read_offset(&record[18]);
+	}
+
+    return ops_true;
+    }
@@ -179,15 +179,63 @@ void ops_init_subregion(ops_region_t *subregion,ops_region_t *region)
  * \sa #ops_reader_ret_t for details of return codes
  */
 
+// Accumulate and count n bytes read by rinfo
+static void account_read(ops_reader_info_t *rinfo,const void *data,size_t n)
+    {
+    if(rinfo->accumulate)
+	{
+	assert(rinfo->asize >= rinfo->alength);
+	if(rinfo->alength+n > rinfo->asize)
+	    {
+	    rinfo->asize=rinfo->asize*2+n;
+	    rinfo->accumulated=realloc(rinfo->accumulated,rinfo->asize);
+	    }
+	assert(rinfo->asize >= rinfo->alength+n);
+	memcpy(rinfo->accumulated+rinfo->alength,data,n);
+	}
+    // we track length anyway, because it is used for packet offsets
+    rinfo->alength+=n;
+    // and also the position
+    rinfo->position+=n;
+    }
+
+/*
+ * If the reader's data is in memory, take the next length bytes
+ * straight from there, as sub_base_read() would have read them, and
+ * return a pointer to them. Returns NULL if the reader isn't one of
+ * those, or it has fewer than length bytes left, in which case the
+ * caller reads the usual way.
+ */
+static const unsigned char *direct_read(size_t length,
+					ops_reader_info_t *rinfo)
+    {
+    const unsigned char *p=rinfo->direct;
+
+    if(!p || !length || length > (size_t)(rinfo->direct_end-p))
+	return NULL;
+
+    rinfo->direct+=length;
+    account_read(rinfo,p,length);
+
+    return p;
+    }
+
 static int sub_base_read(void *dest,size_t length,ops_error_t **errors,
 			 ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
     {
+    const unsigned char *p;
     size_t n;
 
     /* reading more than this would look like an error */
     if(length > INT_MAX)
 	length=INT_MAX;
 
+    if((p=direct_read(length,rinfo)))
+	{
+	memcpy(dest,p,length);
+	return length;
+	}
+
     for(n=0 ; n < length ; )
 	{
 	int r=rinfo->reader((char*)dest+n,length-n,errors,rinfo,cbinfo);
@@ -207,21 +255,7 @@ static int sub_base_read(void *dest,size_t length,ops_error_t **errors,
     if(n == 0)
 	return 0;
 
-    if(rinfo->accumulate)
-	{
-	assert(rinfo->asize >= rinfo->alength);
-	if(rinfo->alength+n > rinfo->asize)
-	    {
-	    rinfo->asize=rinfo->asize*2+n;
-	    rinfo->accumulated=realloc(rinfo->accumulated,rinfo->asize);
-	    }
-	assert(rinfo->asize >= rinfo->alength+n);
-	memcpy(rinfo->accumulated+rinfo->alength,dest,n);
-	}
-    // we track length anyway, because it is used for packet offsets
-    rinfo->alength+=n;
-    // and also the position
-    rinfo->position+=n;
+    account_read(rinfo,dest,n);
 
     return n;
     }
@@ -284,9 +318,18 @@ static ops_boolean_t _read_scalar(unsigned *result,unsigned length,
 				    ops_parse_info_t *pinfo)
     {
     unsigned t=0;
+    const unsigned char *p;
 
     assert (length <= sizeof(*result));
 
+    if((p=direct_read(length,&pinfo->rinfo)))
+	{
+	while(length--)
+	    t=(t << 8)+*p++;
+	*result=t;
+	return ops_true;
+	}
+
     while(length--)
 	{
 	unsigned char c[1];
@@ -302,6 +345,18 @@ static ops_boolean_t _read_scalar(unsigned *result,unsigned length,
     return ops_true;
     }
 
+// Count r bytes just read as read from region and those containing it
+static void region_add_read(ops_region_t *region,size_t r)
+    {
+    region->last_read=r;
+    do
+	{
+	region->length_read+=r;
+	assert(!region->parent || region->length <= region->parent->length);
+	}
+    while((region=region->parent));
+    }
+
 /** 
  * \ingroup Core_ReadPackets
  * \brief Read bytes from a region within the packet.
@@ -356,13 +411,7 @@ ops_boolean_t ops_limited_read(unsigned char *dest,size_t length,
 	return ops_false;
 	}
 
-    region->last_read=r;
-    do
-	{
-	region->length_read+=r;
-	assert(!region->parent || region->length <= region->parent->length);
-	}
-    while((region=region->parent));
+    region_add_read(region,r);
 
     return ops_true;
     }
@@ -387,6 +436,29 @@ static ops_boolean_t limited_read(unsigned char *dest,unsigned length,
 			    &info->rinfo,&info->cbinfo);
     }
 
+/*
+ * As limited_read(), but returns a pointer to the bytes read, or NULL
+ * on error. When the reader's data is in memory, that points straight
+ * into it, and nothing is copied; otherwise the bytes are read into
+ * buf, which must have room for them.
+ */
+static const unsigned char *limited_read_ptr(unsigned char *buf,
+					     unsigned length,
+					     ops_region_t *region,
+					     ops_parse_info_t *pinfo)
+    {
+    const unsigned char *p;
+
+    if((region->indeterminate || region->length_read+length <= region->length)
+       && (p=direct_read(length,&pinfo->rinfo)))
+	{
+	region_add_read(region,length);
+	return p;
+	}
+
+    return limited_read(buf,length,region,pinfo) ? buf : NULL;
+    }
+
 static ops_boolean_t exact_limited_read(unsigned char *dest,unsigned length,
 					ops_region_t *region,
 					ops_parse_info_t *pinfo)
@@ -418,8 +490,10 @@ static int limited_skip(unsigned length,ops_region_t *region,
 
     while(length)
 	{
-	int n=length%8192;
-	if(!limited_read(buf,n,region,pinfo))
+	unsigned n=length > sizeof buf ? sizeof buf : length;
+
+	// nothing is copied if the data is in memory
+	if(!limited_read_ptr(buf,n,region,pinfo))
 	    return 0;
 	length-=n;
 	}
@@ -446,13 +520,14 @@ static int limited_read_scalar(unsigned *dest,unsigned length,
 			       ops_region_t *region,
 			       ops_parse_info_t *pinfo)
     {
-    unsigned char c[4]="";
+    unsigned char buf[4];
+    const unsigned char *c;
     unsigned t;
     unsigned n;
 
     assert(length <= 4);
     assert(sizeof(*dest) >= 4);
-    if(!limited_read(c,length,region,pinfo))
+    if(!(c=limited_read_ptr(buf,length,region,pinfo)))
 	return 0;
 
     for(t=0,n=0 ; n < length ; ++n)
@@ -530,13 +605,13 @@ static int limited_read_time(time_t *dest,ops_region_t *region,
         {
         time_t mytime=0;
         int i=0;
-        unsigned char c[1];
+        unsigned char buf[4];
+        const unsigned char *c;
+
+        if (!(c=limited_read_ptr(buf,4,region,pinfo)))
+            return 0;
         for (i=0; i<4; i++)
-            {
-            if (!limited_read(c,1,region,pinfo))
-                return 0;
-            mytime=(mytime << 8) + c[0];
-            }
+            mytime=(mytime << 8) + c[i];
         *dest=mytime;
         return 1;
         }
@@ -571,10 +646,12 @@ static int limited_read_mpi(BIGNUM **pbn,ops_region_t *region,
     {
     unsigned length;
     unsigned nonzero;
-    unsigned char buf[8192]=""; /* an MPI has a 2 byte length part.  Length
+    unsigned char buf[8192]; /* an MPI has a 2 byte length part.  Length
                                 is given in bits, so the largest we should
                                 ever need for the buffer is 8192 bytes. */
+    const unsigned char *p;
     ops_boolean_t ret;
+    BIGNUM *bn=NULL;
 
     pinfo->reading_mpi_length=ops_true;
     ret=limited_read_scalar(&length,2,region,pinfo);
@@ -589,16 +666,170 @@ static int limited_read_mpi(BIGNUM **pbn,ops_region_t *region,
     length=(length+7)/8;
 
     assert(length <= 8192);
-    if(!limited_read(buf,length,region,pinfo))
+    if(!(p=limited_read_ptr(buf,length,region,pinfo)))
 	return 0;
 
-    if((buf[0] >> nonzero) != 0 || !(buf[0]&(1 << (nonzero-1))))
+    if((p[0] >> nonzero) != 0 || !(p[0]&(1 << (nonzero-1))))
 	{
 	OPS_ERROR(&pinfo->errors,OPS_E_P_MPI_FORMAT_ERROR,"MPI Format error");  /* XXX: Ben, one part of this constraint does not apply to encrypted MPIs the draft says. -- peter */
 	return 0;
 	}
 
-    *pbn=BN_bin2bn(buf,length,NULL);
+    if(pinfo->nspare_mpis)
+	bn=pinfo->spare_mpis[--pinfo->nspare_mpis];
+    if(!(*pbn=BN_bin2bn(p,length,bn)))
+	{
+	BN_free(bn);
+	OPS_ERROR(&pinfo->errors,OPS_E_FAIL,"Out of memory reading MPI");
+	return 0;
+	}
+    return 1;
+    }
+
+static void spare_mpi(ops_parse_info_t *pinfo,BIGNUM **pbn)
+    {
+    if(*pbn && pinfo->nspare_mpis < OPS_SPARE_MPIS)
+	{
+	pinfo->spare_mpis[pinfo->nspare_mpis++]=*pbn;
+	*pbn=NULL;
+	}
+    }
+
+/*
+ * Hand a signature to the callback. If the callback releases it, its
+ * MPIs are kept for the next signature to read into, rather than being
+ * freed only for the same sizes to be allocated again.
+ */
+static void signature_cb(ops_content_tag_t tag,ops_parser_content_t *content,
+			 ops_parse_info_t *pinfo)
+    {
+    ops_signature_t *sig=&content->content.signature;
+
+    content->tag=tag;
+    if(ops_parse_cb(content,&pinfo->cbinfo) != OPS_RELEASE_MEMORY)
+	return;
+
+    switch(sig->info.key_algorithm)
+	{
+    case OPS_PKA_RSA:
+    case OPS_PKA_RSA_SIGN_ONLY:
+	spare_mpi(pinfo,&sig->info.signature.rsa.sig);
+	break;
+
+    case OPS_PKA_DSA:
+	spare_mpi(pinfo,&sig->info.signature.dsa.r);
+	spare_mpi(pinfo,&sig->info.signature.dsa.s);
+	break;
+
+    case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
+	spare_mpi(pinfo,&sig->info.signature.elgamal.r);
+	spare_mpi(pinfo,&sig->info.signature.elgamal.s);
+	break;
+
+    default:
+	break;
+	}
+    ops_parser_content_free(content);
+    }
+
+/*
+ * Decode the new format length at p, which has left bytes: that of a
+ * packet, or of a partial chunk of one. Returns 1 with *hlen set to the
+ * number of bytes it takes, *blen to the length and *type to whether it
+ * is partial, or 0 if more than left bytes are needed, with *hlen set
+ * to how many.
+ *
+ * \see RFC4880 4.2.2
+ */
+int ops_decode_new_length(const unsigned char *p,size_t left,size_t *hlen,
+			  size_t *blen,ops_length_type_t *type)
+    {
+    *hlen=1;
+    if(left < 1)
+	return 0;
+
+    *type=OPS_LENGTH_FIXED;
+    if(p[0] < 192)
+	*blen=p[0];
+    else if(p[0] < 224)
+	{
+	*hlen=2;
+	if(left < *hlen)
+	    return 0;
+	*blen=((p[0]-192) << 8)+p[1]+192;
+	}
+    else if(p[0] == 255)
+	{
+	*hlen=5;
+	if(left < *hlen)
+	    return 0;
+	*blen=((size_t)p[1] << 24)|(p[2] << 16)|(p[3] << 8)|p[4];
+	}
+    else
+	{
+	*blen=(size_t)1 << (p[0]&0x1f);
+	*type=OPS_LENGTH_PARTIAL;
+	}
+    return 1;
+    }
+
+/*
+ * Decode the packet header at p, which has left bytes, without reading
+ * the packet. Returns 1 with *tag set to the packet's tag, *hlen to the
+ * length of the header, and *blen and *type to the length of the body,
+ * or of its first chunk, as ops_decode_new_length() sets them; 0 if
+ * more than left bytes are needed, with *hlen set to how many; or -1 if
+ * p doesn't start with a packet tag. *tag is set whenever there is a
+ * tag to read it from. An indeterminate length is given as 0.
+ *
+ * \see RFC4880 4.2
+ */
+int ops_decode_packet_header(const unsigned char *p,size_t left,
+			     unsigned *tag,size_t *hlen,size_t *blen,
+			     ops_length_type_t *type)
+    {
+    unsigned n;
+    int r;
+
+    *hlen=1;
+    if(left < 1)
+	return 0;
+    if(!(p[0]&OPS_PTAG_ALWAYS_SET))
+	return -1;
+
+    if(p[0]&OPS_PTAG_NEW_FORMAT)
+	{
+	*tag=p[0]&OPS_PTAG_NF_CONTENT_TAG_MASK;
+	r=ops_decode_new_length(p+1,left-1,hlen,blen,type);
+	++*hlen;
+	return r;
+	}
+
+    *tag=(p[0]&OPS_PTAG_OF_CONTENT_TAG_MASK) >> OPS_PTAG_OF_CONTENT_TAG_SHIFT;
+    switch(p[0]&OPS_PTAG_OF_LENGTH_TYPE_MASK)
+	{
+    case OPS_PTAG_OF_LT_ONE_BYTE:
+	*hlen=2;
+	break;
+
+    case OPS_PTAG_OF_LT_TWO_BYTE:
+	*hlen=3;
+	break;
+
+    case OPS_PTAG_OF_LT_FOUR_BYTE:
+	*hlen=5;
+	break;
+
+    default:
+	*blen=0;
+	*type=OPS_LENGTH_INDETERMINATE;
+	return 1;
+	}
+    if(left < *hlen)
+	return 0;
+    for(*blen=0,n=1 ; n < *hlen ; ++n)
+	*blen=(*blen << 8)|p[n];
+    *type=OPS_LENGTH_FIXED;
     return 1;
     }
 
@@ -787,6 +1018,7 @@ void ops_parser_content_free(ops_parser_content_t *c)
     case OPS_PTAG_SS_REVOCATION_KEY:
     case OPS_PTAG_CT_LITERAL_DATA_HEADER:
     case OPS_PTAG_CT_LITERAL_DATA_BODY:
+    case OPS_PTAG_CT_LITERAL_DATA_SLICE:
     case OPS_PTAG_CT_SIGNED_CLEARTEXT_BODY:
     case OPS_PTAG_CT_UNARMOURED_TEXT:
     case OPS_PTAG_CT_ARMOUR_TRAILER:
@@ -969,6 +1201,9 @@ void ops_pk_session_key_free(ops_pk_session_key_t *sk)
 /*! Free the memory used when parsing a public key */
 void ops_public_key_free(ops_public_key_t *p)
     {
+    free(p->serialised);
+    p->serialised=NULL;
+
     switch(p->algorithm)
 	{
     case OPS_PKA_RSA:
@@ -997,16 +1232,17 @@ void ops_public_key_free(ops_public_key_t *p)
 	}
     }
 
-/**
-   \ingroup Core_ReadPackets
-*/
-static int parse_public_key_data(ops_public_key_t *key,ops_region_t *region,
-				 ops_parse_info_t *pinfo)
+// Read the public parameters of a key, for parse_public_key_data()
+static int read_public_key_data(ops_public_key_t *key,ops_region_t *region,
+				ops_parse_info_t *pinfo)
     {
     unsigned char c[1]="";
 
     assert (region->length_read == 0);  /* We should not have read anything so far */
 
+    key->serialised=NULL;
+    key->serialised_length=0;
+
     if(!limited_read(c,1,region,pinfo))
 	return 0;
     key->version=c[0];
@@ -1064,6 +1300,55 @@ static int parse_public_key_data(ops_public_key_t *key,ops_region_t *region,
     return 1;
     }
 
+/**
+   \ingroup Core_ReadPackets
+
+   The key will be hashed at least once, for its key ID, so the bytes
+   it was read from are kept as its serialised form, as
+   ops_public_key_serialise() would make it. Like parse_v4_signature(),
+   this accumulates them itself if the caller isn't.
+*/
+static int parse_public_key_data(ops_public_key_t *key,ops_region_t *region,
+				 ops_parse_info_t *pinfo)
+    {
+    ops_reader_info_t *rinfo=&pinfo->rinfo;
+    ops_boolean_t accumulating=rinfo->accumulate;
+    unsigned alength=rinfo->alength;
+    unsigned start;
+    size_t l;
+    int ok;
+
+    if(!accumulating)
+	{
+	rinfo->alength=0;
+	rinfo->accumulate=ops_true;
+	}
+    start=rinfo->alength;
+
+    ok=read_public_key_data(key,region,pinfo);
+    l=rinfo->alength-start;
+    if(ok)
+	{
+	key->serialised=malloc(3+l);
+	key->serialised[0]=0x99;
+	key->serialised[1]=l >> 8;
+	key->serialised[2]=l;
+	memcpy(key->serialised+3,rinfo->accumulated+start,l);
+	key->serialised_length=3+l;
+	}
+
+    if(!accumulating)
+	{
+	free(rinfo->accumulated);
+	rinfo->accumulated=NULL;
+	rinfo->asize=0;
+	rinfo->accumulate=ops_false;
+	rinfo->alength+=alength;
+	}
+
+    return ok;
+    }
+
 
 /**
  * \ingroup Core_ReadPackets
@@ -1270,6 +1555,20 @@ void ops_signature_free(ops_signature_t *sig)
     free(sig->info.v4_hashed_data);
     }
 
+static ops_hash_t *claim_hash(ops_parse_info_t *pinfo,
+			      const unsigned char keyid[OPS_KEY_ID_SIZE],
+			      ops_boolean_t match_algorithm,
+			      ops_hash_algorithm_t algorithm);
+
+// The hash started by the one-pass signature that matches sig, if
+// there is one that hasn't already been claimed
+static ops_hash_t *find_signature_hash(ops_parse_info_t *pinfo,
+				       const ops_signature_t *sig)
+    {
+    return claim_hash(pinfo,sig->info.signer_id,ops_true,
+		      sig->info.hash_algorithm);
+    }
+
 /**
  * \ingroup Core_Parse
  * \brief Parse a version 3 signature.
@@ -1362,13 +1661,53 @@ static int parse_v3_signature(ops_region_t *region,
         }
 
     if(C.signature.info.signer_id_set)
-	C.signature.hash=ops_parse_hash_find(pinfo,C.signature.info.signer_id);
+	C.signature.hash=find_signature_hash(pinfo,&C.signature);
 
-    CBP(pinfo,OPS_PTAG_CT_SIGNATURE,&content);
+    signature_cb(OPS_PTAG_CT_SIGNATURE,&content,pinfo);
 
     return 1;
     }
 
+/*
+ * The keys only version of parse_one_signature_subpacket(): take the
+ * issuer, creation time and key flags into sig, and skip everything
+ * else, without calling back.
+ */
+static int scan_signature_subpacket(ops_signature_t *sig,
+				    ops_content_tag_t tag,
+				    ops_region_t *subregion,
+				    ops_parse_info_t *pinfo)
+    {
+    switch(tag)
+	{
+    case OPS_PTAG_SS_CREATION_TIME:
+	if(!limited_read_time(&sig->info.creation_time,subregion,pinfo))
+	    return 0;
+	sig->info.creation_time_set=ops_true;
+	break;
+
+    case OPS_PTAG_SS_ISSUER_KEY_ID:
+	if(!limited_read(sig->info.signer_id,OPS_KEY_ID_SIZE,subregion,pinfo))
+	    return 0;
+	sig->info.signer_id_set=ops_true;
+	break;
+
+    case OPS_PTAG_SS_KEY_FLAGS:
+	if(subregion->length_read == subregion->length)
+	    break;
+	if(!limited_read(&sig->info.key_flags,1,subregion,pinfo))
+	    return 0;
+	sig->info.key_flags_set=ops_true;
+	break;
+
+    default:
+	break;
+	}
+
+    return limited_skip(subregion->length-subregion->length_read,subregion,
+			pinfo);
+    }
+
 /**
  * \ingroup Core_ReadPackets
  * \brief Parse one signature sub-packet.
@@ -1414,6 +1753,9 @@ static int parse_one_signature_subpacket(ops_signature_t *sig,
     content.critical=c[0] >> 7;
     content.tag=OPS_PTAG_SIGNATURE_SUBPACKET_BASE+(c[0]&0x7f);
 
+    if(pinfo->keys_only)
+	return scan_signature_subpacket(sig,content.tag,&subregion,pinfo);
+
     /* Application wants it delivered raw */
     if(pinfo->ss_raw[t8]&t7)
 	{
@@ -1484,6 +1826,11 @@ static int parse_one_signature_subpacket(ops_signature_t *sig,
     case OPS_PTAG_SS_KEY_FLAGS:
 	if(!read_data(&C.ss_key_flags.data,&subregion,pinfo))
 	    return 0;
+	if(C.ss_key_flags.data.len)
+	    {
+	    sig->info.key_flags=C.ss_key_flags.data.contents[0];
+	    sig->info.key_flags_set=ops_true;
+	    }
 	break;
 
     case OPS_PTAG_SS_KEY_SERVER_PREFS:
@@ -1728,6 +2075,21 @@ static int parse_signature_subpackets(ops_signature_t *sig,
     return 1;
     }
 
+// Whether parse_v4_signature() can read a signature made with alg
+static ops_boolean_t signature_algorithm_known(ops_public_key_algorithm_t alg)
+    {
+    switch(alg)
+	{
+    case OPS_PKA_RSA:
+    case OPS_PKA_DSA:
+    case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
+	return ops_true;
+
+    default:
+	return alg >= OPS_PKA_PRIVATE00 && alg <= OPS_PKA_PRIVATE10;
+	}
+    }
+
 /** 
  * \ingroup Core_ReadPackets
  * \brief Parse a version 4 signature.
@@ -1787,27 +2149,72 @@ static int parse_v4_signature(ops_region_t *region,ops_parse_info_t *pinfo)
 
     CBP(pinfo,OPS_PTAG_CT_SIGNATURE_HEADER,&content);
 
-    if(!parse_signature_subpackets(&C.signature,region,pinfo))
-	return 0;
+    if(pinfo->keys_only)
+	{
+	// nothing beyond what the subpackets give is wanted, and the
+	// raw packet is there for anything that wants the rest
+	if(!signature_algorithm_known(C.signature.info.key_algorithm))
+	    {
+	    OPS_ERROR_1(&pinfo->errors,OPS_E_ALG_UNSUPPORTED_SIGNATURE_ALG,
+			"Bad v4 signature key algorithm (%s)",
+			ops_show_pka(C.signature.info.key_algorithm));
+	    return 0;
+	    }
+	if(!parse_signature_subpackets(&C.signature,region,pinfo)
+	   || !parse_signature_subpackets(&C.signature,region,pinfo)
+	   || !limited_skip(region->length-region->length_read,region,pinfo))
+	    return 0;
 
-    C.signature.info.v4_hashed_data_length=pinfo->rinfo.alength
-        -C.signature.v4_hashed_data_start;
+	CBP(pinfo,OPS_PTAG_CT_SIGNATURE_FOOTER,&content);
+	return 1;
+	}
 
-    // copy hashed subpackets
-    if (C.signature.info.v4_hashed_data)
-        free(C.signature.info.v4_hashed_data);
-    C.signature.info.v4_hashed_data=ops_mallocz(C.signature.info.v4_hashed_data_length);
+    if(pinfo->rinfo.accumulate)
+	{
+	if(!parse_signature_subpackets(&C.signature,region,pinfo))
+	    return 0;
 
-    if (!pinfo->rinfo.accumulate)
-        {
-        /* We must accumulate, else we can't check the signature */
-        fprintf(stderr,"*** ERROR: must set accumulate to true\n");
-        assert(0);
-        }
+	C.signature.info.v4_hashed_data_length=pinfo->rinfo.alength
+	    -C.signature.v4_hashed_data_start;
 
-    memcpy(C.signature.info.v4_hashed_data,
-           pinfo->rinfo.accumulated+C.signature.v4_hashed_data_start,
-           C.signature.info.v4_hashed_data_length);
+	// copy hashed subpackets
+	C.signature.info.v4_hashed_data=ops_mallocz(C.signature.info.v4_hashed_data_length);
+	memcpy(C.signature.info.v4_hashed_data,
+	       pinfo->rinfo.accumulated+C.signature.v4_hashed_data_start,
+	       C.signature.info.v4_hashed_data_length);
+	}
+    else
+	{
+	/* Accumulate just the hashed subpackets, so a caller that isn't
+	   accumulating packets can still check the signature */
+	unsigned alength=pinfo->rinfo.alength;
+	int ok;
+
+	pinfo->rinfo.alength=0;
+	pinfo->rinfo.accumulate=ops_true;
+	ok=parse_signature_subpackets(&C.signature,region,pinfo);
+
+	C.signature.info.v4_hashed_data_length=4+pinfo->rinfo.alength;
+	C.signature.info.v4_hashed_data=ops_mallocz(C.signature.info.v4_hashed_data_length);
+	C.signature.info.v4_hashed_data[0]=OPS_V4;
+	C.signature.info.v4_hashed_data[1]=C.signature.info.type;
+	C.signature.info.v4_hashed_data[2]=C.signature.info.key_algorithm;
+	C.signature.info.v4_hashed_data[3]=C.signature.info.hash_algorithm;
+	if(pinfo->rinfo.alength)
+	    memcpy(C.signature.info.v4_hashed_data+4,pinfo->rinfo.accumulated,
+		   pinfo->rinfo.alength);
+
+	free(pinfo->rinfo.accumulated);
+	pinfo->rinfo.accumulated=NULL;
+	pinfo->rinfo.asize=0;
+	pinfo->rinfo.accumulate=ops_false;
+	pinfo->rinfo.alength+=alength;
+	// there is no raw packet for the hashed data to be found in
+	C.signature.v4_hashed_data_start=0;
+
+	if(!ok)
+	    return 0;
+	}
 
     if(!parse_signature_subpackets(&C.signature,region,pinfo))
 	return 0;
@@ -1865,7 +2272,10 @@ static int parse_v4_signature(ops_region_t *region,ops_parse_info_t *pinfo)
         return 0;
         }
 
-    CBP(pinfo,OPS_PTAG_CT_SIGNATURE_FOOTER,&content);
+    if(C.signature.info.signer_id_set)
+	C.signature.hash=find_signature_hash(pinfo,&C.signature);
+
+    signature_cb(OPS_PTAG_CT_SIGNATURE_FOOTER,&content,pinfo);
 
     return 1;
     }
@@ -2043,6 +2453,17 @@ parse_trust (ops_region_t *region, ops_parse_info_t *pinfo)
     return 1;
     }
 
+/*
+ * The buffer bodies are delivered in, allocated the first time one
+ * needs it, and kept until the parse_info is deleted.
+ */
+static unsigned char *body_buffer(ops_parse_info_t *pinfo)
+    {
+    if(!pinfo->body)
+	pinfo->body=malloc(pinfo->body_size);
+    return pinfo->body;
+    }
+
 /**
    \ingroup Core_ReadPackets
    \brief Parse a Literal Data packet
@@ -2051,6 +2472,7 @@ static int parse_literal_data(ops_region_t *region,ops_parse_info_t *pinfo)
     {
     ops_parser_content_t content;
     unsigned char c[1]="";
+    unsigned char *buf;
 
     if(!limited_read(c,1,region,pinfo))
 	return 0;
@@ -2068,16 +2490,42 @@ static int parse_literal_data(ops_region_t *region,ops_parse_info_t *pinfo)
 
     CBP(pinfo,OPS_PTAG_CT_LITERAL_DATA_HEADER,&content);
 
+    buf=body_buffer(pinfo);
+
+    while(pinfo->borrow_bodies && region->length_read < region->length)
+	{
+	unsigned l=region->length-region->length_read;
+	unsigned max=pinfo->body_size;
+	const unsigned char *p;
+
+	// as much as the reader holds in memory, or else a buffer's worth
+	if(pinfo->rinfo.direct && pinfo->rinfo.direct < pinfo->rinfo.direct_end)
+	    max=pinfo->rinfo.direct_end-pinfo->rinfo.direct;
+	if(l > max)
+	    l=max;
+
+	if(!(p=limited_read_ptr(buf,l,region,pinfo)))
+	    return 0;
+
+	C.literal_data_slice.ptr=p;
+	C.literal_data_slice.len=l;
+
+	ops_parse_hash_data(pinfo,p,l);
+
+	CBP(pinfo,OPS_PTAG_CT_LITERAL_DATA_SLICE,&content);
+	}
+
     while(region->length_read < region->length)
 	{
 	unsigned l=region->length-region->length_read;
 
-	if(l > sizeof C.literal_data_body.data)
-	    l=sizeof C.literal_data_body.data;
+	if(l > pinfo->body_size)
+	    l=pinfo->body_size;
 
-	if(!limited_read(C.literal_data_body.data,l,region,pinfo))
+	if(!limited_read(buf,l,region,pinfo))
 	    return 0;
 
+	C.literal_data_body.data=buf;
 	C.literal_data_body.length=l;
 
 	ops_parse_hash_data(pinfo,C.literal_data_body.data,l);
@@ -2682,9 +3130,10 @@ int ops_decrypt_se_data(ops_content_tag_t tag,ops_region_t *region,
 	    {
 	    unsigned l=region->length-region->length_read;
 
-	    if(l > sizeof C.se_data_body.data)
-		l=sizeof C.se_data_body.data;
+	    if(l > pinfo->body_size)
+		l=pinfo->body_size;
 
+	    C.se_data_body.data=body_buffer(pinfo);
 	    if(!limited_read(C.se_data_body.data,l,region,pinfo))
 		return 0;
 
@@ -2722,9 +3171,10 @@ int ops_decrypt_se_ip_data(ops_content_tag_t tag,ops_region_t *region,
             {
             unsigned l=region->length-region->length_read;
             
-            if(l > sizeof C.se_data_body.data)
-                l=sizeof C.se_data_body.data;
+            if(l > pinfo->body_size)
+                l=pinfo->body_size;
             
+            C.se_data_body.data=body_buffer(pinfo);
             if(!limited_read(C.se_data_body.data,l,region,pinfo))
                 return 0;
             
@@ -3056,6 +3506,77 @@ int ops_parse_and_print_errors(ops_parse_info_t *pinfo)
     return pinfo->errors ? 0 : 1;
     }
 
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Specifies whether Literal Data bodies are borrowed or copied
+ *
+ * By default the body of a Literal Data packet is copied, up to the
+ * size set by ops_parse_set_body_size() at a time, into the
+ * ops_literal_data_body_t of an
+ * OPS_PTAG_CT_LITERAL_DATA_BODY. A callback that sets borrow gets
+ * OPS_PTAG_CT_LITERAL_DATA_SLICE instead, whose
+ * ops_literal_data_slice_t points at the body. When the parser is
+ * reading straight from memory, see ops_reader_set_memory(), that is
+ * in the input itself, and each slice is as much of the body as the
+ * input holds; otherwise it is a buffer the body was read into.
+ *
+ * \param pinfo Parse settings
+ * \param borrow ops_true to have bodies borrowed
+ * \note A slice is only valid until the callback returns.
+ */
+void ops_parse_borrow_bodies(ops_parse_info_t *pinfo,ops_boolean_t borrow)
+    { pinfo->borrow_bodies=borrow; }
+
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Sets how much of a body is delivered in each callback
+ *
+ * The bodies of Literal Data and Symmetrically Encrypted Data packets
+ * are passed to the callback up to size bytes at a time, as are the
+ * bodies of cleartext signed messages by the dearmouring reader. The
+ * default is OPS_DEFAULT_BODY_SIZE; a larger size, such as a megabyte
+ * when decrypting big files, means fewer callbacks, hash updates and
+ * writes, at the cost of a buffer that size. Bodies borrowed from
+ * memory, see ops_parse_borrow_bodies(), are not limited by it.
+ *
+ * \param pinfo Parse settings
+ * \param size Bytes per body callback; must not be 0
+ * \note Call this before parsing starts.
+ */
+void ops_parse_set_body_size(ops_parse_info_t *pinfo,size_t size)
+    {
+    assert(size > 0);
+    free(pinfo->body);
+    pinfo->body=NULL;
+    pinfo->body_size=size;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Specifies whether signatures are only scanned
+ *
+ * Reading a keyring needs little from its signatures beyond the raw
+ * packets. When keys_only is set, a version 4 signature's subpackets
+ * are skipped, except that the issuer key ID, creation time and first
+ * octet of the key flags are put in the ops_signature_info_t of the
+ * OPS_PTAG_CT_SIGNATURE_FOOTER, and its signature MPIs and hashed data
+ * are not read. No subpacket is passed to the callback, whatever
+ * ops_parse_options() says, and no error is given for subpackets that
+ * aren't understood.
+ *
+ * A signature can be fully decoded later, when it is wanted, by parsing
+ * its raw packet again without this set, as ops_validate_key_signatures()
+ * does.
+ *
+ * \param pinfo Parse settings
+ * \param keys_only ops_true to only scan signatures
+ */
+void ops_parse_keys_only(ops_parse_info_t *pinfo,ops_boolean_t keys_only)
+    { pinfo->keys_only=keys_only; }
+
 /**
  * \ingroup Core_ReadPackets
  *
@@ -3105,13 +3626,33 @@ void ops_parse_options(ops_parse_info_t *pinfo,
 	}
     }
 
+// Finish the one-pass hashes, keeping the arrays for the next ones
+static void hashes_clear(ops_parse_info_t *pinfo)
+    {
+    unsigned char out[OPS_MAX_HASH_SIZE];
+    size_t n;
+
+    for(n=0 ; n < pinfo->nhashes ; ++n)
+	if(pinfo->hashes[n].hash.data)
+	    pinfo->hashes[n].hash.finish(&pinfo->hashes[n].hash,out);
+    for(n=0 ; n < pinfo->ndigests ; ++n)
+	pinfo->digests[n].hash.finish(&pinfo->digests[n].hash,out);
+    pinfo->nhashes=0;
+    pinfo->ndigests=0;
+    }
+
 /**
 \ingroup Core_ReadPackets
 \brief Creates a new zero-ed ops_parse_info_t struct
 \sa ops_parse_info_delete()
 */
 ops_parse_info_t *ops_parse_info_new(void)
-    { return ops_mallocz(sizeof(ops_parse_info_t)); }
+    {
+    ops_parse_info_t *pinfo=ops_mallocz(sizeof *pinfo);
+
+    pinfo->body_size=OPS_DEFAULT_BODY_SIZE;
+    return pinfo;
+    }
 
 /**
 \ingroup Core_ReadPackets
@@ -3132,9 +3673,84 @@ void ops_parse_info_delete(ops_parse_info_t *pinfo)
     ops_free_errors(pinfo->errors);
     if(pinfo->rinfo.accumulated)
         free(pinfo->rinfo.accumulated);
+    ops_parse_hash_finish(pinfo);
+    free(pinfo->body);
+    while(pinfo->nspare_mpis)
+	BN_free(pinfo->spare_mpis[--pinfo->nspare_mpis]);
+    while(pinfo->spare_rinfo)
+	{
+	ops_reader_info_t *rinfo=pinfo->spare_rinfo;
+
+	pinfo->spare_rinfo=rinfo->next;
+	free(rinfo);
+	}
+    for(cbinfo=pinfo->spare_cbinfo ; cbinfo ; cbinfo=next)
+	{
+	next=cbinfo->next;
+	free(cbinfo);
+	}
     free(pinfo);
     }
 
+/**
+\ingroup Core_ReadPackets
+\brief Returns an ops_parse_info_t struct to how ops_parse_info_new() left it
+\param pinfo Parse settings
+
+Every reader on the stack is destroyed, the callbacks, errors and
+options are cleared and any one-pass hashes are finished. What was
+allocated along the way is kept for the next parse: the stack nodes,
+the hash arrays, the body buffer and spare signature MPIs. A caller
+parsing many small messages can reset one ops_parse_info_t between them
+rather than creating a new one for each.
+
+\sa ops_parse_info_delete()
+*/
+void ops_parse_info_reset(ops_parse_info_t *pinfo)
+    {
+    ops_parse_cb_info_t *cbinfo,*next;
+    unsigned char *accumulated;
+    unsigned asize;
+
+    for( ; ; )
+	{
+	if(pinfo->rinfo.destroyer)
+	    pinfo->rinfo.destroyer(&pinfo->rinfo);
+	if(!pinfo->rinfo.next)
+	    break;
+	ops_reader_pop(pinfo);
+	}
+    accumulated=pinfo->rinfo.accumulated;
+    asize=pinfo->rinfo.asize;
+    memset(&pinfo->rinfo,'\0',sizeof pinfo->rinfo);
+    pinfo->rinfo.accumulated=accumulated;
+    pinfo->rinfo.asize=asize;
+
+    for(cbinfo=pinfo->cbinfo.next ; cbinfo ; cbinfo=next)
+	{
+	next=cbinfo->next;
+	cbinfo->next=pinfo->spare_cbinfo;
+	pinfo->spare_cbinfo=cbinfo;
+	}
+    memset(&pinfo->cbinfo,'\0',sizeof pinfo->cbinfo);
+
+    ops_free_errors(pinfo->errors);
+    pinfo->errors=NULL;
+    memset(&pinfo->decrypt,'\0',sizeof pinfo->decrypt);
+    memset(&pinfo->cryptinfo,'\0',sizeof pinfo->cryptinfo);
+    hashes_clear(pinfo);
+
+    memset(pinfo->ss_raw,'\0',sizeof pinfo->ss_raw);
+    memset(pinfo->ss_parsed,'\0',sizeof pinfo->ss_parsed);
+    pinfo->reading_v3_secret=ops_false;
+    pinfo->reading_mpi_length=ops_false;
+    pinfo->exact_read=ops_false;
+    pinfo->borrow_bodies=ops_false;
+    pinfo->keys_only=ops_false;
+    if(pinfo->body_size != OPS_DEFAULT_BODY_SIZE)
+	ops_parse_set_body_size(pinfo,OPS_DEFAULT_BODY_SIZE);
+    }
+
 /**
 \ingroup Core_ReadPackets
 \brief Returns the parse_info's reader_info
@@ -3164,7 +3780,12 @@ void ops_parse_cb_set(ops_parse_info_t *pinfo,ops_parse_cb_t *cb,void *arg)
 */
 void ops_parse_cb_push(ops_parse_info_t *pinfo,ops_parse_cb_t *cb,void *arg)
     {
-    ops_parse_cb_info_t *cbinfo=malloc(sizeof *cbinfo);
+    ops_parse_cb_info_t *cbinfo=pinfo->spare_cbinfo;
+
+    if(cbinfo)
+	pinfo->spare_cbinfo=cbinfo->next;
+    else
+	cbinfo=malloc(sizeof *cbinfo);
 
     *cbinfo=pinfo->cbinfo;
     pinfo->cbinfo.next=cbinfo;
@@ -3223,41 +3844,156 @@ ops_crypt_t *ops_parse_get_decrypt(ops_parse_info_t *pinfo)
     return NULL;
     }
 
-// XXX: this could be improved by sharing all hashes that are the
-// same, then duping them just before checking the signature.
+/**
+   \ingroup Core_ReadPackets
+   \brief Starts hashing the data that follows, for a one-pass signature
+   \param pinfo Parse settings
+   \param type The hash algorithm
+   \param keyid The signer's key ID
+
+   However many signatures ask for the same algorithm before the data
+   starts, the data is only hashed once with it. A signature that comes
+   after the data has started, such as the next of several messages read
+   in one parse, gets a hash of its own.
+*/
 void ops_parse_hash_init(ops_parse_info_t *pinfo,ops_hash_algorithm_t type,
 			 const unsigned char *keyid)
     {
     ops_parse_hash_info_t *hash;
+    ops_parse_digest_t *digest;
+    size_t n;
 
-    pinfo->hashes=realloc(pinfo->hashes,
-			  (pinfo->nhashes+1)*sizeof *pinfo->hashes);
+    if(pinfo->nhashes == pinfo->hashes_size)
+	{
+	pinfo->hashes_size=pinfo->hashes_size*2+1;
+	pinfo->hashes=realloc(pinfo->hashes,
+			      pinfo->hashes_size*sizeof *pinfo->hashes);
+	}
     hash=&pinfo->hashes[pinfo->nhashes++];
-
-    ops_hash_any(&hash->hash,type);
-    hash->hash.init(&hash->hash);
+    memset(hash,'\0',sizeof *hash);
+    hash->algorithm=type;
     memcpy(hash->keyid,keyid,sizeof hash->keyid);
+
+    for(n=0 ; n < pinfo->ndigests ; ++n)
+	if(pinfo->digests[n].hash.algorithm == type
+	   && !pinfo->digests[n].started)
+	    {
+	    hash->digest=n;
+	    ++pinfo->digests[n].waiting;
+	    return;
+	    }
+
+    if(pinfo->ndigests == pinfo->digests_size)
+	{
+	pinfo->digests_size=pinfo->digests_size*2+1;
+	pinfo->digests=realloc(pinfo->digests,
+			       pinfo->digests_size*sizeof *pinfo->digests);
+	}
+    hash->digest=pinfo->ndigests;
+    digest=&pinfo->digests[pinfo->ndigests++];
+    ops_hash_any(&digest->hash,type);
+    digest->hash.init(&digest->hash);
+    digest->waiting=1;
+    digest->started=ops_false;
     }
 
+/**
+   \ingroup Core_ReadPackets
+   \brief Adds data to every hash started by ops_parse_hash_init()
+   \param pinfo Parse settings
+   \param data The data
+   \param length Its length
+
+   With more than one algorithm, the data is taken a block at a time,
+   each block going through every algorithm while it is still in cache.
+*/
 void ops_parse_hash_data(ops_parse_info_t *pinfo,const void *data,
 			 size_t length)
     {
+    const unsigned char *p=data;
     size_t n;
 
-    for(n=0 ; n < pinfo->nhashes ; ++n)
-	pinfo->hashes[n].hash.add(&pinfo->hashes[n].hash,data,length);
+    if(length == 0)
+	return;
+    for(n=0 ; n < pinfo->ndigests ; ++n)
+	pinfo->digests[n].started=ops_true;
+    if(pinfo->ndigests == 1)
+	{
+	if(pinfo->digests[0].waiting)
+	    pinfo->digests[0].hash.add(&pinfo->digests[0].hash,p,length);
+	return;
+	}
+
+    while(length)
+	{
+	size_t l=length < OPS_HASH_BLOCK_SIZE ? length : OPS_HASH_BLOCK_SIZE;
+
+	// a hash all of whose signatures have arrived needs no more data
+	for(n=0 ; n < pinfo->ndigests ; ++n)
+	    if(pinfo->digests[n].waiting)
+		pinfo->digests[n].hash.add(&pinfo->digests[n].hash,p,l);
+	p+=l;
+	length-=l;
+	}
     }
 
-ops_hash_t *ops_parse_hash_find(ops_parse_info_t *pinfo,
-				const unsigned char keyid[OPS_KEY_ID_SIZE])
+/**
+   \ingroup Core_ReadPackets
+   \brief Frees the hashes started by one-pass signatures
+   \param pinfo Parse settings
+*/
+void ops_parse_hash_finish(ops_parse_info_t *pinfo)
+    {
+    hashes_clear(pinfo);
+    free(pinfo->hashes);
+    pinfo->hashes=NULL;
+    pinfo->hashes_size=0;
+    free(pinfo->digests);
+    pinfo->digests=NULL;
+    pinfo->digests_size=0;
+    }
+
+// Give the first unclaimed one-pass hash for keyid (and, if
+// match_algorithm, of the given algorithm) its own copy of the data
+// hashed so far
+static ops_hash_t *claim_hash(ops_parse_info_t *pinfo,
+			      const unsigned char keyid[OPS_KEY_ID_SIZE],
+			      ops_boolean_t match_algorithm,
+			      ops_hash_algorithm_t algorithm)
     {
     size_t n;
 
     for(n=0 ; n < pinfo->nhashes ; ++n)
-	if(!memcmp(pinfo->hashes[n].keyid,keyid,OPS_KEY_ID_SIZE))
-	    return &pinfo->hashes[n].hash;
+	{
+	ops_parse_hash_info_t *hash=&pinfo->hashes[n];
+	ops_parse_digest_t *digest;
+
+	if(hash->claimed
+	   || (match_algorithm && hash->algorithm != algorithm)
+	   || memcmp(hash->keyid,keyid,OPS_KEY_ID_SIZE))
+	    continue;
+
+	digest=&pinfo->digests[hash->digest];
+	ops_hash_dup(&hash->hash,&digest->hash);
+	hash->claimed=ops_true;
+	--digest->waiting;
+	digest->started=ops_true;
+	return &hash->hash;
+	}
     return NULL;
     }
 
+/**
+   \ingroup Core_ReadPackets
+   \brief Claims the hash started by a one-pass signature
+   \param pinfo Parse settings
+   \param keyid The signer's key ID
+   \return A hash of the data so far, which the caller should finish,
+   or NULL if there is no unclaimed hash for keyid
+*/
+ops_hash_t *ops_parse_hash_find(ops_parse_info_t *pinfo,
+				const unsigned char keyid[OPS_KEY_ID_SIZE])
+    { return claim_hash(pinfo,keyid,ops_false,OPS_HASH_UNKNOWN); }
+
 /* vim:set textwidth=120: */
 /* vim:set ts=8: */
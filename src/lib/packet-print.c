@@ -72,16 +72,25 @@ static void showtime_short(time_t t);
 void 
 ops_print_public_keydata(const ops_keydata_t *key)
     {
+    const ops_public_key_t* pkey=ops_get_public_key_from_data(key);
+
     printf("pub ");
 
-    ops_show_pka(key->key.pkey.algorithm);
-    printf(" ");
+    // a compact key whose packet can't be decoded has only its key ID
+    if (pkey)
+	{
+	ops_show_pka(pkey->algorithm);
+	printf(" ");
+	}
 
     hexdump(key->key_id, OPS_KEY_ID_SIZE);
     printf(" ");
 
-    print_time_short(key->key.pkey.creation_time);
-    printf(" ");
+    if (pkey)
+	{
+	print_time_short(pkey->creation_time);
+	printf(" ");
+	}
 
     if (key->nuids==1)
 	{
@@ -157,9 +166,10 @@ ops_print_public_key(const ops_public_key_t *pkey)
 void 
 ops_print_public_keydata_verbose(const ops_keydata_t *key)
     {
-    const ops_public_key_t* pkey=&key->key.pkey;
+    const ops_public_key_t* pkey=ops_get_public_key_from_data(key);
 
-    ops_print_public_key(pkey);
+    if (pkey)
+	ops_print_public_key(pkey);
     }
 
 /**
@@ -1058,6 +1068,16 @@ int ops_print_packet(const ops_parser_content_t *content_)
 	printf("\n");
 	break;
 
+    case OPS_PTAG_CT_LITERAL_DATA_SLICE:
+	print_tagname("LITERAL DATA SLICE");
+	printf("  literal data slice length=%u\n",
+	       (unsigned)content->literal_data_slice.len);
+	printf("    data=");
+	print_escaped(content->literal_data_slice.ptr,
+		      content->literal_data_slice.len);
+	printf("\n");
+	break;
+
     case OPS_PTAG_CT_SIGNATURE_HEADER:
 	print_tagname("SIGNATURE");
 	print_indent();
@@ -1637,6 +1657,16 @@ static ops_parse_cb_return_t cb_list_packets(const ops_parser_content_t * conten
 	printf("\n");
 	break;
 
+    case OPS_PTAG_CT_LITERAL_DATA_SLICE:
+	print_tagname("LITERAL DATA SLICE");
+	printf("  literal data slice length=%u\n",
+	       (unsigned)content->literal_data_slice.len);
+	printf("    data=");
+	print_escaped(content->literal_data_slice.ptr,
+		      content->literal_data_slice.len);
+	printf("\n");
+	break;
+
     case OPS_PTAG_CT_SIGNATURE_HEADER:
 	print_tagname("SIGNATURE");
 	print_indent();
@@ -108,6 +108,7 @@ static ops_map_t packet_tag_map[] =
     { OPS_PTAG_CT_SE_IP_DATA_HEADER,	"CT: Sym Encrypted IP Data Header" },
     { OPS_PTAG_CT_SE_IP_DATA_BODY,	"CT: Sym Encrypted IP Data Body" },
     { OPS_PTAG_CT_ENCRYPTED_PK_SESSION_KEY, "CT: Encrypted PK Session Key" },
+    { OPS_PTAG_CT_LITERAL_DATA_SLICE,	"CT: Literal Data Slice" },
     { OPS_PARSER_CMD_GET_SK_PASSPHRASE,	"CMD: Get Secret Key Passphrase" },
     { OPS_PARSER_CMD_GET_SECRET_KEY, 	"CMD: Get Secret Key" },
     { OPS_PARSER_ERROR,			"OPS_PARSER_ERROR" },
@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** \file
+ * \brief Parsing a buffer of independent packets on several threads.
+ *
+ * The buffer is cut into spans of whole top-level packets by walking
+ * their headers. Worker threads parse the spans, each with a
+ * parse_info of its own, and record the content they produce instead
+ * of handing it over. The calling thread hands each span's content to
+ * the callback in turn, so it arrives in the order of the packets,
+ * just as ops_parse() would deliver it. No more than a window of spans
+ * is parsed ahead of the callback.
+ */
+
+#include <openpgpsdk/parse-parallel.h>
+#include <openpgpsdk/readerwriter.h>
+#include <openpgpsdk/util.h>
+#include "parse_local.h"
+#include "keyring_local.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include <openpgpsdk/final.h>
+
+#ifdef HAVE_PTHREAD_H
+# define LOCK(p)	pthread_mutex_lock(&(p)->lock)
+# define UNLOCK(p)	pthread_mutex_unlock(&(p)->lock)
+#else
+# define LOCK(p)
+# define UNLOCK(p)
+#endif
+
+// How many spans may be parsed ahead of the callback, per worker
+#define SPANS_PER_WORKER	4
+
+// Content recorded by a worker, for the callback
+typedef struct
+    {
+    ops_parser_content_t content;
+    unsigned char *copy;	/*!< a body the parser only lent, copied */
+    } event_t;
+
+typedef struct
+    {
+    const unsigned char *start;
+    size_t length;
+    DECLARE_ARRAY(event_t,events);
+    ops_error_t *errors;
+    ops_boolean_t done;		/*!< parsed, and not yet delivered */
+    } span_t;
+
+typedef struct
+    {
+    ops_parse_info_t *pinfo;	/*!< the caller's, for options and the
+				  callback */
+    const unsigned char *buffer;
+    size_t length;
+    size_t span_size;		/*!< roughly how long a span is */
+    size_t cursor;		/*!< where the next span starts */
+    unsigned next;		/*!< number of the next span */
+    unsigned delivered;		/*!< spans handed to the callback */
+    unsigned window;
+    span_t *spans;		/*!< span n is spans[n%window] */
+    ops_boolean_t stopping;	/*!< an error was delivered */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;	/*!< protects all of the above but the
+				  spans being parsed */
+    pthread_cond_t parsed;	/*!< signalled when a span is parsed */
+    pthread_cond_t freed;	/*!< signalled when a span is delivered */
+#endif
+    } parallel_t;
+
+/*
+ * The length of the packet at p, which has left bytes, header and all,
+ * or 0 if its headers don't tell: it runs to the end of the input, or
+ * past it, or p isn't a packet at all.
+ */
+static size_t packet_size(const unsigned char *p,size_t left)
+    {
+    unsigned tag;
+    size_t hlen;
+    size_t blen;
+    ops_length_type_t type;
+    size_t pos;
+
+    if(ops_decode_packet_header(p,left,&tag,&hlen,&blen,&type) <= 0
+       || type == OPS_LENGTH_INDETERMINATE)
+	return 0;
+    // each partial chunk has another length after it
+    for(pos=hlen+blen ; type == OPS_LENGTH_PARTIAL ; pos+=hlen+blen)
+	if(pos > left
+	   || !ops_decode_new_length(p+pos,left-pos,&hlen,&blen,&type))
+	    return 0;
+    return pos <= left ? pos : 0;
+    }
+
+/*
+ * Take the next span, waiting, if wait is set, for the window to have
+ * room for it. Returns NULL when there is nothing more to take.
+ */
+static span_t *claim_span(parallel_t *par,ops_boolean_t wait)
+    {
+    span_t *span;
+    size_t end;
+
+    LOCK(par);
+    while(!par->stopping && par->cursor < par->length
+	  && par->next >= par->delivered+par->window)
+	{
+#ifdef HAVE_PTHREAD_H
+	if(wait)
+	    {
+	    pthread_cond_wait(&par->freed,&par->lock);
+	    continue;
+	    }
+#endif
+	UNLOCK(par);
+	return NULL;
+	}
+    if(par->stopping || par->cursor >= par->length)
+	{
+	UNLOCK(par);
+	return NULL;
+	}
+
+    // Whole packets, until there are enough of them. One whose size
+    // can't be told takes the rest, for the parser to deal with.
+    for(end=par->cursor ; end < par->length
+	    && end-par->cursor < par->span_size ; )
+	{
+	size_t size=packet_size(par->buffer+end,par->length-end);
+
+	if(!size)
+	    {
+	    end=par->length;
+	    break;
+	    }
+	end+=size;
+	}
+
+    span=&par->spans[par->next++%par->window];
+    span->start=par->buffer+par->cursor;
+    span->length=end-par->cursor;
+    span->nevents=0;
+    span->errors=NULL;
+    span->done=ops_false;
+    par->cursor=end;
+    UNLOCK(par);
+
+    return span;
+    }
+
+static ops_parse_cb_return_t
+record_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo)
+    {
+    span_t *span=ops_parse_cb_get_arg(cbinfo);
+    event_t *event;
+    unsigned char **data=NULL;
+    unsigned length=0;
+
+    switch(content_->tag)
+	{
+    case OPS_PARSER_CMD_GET_SK_PASSPHRASE:
+    case OPS_PARSER_CMD_GET_SECRET_KEY:
+	// These want an answer now, which the callback can't give yet
+	return OPS_RELEASE_MEMORY;
+
+    default:
+	break;
+	}
+
+    EXPAND_ARRAY(span,events);
+    event=&span->events[span->nevents++];
+    event->content=*content_;
+    event->copy=NULL;
+
+    switch(content_->tag)
+	{
+    case OPS_PTAG_CT_LITERAL_DATA_BODY:
+	data=&event->content.content.literal_data_body.data;
+	length=event->content.content.literal_data_body.length;
+	break;
+
+    case OPS_PTAG_CT_SE_DATA_BODY:
+	data=&event->content.content.se_data_body.data;
+	length=event->content.content.se_data_body.length;
+	break;
+
+    case OPS_PTAG_CT_SE_IP_DATA_BODY:
+	data=&event->content.content.se_ip_data_body.data;
+	length=event->content.content.se_ip_data_body.length;
+	break;
+
+    default:
+	break;
+	}
+    if(data)
+	{
+	// the parser's buffer is reused for the next body
+	event->copy=malloc(length ? length : 1);
+	memcpy(event->copy,*data,length);
+	*data=event->copy;
+	}
+
+    return OPS_KEEP_MEMORY;
+    }
+
+static void parse_span(parallel_t *par,ops_parse_info_t *pinfo,span_t *span)
+    {
+    ops_reader_set_memory(pinfo,span->start,span->length);
+    pinfo->rinfo.position=span->start-par->buffer;
+    ops_parse_cb_set(pinfo,record_cb,span);
+    ops_parse(pinfo);
+
+    span->errors=pinfo->errors;
+    pinfo->errors=NULL;
+    ops_parse_hash_finish(pinfo);
+    }
+
+// A parse_info with the caller's options
+static ops_parse_info_t *worker_pinfo(const parallel_t *par)
+    {
+    ops_parse_info_t *pinfo=ops_parse_info_new();
+
+    memcpy(pinfo->ss_raw,par->pinfo->ss_raw,sizeof pinfo->ss_raw);
+    memcpy(pinfo->ss_parsed,par->pinfo->ss_parsed,sizeof pinfo->ss_parsed);
+    pinfo->keys_only=par->pinfo->keys_only;
+    pinfo->rinfo.accumulate=par->pinfo->rinfo.accumulate;
+    if(par->pinfo->body_size != pinfo->body_size)
+	ops_parse_set_body_size(pinfo,par->pinfo->body_size);
+    return pinfo;
+    }
+
+#ifdef HAVE_PTHREAD_H
+static void *parse_spans(void *arg)
+    {
+    parallel_t *par=arg;
+    ops_parse_info_t *pinfo=worker_pinfo(par);
+    span_t *span;
+
+    while((span=claim_span(par,ops_true)))
+	{
+	parse_span(par,pinfo,span);
+	LOCK(par);
+	span->done=ops_true;
+	pthread_cond_broadcast(&par->parsed);
+	UNLOCK(par);
+	}
+
+    ops_parse_info_delete(pinfo);
+    return NULL;
+    }
+#endif
+
+/*
+ * Wait for span n to be parsed, parsing it here if there are no
+ * workers. Returns NULL if there is no span n.
+ */
+static span_t *wait_for_span(parallel_t *par,unsigned n,
+			     ops_parse_info_t *pinfo)
+    {
+    span_t *span;
+
+    LOCK(par);
+    for( ; ; )
+	{
+	if(n < par->next)
+	    {
+	    span=&par->spans[n%par->window];
+	    if(span->done)
+		break;
+	    }
+	else if(par->stopping || par->cursor >= par->length)
+	    {
+	    span=NULL;
+	    break;
+	    }
+	if(pinfo)
+	    {
+	    UNLOCK(par);
+	    span=claim_span(par,ops_false);
+	    parse_span(par,pinfo,span);
+	    span->done=ops_true;
+	    return span;
+	    }
+#ifdef HAVE_PTHREAD_H
+	pthread_cond_wait(&par->parsed,&par->lock);
+#endif
+	}
+    UNLOCK(par);
+
+    return span;
+    }
+
+// Hand a span's content to the callback, or just free it once stopping
+static void deliver(parallel_t *par,span_t *span)
+    {
+    ops_error_t *last;
+    ops_boolean_t failed=span->errors != NULL;
+    unsigned n;
+
+    for(n=0 ; n < span->nevents ; ++n)
+	{
+	event_t *event=&span->events[n];
+
+	if(par->stopping
+	   || ops_parse_cb(&event->content,&par->pinfo->cbinfo)
+	   == OPS_RELEASE_MEMORY)
+	    ops_parser_content_free(&event->content);
+	free(event->copy);
+	}
+    span->nevents=0;
+
+    // The span's errors go on top, as later errors would
+    if(par->stopping)
+	ops_free_errors(span->errors);
+    else if(span->errors)
+	{
+	for(last=span->errors ; last->next ; last=last->next)
+	    ;
+	last->next=par->pinfo->errors;
+	par->pinfo->errors=span->errors;
+	}
+    span->errors=NULL;
+
+    LOCK(par);
+    // ops_parse() goes no further than an error
+    if(failed)
+	par->stopping=ops_true;
+    span->done=ops_false;
+    ++par->delivered;
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_broadcast(&par->freed);
+#endif
+    UNLOCK(par);
+    }
+
+/**
+   \ingroup Core_ReadPackets
+   \brief Parses packets in memory on several threads
+   \param pinfo Parse settings, giving the callback and options
+   \param buffer The packets
+   \param length Their length
+   \param nthreads Number of threads to parse with, or 0 for one per CPU
+   \param span_size Roughly how many bytes of packets a thread takes at
+   a time, or 0 for OPS_PARALLEL_SPAN_SIZE
+   \return 1 on success in all packets, 0 on error in any packet, as
+   for ops_parse()
+
+   The callback is called on this thread, in the order of the packets,
+   with the content ops_parse() would give it. The work of parsing,
+   such as reading MPIs and decoding subpackets, is shared among the
+   other threads. The signature subpacket options, ops_parse_keys_only(),
+   ops_parse_set_body_size() and accumulation are taken from pinfo.
+
+   \note Packets are parsed apart from those before them, so this is
+   for streams of packets that stand alone, such as keyrings or runs
+   of signatures. A message that needs a secret key or passphrase, or
+   whose signatures hash earlier packets, must be parsed with
+   ops_parse(); the callback is never asked for either. Literal data
+   bodies are copied, never borrowed.
+*/
+int ops_parse_parallel(ops_parse_info_t *pinfo,const void *buffer,
+		       size_t length,unsigned nthreads,size_t span_size)
+    {
+    parallel_t par;
+    ops_parse_info_t *local=NULL;
+    unsigned nstarted=0;
+    span_t *span;
+    unsigned n;
+#ifdef HAVE_PTHREAD_H
+    pthread_t *threads;
+#endif
+
+    if(!nthreads)
+	nthreads=ops_default_nthreads();
+
+    memset(&par,'\0',sizeof par);
+    par.pinfo=pinfo;
+    par.buffer=buffer;
+    par.length=length;
+    par.span_size=span_size ? span_size : OPS_PARALLEL_SPAN_SIZE;
+    par.window=nthreads*SPANS_PER_WORKER;
+    par.spans=ops_mallocz(par.window*sizeof *par.spans);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&par.lock,NULL);
+    pthread_cond_init(&par.parsed,NULL);
+    pthread_cond_init(&par.freed,NULL);
+    threads=malloc(nthreads*sizeof *threads);
+    if(nthreads > 1)
+	for( ; nstarted < nthreads ; ++nstarted)
+	    if(pthread_create(&threads[nstarted],NULL,parse_spans,&par))
+		break;
+#endif
+    // Without workers, this thread parses each span as it comes to it
+    if(!nstarted)
+	local=worker_pinfo(&par);
+
+    for(n=0 ; (span=wait_for_span(&par,n,local)) ; ++n)
+	deliver(&par,span);
+
+#ifdef HAVE_PTHREAD_H
+    LOCK(&par);
+    par.stopping=ops_true;
+    pthread_cond_broadcast(&par.freed);
+    UNLOCK(&par);
+    while(nstarted)
+	pthread_join(threads[--nstarted],NULL);
+    free(threads);
+#endif
+
+    // Anything parsed past an error is never delivered
+    for( ; n < par.next ; ++n)
+	deliver(&par,&par.spans[n%par.window]);
+
+    for(n=0 ; n < par.window ; ++n)
+	free(par.spans[n].events);
+    free(par.spans);
+    if(local)
+	ops_parse_info_delete(local);
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_destroy(&par.freed);
+    pthread_cond_destroy(&par.parsed);
+    pthread_mutex_destroy(&par.lock);
+#endif
+
+    return pinfo->errors ? 0 : 1;
+    }
@@ -38,6 +38,10 @@ struct ops_reader_info
     unsigned alength;	/*!< used buffer */
     /* XXX: what do we do about offsets into compressed packets? */
     unsigned position; /*!< the offset from the beginning (with this reader) */
+    const unsigned char *direct; /*!< if set, the reader's unread data is
+				   here, up to direct_end, and the parser
+				   may take it without calling the reader */
+    const unsigned char *direct_end;
 
     ops_reader_info_t *next;
     ops_parse_info_t *pinfo; /*!< A pointer back to the parent parse_info structure */
@@ -68,13 +72,39 @@ struct ops_parse_cb_info
     ops_crypt_info_t cryptinfo; /*!< used when decrypting */
     };
 
-/** ops_parse_hash_info_t */
+/** When data goes through several hash algorithms, it is fed to them
+ * this much at a time, so each piece is still in cache for the next one */
+#define OPS_HASH_BLOCK_SIZE	8192
+
+/** ops_parse_hash_info_t
+ * The hash a one-pass signature asked for. The data is hashed once per
+ * algorithm, in ops_parse_info_t's digests, and copied out into hash
+ * when the signature arrives.
+ */
 typedef struct
     {
-    ops_hash_t hash; /*!< hashes we should hash data with */
+    ops_hash_t hash; /*!< the signature's own copy, once claimed */
+    ops_hash_algorithm_t algorithm;
     unsigned char keyid[OPS_KEY_ID_SIZE];
+    size_t digest; /*!< which of the digests it shares */
+    ops_boolean_t claimed;
     } ops_parse_hash_info_t;
 
+/** ops_parse_digest_t
+ * A running hash shared by the one-pass signatures that were all waiting
+ * before any of the data came.
+ */
+typedef struct
+    {
+    ops_hash_t hash;
+    unsigned waiting; /*!< how many of its signatures are unclaimed */
+    ops_boolean_t started; /*!< data has been hashed or claimed */
+    } ops_parse_digest_t;
+
+/** How many released signature MPIs a parse keeps for reuse. A DSA
+ * signature has two, so this covers a couple of signatures in a row. */
+#define OPS_SPARE_MPIS	4
+
 #define NTAGS	0x100
 /** \brief Structure to hold information about a packet parse.
  *
@@ -111,8 +141,38 @@ struct ops_parse_info
     ops_crypt_t decrypt;
     ops_crypt_info_t cryptinfo;
     size_t nhashes;
+    size_t hashes_size; /*!< room in hashes */
     ops_parse_hash_info_t *hashes;
+    size_t ndigests;
+    size_t digests_size; /*!< room in digests */
+    ops_parse_digest_t *digests; /*!< the running hashes in hashes */
     ops_boolean_t reading_v3_secret:1;
     ops_boolean_t reading_mpi_length:1;
     ops_boolean_t exact_read:1;
+    ops_boolean_t borrow_bodies:1; /*!< see ops_parse_borrow_bodies() */
+    ops_boolean_t keys_only:1; /*!< see ops_parse_keys_only() */
+    size_t body_size; /*!< see ops_parse_set_body_size() */
+    unsigned char *body; /*!< body_size bytes, once a body needs it */
+    BIGNUM *spare_mpis[OPS_SPARE_MPIS]; /*!< from released signatures, for
+					 limited_read_mpi() to read into */
+    unsigned nspare_mpis;
+    ops_reader_info_t *spare_rinfo; /*!< popped reader nodes, linked by
+				     next, for ops_reader_push() to reuse */
+    ops_parse_cb_info_t *spare_cbinfo; /*!< likewise for callbacks */
     };
+
+/** How a packet header gives the length of the body that follows it */
+typedef enum
+    {
+    OPS_LENGTH_FIXED,		/*!< the body is the length given */
+    OPS_LENGTH_PARTIAL,		/*!< a partial chunk of the body is, and
+				  another length follows it */
+    OPS_LENGTH_INDETERMINATE,	/*!< the body runs to the end of the
+				  input */
+    } ops_length_type_t;
+
+int ops_decode_packet_header(const unsigned char *p,size_t left,
+			     unsigned *tag,size_t *hlen,size_t *blen,
+			     ops_length_type_t *type);
+int ops_decode_new_length(const unsigned char *p,size_t left,size_t *hlen,
+			  size_t *blen,ops_length_type_t *type);
@@ -0,0 +1,591 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/** \file
+ * \brief Reading and writing files on their own threads.
+ *
+ * A pipelined file has a ring of large buffers between the thread that
+ * does the I/O and the thread that does the work. Reading, the I/O
+ * thread fills buffers ahead of the work; writing, it drains them
+ * behind it. When the ring is full (or empty) one side waits for the
+ * other, so no more than the ring is ever held in memory.
+ */
+
+#include <openpgpsdk/pipeline.h>
+#include <openpgpsdk/util.h>
+#include <openpgpsdk/errors.h>
+#include <openpgpsdk/writer.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include <openpgpsdk/final.h>
+
+#ifdef HAVE_PTHREAD_H
+# define LOCK(r)	pthread_mutex_lock(&(r)->lock)
+# define UNLOCK(r)	pthread_mutex_unlock(&(r)->lock)
+#else
+# define LOCK(r)
+# define UNLOCK(r)
+#endif
+
+/* The ring */
+
+typedef struct
+    {
+    unsigned char *data;
+    size_t length;
+    } block_t;
+
+typedef struct
+    {
+    block_t *blocks;
+    unsigned nblocks;
+    size_t block_size;
+    unsigned head;		/*!< the next block to be filled */
+    unsigned tail;		/*!< the next block to be drained */
+    unsigned count;		/*!< blocks filled and not yet drained */
+    ops_boolean_t done;		/*!< nothing more will be filled */
+    ops_boolean_t stopping;	/*!< the I/O thread should give up */
+    int sys_errno;		/*!< why the I/O thread failed, if it did */
+    int fd;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;	/*!< protects all of the above but the
+				  contents of blocks */
+    pthread_cond_t filled;	/*!< signalled when a block is filled */
+    pthread_cond_t drained;	/*!< signalled when a block is drained */
+    pthread_t thread;
+    ops_boolean_t threaded;	/*!< thread was started */
+#endif
+    } ring_t;
+
+static void ring_init(ring_t *ring,int fd,unsigned nblocks,size_t block_size)
+    {
+    unsigned n;
+
+    memset(ring,'\0',sizeof *ring);
+    ring->fd=fd;
+    ring->nblocks=nblocks;
+    ring->block_size=block_size;
+    ring->blocks=ops_mallocz(nblocks*sizeof *ring->blocks);
+    for(n=0 ; n < nblocks ; ++n)
+	ring->blocks[n].data=malloc(block_size);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&ring->lock,NULL);
+    pthread_cond_init(&ring->filled,NULL);
+    pthread_cond_init(&ring->drained,NULL);
+#endif
+    }
+
+static void ring_free(ring_t *ring)
+    {
+    unsigned n;
+
+    for(n=0 ; n < ring->nblocks ; ++n)
+	free(ring->blocks[n].data);
+    free(ring->blocks);
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_destroy(&ring->drained);
+    pthread_cond_destroy(&ring->filled);
+    pthread_mutex_destroy(&ring->lock);
+#endif
+    }
+
+#ifdef HAVE_PTHREAD_H
+static void ring_start(ring_t *ring,void *(*fn)(void *))
+    { ring->threaded=!pthread_create(&ring->thread,NULL,fn,ring); }
+#endif
+
+// Read as much of block's size as there is, returning the amount read,
+// 0 at EOF or -1 on error, with *sys_errno set to why
+static int read_block(const ring_t *ring,block_t *block,int *sys_errno)
+    {
+    int n;
+
+    do
+	n=read(ring->fd,block->data,ring->block_size);
+    while(n < 0 && errno == EINTR);
+    if(n < 0)
+	*sys_errno=errno;
+    block->length=n < 0 ? 0 : n;
+    return n;
+    }
+
+/* Reading ahead */
+
+struct ops_prefetch
+    {
+    ring_t ring;
+    ops_boolean_t holding;	/*!< the consumer has the tail block */
+    };
+
+#ifdef HAVE_PTHREAD_H
+static void *prefetch_thread(void *ring_)
+    {
+    ring_t *ring=ring_;
+
+    LOCK(ring);
+    for( ; ; )
+	{
+	block_t *block;
+	int sys_errno=0;
+	int n;
+
+	while(!ring->stopping && ring->count == ring->nblocks)
+	    pthread_cond_wait(&ring->drained,&ring->lock);
+	if(ring->stopping)
+	    break;
+	block=&ring->blocks[ring->head];
+	UNLOCK(ring);
+
+	n=read_block(ring,block,&sys_errno);
+
+	LOCK(ring);
+	ring->sys_errno=sys_errno;
+	if(n > 0)
+	    {
+	    ring->head=(ring->head+1)%ring->nblocks;
+	    ++ring->count;
+	    }
+	else
+	    ring->done=ops_true;
+	pthread_cond_signal(&ring->filled);
+	if(n <= 0)
+	    break;
+	}
+    UNLOCK(ring);
+
+    return NULL;
+    }
+#endif
+
+/**
+   \ingroup Core_Readers
+   \brief Starts reading an fd ahead, on a thread of its own
+   \param fd File descriptor to read, from its current position to EOF
+   \param nbuffers Number of buffers to read ahead into, or 0 to read
+   only when asked
+   \param buffer_size Size of each buffer
+   \return New prefetch, to be freed with ops_prefetch_free()
+
+   If threads aren't available, or nbuffers is 0, the fd is read one
+   buffer at a time by ops_prefetch_read() itself.
+
+   \note Once the prefetch is freed, fd is left at some point after
+   what was read from it.
+*/
+ops_prefetch_t *ops_prefetch_new(int fd,unsigned nbuffers,size_t buffer_size)
+    {
+    ops_prefetch_t *prefetch=ops_mallocz(sizeof *prefetch);
+
+    ring_init(&prefetch->ring,fd,nbuffers ? nbuffers : 1,buffer_size);
+#ifdef HAVE_PTHREAD_H
+    if(nbuffers)
+	ring_start(&prefetch->ring,prefetch_thread);
+#endif
+
+    return prefetch;
+    }
+
+/**
+   \ingroup Core_Readers
+   \brief Gets the next buffer's worth of a prefetched fd
+   \param prefetch Prefetch
+   \param data Set to the data, which stays valid until the next call
+   \return The length of the data, 0 at EOF, or -1 if the fd couldn't be
+   read, in which case ops_prefetch_get_errno() says why
+*/
+int ops_prefetch_read(ops_prefetch_t *prefetch,const unsigned char **data)
+    {
+    ring_t *ring=&prefetch->ring;
+    block_t *block;
+
+#ifdef HAVE_PTHREAD_H
+    if(ring->threaded)
+	{
+	LOCK(ring);
+	if(prefetch->holding)
+	    {
+	    ring->tail=(ring->tail+1)%ring->nblocks;
+	    --ring->count;
+	    prefetch->holding=ops_false;
+	    pthread_cond_signal(&ring->drained);
+	    }
+	while(!ring->count && !ring->done)
+	    pthread_cond_wait(&ring->filled,&ring->lock);
+	if(!ring->count)
+	    {
+	    int n=ring->sys_errno ? -1 : 0;
+
+	    UNLOCK(ring);
+	    return n;
+	    }
+	block=&ring->blocks[ring->tail];
+	prefetch->holding=ops_true;
+	UNLOCK(ring);
+
+	*data=block->data;
+	return block->length;
+	}
+#endif
+
+    block=&ring->blocks[0];
+    if(read_block(ring,block,&ring->sys_errno) < 0)
+	return -1;
+    *data=block->data;
+    return block->length;
+    }
+
+/**
+   \ingroup Core_Readers
+   \brief Says why a prefetched fd couldn't be read
+   \param prefetch Prefetch
+   \return The errno from the failed read, or 0
+*/
+int ops_prefetch_get_errno(ops_prefetch_t *prefetch)
+    {
+    int sys_errno;
+
+    LOCK(&prefetch->ring);
+    sys_errno=prefetch->ring.sys_errno;
+    UNLOCK(&prefetch->ring);
+
+    return sys_errno;
+    }
+
+/**
+   \ingroup Core_Readers
+   \brief Stops reading ahead, and frees a prefetch
+   \param prefetch Prefetch to free
+   \note The fd is not closed.
+*/
+void ops_prefetch_free(ops_prefetch_t *prefetch)
+    {
+#ifdef HAVE_PTHREAD_H
+    ring_t *ring=&prefetch->ring;
+
+    if(ring->threaded)
+	{
+	LOCK(ring);
+	ring->stopping=ops_true;
+	pthread_cond_signal(&ring->drained);
+	UNLOCK(ring);
+	pthread_join(ring->thread,NULL);
+	}
+#endif
+    ring_free(&prefetch->ring);
+    free(prefetch);
+    }
+
+/* A reader on a prefetch */
+
+typedef struct
+    {
+    ops_prefetch_t *prefetch;
+    const unsigned char *data;	/*!< what is left of the current buffer */
+    size_t left;
+    } reader_pipelined_arg_t;
+
+static int pipelined_reader(void *dest,size_t length,ops_error_t **errors,
+			    ops_reader_info_t *rinfo,
+			    ops_parse_cb_info_t *cbinfo)
+    {
+    reader_pipelined_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    OPS_USED(cbinfo);
+
+    if(!arg->left)
+	{
+	int n=ops_prefetch_read(arg->prefetch,&arg->data);
+
+	if(n == 0)
+	    return 0;
+	if(n < 0)
+	    {
+	    errno=ops_prefetch_get_errno(arg->prefetch);
+	    OPS_SYSTEM_ERROR_1(errors,OPS_E_R_READ_FAILED,"read",
+			       "file descriptor %d",arg->prefetch->ring.fd);
+	    return -1;
+	    }
+	arg->left=n;
+	}
+
+    if(length > arg->left)
+	length=arg->left;
+    memcpy(dest,arg->data,length);
+    arg->data+=length;
+    arg->left-=length;
+
+    return length;
+    }
+
+static void pipelined_reader_destroyer(ops_reader_info_t *rinfo)
+    {
+    reader_pipelined_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    ops_prefetch_free(arg->prefetch);
+    free(arg);
+    }
+
+/**
+   \ingroup Core_Readers_First
+   \brief Starts stack with a file reader that reads ahead on a thread of
+   its own
+   \param pinfo Parse settings
+   \param fd File descriptor to read
+   \param nbuffers Number of buffers to read ahead into
+   \param buffer_size Size of each buffer
+   \note The fd must not be closed until pinfo has been deleted.
+   \sa ops_prefetch_new()
+*/
+void ops_reader_set_fd_pipelined(ops_parse_info_t *pinfo,int fd,
+				 unsigned nbuffers,size_t buffer_size)
+    {
+    reader_pipelined_arg_t *arg=ops_mallocz(sizeof *arg);
+
+    arg->prefetch=ops_prefetch_new(fd,nbuffers,buffer_size);
+    ops_reader_set(pinfo,pipelined_reader,pipelined_reader_destroyer,arg);
+    }
+
+/* Writing behind */
+
+typedef struct
+    {
+    ring_t ring;
+    size_t fill;		/*!< how much of the head block is filled */
+    } writer_pipelined_arg_t;
+
+// Write all of block, returning ops_false on error, with *sys_errno set
+// to why
+static ops_boolean_t write_block(const ring_t *ring,const block_t *block,
+				 int *sys_errno)
+    {
+    size_t done=0;
+
+    while(done < block->length)
+	{
+	int n=write(ring->fd,block->data+done,block->length-done);
+
+	if(n < 0 && errno == EINTR)
+	    continue;
+	if(n <= 0)
+	    {
+	    *sys_errno=n < 0 ? errno : EIO;
+	    return ops_false;
+	    }
+	done+=n;
+	}
+    return ops_true;
+    }
+
+#ifdef HAVE_PTHREAD_H
+static void *write_behind_thread(void *ring_)
+    {
+    ring_t *ring=ring_;
+    ops_boolean_t failed=ops_false;
+
+    LOCK(ring);
+    for( ; ; )
+	{
+	block_t *block;
+	int sys_errno=0;
+
+	while(!ring->count && !ring->done)
+	    pthread_cond_wait(&ring->filled,&ring->lock);
+	if(!ring->count)
+	    break;
+	block=&ring->blocks[ring->tail];
+	UNLOCK(ring);
+
+	// once a write has failed, the rest is thrown away
+	if(!failed)
+	    failed=!write_block(ring,block,&sys_errno);
+
+	LOCK(ring);
+	if(sys_errno)
+	    ring->sys_errno=sys_errno;
+	ring->tail=(ring->tail+1)%ring->nblocks;
+	--ring->count;
+	pthread_cond_signal(&ring->drained);
+	}
+    UNLOCK(ring);
+
+    return NULL;
+    }
+#endif
+
+// Hand the head block over to be written, and wait until there is
+// another free to fill
+static ops_boolean_t submit_block(writer_pipelined_arg_t *arg,
+				  ops_error_t **errors)
+    {
+    ring_t *ring=&arg->ring;
+    int sys_errno;
+
+    if(!arg->fill)
+	return ops_true;
+    ring->blocks[ring->head].length=arg->fill;
+    arg->fill=0;
+
+#ifdef HAVE_PTHREAD_H
+    if(ring->threaded)
+	{
+	LOCK(ring);
+	ring->head=(ring->head+1)%ring->nblocks;
+	++ring->count;
+	pthread_cond_signal(&ring->filled);
+	while(ring->count == ring->nblocks)
+	    pthread_cond_wait(&ring->drained,&ring->lock);
+	sys_errno=ring->sys_errno;
+	UNLOCK(ring);
+	}
+    else
+#endif
+	{
+	write_block(ring,&ring->blocks[ring->head],&ring->sys_errno);
+	sys_errno=ring->sys_errno;
+	}
+
+    if(sys_errno)
+	{
+	errno=sys_errno;
+	OPS_SYSTEM_ERROR_1(errors,OPS_E_W_WRITE_FAILED,"write",
+			   "file descriptor %d",ring->fd);
+	return ops_false;
+	}
+    return ops_true;
+    }
+
+static ops_boolean_t pipelined_writer(const unsigned char *src,
+				      unsigned length,
+				      ops_error_t **errors,
+				      ops_writer_info_t *winfo)
+    {
+    writer_pipelined_arg_t *arg=ops_writer_get_arg(winfo);
+    ring_t *ring=&arg->ring;
+
+    while(length)
+	{
+	size_t l=ring->block_size-arg->fill;
+
+	if(l > length)
+	    l=length;
+	memcpy(ring->blocks[ring->head].data+arg->fill,src,l);
+	arg->fill+=l;
+	src+=l;
+	length-=l;
+	if(arg->fill == ring->block_size && !submit_block(arg,errors))
+	    return ops_false;
+	}
+    return ops_true;
+    }
+
+#ifdef HAVE_PTHREAD_H
+// Let the write-behind thread write what it has been given, and wait
+// for it to finish
+static void write_behind_stop(ring_t *ring)
+    {
+    if(!ring->threaded)
+	return;
+    LOCK(ring);
+    ring->done=ops_true;
+    pthread_cond_broadcast(&ring->filled);
+    UNLOCK(ring);
+    pthread_join(ring->thread,NULL);
+    ring->threaded=ops_false;
+    }
+#endif
+
+static ops_boolean_t pipelined_writer_finaliser(ops_error_t **errors,
+						ops_writer_info_t *winfo)
+    {
+    writer_pipelined_arg_t *arg=ops_writer_get_arg(winfo);
+    ring_t *ring=&arg->ring;
+    ops_boolean_t ret=submit_block(arg,errors);
+
+#ifdef HAVE_PTHREAD_H
+    if(ring->threaded)
+	{
+	write_behind_stop(ring);
+	if(ret && ring->sys_errno)
+	    {
+	    errno=ring->sys_errno;
+	    OPS_SYSTEM_ERROR_1(errors,OPS_E_W_WRITE_FAILED,"write",
+			       "file descriptor %d",ring->fd);
+	    ret=ops_false;
+	    }
+	}
+#endif
+
+    return ret;
+    }
+
+static void pipelined_writer_destroyer(ops_writer_info_t *winfo)
+    {
+    writer_pipelined_arg_t *arg=ops_writer_get_arg(winfo);
+
+    // the writer may be torn down without being finalised, and the
+    // thread must not outlive the ring
+#ifdef HAVE_PTHREAD_H
+    write_behind_stop(&arg->ring);
+#endif
+    ring_free(&arg->ring);
+    free(arg);
+    }
+
+/**
+ * \ingroup Core_WritersFirst
+ * \brief Write to a File, on a thread of its own
+ *
+ * As ops_writer_set_fd(), but what is written is collected in buffers,
+ * which are written to the file by another thread while the next is
+ * filled. If all the buffers are waiting to be written, writing waits.
+ *
+ * \param info The info structure
+ * \param fd The file descriptor
+ * \param nbuffers Number of buffers
+ * \param buffer_size Size of each buffer
+ *
+ * \note The writer must be closed, with ops_writer_close(), before fd
+ * is closed.
+ */
+void ops_writer_set_fd_pipelined(ops_create_info_t *info,int fd,
+				 unsigned nbuffers,size_t buffer_size)
+    {
+    writer_pipelined_arg_t *arg=ops_mallocz(sizeof *arg);
+
+    ring_init(&arg->ring,fd,nbuffers ? nbuffers : 1,buffer_size);
+#ifdef HAVE_PTHREAD_H
+    if(nbuffers > 1)
+	ring_start(&arg->ring,write_behind_thread);
+#endif
+    ops_writer_set(info,pipelined_writer,pipelined_writer_finaliser,
+		   pipelined_writer_destroyer,arg);
+    }
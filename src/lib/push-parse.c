@@ -0,0 +1,517 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/** \file
+ * \brief Parsing input that is handed over a piece at a time.
+ *
+ * The input is framed into top-level packets as it arrives, following
+ * the packet lengths, partial chunks included, from wherever the last
+ * piece left off. Each run of whole packets is then parsed from memory
+ * by the usual parser, so the callbacks are the ones ops_parse() would
+ * make.
+ *
+ * Literal Data packets, which hold the bulk of a signed message, are
+ * not held: their headers are parsed here and their bodies passed to
+ * the callback as they arrive. Any other packet is held until it is
+ * all here, so a large Compressed or encrypted packet is held whole
+ * before its contents are parsed.
+ */
+
+#include <openpgpsdk/push-parse.h>
+#include <openpgpsdk/readerwriter.h>
+#include <openpgpsdk/callback.h>
+#include <openpgpsdk/util.h>
+#include "parse_local.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openpgpsdk/final.h>
+
+/** The most a Literal Data packet's header fields take: the format,
+ * the filename's length, the filename and the date */
+#define LITERAL_HEADER_MAX	(1+1+255+4)
+
+struct ops_push_parser
+    {
+    ops_parse_info_t *pinfo;
+    unsigned char *buffer;	/*!< the start of a packet that isn't
+				  all here yet */
+    size_t length;
+    size_t size;
+    size_t scan;		/*!< how far into that packet its lengths
+				  have been followed */
+    unsigned known:1;		/*!< scan is the packet's whole length */
+    unsigned indeterminate:1;	/*!< the packet runs to the end of the
+				  input */
+    unsigned failed:1;
+
+    // a Literal Data packet being passed through
+    unsigned literal:1;		/*!< its body is being passed through */
+    size_t literal_left;	/*!< how much of it is still to come */
+    size_t literal_read;	/*!< how much of it has come */
+    unsigned char header[LITERAL_HEADER_MAX];
+    size_t header_length;	/*!< how much of header has come */
+    };
+
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Creates a parser to be fed its input
+ * \param cb	Callback for the parsed content
+ * \param arg	Argument for the callback
+ * \return	The new parser. Free with ops_push_parser_free().
+ * \note The input must be binary: armour isn't undone.
+ * \sa ops_push_parser_feed()
+ */
+ops_push_parser_t *ops_push_parser_new(ops_parse_cb_t *cb,void *arg)
+    {
+    ops_push_parser_t *push=ops_mallocz(sizeof *push);
+
+    push->pinfo=ops_parse_info_new();
+    ops_parse_cb_set(push->pinfo,cb,arg);
+    return push;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Frees a parser and whatever of its input it was holding
+ * \param push	The parser
+ */
+void ops_push_parser_free(ops_push_parser_t *push)
+    {
+    ops_parse_info_delete(push->pinfo);
+    free(push->buffer);
+    free(push);
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Gets the parse settings, to set options or read errors
+ * \param push	The parser
+ * \return	The settings, which belong to the parser
+ */
+ops_parse_info_t *ops_push_parser_get_pinfo(ops_push_parser_t *push)
+    { return push->pinfo; }
+
+/*
+ * Whether the packet at the start of p is a Literal Data packet whose
+ * body can be passed through as it comes: 1 if it is, with *header set
+ * to the length of its tag and length and *body to the length of its
+ * body; 0 if more is needed to tell; -1 if not. Only packets of a
+ * known length are, as the parser doesn't take partial chunks and
+ * stops a literal whose length runs to the end of the input at its
+ * header. None are while the parser is accumulating packets.
+ */
+static int literal_packet(const ops_push_parser_t *push,
+			  const unsigned char *p,size_t left,size_t *header,
+			  size_t *body)
+    {
+    unsigned tag;
+    ops_length_type_t type;
+    int r;
+
+    if(left < 1)
+	return 0;
+    if(push->pinfo->rinfo.accumulate)
+	return -1;
+
+    r=ops_decode_packet_header(p,left,&tag,header,body,&type);
+    if(r < 0 || tag != OPS_PTAG_CT_LITERAL_DATA)
+	return -1;
+    if(r == 0)
+	return 0;
+    return type == OPS_LENGTH_FIXED ? 1 : -1;
+    }
+
+/*
+ * Follow the lengths of the packet at the start of p, which holds left
+ * bytes. Returns 1 if the packet is all there, when push->scan is its
+ * length; 2 if it is a Literal Data packet whose tag and length are
+ * all there, to be passed through; 0 if more is needed; or -1 if p
+ * doesn't start with a tag.
+ */
+static int frame_packet(ops_push_parser_t *push,const unsigned char *p,
+			size_t left)
+    {
+    size_t hlen;
+    size_t blen;
+    ops_length_type_t type;
+
+    if(push->indeterminate)
+	return 0;
+
+    if(!push->scan)
+	{
+	unsigned tag;
+	int r;
+
+	if((r=literal_packet(push,p,left,&hlen,&blen)) >= 0)
+	    return r ? 2 : 0;
+	if((r=ops_decode_packet_header(p,left,&tag,&hlen,&blen,&type)) <= 0)
+	    return r;
+	if(type == OPS_LENGTH_INDETERMINATE)
+	    {
+	    push->indeterminate=ops_true;
+	    return 0;
+	    }
+	push->scan=hlen+blen;
+	push->known=type == OPS_LENGTH_FIXED;
+	}
+
+    // each partial chunk has another length after it
+    while(!push->known)
+	{
+	if(left < push->scan
+	   || !ops_decode_new_length(p+push->scan,left-push->scan,&hlen,&blen,
+				     &type))
+	    return 0;
+	push->scan+=hlen+blen;
+	push->known=type == OPS_LENGTH_FIXED;
+	}
+
+    return left >= push->scan;
+    }
+
+static void frame_reset(ops_push_parser_t *push)
+    {
+    push->scan=0;
+    push->known=ops_false;
+    }
+
+/*
+ * How many bytes at the start of p are whole packets, up to the first
+ * Literal Data packet. Where p doesn't start with a tag it's all handed
+ * over, for the parser to report.
+ */
+static size_t whole_packets(ops_push_parser_t *push,const unsigned char *p,
+			    size_t left)
+    {
+    size_t whole=0;
+    int r;
+
+    while((r=frame_packet(push,p+whole,left-whole)) == 1)
+	{
+	whole+=push->scan;
+	frame_reset(push);
+	}
+    if(r < 0)
+	{
+	push->failed=ops_true;
+	whole=left;
+	}
+    return whole;
+    }
+
+static void parse_span(ops_push_parser_t *push,const unsigned char *p,
+		       size_t length)
+    {
+    if(!length)
+	return;
+    ops_reader_set_memory(push->pinfo,p,length);
+    if(!ops_parse(push->pinfo))
+	push->failed=ops_true;
+    }
+
+static void hold(ops_push_parser_t *push,const unsigned char *p,
+		 size_t length)
+    {
+    if(push->length+length > push->size)
+	{
+	push->size=push->size ? push->size*2 : 8192;
+	if(push->size < push->length+length)
+	    push->size=push->length+length;
+	push->buffer=realloc(push->buffer,push->size);
+	}
+    memcpy(push->buffer+push->length,p,length);
+    push->length+=length;
+    }
+
+/*
+ * Start passing through the Literal Data packet at the start of p,
+ * whose tag and length are there. Returns how much of p they take.
+ */
+static size_t start_literal(ops_push_parser_t *push,const unsigned char *p,
+			    size_t left)
+    {
+    ops_parser_content_t content;
+    size_t header;
+    size_t body;
+    int r;
+
+    r=literal_packet(push,p,left,&header,&body);
+    OPS_USED(r);
+
+    memset(&content,'\0',sizeof content);
+    content.content.ptag.position=push->pinfo->rinfo.position;
+    content.content.ptag.new_format=!!(p[0]&OPS_PTAG_NEW_FORMAT);
+    if(content.content.ptag.new_format)
+	content.content.ptag.content_tag=p[0]&OPS_PTAG_NF_CONTENT_TAG_MASK;
+    else
+	{
+	content.content.ptag.content_tag=(p[0]&OPS_PTAG_OF_CONTENT_TAG_MASK)
+	    >> OPS_PTAG_OF_CONTENT_TAG_SHIFT;
+	content.content.ptag.length_type=p[0]&OPS_PTAG_OF_LENGTH_TYPE_MASK;
+	}
+    content.content.ptag.length=body;
+    push->pinfo->rinfo.position+=header;
+    CBP(push->pinfo,OPS_PARSER_PTAG,&content);
+
+    push->literal=ops_true;
+    push->literal_left=body;
+    push->literal_read=header;
+    push->header_length=0;
+
+    return header;
+    }
+
+// How long the Literal Data header fields are, once enough of them
+// has come to tell
+static size_t literal_header_length(const ops_push_parser_t *push)
+    {
+    if(push->header_length < 2)
+	return LITERAL_HEADER_MAX;
+    return 1+1+push->header[1]+4;
+    }
+
+static void literal_header(ops_push_parser_t *push)
+    {
+    ops_parser_content_t content;
+    const unsigned char *h=push->header;
+    unsigned l=h[1];
+
+    memset(&content,'\0',sizeof content);
+    content.content.literal_data_header.format=h[0];
+    memcpy(content.content.literal_data_header.filename,h+2,l);
+    content.content.literal_data_header.filename[l]='\0';
+    content.content.literal_data_header.modification_time
+	=((time_t)h[2+l] << 24)+(h[3+l] << 16)+(h[4+l] << 8)+h[5+l];
+    CBP(push->pinfo,OPS_PTAG_CT_LITERAL_DATA_HEADER,&content);
+    }
+
+// Pass on part of the body, as the parser would, hashing it for any
+// one-pass signatures
+static void literal_body(ops_push_parser_t *push,const unsigned char *p,
+			 size_t length)
+    {
+    ops_parse_info_t *pinfo=push->pinfo;
+    ops_parser_content_t content;
+
+    while(length)
+	{
+	size_t l=length;
+
+	if(!pinfo->borrow_bodies && l > pinfo->body_size)
+	    l=pinfo->body_size;
+
+	ops_parse_hash_data(pinfo,p,l);
+
+	memset(&content,'\0',sizeof content);
+	if(pinfo->borrow_bodies)
+	    {
+	    content.content.literal_data_slice.ptr=p;
+	    content.content.literal_data_slice.len=l;
+	    CBP(pinfo,OPS_PTAG_CT_LITERAL_DATA_SLICE,&content);
+	    }
+	else
+	    {
+	    // the body isn't changed by the callback, nor kept past it
+	    content.content.literal_data_body.data=(unsigned char *)p;
+	    content.content.literal_data_body.length=l;
+	    CBP(pinfo,OPS_PTAG_CT_LITERAL_DATA_BODY,&content);
+	    }
+	p+=l;
+	length-=l;
+	}
+    }
+
+/*
+ * Pass on as much of the Literal Data packet being passed through as
+ * p holds. Returns how much of p it takes.
+ */
+static size_t stream_literal(ops_push_parser_t *push,const unsigned char *p,
+			     size_t left)
+    {
+    size_t n=left;
+    size_t taken=0;
+
+    if(n > push->literal_left)
+	n=push->literal_left;
+
+    while(taken < n && push->header_length < literal_header_length(push))
+	{
+	// the format and the filename's length first, to know the rest
+	size_t l=(push->header_length < 2 ? 2 : literal_header_length(push))
+	    -push->header_length;
+
+	if(l > n-taken)
+	    l=n-taken;
+	memcpy(push->header+push->header_length,p+taken,l);
+	push->header_length+=l;
+	taken+=l;
+	if(push->header_length == literal_header_length(push))
+	    literal_header(push);
+	}
+    literal_body(push,p+taken,n-taken);
+
+    push->pinfo->rinfo.position+=n;
+    push->literal_read+=n;
+    push->literal_left-=n;
+    if(!push->literal_left)
+	{
+	push->literal=ops_false;
+	if(push->header_length < literal_header_length(push))
+	    {
+	    OPS_ERROR(&push->pinfo->errors,OPS_E_P_NOT_ENOUGH_DATA,
+		      "Not enough data");
+	    push->failed=ops_true;
+	    }
+	}
+
+    return n;
+    }
+
+/*
+ * Add to the packet that is held as much of p as it needs, or as is
+ * needed to tell how much it needs. Returns how much of p it takes.
+ */
+static size_t add_to_held(ops_push_parser_t *push,const unsigned char *p,
+			  size_t left)
+    {
+    size_t want;
+    int r;
+
+    if(push->indeterminate)
+	want=left;
+    else if(push->known)
+	want=push->scan-push->length;
+    else if(push->scan >= push->length)
+	want=push->scan-push->length+1;
+    else
+	want=1;
+    if(want > left)
+	want=left;
+    hold(push,p,want);
+
+    r=frame_packet(push,push->buffer,push->length);
+    if(r == 1)
+	{
+	parse_span(push,push->buffer,push->length);
+	frame_reset(push);
+	push->length=0;
+	}
+    else if(r == 2)
+	{
+	start_literal(push,push->buffer,push->length);
+	push->length=0;
+	}
+    else if(r < 0)
+	{
+	push->failed=ops_true;
+	parse_span(push,push->buffer,push->length);
+	push->length=0;
+	}
+    return want;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Parses the next piece of input
+ *
+ * Whatever the piece completes is parsed before this returns, and the
+ * rest is kept for the next call, so a piece can end anywhere, even
+ * inside a packet's header. Literal data is passed to the callback as
+ * it comes, rather than being kept.
+ *
+ * \param push	The parser
+ * \param buf	The piece of input
+ * \param length	Its length
+ * \return ops_true, or ops_false once there has been an error, which
+ * is in the errors of ops_push_parser_get_pinfo(). The parser takes no
+ * more input after that.
+ * \note Only Literal Data packets are passed through. Any other packet
+ * is held until it is all here, so a Compressed or encrypted packet is
+ * held whole before anything inside it reaches the callback.
+ */
+ops_boolean_t ops_push_parser_feed(ops_push_parser_t *push,const void *buf,
+				   size_t length)
+    {
+    const unsigned char *p=buf;
+
+    while(length && !push->failed)
+	{
+	size_t n;
+
+	if(push->literal)
+	    n=stream_literal(push,p,length);
+	else if(push->length)
+	    n=add_to_held(push,p,length);
+	else
+	    {
+	    // Nothing held, so parse what's whole where it is
+	    n=whole_packets(push,p,length);
+	    parse_span(push,p,n);
+	    if(!n)
+		n=add_to_held(push,p,length);
+	    }
+	p+=n;
+	length-=n;
+	}
+
+    return !push->failed;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Ends the input
+ *
+ * A packet whose length runs to the end of the input is parsed now.
+ * Any other packet that isn't all there is an error.
+ *
+ * \param push	The parser
+ * \return ops_true if all the input parsed without errors
+ */
+ops_boolean_t ops_push_parser_finish(ops_push_parser_t *push)
+    {
+    if(push->failed)
+	return ops_false;
+
+    if(push->literal)
+	{
+	OPS_ERROR_1(&push->pinfo->errors,OPS_E_R_EARLY_EOF,
+		    "Input ends %u bytes into a packet",
+		    (unsigned)push->literal_read);
+	push->failed=ops_true;
+	}
+    else if(push->indeterminate)
+	parse_span(push,push->buffer,push->length);
+    else if(push->length)
+	{
+	OPS_ERROR_1(&push->pinfo->errors,OPS_E_R_EARLY_EOF,
+		    "Input ends %u bytes into a packet",
+		    (unsigned)push->length);
+	push->failed=ops_true;
+	}
+    push->length=0;
+
+    return !push->failed;
+    }
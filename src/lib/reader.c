@@ -48,6 +48,8 @@ void ops_reader_set(ops_parse_info_t *pinfo,ops_reader_t *reader,ops_reader_dest
     pinfo->rinfo.reader=reader;
     pinfo->rinfo.destroyer=destroyer;
     pinfo->rinfo.arg=arg;
+    pinfo->rinfo.direct=NULL;
+    pinfo->rinfo.direct_end=NULL;
     }
 
 /**
@@ -60,7 +62,12 @@ void ops_reader_set(ops_parse_info_t *pinfo,ops_reader_t *reader,ops_reader_dest
  */
 void ops_reader_push(ops_parse_info_t *pinfo,ops_reader_t *reader,ops_reader_destroyer_t *destroyer,void *arg)
     {
-    ops_reader_info_t *rinfo=malloc(sizeof *rinfo);
+    ops_reader_info_t *rinfo=pinfo->spare_rinfo;
+
+    if(rinfo)
+	pinfo->spare_rinfo=rinfo->next;
+    else
+	rinfo=malloc(sizeof *rinfo);
 
     *rinfo=pinfo->rinfo;
     memset(&pinfo->rinfo,'\0',sizeof pinfo->rinfo);
@@ -85,7 +92,9 @@ void ops_reader_pop(ops_parse_info_t *pinfo)
     // old rinfo structure first.
     free(pinfo->rinfo.accumulated);
     pinfo->rinfo=*next;
-    free(next);
+    // Keep the node for the next push
+    next->next=pinfo->spare_rinfo;
+    pinfo->spare_rinfo=next;
     }
 
 /**
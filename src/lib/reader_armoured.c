@@ -110,6 +110,8 @@ typedef struct
     unsigned npushed_back;
     // armoured block headers
     ops_headers_t headers;
+    // cleartext signed bodies, see ops_parse_set_body_size()
+    unsigned char *body;
     } dearmour_arg_t;
 
 static void push_back(dearmour_arg_t *arg,const unsigned char *buf,
@@ -387,6 +389,9 @@ static int process_dash_escaped(dearmour_arg_t *arg,ops_error_t **errors,
 
     hash->init(hash);
 
+    if(!arg->body)
+	arg->body=malloc(rinfo->pinfo->body_size);
+    body->data=arg->body;
     body->length=0;
     total=0;
     for( ; ; )
@@ -433,8 +438,11 @@ static int process_dash_escaped(dearmour_arg_t *arg,ops_error_t **errors,
 		
 	body->data[body->length++]=c;
 	++total;
-	if(body->length == sizeof body->data)
+	if(body->length == rinfo->pinfo->body_size)
 	    {
+	    if(body->data[0] == '\n')
+		hash->add(hash,(unsigned char *)"\r",1);
+	    hash->add(hash,body->data,body->length);
             if (debug)
                 { fprintf(stderr,"Got body (2):\n%s\n",body->data); }
 	    CB(cbinfo,OPS_PTAG_CT_SIGNED_CLEARTEXT_BODY,&content);
@@ -987,7 +995,12 @@ static int armoured_data_reader(void *dest_,size_t length,ops_error_t **errors,
     }
 
 static void armoured_data_destroyer(ops_reader_info_t *rinfo)
-    { free(ops_reader_get_arg(rinfo)); }
+    {
+    dearmour_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    free(arg->body);
+    free(arg);
+    }
 
 /**
  * \ingroup Core_Readers_Armour
@@ -1039,6 +1052,7 @@ void ops_reader_push_dearmour(ops_parse_info_t *parse_info)
 void ops_reader_pop_dearmour(ops_parse_info_t *pinfo)
     {
     dearmour_arg_t *arg=ops_reader_get_arg(ops_parse_get_rinfo(pinfo));
+    free(arg->body);
     free(arg);
     ops_reader_pop(pinfo);
     }
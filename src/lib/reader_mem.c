@@ -36,55 +36,45 @@
 
 #include <string.h>
 
-#include <openpgpsdk/final.h>
+#include "parse_local.h"
 
-typedef struct
-    {
-    const unsigned char *buffer;
-    size_t length;
-    size_t offset;
-    } reader_mem_arg_t;
+#include <openpgpsdk/final.h>
 
+// The buffer is kept in the reader info's direct window, which the
+// parser also takes data from without calling the reader
 static int mem_reader(void *dest,size_t length,ops_error_t **errors,
 		      ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
     {
-    reader_mem_arg_t *arg=ops_reader_get_arg(rinfo);
-    unsigned n;
+    size_t n=rinfo->direct_end-rinfo->direct;
 
     OPS_USED(cbinfo);
     OPS_USED(errors);
 
-    if(arg->offset+length > arg->length)
-	n=arg->length-arg->offset;
-    else
+    if(length < n)
 	n=length;
 
     if(n == 0)
 	return 0;
 
-    memcpy(dest,arg->buffer+arg->offset,n);
-    arg->offset+=n;
+    memcpy(dest,rinfo->direct,n);
+    rinfo->direct+=n;
 
     return n;
     }
 
-static void mem_destroyer(ops_reader_info_t *rinfo)
-    { free(ops_reader_get_arg(rinfo)); }
-
 /**
    \ingroup Core_Readers_First
    \brief Starts stack with memory reader
+   \note While nothing is pushed on top of it, the parser reads the
+   buffer directly, rather than through the reader.
 */
 
 void ops_reader_set_memory(ops_parse_info_t *pinfo,const void *buffer,
 			   size_t length)
     {
-    reader_mem_arg_t *arg=malloc(sizeof *arg);
-
-    arg->buffer=buffer;
-    arg->length=length;
-    arg->offset=0;
-    ops_reader_set(pinfo,mem_reader,mem_destroyer,arg);
+    ops_reader_set(pinfo,mem_reader,NULL,NULL);
+    pinfo->rinfo.direct=buffer;
+    pinfo->rinfo.direct_end=pinfo->rinfo.direct+length;
     }
 
 /* eof */
@@ -32,6 +32,7 @@
 
 #include <openpgpsdk/readerwriter.h>
 #include <openpgpsdk/callback.h>
+#include <openpgpsdk/pipeline.h>
 
 #include "parse_local.h"
 
@@ -127,6 +128,29 @@ void ops_teardown_memory_read(ops_parse_info_t *pinfo, ops_memory_t *mem)
 */
 int ops_setup_file_write(ops_create_info_t **cinfo, const char* filename, ops_boolean_t allow_overwrite)
     {
+    return ops_setup_file_write_pipelined(cinfo, filename, allow_overwrite,
+					  0, 0);
+    }
+
+/**
+ \ingroup Core_Writers
+ \brief As ops_setup_file_write(), but writing behind on a thread of
+ its own
+ \param cinfo Address where new cinfo pointer will be set
+ \param filename File to write to
+ \param allow_overwrite Allows file to be overwritten, if set.
+ \param nbuffers Number of buffers waiting to be written, or 0 to write
+ as ops_setup_file_write() does
+ \param buffer_size Size of each buffer, or 0 for
+ OPS_PIPELINE_DEFAULT_BUFFER_SIZE
+ \return Newly-opened file descriptor
+ \sa ops_writer_set_fd_pipelined()
+*/
+int ops_setup_file_write_pipelined(ops_create_info_t **cinfo,
+				   const char* filename,
+				   ops_boolean_t allow_overwrite,
+				   unsigned nbuffers,size_t buffer_size)
+    {
     int fd=0;
     int flags=0;
 
@@ -150,7 +174,11 @@ int ops_setup_file_write(ops_create_info_t **cinfo, const char* filename, ops_bo
     
     *cinfo=ops_create_info_new();
 
-    ops_writer_set_fd(*cinfo,fd);
+    if(nbuffers)
+	ops_writer_set_fd_pipelined(*cinfo,fd,nbuffers,buffer_size ? buffer_size
+				    : OPS_PIPELINE_DEFAULT_BUFFER_SIZE);
+    else
+	ops_writer_set_fd(*cinfo,fd);
 
     return fd;
     }
@@ -219,6 +247,31 @@ int ops_setup_file_read(ops_parse_info_t **pinfo, const char *filename,
                         ops_parse_cb_return_t callback(const ops_parser_content_t *, ops_parse_cb_info_t *),
                         ops_boolean_t accumulate)
     {
+    return ops_setup_file_read_pipelined(pinfo, filename, arg, callback,
+					 accumulate, 0, 0);
+    }
+
+/**
+   \ingroup Core_Readers
+   \brief As ops_setup_file_read(), but reading ahead on a thread of its
+   own
+   \param pinfo Address where new parse_info will be set
+   \param filename Name of file to read
+   \param arg Reader-specific arg
+   \param callback Callback to use when reading
+   \param accumulate Set if we need to accumulate as we read
+   \param nbuffers Number of buffers to read ahead into, or 0 to read as
+   ops_setup_file_read() does
+   \param buffer_size Size of each buffer, or 0 for
+   OPS_PIPELINE_DEFAULT_BUFFER_SIZE
+   \sa ops_reader_set_fd_pipelined()
+*/
+int ops_setup_file_read_pipelined(ops_parse_info_t **pinfo,
+				  const char *filename,void* arg,
+				  ops_parse_cb_return_t callback(const ops_parser_content_t *, ops_parse_cb_info_t *),
+				  ops_boolean_t accumulate,
+				  unsigned nbuffers,size_t buffer_size)
+    {
     int fd=0;
     /*
      * initialise needed structures for reading
@@ -233,7 +286,11 @@ int ops_setup_file_read(ops_parse_info_t **pinfo, const char *filename,
 
     *pinfo=ops_parse_info_new();
     ops_parse_cb_set(*pinfo,callback,arg);
-    ops_reader_set_fd(*pinfo,fd);
+    if(nbuffers)
+	ops_reader_set_fd_pipelined(*pinfo,fd,nbuffers,buffer_size ? buffer_size
+				    : OPS_PIPELINE_DEFAULT_BUFFER_SIZE);
+    else
+	ops_reader_set_fd(*pinfo,fd);
 
     if (accumulate)
         (*pinfo)->rinfo.accumulate=ops_true;
@@ -250,8 +307,9 @@ int ops_setup_file_read(ops_parse_info_t **pinfo, const char *filename,
 */
 void ops_teardown_file_read(ops_parse_info_t *pinfo, int fd)
     {
-    close(fd);
+    // the reader may have a thread of its own reading fd
     ops_parse_info_delete(pinfo);
+    close(fd);
     }
 
 ops_parse_cb_return_t
@@ -281,6 +339,13 @@ callback_literal_data(const ops_parser_content_t *content_,ops_parse_cb_info_t *
         */
         break;
 
+    case OPS_PTAG_CT_LITERAL_DATA_SLICE:
+        if (cbinfo->cinfo)
+            ops_write(content->literal_data_slice.ptr,
+                      content->literal_data_slice.len,
+                      cbinfo->cinfo);
+        break;
+
     case OPS_PTAG_CT_LITERAL_DATA_HEADER:
         // ignore
         break;
@@ -30,11 +30,14 @@
 #include <openpgpsdk/literal.h>
 #include <openpgpsdk/partial.h>
 #include <openpgpsdk/writer_armoured.h>
+#include <openpgpsdk/pipeline.h>
 
 #include <assert.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <openpgpsdk/final.h>
 
@@ -336,19 +339,7 @@ static ops_boolean_t rsa_verify(ops_hash_algorithm_t type,
     }
 
 static void hash_add_key(ops_hash_t *hash, const ops_public_key_t *key)
-    {
-    ops_memory_t *mem=ops_memory_new();
-    size_t l;
-
-    ops_build_public_key(mem, key, ops_false);
-
-    l=ops_memory_get_length(mem);
-    ops_hash_add_int(hash, 0x99, 1);
-    ops_hash_add_int(hash, l, 2);
-    hash->add(hash, ops_memory_get_data(mem), l);
-
-    ops_memory_free(mem);
-    }
+    { ops_hash_add_public_key(hash, key); }
 
 static void initialise_hash(ops_hash_t *hash, const ops_signature_t *sig)
     {
@@ -892,14 +883,16 @@ static int open_output_file(ops_create_info_t **cinfo,
 			    const char* input_filename,
 			    const char* output_filename,
 			    const ops_boolean_t use_armour,
-			    const ops_boolean_t overwrite)
+			    const ops_boolean_t overwrite,
+			    unsigned nbuffers,size_t buffer_size)
     {
     int fd_out;
 
     // setup output file
 
     if (output_filename)
-        fd_out=ops_setup_file_write(cinfo, output_filename, overwrite);
+        fd_out=ops_setup_file_write_pipelined(cinfo, output_filename, overwrite,
+                                              nbuffers, buffer_size);
     else
         {
         char *myfilename=NULL;
@@ -909,13 +902,23 @@ static int open_output_file(ops_create_info_t **cinfo,
             snprintf(myfilename, filenamelen, "%s.asc", input_filename);
         else
             snprintf(myfilename, filenamelen, "%s.gpg", input_filename);
-        fd_out=ops_setup_file_write(cinfo,  myfilename,  overwrite);
+        fd_out=ops_setup_file_write_pipelined(cinfo, myfilename, overwrite,
+                                              nbuffers, buffer_size);
         free(myfilename);
         } 
 
     return fd_out;
     }
 
+// Read the file to be signed ahead of the signing, if nbuffers isn't 0;
+// otherwise in the same buffer size, but only as it is wanted
+static ops_prefetch_t *prefetch_input(int fd_in,unsigned nbuffers,
+				      size_t buffer_size)
+    {
+    return ops_prefetch_new(fd_in,nbuffers,buffer_size ? buffer_size
+			    : OPS_PIPELINE_DEFAULT_BUFFER_SIZE);
+    }
+
 /**
    \ingroup HighLevel_Sign
    \brief Sign a file with a Cleartext Signature
@@ -941,6 +944,33 @@ ops_boolean_t ops_sign_file_as_cleartext(const char* input_filename,
 					 const ops_secret_key_t *skey,
 					 const ops_boolean_t overwrite)
     {
+    return ops_sign_file_as_cleartext_pipelined(input_filename,
+						output_filename, skey,
+						overwrite, 0, 0);
+    }
+
+/**
+   \ingroup HighLevel_Sign
+   \brief As ops_sign_file_as_cleartext(), but reading ahead and
+   writing behind on threads of their own
+   \param input_filename Name of file to be signed
+   \param output_filename Filename to be created. If NULL, filename will
+   be constructed from the input_filename.
+   \param skey Secret Key to sign with
+   \param overwrite Allow output file to be overwritten, if set
+   \param nbuffers Number of buffers each file may have in flight, or 0
+   to sign as ops_sign_file_as_cleartext() does
+   \param buffer_size Size of each buffer, or 0 for
+   OPS_PIPELINE_DEFAULT_BUFFER_SIZE
+   \return ops_true if OK, else ops_false
+*/
+ops_boolean_t ops_sign_file_as_cleartext_pipelined(const char* input_filename,
+						   const char* output_filename,
+						   const ops_secret_key_t *skey,
+						   const ops_boolean_t overwrite,
+						   unsigned nbuffers,
+						   size_t buffer_size)
+    {
     // \todo allow choice of hash algorithams
     // enforce use of SHA1 for now
 
@@ -950,7 +980,7 @@ ops_boolean_t ops_sign_file_as_cleartext(const char* input_filename,
     int fd_in=0;
     int fd_out=0;
     ops_create_info_t *cinfo=NULL;
-    unsigned char buf[MAXBUF];
+    ops_prefetch_t *prefetch=NULL;
     //int flags=0;
     ops_boolean_t rtn=ops_false;
     ops_boolean_t use_armour=ops_true;
@@ -965,7 +995,7 @@ ops_boolean_t ops_sign_file_as_cleartext(const char* input_filename,
     // set up output file
 
     fd_out=open_output_file(&cinfo, input_filename, output_filename, use_armour,
-			    overwrite);
+			    overwrite, nbuffers, buffer_size);
 
     if (fd_out < 0)
         {
@@ -990,16 +1020,19 @@ ops_boolean_t ops_sign_file_as_cleartext(const char* input_filename,
 
     // Do the signing
 
+    prefetch=prefetch_input(fd_in, nbuffers, buffer_size);
     for (;;)
         {
+        const unsigned char *buf;
         int n=0;
     
-        n=read(fd_in, buf, sizeof(buf));
+        n=ops_prefetch_read(prefetch, &buf);
         if (!n)
             break;
         assert(n>=0);
         ops_write(buf, n, cinfo);
         }
+    ops_prefetch_free(prefetch);
     close(fd_in);
 
     // add signature with subpackets:
@@ -1117,6 +1150,9 @@ ops_boolean_t ops_sign_buf_as_cleartext(const char* cleartext, const size_t len,
 \param use_armour Write armoured text, if set.
 \param overwrite May overwrite existing file, if set.
 \return ops_true if OK; else ops_false;
+\note The file is read, hashed and written out a buffer at a time, so
+it is never held in memory. ops_sign_file_pipelined() does the reading
+and writing on threads of their own.
 
 Example code:
 \code
@@ -1138,36 +1174,75 @@ ops_boolean_t ops_sign_file(const char* input_filename,
 			    const ops_boolean_t use_armour,
 			    const ops_boolean_t overwrite)
     {
+    return ops_sign_file_pipelined(input_filename, output_filename, skey,
+				   use_armour, overwrite, 0, 0);
+    }
+
+/**
+\ingroup HighLevel_Sign
+\brief As ops_sign_file(), but reading ahead and writing behind on
+threads of their own, so that disk latency overlaps with hashing
+\param input_filename Input filename
+\param output_filename Output filename. If NULL, a name is constructed from the input filename.
+\param skey Secret Key to use for signing
+\param use_armour Write armoured text, if set.
+\param overwrite May overwrite existing file, if set.
+\param nbuffers Number of buffers each file may have in flight, or 0 to
+sign as ops_sign_file() does
+\param buffer_size Size of each buffer, or 0 for
+OPS_PIPELINE_DEFAULT_BUFFER_SIZE
+\return ops_true if OK; else ops_false;
+\note No more than nbuffers buffers of each file are held in memory.
+*/
+ops_boolean_t ops_sign_file_pipelined(const char* input_filename,
+				      const char* output_filename,
+				      const ops_secret_key_t *skey,
+				      const ops_boolean_t use_armour,
+				      const ops_boolean_t overwrite,
+				      unsigned nbuffers,size_t buffer_size)
+    {
     // \todo allow choice of hash algorithams
     // enforce use of SHA1 for now
 
     unsigned char keyid[OPS_KEY_ID_SIZE];
     ops_create_signature_t *sig=NULL;
 
+    int fd_in=0;
     int fd_out=0;
     ops_create_info_t *cinfo=NULL;
 
     ops_hash_algorithm_t hash_alg=OPS_HASH_SHA1;
     ops_sig_type_t sig_type=OPS_SIG_BINARY;
 
-    ops_memory_t* mem_buf=NULL;
+    ops_prefetch_t *prefetch=NULL;
     ops_hash_t* hash=NULL;
+    struct stat st;
+    unsigned length;
+    unsigned done=0;
+    ops_boolean_t rtn;
 
-    // read input file into buf
+    // open file to sign; its length goes in the Literal Data packet
+    // ahead of its contents, which are then read as they are signed
 
-    int errnum;
-    mem_buf=ops_write_mem_from_file(input_filename, &errnum);
-    if (errnum)
+    fd_in=open(input_filename, O_RDONLY | O_BINARY);
+    if (fd_in < 0)
+        return ops_false;
+    if (fstat(fd_in, &st) < 0 || st.st_size < 0
+        || (unsigned long long)st.st_size > 0xffffffffU-(1+1+4))
+        {
+        close(fd_in);
         return ops_false;
+        }
+    length=st.st_size;
 
     // setup output file
 
     fd_out=open_output_file(&cinfo, input_filename, output_filename, use_armour,
-			    overwrite);
+			    overwrite, nbuffers, buffer_size);
 
     if (fd_out < 0)
         {
-        ops_memory_free(mem_buf);
+        close(fd_in);
         return ops_false;
         }
 
@@ -1185,44 +1260,67 @@ ops_boolean_t ops_sign_file(const char* input_filename,
     // write one_pass_sig
     ops_write_one_pass_sig(skey, hash_alg, sig_type, cinfo);
 
-    // hash file contents
-    hash=ops_signature_get_hash(sig);
-    hash->add(hash, ops_memory_get_data(mem_buf),
-	      ops_memory_get_length(mem_buf));
-    
-    // output file contents as Literal Data packet
+    // output file contents as Literal Data packet, hashing them on the
+    // way
 
     if (debug)
         fprintf(stderr,"** Writing out data now\n");
 
-    ops_write_literal_data_from_buf(ops_memory_get_data(mem_buf),
-				    ops_memory_get_length(mem_buf),
-				    OPS_LDT_BINARY, cinfo);
+    hash=ops_signature_get_hash(sig);
+    rtn=ops_write_ptag(OPS_PTAG_CT_LITERAL_DATA, cinfo)
+        && ops_write_length(1+1+4+length, cinfo)
+        && ops_write_scalar(OPS_LDT_BINARY, 1, cinfo)
+        && ops_write_scalar(0, 1, cinfo) // filename
+        && ops_write_scalar(0, 4, cinfo); // date
+
+    prefetch=prefetch_input(fd_in, nbuffers, buffer_size);
+    while (rtn)
+        {
+        const unsigned char *buf;
+        int n=ops_prefetch_read(prefetch, &buf);
+
+        if (n <= 0)
+            {
+            rtn=n == 0;
+            break;
+            }
+        hash->add(hash, buf, n);
+        rtn=ops_write(buf, n, cinfo);
+        done+=n;
+        }
+    ops_prefetch_free(prefetch);
+    close(fd_in);
+
+    // the file must not have changed length while it was read
+    if (rtn && done != length)
+        rtn=ops_false;
 
     if (debug)
         fprintf(stderr, "** After Writing out data now\n");
 
-    // add subpackets to signature
-    // - creation time
-    // - key id
+    if (rtn)
+        {
+        // add subpackets to signature
+        // - creation time
+        // - key id
 
-    ops_signature_add_creation_time(sig, time(NULL));
+        ops_signature_add_creation_time(sig, time(NULL));
 
-    ops_keyid(keyid, &skey->public_key);
-    ops_signature_add_issuer_key_id(sig, keyid);
+        ops_keyid(keyid, &skey->public_key);
+        ops_signature_add_issuer_key_id(sig, keyid);
 
-    ops_signature_hashed_subpackets_end(sig);
+        ops_signature_hashed_subpackets_end(sig);
 
-    // write out sig
-    ops_write_signature(sig, &skey->public_key, skey, cinfo);
+        // write out sig
+        rtn=ops_write_signature(sig, &skey->public_key, skey, cinfo);
+        }
 
     ops_teardown_file_write(cinfo, fd_out);
 
     // tidy up
     ops_create_signature_delete(sig);
-    ops_memory_free(mem_buf);
 
-    return ops_true;
+    return rtn;
     }
 
 /**
@@ -84,7 +84,10 @@ void hexdump(const unsigned char *src,size_t length)
  * \ingroup HighLevel_Functions
  * \brief Initialises OpenPGP::SDK. To be called before any other OPS function.
  *
- * Initialises OpenPGP::SDK and the underlying openssl library.
+ * Initialises OpenPGP::SDK and the underlying openssl library. With
+ * openssl before 1.1.0, this includes the locking callbacks it needs
+ * for the SDK's functions that work on several threads; an application
+ * that installs its own must do so before calling this.
  */
 
 void ops_init(void)
@@ -122,6 +125,23 @@ void *ops_mallocz(size_t n)
     return m;
     }
 
+/**
+   \ingroup HighLevel_Misc
+   \brief Returns the number of threads to use for parallel work
+   \return The number of CPUs online, or 1 if that can't be found out
+   or threads aren't available
+*/
+unsigned ops_default_nthreads(void)
+    {
+#if defined(HAVE_PTHREAD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long n=sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(n > 0)
+	return n;
+#endif
+    return 1;
+    }
+
 typedef struct
     {
     unsigned short sum;
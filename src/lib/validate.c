@@ -30,64 +30,119 @@
 #include <openpgpsdk/memory.h>
 #include <openpgpsdk/validate.h>
 #include <openpgpsdk/readerwriter.h>
+#include <openpgpsdk/verify_cache.h>
+#include <openpgpsdk/crypto.h>
+#include <openpgpsdk/hash.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include <openpgpsdk/final.h>
 
 static int debug=0;
 
-static ops_boolean_t check_binary_signature(const unsigned len,
-                                            const unsigned char *data,
-                                            const ops_signature_t *sig, 
-                                            const ops_public_key_t *signer __attribute__((unused)))
+// Make the bytes hashed after the signed data: the hashed subpackets
+// and trailer of a V4 signature, or the type and creation time of a V3
+// one. Returns their length, or 0 if the signature's version is
+// unknown. The caller frees *trailer.
+static size_t binary_signature_trailer(unsigned char **trailer,
+				       const ops_signature_t *sig)
     {
-    // Does the signed hash match the given hash?
-
-    int n=0;
-    ops_hash_t hash;
-    unsigned char hashout[OPS_MAX_HASH_SIZE];
-    unsigned char trailer[6];
+    unsigned char *t;
     unsigned int hashedlen;
 
-    //common_init_signature(&hash,sig);
-    ops_hash_any(&hash,sig->info.hash_algorithm);
-    hash.init(&hash);
-    hash.add(&hash,data,len);
+    *trailer=NULL;
     switch (sig->info.version)
         {
     case OPS_V3:
-        trailer[0]=sig->info.type;
-        trailer[1]=sig->info.creation_time >> 24;
-        trailer[2]=sig->info.creation_time >> 16;
-        trailer[3]=sig->info.creation_time >> 8;
-        trailer[4]=sig->info.creation_time;
-        hash.add(&hash,&trailer[0],5);
-        break;
+        t=malloc(5);
+        t[0]=sig->info.type;
+        t[1]=sig->info.creation_time >> 24;
+        t[2]=sig->info.creation_time >> 16;
+        t[3]=sig->info.creation_time >> 8;
+        t[4]=sig->info.creation_time;
+        *trailer=t;
+        return 5;
 
     case OPS_V4:
-        hash.add(&hash,sig->info.v4_hashed_data,sig->info.v4_hashed_data_length);
-
-        trailer[0]=0x04; // version
-        trailer[1]=0xFF;
         hashedlen=sig->info.v4_hashed_data_length;
-        trailer[2]=hashedlen >> 24;
-        trailer[3]=hashedlen >> 16;
-        trailer[4]=hashedlen >> 8;
-        trailer[5]=hashedlen;
-        hash.add(&hash,&trailer[0],6);
-        
-        break;
+        t=malloc(hashedlen+6);
+        memcpy(t,sig->info.v4_hashed_data,hashedlen);
+        t[hashedlen]=0x04; // version
+        t[hashedlen+1]=0xFF;
+        t[hashedlen+2]=hashedlen >> 24;
+        t[hashedlen+3]=hashedlen >> 16;
+        t[hashedlen+4]=hashedlen >> 8;
+        t[hashedlen+5]=hashedlen;
+        *trailer=t;
+        return hashedlen+6;
 
     default:
+        return 0;
+        }
+    }
+
+// Check a signature against the finished hash of the data and trailer
+static ops_boolean_t check_binary_digest(const unsigned char *hashout,
+					 unsigned n,
+					 const ops_signature_t *sig,
+					 const ops_keydata_t *signer,
+					 ops_verify_cache_t *cache)
+    {
+    ops_boolean_t valid;
+
+    // the hash covers the data, so it will do as the cache's digest of it
+    if(cache && ops_verify_cache_lookup(cache,sig,&signer->fingerprint,
+					hashout,n,&valid))
+	return valid;
+
+    valid=ops_check_signature(hashout,n,sig,
+			      ops_get_public_key_from_data(signer));
+    if(cache)
+	ops_verify_cache_store(cache,sig,&signer->fingerprint,hashout,n,valid);
+
+    return valid;
+    }
+
+// Check a signature on data that has already been fed to hash, which
+// is finished here
+static ops_boolean_t check_binary_signature(ops_hash_t *hash,
+                                            const ops_signature_t *sig, 
+                                            const ops_keydata_t *signer,
+                                            ops_verify_cache_t *cache)
+    {
+    // Does the signed hash match the given hash?
+
+    unsigned n;
+    unsigned char hashout[OPS_MAX_HASH_SIZE];
+    unsigned char *trailer;
+    size_t length;
+
+    length=binary_signature_trailer(&trailer,sig);
+    if(!length)
+        {
         fprintf(stderr,"Invalid signature version %d\n", sig->info.version);
+        hash->finish(hash,hashout);
         return ops_false;
         }
+    hash->add(hash,trailer,length);
+    free(trailer);
 
-    n=hash.finish(&hash,hashout);
+    n=hash->finish(hash,hashout);
 
-    //    return ops_false;
-    return ops_check_signature(hashout,n,sig,signer);
+    return check_binary_digest(hashout,n,sig,signer,cache);
     }
 
 static int keydata_reader(void *dest,size_t length,ops_error_t **errors,
@@ -116,10 +171,14 @@ static int keydata_reader(void *dest,size_t length,ops_error_t **errors,
     return length;
     }
 
-static void free_signature_info(ops_signature_info_t *sig)
+static void free_signature_info_list(ops_signature_info_t *sigs,
+				     unsigned count)
     {
-    free (sig->v4_hashed_data);
-    free (sig);
+    unsigned n;
+
+    for(n=0 ; n < count ; ++n)
+	free(sigs[n].v4_hashed_data);
+    free(sigs);
     }
 
 static void copy_signature_info(ops_signature_info_t* dst, const ops_signature_info_t* src)
@@ -129,64 +188,142 @@ static void copy_signature_info(ops_signature_info_t* dst, const ops_signature_i
     memcpy(dst->v4_hashed_data,src->v4_hashed_data,src->v4_hashed_data_length);
     }
 
-static void add_sig_to_valid_list(ops_validate_result_t * result, const ops_signature_info_t* sig)
+static void add_sig_to_list(ops_signature_info_t **sigs,unsigned *count,
+			    const ops_signature_info_t *sig)
     {
-    size_t newsize;
-    size_t start;
-
     // increment count
-    ++result->valid_count;
+    ++*count;
 
     // increase size of array
-    newsize=(sizeof *sig) * result->valid_count;
-    if (!result->valid_sigs)
-        result->valid_sigs=malloc(newsize);
-    else
-        result->valid_sigs=realloc(result->valid_sigs, newsize);
+    *sigs=realloc(*sigs,*count * sizeof **sigs);
 
-    // copy key ptr to array
-    start=(sizeof *sig) * (result->valid_count-1);
-    copy_signature_info(result->valid_sigs+start,sig);
+    // copy sig to array
+    copy_signature_info(&(*sigs)[*count-1],sig);
     }
 
+static void add_sig_to_valid_list(ops_validate_result_t * result, const ops_signature_info_t* sig)
+    { add_sig_to_list(&result->valid_sigs,&result->valid_count,sig); }
+
 static void add_sig_to_invalid_list(ops_validate_result_t * result, const ops_signature_info_t *sig)
+    { add_sig_to_list(&result->invalid_sigs,&result->invalid_count,sig); }
+
+static void add_sig_to_unknown_list(ops_validate_result_t * result, const ops_signature_info_t *sig)
     {
-    size_t newsize;
-    size_t start;
+    add_sig_to_list(&result->unknown_sigs,&result->unknown_signer_count,
+		    sig);
+    }
 
-    // increment count
-    ++result->invalid_count;
+// Check a signature on the key being validated by arg
+static ops_boolean_t check_key_signature(validate_key_cb_arg_t *arg,
+					 const ops_signature_t *sig,
+					 const ops_keydata_t *signer,
+					 ops_error_t **errors)
+    {
+    ops_boolean_t valid=ops_false;
 
-    // increase size of array
-    newsize=(sizeof *sig) * result->invalid_count;
-    if (!result->invalid_sigs)
-        result->invalid_sigs=malloc(newsize);
-    else
-        result->invalid_sigs=realloc(result->invalid_sigs, newsize);
+    switch(sig->info.type)
+	{
+    case OPS_CERT_GENERIC:
+    case OPS_CERT_PERSONA:
+    case OPS_CERT_CASUAL:
+    case OPS_CERT_POSITIVE:
+    case OPS_SIG_REV_CERT:
+	if(arg->last_seen == ID)
+	    valid=ops_check_user_id_certification_signature(&arg->pkey,
+							    &arg->user_id,
+							    sig,
+							    ops_get_public_key_from_data(signer),
+							    arg->rarg->key->packets[arg->rarg->packet].raw);
+	else
+	    valid=ops_check_user_attribute_certification_signature(&arg->pkey,
+								   &arg->user_attribute,
+								   sig,
+								   ops_get_public_key_from_data(signer),
+								   arg->rarg->key->packets[arg->rarg->packet].raw);
+	break;
+
+    case OPS_SIG_SUBKEY:
+	// XXX: we should also check that the signer is the key we are validating, I think.
+	valid=ops_check_subkey_signature(&arg->pkey,&arg->subkey,
+					 sig,
+					 ops_get_public_key_from_data(signer),
+					 arg->rarg->key->packets[arg->rarg->packet].raw);
+	break;
+
+    case OPS_SIG_DIRECT:
+	valid=ops_check_direct_signature(&arg->pkey,sig,
+					 ops_get_public_key_from_data(signer),
+					 arg->rarg->key->packets[arg->rarg->packet].raw);
+	break;
 
-    // copy key ptr to array
-    start=(sizeof *sig) * (result->invalid_count-1);
-    copy_signature_info(result->invalid_sigs+start, sig);
+    case OPS_SIG_STANDALONE:
+    case OPS_SIG_PRIMARY:
+    case OPS_SIG_REV_KEY:
+    case OPS_SIG_REV_SUBKEY:
+    case OPS_SIG_TIMESTAMP:
+    case OPS_SIG_3RD_PARTY:
+	OPS_ERROR_1(errors, OPS_E_UNIMPLEMENTED,
+		    "Verification of signature type 0x%02x not yet implemented\n", sig->info.type);
+	break;
+
+    default:
+	OPS_ERROR_1(errors, OPS_E_UNIMPLEMENTED,
+		    "Unexpected signature type 0x%02x\n", sig->info.type);
+	}
+
+    return valid;
     }
 
-static void add_sig_to_unknown_list(ops_validate_result_t * result, const ops_signature_info_t *sig)
+// A digest of what a key signature covers, for the verification
+// cache. Returns ops_false for types of signature that aren't checked.
+static ops_boolean_t key_signature_digest(unsigned char digest[OPS_SHA1_HASH_SIZE],
+					  const validate_key_cb_arg_t *arg,
+					  const ops_signature_t *sig)
     {
-    size_t newsize;
-    size_t start;
+    ops_hash_t hash;
 
-    // increment count
-    ++result->unknown_signer_count;
+    ops_hash_sha1(&hash);
+    hash.init(&hash);
+    ops_hash_add_public_key(&hash,&arg->pkey);
 
-    // increase size of array
-    newsize=(sizeof *sig) * result->unknown_signer_count;
-    if (!result->unknown_sigs)
-        result->unknown_sigs=malloc(newsize);
-    else
-        result->unknown_sigs=realloc(result->unknown_sigs, newsize);
+    switch(sig->info.type)
+	{
+    case OPS_CERT_GENERIC:
+    case OPS_CERT_PERSONA:
+    case OPS_CERT_CASUAL:
+    case OPS_CERT_POSITIVE:
+    case OPS_SIG_REV_CERT:
+	if(arg->last_seen == ID)
+	    {
+	    size_t len=strlen((char *)arg->user_id.user_id);
+
+	    ops_hash_add_int(&hash,0xb4,1);
+	    ops_hash_add_int(&hash,len,4);
+	    hash.add(&hash,arg->user_id.user_id,len);
+	    }
+	else
+	    {
+	    ops_hash_add_int(&hash,0xd1,1);
+	    ops_hash_add_int(&hash,arg->user_attribute.data.len,4);
+	    hash.add(&hash,arg->user_attribute.data.contents,
+		     arg->user_attribute.data.len);
+	    }
+	break;
+
+    case OPS_SIG_SUBKEY:
+	ops_hash_add_public_key(&hash,&arg->subkey);
+	break;
 
-    // copy key id to array
-    start=OPS_KEY_ID_SIZE * (result->unknown_signer_count-1);
-    copy_signature_info(result->unknown_sigs+start, sig);
+    case OPS_SIG_DIRECT:
+	break;
+
+    default:
+	hash.finish(&hash,digest);
+	return ops_false;
+	}
+
+    hash.finish(&hash,digest);
+    return ops_true;
     }
 
 ops_parse_cb_return_t
@@ -197,6 +334,10 @@ ops_validate_key_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cb
     ops_error_t **errors=ops_parse_cb_get_errors(cbinfo);
     const ops_keydata_t *signer;
     ops_boolean_t valid=ops_false;
+    ops_verify_cache_t *cache;
+    unsigned char digest[OPS_SHA1_HASH_SIZE];
+    ops_boolean_t cacheable=ops_false;
+    ops_boolean_t cached=ops_false;
 
     if (debug)
         printf("%s\n",ops_show_packet_tag(content_->tag));
@@ -251,57 +392,22 @@ ops_validate_key_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cb
 	    break;
 	    }
 
-	switch(content->signature.info.type)
+	cache=arg->keyring->verify_cache;
+	if(cache && key_signature_digest(digest,arg,&content->signature))
 	    {
-	case OPS_CERT_GENERIC:
-	case OPS_CERT_PERSONA:
-	case OPS_CERT_CASUAL:
-	case OPS_CERT_POSITIVE:
-	case OPS_SIG_REV_CERT:
-	    if(arg->last_seen == ID)
-		valid=ops_check_user_id_certification_signature(&arg->pkey,
-								&arg->user_id,
-								&content->signature,
-								ops_get_public_key_from_data(signer),
-								arg->rarg->key->packets[arg->rarg->packet].raw);
-	    else
-		valid=ops_check_user_attribute_certification_signature(&arg->pkey,
-								       &arg->user_attribute,
-								       &content->signature,
-								       ops_get_public_key_from_data(signer),
-								       arg->rarg->key->packets[arg->rarg->packet].raw);
-		
-	    break;
-
-	case OPS_SIG_SUBKEY:
-	    // XXX: we should also check that the signer is the key we are validating, I think.
-	    valid=ops_check_subkey_signature(&arg->pkey,&arg->subkey,
-	     	    &content->signature,
-		    ops_get_public_key_from_data(signer),
-		    arg->rarg->key->packets[arg->rarg->packet].raw);
-	    break;
-
-	case OPS_SIG_DIRECT:
-	    valid=ops_check_direct_signature(&arg->pkey,&content->signature,
-		    ops_get_public_key_from_data(signer),
-		    arg->rarg->key->packets[arg->rarg->packet].raw);
-	    break;
-
-    case OPS_SIG_STANDALONE:
-    case OPS_SIG_PRIMARY:
-    case OPS_SIG_REV_KEY:
-    case OPS_SIG_REV_SUBKEY:
-    case OPS_SIG_TIMESTAMP:
-    case OPS_SIG_3RD_PARTY:
-        OPS_ERROR_1(errors, OPS_E_UNIMPLEMENTED,
-                    "Verification of signature type 0x%02x not yet implemented\n", content->signature.info.type);
-                    break;
-
-	default:
-            OPS_ERROR_1(errors, OPS_E_UNIMPLEMENTED,
-                    "Unexpected signature type 0x%02x\n", content->signature.info.type);
+	    cacheable=ops_true;
+	    cached=ops_verify_cache_lookup(cache,&content->signature,
+					   &signer->fingerprint,
+					   digest,sizeof digest,&valid);
 	    }
 
+	if(!cached)
+	    valid=check_key_signature(arg,&content->signature,signer,errors);
+	if(cacheable && !cached)
+	    ops_verify_cache_store(cache,&content->signature,
+				   &signer->fingerprint,digest,sizeof digest,
+				   valid);
+
 	if(valid)
 	    {
         //	    printf(" validated\n");
@@ -339,6 +445,18 @@ ops_validate_key_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cb
     return OPS_RELEASE_MEMORY;
     }
 
+static void free_cleartext_hash(validate_data_cb_arg_t *arg)
+    {
+    unsigned char out[OPS_MAX_HASH_SIZE];
+
+    if(!arg->cleartext_hash)
+	return;
+    if(arg->cleartext_hash->data)
+	arg->cleartext_hash->finish(arg->cleartext_hash,out);
+    free(arg->cleartext_hash);
+    arg->cleartext_hash=NULL;
+    }
+
 ops_parse_cb_return_t
 validate_data_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo)
     {
@@ -347,7 +465,7 @@ validate_data_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinf
     ops_error_t **errors=ops_parse_cb_get_errors(cbinfo);
     const ops_keydata_t *signer;
     ops_boolean_t valid=ops_false;
-    ops_memory_t* mem=NULL;
+    ops_hash_t *hash;
 
     if (debug)
         printf("%s\n",ops_show_packet_tag(content_->tag));
@@ -363,20 +481,16 @@ validate_data_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinf
         break;
 
     case OPS_PTAG_CT_LITERAL_DATA_BODY:
-        arg->data.literal_data_body=content->literal_data_body;
-        arg->use=LITERAL_DATA;
-        return OPS_KEEP_MEMORY;
-        break;
-
+    case OPS_PTAG_CT_LITERAL_DATA_SLICE:
     case OPS_PTAG_CT_SIGNED_CLEARTEXT_BODY:
-        arg->data.signed_cleartext_body=content->signed_cleartext_body;
-        arg->use=SIGNED_CLEARTEXT;
-        return OPS_KEEP_MEMORY;
+        // already hashed, by the parser or the dearmouring reader
         break;
 
     case OPS_PTAG_CT_SIGNED_CLEARTEXT_TRAILER:
-        // this gives us an ops_hash_t struct
-        break;
+        // this gives us an ops_hash_t struct, for the signature to follow
+        free_cleartext_hash(arg);
+        arg->cleartext_hash=content->signed_cleartext_trailer.hash;
+        return OPS_KEEP_MEMORY;
 
     case OPS_PTAG_CT_SIGNATURE: // V3 sigs
     case OPS_PTAG_CT_SIGNATURE_FOOTER: // V4 sigs
@@ -402,37 +516,30 @@ validate_data_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinf
             break;
             }
         
-        mem=ops_memory_new();
-        ops_memory_init(mem,128);
-        
         switch(content->signature.info.type)
             {
         case OPS_SIG_BINARY:
         case OPS_SIG_TEXT:
-            switch(arg->use)
+            // the hash started by the matching one-pass signature, or
+            // the hash of signed cleartext
+            hash=content->signature.hash;
+            if(!hash && arg->cleartext_hash && arg->cleartext_hash->data
+               && arg->cleartext_hash->algorithm
+                  == content->signature.info.hash_algorithm)
+                hash=arg->cleartext_hash;
+            if(!hash)
                 {
-            case LITERAL_DATA:
-                ops_memory_add(mem,
-                               arg->data.literal_data_body.data,
-                               arg->data.literal_data_body.length);
-                break;
-                
-            case SIGNED_CLEARTEXT:
-                ops_memory_add(mem,
-                               arg->data.signed_cleartext_body.data,
-                               arg->data.signed_cleartext_body.length);
-                break;
-                
-            default:
-                OPS_ERROR_1(errors,OPS_E_UNIMPLEMENTED,"Unimplemented Sig Use %d", arg->use);
-                printf(" Unimplemented Sig Use %d\n", arg->use);
+                OPS_ERROR(errors,OPS_E_V_NO_SIGNATURE,
+                          "No hashed data for signature");
                 break;
                 }
             
-            valid=check_binary_signature(ops_memory_get_length(mem), 
-                                         ops_memory_get_data(mem),
+            valid=check_binary_signature(hash,
                                          &content->signature,
-                                         ops_get_public_key_from_data(signer));
+                                         signer,
+                                         arg->keyring->verify_cache);
+            if(hash == arg->cleartext_hash)
+                free_cleartext_hash(arg);
             break;
 
         default:
@@ -441,7 +548,6 @@ validate_data_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinf
             break;
             
 	    }
-    ops_memory_free(mem);
 
 	if(valid)
 	    {
@@ -510,7 +616,10 @@ ops_boolean_t validate_result_status(ops_validate_result_t* result)
  * \param cb_get_passphrase Callback to use to get passphrase
  * \return ops_true if all signatures OK; else ops_false
  * \note It is the caller's responsiblity to free result after use.
+ * \note If keyring has a verify_cache, results found there are used
+ * instead of checking signatures again, and new results are added.
  * \sa ops_validate_result_free()
+ * \sa ops_verify_cache_new()
  
  Example Code:
 \code
@@ -588,7 +697,157 @@ ops_boolean_t ops_validate_all_signatures(ops_validate_result_t *result,
 
     memset(result,'\0',sizeof *result);
     for(n=0 ; n < ring->nkeys ; ++n)
-        ops_validate_key_signatures(result,&ring->keys[n],ring, cb_get_passphrase);
+        ops_validate_key_signatures(result,ring->keys[n],ring, cb_get_passphrase);
+    return validate_result_status(result);
+    }
+
+/* Parallel validation */
+
+// by default, keys are handed out to workers this many at a time
+#define VALIDATE_CHUNK_KEYS	16
+
+typedef struct
+    {
+    const ops_keyring_t *keyring;
+    ops_parse_cb_t *cb_get_passphrase;
+    ops_validate_result_t *chunks; /*!< the results for each chunk of keys */
+    int chunk_keys;		/*!< the number of keys in each chunk */
+    int nchunks;
+    int next_chunk;		/*!< the next chunk to be validated */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;	/*!< protects next_chunk */
+#endif
+    } validate_all_arg_t;
+
+// Validate chunks of keys until there are none left. Runs in each worker.
+static void *validate_chunks(void *arg_)
+    {
+    validate_all_arg_t *arg=arg_;
+    const ops_keyring_t *keyring=arg->keyring;
+
+    for( ; ; )
+	{
+	int chunk;
+	int n;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&arg->lock);
+#endif
+	chunk=arg->next_chunk++;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&arg->lock);
+#endif
+	if(chunk >= arg->nchunks)
+	    break;
+
+	for(n=chunk*arg->chunk_keys ;
+	    n < keyring->nkeys && n < (chunk+1)*arg->chunk_keys ; ++n)
+	    ops_validate_key_signatures(&arg->chunks[chunk],keyring->keys[n],
+					keyring,arg->cb_get_passphrase);
+	}
+
+    return NULL;
+    }
+
+// Move the signatures in src onto the end of those in dst
+static void append_sig_list(ops_signature_info_t **dst,unsigned *dst_count,
+			    ops_signature_info_t *src,unsigned src_count)
+    {
+    if(!src_count)
+	return;
+
+    *dst=realloc(*dst,(*dst_count+src_count)*sizeof **dst);
+    memcpy(&(*dst)[*dst_count],src,src_count*sizeof *src);
+    *dst_count+=src_count;
+    free(src);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Validate all signatures on all keys in a keyring, using
+   several threads
+   \param result Where to put the result
+   \param ring Keyring to use
+   \param cb_get_passphrase Callback to use to get passphrase, which
+   may be called from any of the threads
+   \param nthreads Number of threads to use, or 0 for one per CPU
+   \param chunk_keys Number of keys handed to a thread at a time, or 0
+   for the default
+   \return ops_true if all signatures OK; else ops_false
+
+   The keys are shared out among the threads chunk_keys at a time as
+   they become free. A keyring of no more than one chunk is validated
+   on the calling thread alone. The result is the same, and in the
+   same order, as that of ops_validate_all_signatures().
+
+   \note It is the caller's responsibility to free result after use.
+   \sa ops_validate_all_signatures()
+*/
+ops_boolean_t ops_validate_all_signatures_parallel(ops_validate_result_t *result,
+                                 const ops_keyring_t *ring,
+                                 ops_parse_cb_return_t cb_get_passphrase (const ops_parser_content_t *, ops_parse_cb_info_t *),
+				 unsigned nthreads,unsigned chunk_keys)
+    {
+    validate_all_arg_t arg;
+    int n;
+
+    if(!nthreads)
+	nthreads=ops_default_nthreads();
+    if(!chunk_keys)
+	chunk_keys=VALIDATE_CHUNK_KEYS;
+
+    if(nthreads == 1 || ring->nkeys <= (int)chunk_keys)
+	return ops_validate_all_signatures(result,ring,cb_get_passphrase);
+
+    memset(&arg,'\0',sizeof arg);
+    arg.keyring=ring;
+    arg.cb_get_passphrase=cb_get_passphrase;
+    arg.chunk_keys=chunk_keys;
+    arg.nchunks=(ring->nkeys+chunk_keys-1)/chunk_keys;
+    arg.chunks=ops_mallocz(arg.nchunks*sizeof *arg.chunks);
+    if(nthreads > (unsigned)arg.nchunks)
+	nthreads=arg.nchunks;
+
+#ifdef HAVE_PTHREAD_H
+    {
+    pthread_t *threads=malloc(nthreads*sizeof *threads);
+    ops_boolean_t *started=ops_mallocz(nthreads*sizeof *started);
+    unsigned t;
+
+    pthread_mutex_init(&arg.lock,NULL);
+
+    // this thread is worker 0; if a thread can't be started, the others
+    // simply take on its share
+    for(t=1 ; t < nthreads ; ++t)
+	started[t]=!pthread_create(&threads[t],NULL,validate_chunks,&arg);
+    validate_chunks(&arg);
+    for(t=1 ; t < nthreads ; ++t)
+	if(started[t])
+	    pthread_join(threads[t],NULL);
+
+    pthread_mutex_destroy(&arg.lock);
+    free(started);
+    free(threads);
+    }
+#else
+    validate_chunks(&arg);
+#endif
+
+    // merge in key order
+    memset(result,'\0',sizeof *result);
+    for(n=0 ; n < arg.nchunks ; ++n)
+	{
+	ops_validate_result_t *chunk=&arg.chunks[n];
+
+	append_sig_list(&result->valid_sigs,&result->valid_count,
+			chunk->valid_sigs,chunk->valid_count);
+	append_sig_list(&result->invalid_sigs,&result->invalid_count,
+			chunk->invalid_sigs,chunk->invalid_count);
+	append_sig_list(&result->unknown_sigs,&result->unknown_signer_count,
+			chunk->unknown_sigs,chunk->unknown_signer_count);
+	}
+    free(arg.chunks);
+
     return validate_result_status(result);
     }
 
@@ -603,12 +862,10 @@ void ops_validate_result_free(ops_validate_result_t *result)
     if (!result)
         return;
 
-    if (result->valid_sigs)
-        free_signature_info(result->valid_sigs);
-    if (result->invalid_sigs)
-        free_signature_info(result->invalid_sigs);
-    if (result->unknown_sigs)
-        free_signature_info(result->unknown_sigs);
+    free_signature_info_list(result->valid_sigs,result->valid_count);
+    free_signature_info_list(result->invalid_sigs,result->invalid_count);
+    free_signature_info_list(result->unknown_sigs,
+			     result->unknown_signer_count);
 
     free(result);
     result=NULL;
@@ -625,6 +882,12 @@ void ops_validate_result_free(ops_validate_result_t *result)
    \note After verification, result holds the details of all keys which 
    have passed, failed and not been recognised.
    \note It is the caller's responsiblity to call ops_validate_result_free(result) after use.
+   \note As for ops_validate_key_signatures(), keyring's verify_cache
+   is used if it has one.
+   \note The signed data is hashed as it is read, so it is never held
+   in memory, however large it is. Each signature on literal data must
+   therefore follow a one-pass signature packet, as ops_sign_file()
+   writes.
 
 Example code:
 \code
@@ -649,15 +912,44 @@ void example(const char* filename, const int armoured, const ops_keyring_t* keyr
 */
 ops_boolean_t ops_validate_file(ops_validate_result_t *result, const char* filename, const int armoured, const ops_keyring_t* keyring)
     {
+    return ops_validate_file_pipelined(result, filename, armoured, keyring,
+				       0, 0);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief As ops_validate_file(), but reading the file ahead on a thread
+   of its own, so that disk latency overlaps with hashing
+   \param result Where to put the result
+   \param filename Name of file to be validated
+   \param armoured Treat file as armoured, if set
+   \param keyring Keyring to use
+   \param nbuffers Number of buffers to read ahead into, or 0 to read as
+   ops_validate_file() does
+   \param buffer_size Size of each buffer, or 0 for
+   OPS_PIPELINE_DEFAULT_BUFFER_SIZE
+   \return ops_true if signatures validate successfully; ops_false if
+   signatures fail or there are no signatures
+*/
+ops_boolean_t ops_validate_file_pipelined(ops_validate_result_t *result,
+					  const char* filename,
+					  const int armoured,
+					  const ops_keyring_t* keyring,
+					  unsigned nbuffers,size_t buffer_size)
+    {
     ops_parse_info_t *pinfo=NULL;
     validate_data_cb_arg_t validate_arg;
 
     int fd=0;
 
     //
-    fd=ops_setup_file_read(&pinfo, filename, &validate_arg, validate_data_cb, ops_true);
+    fd=ops_setup_file_read_pipelined(&pinfo, filename, &validate_arg,
+				     validate_data_cb, ops_false, nbuffers,
+				     buffer_size);
     if (fd < 0)
         return ops_false;
+    // the parser hashes literal data, so we needn't have it copied
+    ops_parse_borrow_bodies(pinfo, ops_true);
 
     // Set verification reader and handling options
 
@@ -684,6 +976,7 @@ ops_boolean_t ops_validate_file(ops_validate_result_t *result, const char* filen
         }
 
     // Tidy up
+    free_cleartext_hash(&validate_arg);
     if (armoured)
         ops_reader_pop_dearmour(pinfo);
     ops_teardown_file_read(pinfo, fd);
@@ -710,7 +1003,9 @@ ops_boolean_t ops_validate_mem(ops_validate_result_t *result, ops_memory_t* mem,
     validate_data_cb_arg_t validate_arg;
 
     //
-    ops_setup_memory_read(&pinfo, mem, &validate_arg, validate_data_cb, ops_true);
+    ops_setup_memory_read(&pinfo, mem, &validate_arg, validate_data_cb, ops_false);
+    // the parser hashes literal data straight from mem
+    ops_parse_borrow_bodies(pinfo, ops_true);
 
     // Set verification reader and handling options
 
@@ -737,6 +1032,7 @@ ops_boolean_t ops_validate_mem(ops_validate_result_t *result, ops_memory_t* mem,
         }
 
     // Tidy up
+    free_cleartext_hash(&validate_arg);
     if (armoured)
         ops_reader_pop_dearmour(pinfo);
     ops_teardown_memory_read(pinfo, mem);
@@ -744,4 +1040,449 @@ ops_boolean_t ops_validate_mem(ops_validate_result_t *result, ops_memory_t* mem,
     return validate_result_status(result);
     }
 
+/* Detached signatures */
+
+// how much of the data is read from an fd at a time
+#define DETACHED_READ_SIZE	65536
+// how much of the data is given to a lone hash at a time; the most it
+// can take is an unsigned
+#define DETACHED_HASH_SIZE	(1 << 20)
+
+typedef struct
+    {
+    DECLARE_ARRAY(ops_signature_t,sigs);
+    } detached_arg_t;
+
+// Keep every signature, for when the data has been hashed
+static ops_parse_cb_return_t
+detached_signature_cb(const ops_parser_content_t *content_,
+		      ops_parse_cb_info_t *cbinfo)
+    {
+    detached_arg_t *arg=ops_parse_cb_get_arg(cbinfo);
+
+    switch(content_->tag)
+	{
+    case OPS_PTAG_CT_SIGNATURE: // V3 sigs
+    case OPS_PTAG_CT_SIGNATURE_FOOTER: // V4 sigs
+	EXPAND_ARRAY(arg,sigs);
+	arg->sigs[arg->nsigs++]=content_->content.signature;
+	return OPS_KEEP_MEMORY;
+
+    default:
+	break;
+	}
+    return OPS_RELEASE_MEMORY;
+    }
+
+// Add data to each of the hashes. As for one-pass signatures, several
+// algorithms take it a cache-sized block at a time; one takes it in
+// large blocks.
+static void add_to_hashes(ops_hash_t *hashes,unsigned nhashes,
+			  const unsigned char *data,size_t length)
+    {
+    size_t block=nhashes > 1 ? OPS_HASH_BLOCK_SIZE : DETACHED_HASH_SIZE;
+    unsigned n;
+
+    while(length)
+	{
+	size_t l=length < block ? length : block;
+
+	for(n=0 ; n < nhashes ; ++n)
+	    hashes[n].add(&hashes[n],data,l);
+	data+=l;
+	length-=l;
+	}
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+// If fd is a regular file, hash the rest of it straight from a mapping
+// of it, and leave fd at its end
+static ops_boolean_t hash_mapped(ops_hash_t *hashes,unsigned nhashes,int fd)
+    {
+    struct stat st;
+    off_t offset;
+    unsigned char *map;
+
+    if(fstat(fd,&st) < 0 || !S_ISREG(st.st_mode)
+       || (off_t)(size_t)st.st_size != st.st_size)
+	return ops_false;
+    offset=lseek(fd,0,SEEK_CUR);
+    if(offset < 0 || offset >= st.st_size)
+	return ops_false;
+
+    map=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    if(map == MAP_FAILED)
+	return ops_false;
+#ifdef MADV_SEQUENTIAL
+    madvise(map,st.st_size,MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+    madvise(map,st.st_size,MADV_WILLNEED);
+#endif
+
+    add_to_hashes(hashes,nhashes,map+offset,st.st_size-offset);
+
+    munmap(map,st.st_size);
+    lseek(fd,st.st_size,SEEK_SET);
+    return ops_true;
+    }
+#endif
+
+// Hash all of source, returning ops_false if it couldn't be read
+static ops_boolean_t hash_source(ops_hash_t *hashes,unsigned nhashes,
+				 const ops_validate_source_t *source)
+    {
+    unsigned char *buffer;
+    ops_boolean_t ret=ops_true;
+
+    if(source->fd < 0)
+	{
+	add_to_hashes(hashes,nhashes,source->buffer,source->length);
+	return ops_true;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+    if(hash_mapped(hashes,nhashes,source->fd))
+	return ops_true;
+#endif
+
+    buffer=malloc(DETACHED_READ_SIZE);
+    for( ; ; )
+	{
+	int n=read(source->fd,buffer,DETACHED_READ_SIZE);
+
+	if(n < 0 && errno == EINTR)
+	    continue;
+	if(n < 0)
+	    ret=ops_false;
+	if(n <= 0)
+	    break;
+	add_to_hashes(hashes,nhashes,buffer,n);
+	}
+    free(buffer);
+
+    return ret;
+    }
+
+typedef struct
+    {
+    ops_signature_t sig;
+    const ops_keydata_t *signer; /*!< NULL if not in the keyring */
+    unsigned char *trailer;	/*!< what is hashed after the data */
+    size_t trailer_length;	/*!< 0 if this signature can't be checked
+				  against data */
+    } context_signature_t;
+
+struct ops_validate_context
+    {
+    DECLARE_ARRAY(context_signature_t,sigs);
+    DECLARE_ARRAY(ops_hash_algorithm_t,algorithms); /*!< those the
+						       checkable signatures
+						       use */
+    ops_verify_cache_t *cache;
+    };
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Reads a detached signature, ready to check it against any
+   number of copies of the data
+   \param signature The detached signature, which may hold several
+   signatures over the same data
+   \param armoured Treat the signature as armoured, if set
+   \param keyring Keyring to use, which must outlast the context
+   \return The new context
+   \note Each signature is parsed, its signer found and the signer's
+   key decoded, and the bytes hashed after the data made up, once
+   here rather than for every copy checked.
+   \note As for ops_validate_file(), keyring's verify_cache is used if
+   it has one.
+   \note The context is not changed by checks, so several threads may
+   use it at once. Free it with ops_validate_context_free().
+   \sa ops_validate_context_check()
+   \sa ops_validate_context_check_hash()
+*/
+ops_validate_context_t *
+ops_validate_context_new(const ops_validate_source_t *signature,
+			 const int armoured,const ops_keyring_t *keyring)
+    {
+    ops_validate_context_t *context=ops_mallocz(sizeof *context);
+    ops_parse_info_t *pinfo=ops_parse_info_new();
+    detached_arg_t arg;
+    unsigned n,m;
+
+    memset(&arg,'\0',sizeof arg);
+    ops_parse_cb_set(pinfo,detached_signature_cb,&arg);
+    if(signature->fd < 0)
+	ops_reader_set_memory(pinfo,signature->buffer,signature->length);
+    else
+	ops_reader_set_fd(pinfo,signature->fd);
+    if(armoured)
+	ops_reader_push_dearmour(pinfo);
+    ops_parse(pinfo);
+    if(armoured)
+	ops_reader_pop_dearmour(pinfo);
+    ops_parse_info_delete(pinfo);
+
+    context->cache=keyring->verify_cache;
+    for(n=0 ; n < arg.nsigs ; ++n)
+	{
+	context_signature_t *csig;
+	ops_hash_algorithm_t alg=arg.sigs[n].info.hash_algorithm;
+
+	EXPAND_ARRAY(context,sigs);
+	csig=&context->sigs[context->nsigs++];
+	memset(csig,'\0',sizeof *csig);
+	csig->sig=arg.sigs[n];
+	csig->signer=ops_keyring_find_key_by_id(keyring,
+						csig->sig.info.signer_id);
+	if(!csig->signer || !ops_is_hash_alg_supported(&alg)
+	   || (csig->sig.info.type != OPS_SIG_BINARY
+	       && csig->sig.info.type != OPS_SIG_TEXT))
+	    continue;
+	csig->trailer_length=binary_signature_trailer(&csig->trailer,
+						      &csig->sig);
+	if(!csig->trailer_length)
+	    continue;
+	ops_get_public_key_from_data(csig->signer);
+
+	for(m=0 ; m < context->nalgorithms ; ++m)
+	    if(context->algorithms[m] == alg)
+		break;
+	if(m == context->nalgorithms)
+	    {
+	    EXPAND_ARRAY(context,algorithms);
+	    context->algorithms[context->nalgorithms++]=alg;
+	    }
+	}
+    free(arg.sigs);
+
+    return context;
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Frees a context made by ops_validate_context_new()
+   \param context The context, which may be NULL
+*/
+void ops_validate_context_free(ops_validate_context_t *context)
+    {
+    unsigned n;
+
+    if(!context)
+	return;
+    for(n=0 ; n < context->nsigs ; ++n)
+	{
+	ops_signature_free(&context->sigs[n].sig);
+	free(context->sigs[n].trailer);
+	}
+    free(context->sigs);
+    free(context->algorithms);
+    free(context);
+    }
+
+// Check one signature, given a hash of the data with its algorithm,
+// which is left untouched, or NULL if there isn't one
+static void check_context_signature(ops_validate_result_t *result,
+				    const ops_validate_context_t *context,
+				    const context_signature_t *csig,
+				    const ops_hash_t *hash)
+    {
+    ops_boolean_t valid=ops_false;
+
+    if(!csig->signer)
+	{
+	add_sig_to_unknown_list(result,&csig->sig.info);
+	return;
+	}
+
+    if(hash && csig->trailer_length)
+	{
+	ops_hash_t copy;
+	unsigned char hashout[OPS_MAX_HASH_SIZE];
+	unsigned n;
+
+	ops_hash_dup(&copy,hash);
+	copy.add(&copy,csig->trailer,csig->trailer_length);
+	n=copy.finish(&copy,hashout);
+	valid=check_binary_digest(hashout,n,&csig->sig,csig->signer,
+				  context->cache);
+	}
+
+    if(valid)
+	add_sig_to_valid_list(result,&csig->sig.info);
+    else
+	add_sig_to_invalid_list(result,&csig->sig.info);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Checks a detached signature read by ops_validate_context_new()
+   against a copy of the data
+   \param result Where to put the result
+   \param context The signature
+   \param data The signed data
+   \return ops_true if the signatures validate successfully; ops_false
+   if any fail, their signers are unknown, there are none, or the data
+   can't be read
+   \note The data is read once, and hashed once with each hash
+   algorithm the signatures use, as by ops_validate_detached().
+   \note It is the caller's responsiblity to call ops_validate_result_free(result) after use.
+*/
+ops_boolean_t ops_validate_context_check(ops_validate_result_t *result,
+					 const ops_validate_context_t *context,
+					 const ops_validate_source_t *data)
+    {
+    ops_hash_t *hashes;
+    unsigned char out[OPS_MAX_HASH_SIZE];
+    ops_boolean_t read_ok;
+    unsigned n,m;
+
+    // one hash for each algorithm
+    hashes=malloc((context->nalgorithms+1)*sizeof *hashes);
+    for(m=0 ; m < context->nalgorithms ; ++m)
+	{
+	ops_hash_any(&hashes[m],context->algorithms[m]);
+	hashes[m].init(&hashes[m]);
+	}
+
+    read_ok=hash_source(hashes,context->nalgorithms,data);
+
+    for(n=0 ; read_ok && n < context->nsigs ; ++n)
+	{
+	const context_signature_t *csig=&context->sigs[n];
+
+	for(m=0 ; m < context->nalgorithms ; ++m)
+	    if(hashes[m].algorithm == csig->sig.info.hash_algorithm)
+		break;
+	check_context_signature(result,context,csig,
+				m < context->nalgorithms ? &hashes[m] : NULL);
+	}
+
+    for(m=0 ; m < context->nalgorithms ; ++m)
+	hashes[m].finish(&hashes[m],out);
+    free(hashes);
+
+    return read_ok && validate_result_status(result);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Checks a detached signature read by ops_validate_context_new()
+   against data that has already been hashed
+   \param result Where to put the result
+   \param context The signature
+   \param hash A hash that has been fed the signed data, and not
+   finished. It is not changed, so it can be used again.
+   \return ops_true if the signatures validate successfully; ops_false
+   if any fail, their signers are unknown, or there are none
+   \note Signatures that use a different hash algorithm from hash fail.
+   \note It is the caller's responsiblity to call ops_validate_result_free(result) after use.
+*/
+ops_boolean_t ops_validate_context_check_hash(ops_validate_result_t *result,
+					      const ops_validate_context_t *context,
+					      const ops_hash_t *hash)
+    {
+    unsigned n;
+
+    for(n=0 ; n < context->nsigs ; ++n)
+	{
+	const context_signature_t *csig=&context->sigs[n];
+
+	check_context_signature(result,context,csig,
+				csig->sig.info.hash_algorithm == hash->algorithm
+				? hash : NULL);
+	}
+
+    return validate_result_status(result);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Verifies a detached signature
+   \param result Where to put the result
+   \param data The signed data
+   \param signature The detached signature, which may hold several
+   signatures over the same data
+   \param armoured Treat the signature as armoured, if set
+   \param keyring Keyring to use
+   \return ops_true if the signatures validate successfully; ops_false
+   if any fail, their signers are unknown, or there are none
+   \note The data is read once, whatever the number of signatures,
+   and hashed once with each hash algorithm they use. If it is read
+   from a regular file, the file is mapped into memory where that is
+   possible, and hashed straight from there.
+   \note As for ops_validate_file(), keyring's verify_cache is used if
+   it has one.
+   \note To check the same signature against several copies of the
+   data, use ops_validate_context_new() instead.
+   \note It is the caller's responsiblity to call ops_validate_result_free(result) after use.
+*/
+ops_boolean_t ops_validate_detached(ops_validate_result_t *result,
+				    const ops_validate_source_t *data,
+				    const ops_validate_source_t *signature,
+				    const int armoured,
+				    const ops_keyring_t *keyring)
+    {
+    ops_validate_context_t *context;
+    ops_boolean_t ret;
+
+    context=ops_validate_context_new(signature,armoured,keyring);
+    ret=ops_validate_context_check(result,context,data);
+    ops_validate_context_free(context);
+
+    return ret;
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Verifies a file against a detached signature in another file
+   \param result Where to put the result
+   \param data_filename Name of the signed file
+   \param signature_filename Name of the file holding the signature
+   \param armoured Treat the signature as armoured, if set
+   \param keyring Keyring to use
+   \return ops_true if the signatures validate successfully; ops_false
+   if either file can't be opened, any signature fails, its signer is
+   unknown, or there are none
+   \note The signed file does not go through the parser at all; it is
+   mapped into memory, if possible, and hashed from there in large
+   blocks, so a large file is verified at about the speed of the hash.
+   \note It is the caller's responsiblity to call ops_validate_result_free(result) after use.
+   \sa ops_validate_detached()
+*/
+ops_boolean_t ops_validate_detached_file(ops_validate_result_t *result,
+					 const char *data_filename,
+					 const char *signature_filename,
+					 const int armoured,
+					 const ops_keyring_t *keyring)
+    {
+    ops_validate_source_t data;
+    ops_validate_source_t signature;
+    ops_boolean_t ret;
+
+    memset(&data,'\0',sizeof data);
+    memset(&signature,'\0',sizeof signature);
+
+    data.fd=open(data_filename,O_RDONLY | O_BINARY);
+    if(data.fd < 0)
+	{
+	perror(data_filename);
+	return ops_false;
+	}
+    signature.fd=open(signature_filename,O_RDONLY | O_BINARY);
+    if(signature.fd < 0)
+	{
+	perror(signature_filename);
+	close(data.fd);
+	return ops_false;
+	}
+
+    ret=ops_validate_detached(result,&data,&signature,armoured,keyring);
+
+    close(signature.fd);
+    close(data.fd);
+
+    return ret;
+    }
+
 // eof
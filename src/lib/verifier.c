@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/** \file
+ * \brief Verification of many detached signatures against one keyring.
+ *
+ * A verifier owns its keyring, which is indexed and has every key's
+ * material decoded when the verifier is made, so nothing is left to do
+ * per job but read, hash and check. Jobs are run in batches by a pool
+ * of threads that lasts as long as the verifier.
+ */
+
+#include <openpgpsdk/verifier.h>
+#include <openpgpsdk/keyring.h>
+#include <openpgpsdk/util.h>
+#include "keyring_local.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include <openpgpsdk/final.h>
+
+#ifdef HAVE_PTHREAD_H
+# define LOCK(v)	pthread_mutex_lock(&(v)->lock)
+# define UNLOCK(v)	pthread_mutex_unlock(&(v)->lock)
+#else
+# define LOCK(v)
+# define UNLOCK(v)
+#endif
+
+struct ops_verifier
+    {
+    ops_keyring_t keyring;
+    ops_verify_job_t *jobs;	/*!< the batch being run, if any */
+    unsigned njobs;
+    unsigned next_job;		/*!< the next job to be handed out */
+    unsigned unfinished;	/*!< jobs in the batch not yet finished */
+    ops_boolean_t stopping;	/*!< the workers should exit */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;	/*!< protects all of the above but keyring */
+    pthread_cond_t work;	/*!< signalled when a batch starts, or
+				  the workers should stop */
+    pthread_cond_t done;	/*!< signalled when a batch finishes */
+    pthread_t *threads;
+    unsigned nthreads;		/*!< workers that were started */
+#endif
+    };
+
+#ifndef WIN32
+static unsigned long usecs_since(const struct timeval *start)
+    {
+    struct timeval now;
+
+    gettimeofday(&now,NULL);
+    return (now.tv_sec-start->tv_sec)*1000000UL+now.tv_usec-start->tv_usec;
+    }
+#endif
+
+// Open filename if it is set, and point source at it
+static ops_boolean_t open_source(ops_validate_source_t *source,
+				 const char *filename,
+				 const ops_validate_source_t *given,
+				 int *sys_errno)
+    {
+    *source=*given;
+    if(!filename)
+	return ops_true;
+
+    source->fd=open(filename,O_RDONLY | O_BINARY);
+    if(source->fd < 0)
+	{
+	*sys_errno=errno;
+	return ops_false;
+	}
+    return ops_true;
+    }
+
+static void run_job(ops_verifier_t *verifier,ops_verify_job_t *job)
+    {
+    ops_validate_source_t data;
+    ops_validate_source_t signature;
+#ifndef WIN32
+    struct timeval start;
+
+    gettimeofday(&start,NULL);
+#endif
+    job->valid=ops_false;
+    job->result=ops_mallocz(sizeof *job->result);
+    job->sys_errno=0;
+
+    if(open_source(&data,job->data_filename,&job->data,&job->sys_errno))
+	{
+	if(open_source(&signature,job->signature_filename,&job->signature,
+		       &job->sys_errno))
+	    {
+	    job->valid=ops_validate_detached(job->result,&data,&signature,
+					     job->armoured,&verifier->keyring);
+	    if(job->signature_filename)
+		close(signature.fd);
+	    }
+	if(job->data_filename)
+	    close(data.fd);
+	}
+
+#ifndef WIN32
+    job->usecs=usecs_since(&start);
+#else
+    job->usecs=0;
+#endif
+    }
+
+// Run jobs from the current batch until there are none left to hand
+// out. Called, and returns, with the lock held.
+static void run_jobs(ops_verifier_t *verifier)
+    {
+    while(verifier->next_job < verifier->njobs)
+	{
+	ops_verify_job_t *job=&verifier->jobs[verifier->next_job++];
+
+	UNLOCK(verifier);
+	run_job(verifier,job);
+	LOCK(verifier);
+#ifdef HAVE_PTHREAD_H
+	if(!--verifier->unfinished)
+	    pthread_cond_broadcast(&verifier->done);
+#else
+	--verifier->unfinished;
+#endif
+	}
+    }
+
+#ifdef HAVE_PTHREAD_H
+static void *worker(void *verifier_)
+    {
+    ops_verifier_t *verifier=verifier_;
+
+    LOCK(verifier);
+    for( ; ; )
+	{
+	while(!verifier->stopping && verifier->next_job >= verifier->njobs)
+	    pthread_cond_wait(&verifier->work,&verifier->lock);
+	if(verifier->stopping)
+	    break;
+	run_jobs(verifier);
+	}
+    UNLOCK(verifier);
+
+    return NULL;
+    }
+#endif
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Creates a verifier for detached signatures
+   \param keyring Keys to verify against, which are moved into the
+   verifier, so that keyring is left empty
+   \param nthreads Number of threads to verify with, or 0 for one per CPU
+   \return New verifier, to be freed with ops_verifier_free()
+
+   The keyring is indexed, and the key material of every key is
+   decoded, now rather than during the first jobs. If the keyring has
+   a verify_cache, it is used for every job.
+*/
+ops_verifier_t *ops_verifier_new(ops_keyring_t *keyring,unsigned nthreads)
+    {
+    ops_verifier_t *verifier=ops_mallocz(sizeof *verifier);
+    int n;
+
+    verifier->keyring=*keyring;
+    memset(keyring,'\0',sizeof *keyring);
+    ops_keyring_index_update(&verifier->keyring);
+    for(n=0 ; n < verifier->keyring.nkeys ; ++n)
+	ops_get_public_key_from_data(verifier->keyring.keys[n]);
+
+    if(!nthreads)
+	nthreads=ops_default_nthreads();
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&verifier->lock,NULL);
+    pthread_cond_init(&verifier->work,NULL);
+    pthread_cond_init(&verifier->done,NULL);
+
+    // the thread calling ops_verifier_run() makes up the number; if a
+    // thread can't be started, the others simply take on its share
+    verifier->threads=malloc(nthreads*sizeof *verifier->threads);
+    while(verifier->nthreads+1 < nthreads
+	  && !pthread_create(&verifier->threads[verifier->nthreads],NULL,
+			     worker,verifier))
+	++verifier->nthreads;
+#endif
+
+    return verifier;
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Frees a verifier, its threads and its keyring
+   \param verifier Verifier to free
+   \note No batch may be running.
+*/
+void ops_verifier_free(ops_verifier_t *verifier)
+    {
+#ifdef HAVE_PTHREAD_H
+    unsigned t;
+
+    LOCK(verifier);
+    verifier->stopping=ops_true;
+    pthread_cond_broadcast(&verifier->work);
+    UNLOCK(verifier);
+    for(t=0 ; t < verifier->nthreads ; ++t)
+	pthread_join(verifier->threads[t],NULL);
+    free(verifier->threads);
+
+    pthread_cond_destroy(&verifier->done);
+    pthread_cond_destroy(&verifier->work);
+    pthread_mutex_destroy(&verifier->lock);
+#endif
+    ops_keyring_free(&verifier->keyring);
+    free(verifier);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Gets the keyring a verifier checks signatures against
+   \param verifier Verifier
+   \return Its keyring
+*/
+const ops_keyring_t *ops_verifier_get_keyring(const ops_verifier_t *verifier)
+    { return &verifier->keyring; }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Verifies a batch of detached signatures
+   \param verifier Verifier to use
+   \param jobs The data and signatures to verify
+   \param njobs Number of jobs
+
+   The jobs are shared out among the verifier's threads, and the calling
+   thread, and this returns when all of them are done. Each job's
+   valid, result, sys_errno and usecs are filled in.
+
+   \note Batches from different threads are run one after the other.
+   \note It is the caller's responsibility to free each job's result
+   with ops_validate_result_free().
+   \sa ops_validate_detached()
+*/
+void ops_verifier_run(ops_verifier_t *verifier,ops_verify_job_t *jobs,
+		      unsigned njobs)
+    {
+    LOCK(verifier);
+#ifdef HAVE_PTHREAD_H
+    while(verifier->jobs)
+	pthread_cond_wait(&verifier->done,&verifier->lock);
+#endif
+
+    verifier->jobs=jobs;
+    verifier->njobs=njobs;
+    verifier->next_job=0;
+    verifier->unfinished=njobs;
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_broadcast(&verifier->work);
+#endif
+
+    run_jobs(verifier);
+#ifdef HAVE_PTHREAD_H
+    while(verifier->unfinished)
+	pthread_cond_wait(&verifier->done,&verifier->lock);
+#endif
+
+    verifier->jobs=NULL;
+    verifier->njobs=0;
+    verifier->next_job=0;
+#ifdef HAVE_PTHREAD_H
+    // let in any batch that is waiting
+    pthread_cond_broadcast(&verifier->done);
+#endif
+    UNLOCK(verifier);
+    }
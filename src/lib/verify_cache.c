@@ -0,0 +1,587 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** \file
+ * \brief A cache of signature verification results.
+ *
+ * A result is filed under a digest of the signature, the signer's
+ * fingerprint and a digest of the data that was signed, so a hit
+ * means exactly this signature by exactly this key over exactly this
+ * data has been checked before. The most recently used results are
+ * kept in memory; if a file is attached, every result is also appended
+ * to it and any results it already holds are used as a second tier.
+ */
+
+#include <openpgpsdk/verify_cache.h>
+#include <openpgpsdk/crypto.h>
+#include <openpgpsdk/util.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include <openpgpsdk/final.h>
+
+#ifdef HAVE_PTHREAD_H
+# define LOCK(c)	pthread_mutex_lock(&(c)->lock)
+# define UNLOCK(c)	pthread_mutex_unlock(&(c)->lock)
+#else
+# define LOCK(c)
+# define UNLOCK(c)
+#endif
+
+#define KEY_SIZE	OPS_SHA1_HASH_SIZE
+
+// Records in the cache file are a kind byte, the key, the length of the
+// signer's fingerprint and the fingerprint
+#define RECORD_GOOD	'G'
+#define RECORD_BAD	'B'
+#define RECORD_REVOKE	'R'	/* forget everything signed by this signer */
+#define RECORD_SIZE	(1+KEY_SIZE+1+20)
+
+typedef struct entry
+    {
+    unsigned char key[KEY_SIZE];
+    ops_fingerprint_t signer;
+    ops_boolean_t valid;
+    struct entry *next;		/*!< next in the hash chain */
+    struct entry *newer;	/*!< LRU list, memory tier only */
+    struct entry *older;
+    } entry_t;
+
+typedef struct
+    {
+    entry_t **buckets;
+    unsigned size;		/*!< always a power of 2 */
+    unsigned count;
+    } table_t;
+
+struct ops_verify_cache
+    {
+    table_t memory;
+    unsigned capacity;
+    entry_t *newest;
+    entry_t *oldest;
+    table_t file;		/*!< results read from or written to fp */
+    FILE *fp;
+    unsigned long hits;
+    unsigned long misses;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
+    };
+
+static unsigned key_hash(const unsigned char key[KEY_SIZE])
+    { return key[0] | key[1] << 8 | key[2] << 16 | key[3] << 24; }
+
+static void table_init(table_t *table,unsigned size)
+    {
+    table->size=1;
+    while(table->size < size)
+	table->size <<= 1;
+    table->buckets=ops_mallocz(table->size*sizeof *table->buckets);
+    table->count=0;
+    }
+
+static entry_t *table_find(const table_t *table,
+			   const unsigned char key[KEY_SIZE])
+    {
+    entry_t *entry;
+
+    for(entry=table->buckets[key_hash(key)&(table->size-1)] ; entry ;
+	entry=entry->next)
+	if(!memcmp(entry->key,key,KEY_SIZE))
+	    return entry;
+    return NULL;
+    }
+
+static void table_insert(table_t *table,entry_t *entry)
+    {
+    entry_t **bucket;
+
+    if(table->count >= table->size)
+	{
+	entry_t **old=table->buckets;
+	unsigned size=table->size;
+	unsigned n;
+
+	table_init(table,size*2);
+	for(n=0 ; n < size ; ++n)
+	    while(old[n])
+		{
+		entry_t *e=old[n];
+
+		old[n]=e->next;
+		table_insert(table,e);
+		}
+	free(old);
+	}
+
+    bucket=&table->buckets[key_hash(entry->key)&(table->size-1)];
+    entry->next=*bucket;
+    *bucket=entry;
+    ++table->count;
+    }
+
+static void table_remove(table_t *table,const entry_t *entry)
+    {
+    entry_t **p;
+
+    for(p=&table->buckets[key_hash(entry->key)&(table->size-1)] ; *p ;
+	p=&(*p)->next)
+	if(*p == entry)
+	    {
+	    *p=entry->next;
+	    --table->count;
+	    return;
+	    }
+    }
+
+static void table_free(table_t *table)
+    {
+    unsigned n;
+
+    for(n=0 ; n < table->size ; ++n)
+	while(table->buckets[n])
+	    {
+	    entry_t *entry=table->buckets[n];
+
+	    table->buckets[n]=entry->next;
+	    free(entry);
+	    }
+    free(table->buckets);
+    table->buckets=NULL;
+    table->count=0;
+    }
+
+static ops_boolean_t same_signer(const ops_fingerprint_t *a,
+				 const ops_fingerprint_t *b)
+    {
+    return a->length == b->length
+	&& !memcmp(a->fingerprint,b->fingerprint,a->length);
+    }
+
+// Remove, and free, every entry in table made by signer, calling
+// unlink on each first
+static void table_remove_signer(ops_verify_cache_t *cache,table_t *table,
+				const ops_fingerprint_t *signer,
+				void (*unlink)(ops_verify_cache_t *,entry_t *))
+    {
+    unsigned n;
+
+    for(n=0 ; n < table->size ; ++n)
+	{
+	entry_t **p=&table->buckets[n];
+
+	while(*p)
+	    {
+	    entry_t *entry=*p;
+
+	    if(!same_signer(&entry->signer,signer))
+		{
+		p=&entry->next;
+		continue;
+		}
+	    *p=entry->next;
+	    --table->count;
+	    if(unlink)
+		unlink(cache,entry);
+	    free(entry);
+	    }
+	}
+    }
+
+static void lru_unlink(ops_verify_cache_t *cache,entry_t *entry)
+    {
+    if(entry->newer)
+	entry->newer->older=entry->older;
+    else
+	cache->newest=entry->older;
+    if(entry->older)
+	entry->older->newer=entry->newer;
+    else
+	cache->oldest=entry->newer;
+    }
+
+static void lru_push(ops_verify_cache_t *cache,entry_t *entry)
+    {
+    entry->newer=NULL;
+    entry->older=cache->newest;
+    if(cache->newest)
+	cache->newest->newer=entry;
+    else
+	cache->oldest=entry;
+    cache->newest=entry;
+    }
+
+// Add a result to the memory tier, evicting the least recently used
+// result if it is full
+static void memory_add(ops_verify_cache_t *cache,
+		       const unsigned char key[KEY_SIZE],
+		       const ops_fingerprint_t *signer,ops_boolean_t valid)
+    {
+    entry_t *entry=table_find(&cache->memory,key);
+
+    if(entry)
+	{
+	entry->valid=valid;
+	lru_unlink(cache,entry);
+	lru_push(cache,entry);
+	return;
+	}
+
+    if(cache->memory.count >= cache->capacity)
+	{
+	entry=cache->oldest;
+	lru_unlink(cache,entry);
+	table_remove(&cache->memory,entry);
+	}
+    else
+	entry=malloc(sizeof *entry);
+
+    memcpy(entry->key,key,KEY_SIZE);
+    entry->signer=*signer;
+    entry->valid=valid;
+    table_insert(&cache->memory,entry);
+    lru_push(cache,entry);
+    }
+
+static void file_add(ops_verify_cache_t *cache,
+		     const unsigned char key[KEY_SIZE],
+		     const ops_fingerprint_t *signer,ops_boolean_t valid)
+    {
+    entry_t *entry=table_find(&cache->file,key);
+
+    if(!entry)
+	{
+	entry=ops_mallocz(sizeof *entry);
+	memcpy(entry->key,key,KEY_SIZE);
+	table_insert(&cache->file,entry);
+	}
+    entry->signer=*signer;
+    entry->valid=valid;
+    }
+
+static void write_record(ops_verify_cache_t *cache,int kind,
+			 const unsigned char key[KEY_SIZE],
+			 const ops_fingerprint_t *signer)
+    {
+    unsigned char record[RECORD_SIZE];
+
+    memset(record,'\0',sizeof record);
+    record[0]=kind;
+    if(key)
+	memcpy(&record[1],key,KEY_SIZE);
+    record[1+KEY_SIZE]=signer->length;
+    memcpy(&record[2+KEY_SIZE],signer->fingerprint,signer->length);
+
+    if(fwrite(record,sizeof record,1,cache->fp) == 1)
+	fflush(cache->fp);
+    }
+
+static void hash_add_bignum(ops_hash_t *hash,const BIGNUM *bn)
+    {
+    unsigned n=bn ? BN_num_bytes(bn) : 0;
+    unsigned char *buf=malloc(n+1);
+
+    if(n)
+	BN_bn2bin(bn,buf);
+    ops_hash_add_int(hash,n,4);
+    hash->add(hash,buf,n);
+    free(buf);
+    }
+
+// The key a result is filed under. Each part is length-prefixed where
+// its length can vary, so different inputs can't run together.
+static void make_key(unsigned char key[KEY_SIZE],const ops_signature_t *sig,
+		     const ops_fingerprint_t *signer,
+		     const unsigned char *digest,unsigned digest_length)
+    {
+    const ops_signature_info_t *info=&sig->info;
+    ops_hash_t hash;
+
+    ops_hash_sha1(&hash);
+    hash.init(&hash);
+
+    ops_hash_add_int(&hash,info->version,1);
+    ops_hash_add_int(&hash,info->type,1);
+    ops_hash_add_int(&hash,info->creation_time,4);
+    hash.add(&hash,info->signer_id,OPS_KEY_ID_SIZE);
+    ops_hash_add_int(&hash,info->key_algorithm,1);
+    ops_hash_add_int(&hash,info->hash_algorithm,1);
+    ops_hash_add_int(&hash,info->v4_hashed_data_length,4);
+    if(info->v4_hashed_data)
+	hash.add(&hash,info->v4_hashed_data,info->v4_hashed_data_length);
+
+    switch(info->key_algorithm)
+	{
+    case OPS_PKA_RSA:
+    case OPS_PKA_RSA_SIGN_ONLY:
+	hash_add_bignum(&hash,info->signature.rsa.sig);
+	break;
+
+    case OPS_PKA_DSA:
+	hash_add_bignum(&hash,info->signature.dsa.r);
+	hash_add_bignum(&hash,info->signature.dsa.s);
+	break;
+
+    case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
+	hash_add_bignum(&hash,info->signature.elgamal.r);
+	hash_add_bignum(&hash,info->signature.elgamal.s);
+	break;
+
+    default:
+	ops_hash_add_int(&hash,info->signature.unknown.data.len,4);
+	hash.add(&hash,info->signature.unknown.data.contents,
+		 info->signature.unknown.data.len);
+	}
+
+    ops_hash_add_int(&hash,signer->length,1);
+    hash.add(&hash,signer->fingerprint,signer->length);
+    ops_hash_add_int(&hash,digest_length,1);
+    hash.add(&hash,digest,digest_length);
+
+    hash.finish(&hash,key);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Creates a verification cache
+   \param capacity The number of results to keep in memory, or 0 for
+   OPS_VERIFY_CACHE_DEFAULT_CAPACITY
+   \return The new cache
+   \note To use it, set the verify_cache field of the keyring that
+   signers are looked up in. Free it with ops_verify_cache_free().
+*/
+ops_verify_cache_t *ops_verify_cache_new(unsigned capacity)
+    {
+    ops_verify_cache_t *cache=ops_mallocz(sizeof *cache);
+
+    if(!capacity)
+	capacity=OPS_VERIFY_CACHE_DEFAULT_CAPACITY;
+    cache->capacity=capacity;
+    table_init(&cache->memory,capacity);
+    table_init(&cache->file,64);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&cache->lock,NULL);
+#endif
+
+    return cache;
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Frees a verification cache, closing its file if it has one
+   \param cache The cache, which must not be attached to any keyring
+   still in use
+*/
+void ops_verify_cache_free(ops_verify_cache_t *cache)
+    {
+    if(!cache)
+	return;
+    if(cache->fp)
+	fclose(cache->fp);
+    table_free(&cache->memory);
+    table_free(&cache->file);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&cache->lock);
+#endif
+    free(cache);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Gives a verification cache a persistent file tier
+   \param cache The cache
+   \param filename The file, which is created if it doesn't exist
+   \return ops_true if OK; ops_false if the file can't be opened
+
+   The results already in the file are loaded, and every result stored
+   or signer invalidated from now on is appended to it, so results
+   survive from one run to the next. Results that drop out of memory
+   are still found in the file tier.
+
+   \note The file tier is held in memory in full and the file only
+   ever grows; remove it to start again.
+*/
+ops_boolean_t ops_verify_cache_open_file(ops_verify_cache_t *cache,
+					 const char *filename)
+    {
+    unsigned char record[RECORD_SIZE];
+    FILE *fp=fopen(filename,"a+b");
+
+    if(!fp)
+	return ops_false;
+
+    LOCK(cache);
+    if(cache->fp)
+	fclose(cache->fp);
+    cache->fp=fp;
+
+    rewind(fp);
+    while(fread(record,sizeof record,1,fp) == 1)
+	{
+	ops_fingerprint_t signer;
+
+	signer.length=record[1+KEY_SIZE];
+	if(signer.length > sizeof signer.fingerprint)
+	    continue;
+	memcpy(signer.fingerprint,&record[2+KEY_SIZE],signer.length);
+
+	switch(record[0])
+	    {
+	case RECORD_GOOD:
+	case RECORD_BAD:
+	    file_add(cache,&record[1],&signer,record[0] == RECORD_GOOD);
+	    break;
+
+	case RECORD_REVOKE:
+	    table_remove_signer(cache,&cache->file,&signer,NULL);
+	    break;
+	    }
+	}
+    // a partly written last record is skipped, and appends go to the end
+    fseek(fp,0,SEEK_END);
+    UNLOCK(cache);
+
+    return ops_true;
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Looks up the result of checking a signature
+   \param cache The cache
+   \param sig The signature
+   \param signer The signer's fingerprint
+   \param digest A digest of the data that was signed
+   \param digest_length Length of digest
+   \param valid Set to the result, if it is found
+   \return ops_true if the result was found; else ops_false
+*/
+ops_boolean_t ops_verify_cache_lookup(ops_verify_cache_t *cache,
+				      const ops_signature_t *sig,
+				      const ops_fingerprint_t *signer,
+				      const unsigned char *digest,
+				      unsigned digest_length,
+				      ops_boolean_t *valid)
+    {
+    unsigned char key[KEY_SIZE];
+    entry_t *entry;
+    ops_boolean_t found=ops_true;
+
+    make_key(key,sig,signer,digest,digest_length);
+
+    LOCK(cache);
+    if((entry=table_find(&cache->memory,key)))
+	{
+	*valid=entry->valid;
+	lru_unlink(cache,entry);
+	lru_push(cache,entry);
+	}
+    else if((entry=table_find(&cache->file,key)))
+	{
+	*valid=entry->valid;
+	memory_add(cache,key,signer,*valid);
+	}
+    else
+	found=ops_false;
+
+    if(found)
+	++cache->hits;
+    else
+	++cache->misses;
+    UNLOCK(cache);
+
+    return found;
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Records the result of checking a signature
+   \param cache The cache
+   \param sig The signature
+   \param signer The signer's fingerprint
+   \param digest A digest of the data that was signed
+   \param digest_length Length of digest
+   \param valid The result
+*/
+void ops_verify_cache_store(ops_verify_cache_t *cache,
+			    const ops_signature_t *sig,
+			    const ops_fingerprint_t *signer,
+			    const unsigned char *digest,
+			    unsigned digest_length,
+			    ops_boolean_t valid)
+    {
+    unsigned char key[KEY_SIZE];
+
+    make_key(key,sig,signer,digest,digest_length);
+
+    LOCK(cache);
+    memory_add(cache,key,signer,valid);
+    if(cache->fp)
+	{
+	file_add(cache,key,signer,valid);
+	write_record(cache,valid ? RECORD_GOOD : RECORD_BAD,key,signer);
+	}
+    UNLOCK(cache);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Forgets every result for signatures made by a signer
+   \param cache The cache
+   \param signer The signer's fingerprint
+
+   This should be called whenever the signer's key changes in a way
+   that could affect whether its signatures are acceptable, such as
+   being revoked. ops_keyring_import() does it for every key that
+   gains packets, if the keyring has a cache.
+*/
+void ops_verify_cache_invalidate_signer(ops_verify_cache_t *cache,
+					const ops_fingerprint_t *signer)
+    {
+    LOCK(cache);
+    table_remove_signer(cache,&cache->memory,signer,lru_unlink);
+    if(cache->fp)
+	{
+	table_remove_signer(cache,&cache->file,signer,NULL);
+	write_record(cache,RECORD_REVOKE,NULL,signer);
+	}
+    UNLOCK(cache);
+    }
+
+/**
+   \ingroup HighLevel_Verify
+   \brief Gets the number of lookups that did and didn't find a result
+   \param cache The cache
+   \param hits Set to the number of lookups that found a result
+   \param misses Set to the number of lookups that didn't
+*/
+void ops_verify_cache_get_stats(const ops_verify_cache_t *cache,
+				unsigned long *hits,unsigned long *misses)
+    {
+    *hits=cache->hits;
+    *misses=cache->misses;
+    }
@@ -231,7 +231,12 @@ void ops_writer_push(ops_create_info_t *info,
 		     ops_writer_destroyer_t *destroyer,
 		     void *arg)
     {
-    ops_writer_info_t *copy=ops_mallocz(sizeof *copy);
+    ops_writer_info_t *copy=info->spare_winfo;
+
+    if(copy)
+	info->spare_winfo=copy->next;
+    else
+	copy=malloc(sizeof *copy);
 
     assert(info->winfo.writer);
     *copy=info->winfo;
@@ -257,7 +262,30 @@ void ops_writer_pop(ops_create_info_t *info)
     next=info->winfo.next;
     info->winfo=*next;
 
-    free(next);
+    // Keep the node for the next push
+    next->next=info->spare_winfo;
+    info->spare_winfo=next;
+    }
+
+/*
+ * Destroy every writer in info, top down, keeping the nodes of the
+ * stack as spares.
+ */
+void writer_stack_delete(ops_create_info_t *info)
+    {
+    // we should have finalised before deleting
+    assert(!info->winfo.finaliser);
+    while(info->winfo.next)
+	{
+	info->winfo.finaliser=NULL;
+	ops_writer_pop(info);
+	}
+    if(info->winfo.destroyer)
+	{
+	info->winfo.destroyer(&info->winfo);
+	info->winfo.destroyer=NULL;
+	}
+    info->winfo.writer=NULL;
     }
 
 /**
@@ -271,7 +299,7 @@ ops_boolean_t ops_writer_close(ops_create_info_t *info)
     {
     ops_boolean_t ret=writer_info_finalise(&info->errors,&info->winfo);
 
-    writer_info_delete(&info->winfo);
+    writer_stack_delete(info);
 
     return ret;
     }
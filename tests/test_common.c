@@ -20,6 +20,7 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -756,6 +757,53 @@ void reset_vars()
         }
     }
 
+/*
+ * Break the signature on the signed file dir/name.suffix by changing a
+ * letter of the signed text, which is that of the file dir/name. The
+ * case of the letter is changed, so clearsigned text stays well formed.
+ */
+void corrupt_signed_text(const char *name, const char *suffix)
+    {
+    char filename[MAXBUF+1];
+    ops_memory_t *plain=NULL;
+    ops_memory_t *mem=NULL;
+    const unsigned char *text;
+    unsigned char *data;
+    size_t window=16;
+    size_t middle;
+    size_t n;
+    int errnum=0;
+    FILE *fp=NULL;
+
+    snprintf(filename, sizeof filename, "%s/%s", dir, name);
+    plain=ops_write_mem_from_file(filename, &errnum);
+    assert(errnum == 0);
+    snprintf(filename, sizeof filename, "%s/%s.%s", dir, name, suffix);
+    mem=ops_write_mem_from_file(filename, &errnum);
+    assert(errnum == 0);
+
+    // a stretch from the middle of the text, as it appears in the file
+    text=ops_memory_get_data(plain);
+    data=ops_memory_get_data(mem);
+    middle=ops_memory_get_length(plain)/2;
+    assert(ops_memory_get_length(plain) >= middle+window);
+    for (n=0 ; n+window <= ops_memory_get_length(mem) ; ++n)
+        if (!memcmp(data+n, text+middle, window))
+            break;
+    assert(n+window <= ops_memory_get_length(mem));
+    while (!isalpha(data[n]))
+        ++n;
+
+    fp=fopen(filename, "r+b");
+    assert(fp);
+    fseek(fp, n, SEEK_SET);
+    fputc(data[n]^0x20, fp);
+    fclose(fp);
+
+    ops_memory_free(plain);
+    ops_memory_free(mem);
+    }
+
 int file_compare(char* file1, char* file2)
     {
     FILE *fp1=NULL;
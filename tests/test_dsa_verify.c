@@ -195,8 +195,10 @@ int init_suite_dsa_verify(void)
              gpgcmd, alphadsa_name, dir, filename_dsa_clearsign_fail_bad_sig);
     if (run(cmd))
         { return 1; }
-    // sig will be turned bad on verification
-    // \todo make sig bad here instead
+    // break the signatures that should fail to verify
+    corrupt_signed_text(filename_dsa_noarmour_fail_bad_sig, "gpg");
+    corrupt_signed_text(filename_dsa_v3sig_fail_bad_sig, "gpg");
+    corrupt_signed_text(filename_dsa_clearsign_fail_bad_sig, "asc");
 
     // compression
 
@@ -460,59 +462,12 @@ static void test_dsa_verify_clearsign_passphrase(void)
     test_dsa_verify_ok(armour,filename_dsa_clearsign_passphrase);
     }
 
-static ops_parse_cb_return_t callback_bad_sig(const ops_parser_content_t* content_, ops_parse_cb_info_t *cbinfo)
-    {
-    int target;
-    unsigned char* data;
-    unsigned char orig;
-    switch (content_->tag)
-        {
-    case OPS_PTAG_CT_SIGNED_CLEARTEXT_BODY:
-    case OPS_PTAG_CT_LITERAL_DATA_BODY:
-        // change something in the signed text to break the sig
-        switch (content_->tag)
-            {
-        case OPS_PTAG_CT_SIGNED_CLEARTEXT_BODY:
-            target=content_->content.signed_cleartext_body.length;
-            orig=content_->content.signed_cleartext_body.data[target];
-            data=(unsigned char*) &content_->content.signed_cleartext_body.data[0];
-            break;
-
-        case OPS_PTAG_CT_LITERAL_DATA_BODY:
-            target=content_->content.literal_data_body.length;
-            orig=content_->content.literal_data_body.data[target];
-            data=(unsigned char*) &content_->content.literal_data_body.data[0];
-            break;
-
-        default:
-            assert(0);
-            }
-
-        if (target==0)
-            {
-            fprintf(stderr,"Nothing in text body to change!!\n");
-            break;
-            }
-
-        // change a byte somewhere near the middle
-        target/=2;
-        // remove const-ness so we can change it
-        data[target]= ~orig;
-        assert(orig!=content_->content.signed_cleartext_body.data[target]);
-        break;
-
-    default:
-        break;
-        }
-    return callback_verify(content_,cbinfo);
-    }
-
 static void test_dsa_verify_noarmour_fail_bad_sig(void)
     {
     int armour=0;
     assert(pub_keyring.nkeys);
 
-    test_dsa_verify_fail(armour,filename_dsa_noarmour_fail_bad_sig,callback_bad_sig,OPS_E_V_BAD_SIGNATURE);
+    test_dsa_verify_fail(armour,filename_dsa_noarmour_fail_bad_sig,callback_verify,OPS_E_V_BAD_SIGNATURE);
     }
 
 static void test_dsa_verify_v3sig_fail_bad_sig(void)
@@ -520,7 +475,7 @@ static void test_dsa_verify_v3sig_fail_bad_sig(void)
     int armour=0;
     assert(pub_keyring.nkeys);
 
-    test_dsa_verify_fail(armour,filename_dsa_v3sig_fail_bad_sig, callback_bad_sig, OPS_E_V_BAD_SIGNATURE);
+    test_dsa_verify_fail(armour,filename_dsa_v3sig_fail_bad_sig, callback_verify, OPS_E_V_BAD_SIGNATURE);
     }
 
 static void test_dsa_verify_clearsign_fail_bad_sig(void)
@@ -528,7 +483,7 @@ static void test_dsa_verify_clearsign_fail_bad_sig(void)
     int armour=1;
     assert(pub_keyring.nkeys);
 
-    test_dsa_verify_fail(armour,filename_dsa_clearsign_fail_bad_sig,callback_bad_sig,OPS_E_V_BAD_SIGNATURE);
+    test_dsa_verify_fail(armour,filename_dsa_clearsign_fail_bad_sig,callback_verify,OPS_E_V_BAD_SIGNATURE);
     }
 
 CU_pSuite suite_dsa_verify()
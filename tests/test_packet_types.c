@@ -33,6 +33,8 @@
 #include "openpgpsdk/compress.h"
 #include "openpgpsdk/literal.h"
 #include "openpgpsdk/readerwriter.h"
+#include "openpgpsdk/packet-index.h"
+#include "openpgpsdk/armour.h"
 #include "openpgpsdk/random.h"
 #include "../src/lib/parse_local.h"
 
@@ -286,6 +288,86 @@ static void check_error(ops_create_info_t *cinfo,
         }
     }
 
+// Raises its errors from one place
+static void unknown_tag(ops_error_t **errors, unsigned tag)
+    {
+    OPS_ERROR_1(errors, OPS_E_P_UNKNOWN_TAG, "Unknown tag %u", tag);
+    }
+
+static void test_repeated_errors()
+    {
+    ops_error_t *errors=NULL;
+    ops_error_t *err;
+    ops_error_t *more=NULL;
+    unsigned n;
+
+    // The same error with the same comment from the same place is
+    // entered once and counted
+    for (n=0 ; n < 1000 ; ++n)
+	{
+	unknown_tag(&errors, n%4);
+	OPS_ERROR(&errors, OPS_E_W_WRITE_FAILED, error_message);
+	}
+
+    CU_ASSERT(errors != NULL);
+    CU_ASSERT(errors->errcode == OPS_E_W_WRITE_FAILED);
+    CU_ASSERT(errors->count == 1000);
+    CU_ASSERT(strcmp(errors->comment, error_message) == 0);
+
+    // but different comments from there are kept apart
+    for (n=0, err=errors->next ; err ; ++n, err=err->next)
+	{
+	char comment[20];
+
+	snprintf(comment, sizeof comment, "Unknown tag %u", 3-n);
+	CU_ASSERT(err->errcode == OPS_E_P_UNKNOWN_TAG);
+	CU_ASSERT(err->count == 250);
+	CU_ASSERT(strcmp(err->comment, comment) == 0);
+	}
+    CU_ASSERT(n == 4);
+
+    // A repeat goes to the top
+    unknown_tag(&errors, 1);
+    CU_ASSERT(errors->errcode == OPS_E_P_UNKNOWN_TAG);
+    CU_ASSERT(errors->count == 251);
+    CU_ASSERT(strcmp(errors->comment, "Unknown tag 1") == 0);
+    CU_ASSERT(errors->next->errcode == OPS_E_W_WRITE_FAILED);
+    for (n=0, err=errors ; err ; err=err->next)
+	++n;
+    CU_ASSERT(n == 5);
+
+    // as does one that was moved on from another stack
+    unknown_tag(&more, 2);
+    unknown_tag(&more, 7);
+    for (err=errors ; err->next ; err=err->next)
+	;
+    err->next=more;
+    unknown_tag(&errors, 7);
+    CU_ASSERT(errors->count == 2);
+    CU_ASSERT(strcmp(errors->comment, "Unknown tag 7") == 0);
+    for (n=0, err=errors ; err ; err=err->next)
+	{
+	if (strcmp(err->comment, "Unknown tag 2") == 0)
+	    CU_ASSERT(err->count == 251);
+	++n;
+	}
+    CU_ASSERT(n == 6);
+    CU_ASSERT(ops_has_error(errors, OPS_E_P_UNKNOWN_TAG));
+    ops_free_errors(errors);
+
+    // A long stack is indexed, and finds its repeats just the same
+    errors=NULL;
+    for (n=0 ; n < 100 ; ++n)
+	unknown_tag(&errors, n%20);
+    for (n=0, err=errors ; err ; err=err->next)
+	{
+	CU_ASSERT(err->count == 5);
+	++n;
+	}
+    CU_ASSERT(n == 20);
+    ops_free_errors(errors);
+    }
+
 static void test_small_streamed_literal_data_packet_error()
     {
       char* testtext = create_testtext("literal packet error", 10);
@@ -514,6 +596,98 @@ static void test_large_streamed_literal_data_packet_text() {
   streamed_literal_data_packet_text(2048, 2, 1024);
 }
 
+static void test_packet_index()
+    {
+    ops_create_info_t *cinfo=NULL;
+    ops_memory_t *partial=NULL;
+    ops_memory_t *plain=NULL;
+    ops_memory_t *written=NULL;
+    ops_packet_index_t *index=ops_packet_index_new();
+    ops_packet_index_t *copy=ops_packet_index_new();
+    const ops_packet_index_entry_t *first;
+    const ops_packet_index_entry_t *second;
+    ops_error_t *errors=NULL;
+    char filename[MAXBUF+1];
+    unsigned char *in=ops_mallocz(5120);
+    size_t total;
+    int fd;
+    unsigned n;
+
+    create_testdata("packet index", in, 5120);
+
+    // a literal data packet in partial chunks, then one that isn't
+    ops_setup_memory_write(&cinfo,&partial,5120);
+    ops_writer_push_literal_with_opts(cinfo,1024);
+    CU_ASSERT(ops_write(in,5120,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+
+    ops_setup_memory_write(&cinfo,&plain,1024);
+    ops_write_literal_data_from_buf(in,100,OPS_LDT_BINARY,cinfo);
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+
+    snprintf(filename,MAXBUF,"%s/%s",dir,"packet_index.gpg");
+    fd=open(filename,O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,0600);
+    CU_ASSERT_FATAL(fd >= 0);
+    write(fd,ops_memory_get_data(partial),ops_memory_get_length(partial));
+    write(fd,ops_memory_get_data(plain),ops_memory_get_length(plain));
+    close(fd);
+    total=ops_memory_get_length(partial)+ops_memory_get_length(plain);
+
+    fd=open(filename,O_RDONLY | O_BINARY);
+    CU_ASSERT_FATAL(fd >= 0);
+    CU_ASSERT(ops_packet_index_build(index,fd,&errors));
+    CU_ASSERT(errors == NULL);
+    close(fd);
+
+    CU_ASSERT_FATAL(ops_packet_index_count(index) == 2);
+    first=ops_packet_index_get(index,0);
+    second=ops_packet_index_get(index,1);
+    CU_ASSERT(ops_packet_index_get(index,2) == NULL);
+
+    CU_ASSERT(first->tag == OPS_PTAG_CT_LITERAL_DATA);
+    CU_ASSERT(first->partial);
+    CU_ASSERT(first->header_offset == 0);
+    CU_ASSERT(first->body_offset == 2);
+    // the chunk lengths aren't counted
+    CU_ASSERT(first->length > 5120);
+    CU_ASSERT(first->length < (off_t)ops_memory_get_length(partial)-2);
+
+    CU_ASSERT(second->tag == OPS_PTAG_CT_LITERAL_DATA);
+    CU_ASSERT(!second->partial);
+    CU_ASSERT(second->header_offset == (off_t)ops_memory_get_length(partial));
+    CU_ASSERT(second->body_offset+second->length == (off_t)total);
+
+    // and it reads back as it was written
+    ops_setup_memory_write(&cinfo,&written,128);
+    CU_ASSERT(ops_packet_index_write(index,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    CU_ASSERT(ops_packet_index_read(copy,ops_memory_get_data(written),
+				    ops_memory_get_length(written)));
+    CU_ASSERT_FATAL(ops_packet_index_count(copy) == 2);
+    for (n=0 ; n < 2 ; ++n)
+	{
+	const ops_packet_index_entry_t *a=ops_packet_index_get(index,n);
+	const ops_packet_index_entry_t *b=ops_packet_index_get(copy,n);
+
+	CU_ASSERT(a->tag == b->tag);
+	CU_ASSERT(a->partial == b->partial);
+	CU_ASSERT(a->header_offset == b->header_offset);
+	CU_ASSERT(a->body_offset == b->body_offset);
+	CU_ASSERT(a->length == b->length);
+	}
+    CU_ASSERT(!ops_packet_index_read(copy,ops_memory_get_data(written),
+				     ops_memory_get_length(written)-1));
+
+    ops_teardown_memory_write(cinfo,written);
+    ops_memory_free(partial);
+    ops_memory_free(plain);
+    ops_packet_index_free(index);
+    ops_packet_index_free(copy);
+    free(in);
+    }
+
 static void test_literal_data_packet_data()
     {
     ops_create_info_t *cinfo=NULL;
@@ -717,6 +891,61 @@ static void test_compressed_large_data_error()
     free(testtext);
     }
 
+static void test_reset_contexts()
+    {
+    // One create and one parse context, reset between messages, must
+    // each time do what new ones would
+    ops_create_info_t *cinfo=ops_create_info_new();
+    ops_create_info_t *cinfo_out=ops_create_info_new();
+    ops_parse_info_t *pinfo=ops_parse_info_new();
+    ops_memory_t *mem=ops_memory_new();
+    ops_memory_t *mem_out=ops_memory_new();
+    unsigned n;
+
+    for (n=0 ; n < 3 ; ++n)
+	{
+	char *testtext=create_testtext("reset contexts", n+1);
+
+	ops_memory_clear(mem);
+	ops_writer_set_memory(cinfo, mem);
+	ops_writer_push_armoured_message(cinfo);
+	CU_ASSERT(ops_write_literal_data_from_buf((unsigned char *)testtext,
+						  strlen(testtext),
+						  OPS_LDT_TEXT, cinfo));
+	CU_ASSERT(ops_writer_close(cinfo));
+	ops_create_info_reset(cinfo);
+	CU_ASSERT(cinfo->winfo.writer == NULL);
+
+	ops_memory_clear(mem_out);
+	ops_writer_set_memory(cinfo_out, mem_out);
+	ops_reader_set_memory(pinfo, ops_memory_get_data(mem),
+			      ops_memory_get_length(mem));
+	ops_reader_push_dearmour(pinfo);
+	ops_parse_cb_set(pinfo, callback_literal_data, NULL);
+	pinfo->cbinfo.cinfo=cinfo_out;
+	CU_ASSERT(ops_parse(pinfo));
+	CU_ASSERT(ops_writer_close(cinfo_out));
+
+	CU_ASSERT(strlen(testtext) == ops_memory_get_length(mem_out));
+	CU_ASSERT(strncmp((char *)ops_memory_get_data(mem_out), testtext,
+			  strlen(testtext)) == 0);
+
+	// the dearmouring reader is destroyed, and its node kept
+	ops_parse_info_reset(pinfo);
+	ops_create_info_reset(cinfo_out);
+	CU_ASSERT(pinfo->rinfo.reader == NULL);
+	CU_ASSERT(pinfo->spare_rinfo != NULL);
+	CU_ASSERT(pinfo->errors == NULL);
+	free(testtext);
+	}
+
+    ops_parse_info_delete(pinfo);
+    ops_create_info_delete(cinfo_out);
+    ops_create_info_delete(cinfo);
+    ops_memory_free(mem_out);
+    ops_memory_free(mem);
+    }
+
 static void test_ops_mdc()
 	{
 	// Modification Detection Code Packet
@@ -896,6 +1125,9 @@ CU_pSuite suite_packet_types()
     
     if (NULL == CU_add_test(suite, "Tag 11: Literal Data packet in Data mode", test_literal_data_packet_data))
 	    return NULL;
+
+    if (NULL == CU_add_test(suite, "Tag 11: Index of Literal Data packets", test_packet_index))
+	    return NULL;
     
     if (NULL == CU_add_test(suite, "Tag 8 and 11: Compressed Literal Data packet in Text mode", test_compressed_literal_data_packet_text))
 	    return NULL;
@@ -909,6 +1141,12 @@ CU_pSuite suite_packet_types()
     if (NULL == CU_add_test(suite, "Tag 8: Streaming compressed large packet with error", test_compressed_large_data_error))
 	    return NULL;
     
+    if (NULL == CU_add_test(suite, "Repeated errors counted once", test_repeated_errors))
+	    return NULL;
+
+    if (NULL == CU_add_test(suite, "Reset create and parse contexts", test_reset_contexts))
+	    return NULL;
+
     if (NULL == CU_add_test(suite, "Tag 19: Modification Detection Code packet", test_ops_mdc))
 	    return NULL;
 
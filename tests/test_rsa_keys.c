@@ -23,10 +23,13 @@
 
 #include "openpgpsdk/defs.h"
 #include "openpgpsdk/keyring.h"
+#include "openpgpsdk/keyring_handle.h"
 #include "openpgpsdk/crypto.h"
 #include "openpgpsdk/packet.h"
 #include "openpgpsdk/validate.h"
 #include "openpgpsdk/readerwriter.h"
+#include "openpgpsdk/verify_cache.h"
+#include "openpgpsdk/parse-parallel.h"
 #include "../src/lib/keyring_local.h"
 
 #include "tests.h"
@@ -217,6 +220,925 @@ static void test_rsa_keys_read_from_file(void)
     ops_keyring_free(&keyring);
     }
 
+static void test_rsa_keys_read_from_file_parallel(void)
+    {
+    ops_keyring_t keyring;
+    ops_keyring_t pkeyring;
+    char filename[MAXBUF+1];
+    int n;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+    memset(&pkeyring, '\0', sizeof pkeyring);
+
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    CU_ASSERT(ops_keyring_read_from_file_parallel(&pkeyring, OPS_UNARMOURED,
+						  filename, 4));
+
+    // same keys, in the same order
+    CU_ASSERT(keyring.nkeys == pkeyring.nkeys);
+    for (n=0 ; n < keyring.nkeys && n < pkeyring.nkeys ; ++n)
+	{
+	const ops_keydata_t *key=ops_keyring_get_key_by_index(&keyring, n);
+	const ops_keydata_t *pkey=ops_keyring_get_key_by_index(&pkeyring, n);
+
+	CU_ASSERT(memcmp(key->key_id, pkey->key_id, OPS_KEY_ID_SIZE) == 0);
+	CU_ASSERT(key->nuids == pkey->nuids);
+	CU_ASSERT(key->npackets == pkey->npackets);
+	}
+
+    ops_keyring_free(&keyring);
+    ops_keyring_free(&pkeyring);
+    }
+
+static void test_rsa_keys_read_from_mem(void)
+    {
+    ops_keyring_t keyring;
+    ops_keyring_t mkeyring;
+    ops_memory_t *mem;
+    char filename[MAXBUF+1];
+    int errnum;
+    int n;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    mem=ops_write_mem_from_file(filename, &errnum);
+    CU_ASSERT_FATAL(errnum == 0);
+
+    memset(&keyring, '\0', sizeof keyring);
+    memset(&mkeyring, '\0', sizeof mkeyring);
+
+    // the memory reader is parsed directly, the file through its reader
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    CU_ASSERT(ops_keyring_read_from_mem(&mkeyring, OPS_UNARMOURED, mem));
+
+    CU_ASSERT(keyring.nkeys == mkeyring.nkeys);
+    for (n=0 ; n < keyring.nkeys && n < mkeyring.nkeys ; ++n)
+	{
+	const ops_keydata_t *key=ops_keyring_get_key_by_index(&keyring, n);
+	const ops_keydata_t *mkey=ops_keyring_get_key_by_index(&mkeyring, n);
+	unsigned i;
+
+	CU_ASSERT(memcmp(key->key_id, mkey->key_id, OPS_KEY_ID_SIZE) == 0);
+	CU_ASSERT_FATAL(key->npackets == mkey->npackets);
+	for (i=0 ; i < key->npackets ; ++i)
+	    CU_ASSERT(key->packets[i].length == mkey->packets[i].length
+		      && memcmp(key->packets[i].raw, mkey->packets[i].raw,
+				key->packets[i].length) == 0);
+	}
+
+    ops_keyring_free(&keyring);
+    ops_keyring_free(&mkeyring);
+    ops_memory_free(mem);
+    }
+
+static void test_rsa_keys_read_compact(void)
+    {
+    ops_keyring_t keyring;
+    ops_keyring_t ckeyring;
+    char filename[MAXBUF+1];
+    int n;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+    memset(&ckeyring, '\0', sizeof ckeyring);
+    ckeyring.compact=ops_true;
+
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    CU_ASSERT(ops_keyring_read_from_file(&ckeyring, OPS_UNARMOURED, filename));
+
+    CU_ASSERT(keyring.nkeys == ckeyring.nkeys);
+    for (n=0 ; n < keyring.nkeys && n < ckeyring.nkeys ; ++n)
+	{
+	const ops_keydata_t *key=ops_keyring_get_key_by_index(&keyring, n);
+	const ops_keydata_t *ckey=ops_keyring_get_key_by_index(&ckeyring, n);
+	const ops_public_key_t *pkey=ops_get_public_key_from_data(key);
+	const ops_public_key_t *cpkey=ops_get_public_key_from_data(ckey);
+	unsigned i;
+
+	CU_ASSERT(ckey->compact);
+	CU_ASSERT(memcmp(key->key_id, ckey->key_id, OPS_KEY_ID_SIZE) == 0);
+	CU_ASSERT_FATAL(key->nuids == ckey->nuids);
+	for (i=0 ; i < key->nuids ; ++i)
+	    CU_ASSERT(strcmp((char *)key->uids[i].user_id,
+			     (char *)ckey->uids[i].user_id) == 0);
+	// the raw packets are kept as read
+	CU_ASSERT_FATAL(key->npackets == ckey->npackets);
+	for (i=0 ; i < key->npackets ; ++i)
+	    CU_ASSERT(key->packets[i].length == ckey->packets[i].length
+		      && memcmp(key->packets[i].raw, ckey->packets[i].raw,
+				key->packets[i].length) == 0);
+
+	// and the key material decodes the same
+	CU_ASSERT_FATAL(cpkey != NULL);
+	CU_ASSERT(pkey->version == cpkey->version);
+	CU_ASSERT(pkey->algorithm == cpkey->algorithm);
+	CU_ASSERT(pkey->creation_time == cpkey->creation_time);
+	switch (pkey->algorithm)
+	    {
+	case OPS_PKA_RSA:
+	case OPS_PKA_RSA_ENCRYPT_ONLY:
+	case OPS_PKA_RSA_SIGN_ONLY:
+	    CU_ASSERT(BN_cmp(pkey->key.rsa.n, cpkey->key.rsa.n) == 0);
+	    CU_ASSERT(BN_cmp(pkey->key.rsa.e, cpkey->key.rsa.e) == 0);
+	    break;
+
+	case OPS_PKA_DSA:
+	    CU_ASSERT(BN_cmp(pkey->key.dsa.p, cpkey->key.dsa.p) == 0);
+	    CU_ASSERT(BN_cmp(pkey->key.dsa.q, cpkey->key.dsa.q) == 0);
+	    CU_ASSERT(BN_cmp(pkey->key.dsa.g, cpkey->key.dsa.g) == 0);
+	    CU_ASSERT(BN_cmp(pkey->key.dsa.y, cpkey->key.dsa.y) == 0);
+	    break;
+
+	case OPS_PKA_ELGAMAL:
+	    CU_ASSERT(BN_cmp(pkey->key.elgamal.p, cpkey->key.elgamal.p) == 0);
+	    CU_ASSERT(BN_cmp(pkey->key.elgamal.g, cpkey->key.elgamal.g) == 0);
+	    CU_ASSERT(BN_cmp(pkey->key.elgamal.y, cpkey->key.elgamal.y) == 0);
+	    break;
+
+	default:
+	    break;
+	    }
+	}
+
+    ops_keyring_free(&keyring);
+    ops_keyring_free(&ckeyring);
+    }
+
+static void check_same_sigs(const ops_signature_info_t *sigs,
+			    unsigned count,
+			    const ops_signature_info_t *psigs,
+			    unsigned pcount)
+    {
+    unsigned n;
+
+    CU_ASSERT(count == pcount);
+    for (n=0 ; n < count && n < pcount ; ++n)
+	{
+	CU_ASSERT(memcmp(sigs[n].signer_id, psigs[n].signer_id,
+			 OPS_KEY_ID_SIZE) == 0);
+	CU_ASSERT(sigs[n].type == psigs[n].type);
+	CU_ASSERT(sigs[n].creation_time == psigs[n].creation_time);
+	}
+    }
+
+static void test_rsa_keys_validate_parallel(void)
+    {
+    ops_keyring_t keyring;
+    ops_validate_result_t *result;
+    char filename[MAXBUF+1];
+    ops_boolean_t status;
+    unsigned chunk_keys;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    // otherwise nothing is split among the threads
+    CU_ASSERT_FATAL(keyring.nkeys > 1);
+
+    result=ops_mallocz(sizeof(*result));
+    status=ops_validate_all_signatures(result, &keyring, NULL);
+
+    // chunks small enough that every thread gets some keys, and sizes
+    // that leave a short last chunk
+    for (chunk_keys=1 ; chunk_keys < (unsigned)keyring.nkeys ; ++chunk_keys)
+	{
+	ops_validate_result_t *presult;
+
+	presult=ops_mallocz(sizeof(*presult));
+	CU_ASSERT(ops_validate_all_signatures_parallel(presult, &keyring,
+						       NULL, 4, chunk_keys)
+		  == status);
+
+	// same signatures, in the same order
+	check_same_sigs(result->valid_sigs, result->valid_count,
+			presult->valid_sigs, presult->valid_count);
+	check_same_sigs(result->invalid_sigs, result->invalid_count,
+			presult->invalid_sigs, presult->invalid_count);
+	check_same_sigs(result->unknown_sigs, result->unknown_signer_count,
+			presult->unknown_sigs, presult->unknown_signer_count);
+	ops_validate_result_free(presult);
+	}
+
+    ops_validate_result_free(result);
+    ops_keyring_free(&keyring);
+    }
+
+static void test_rsa_keys_verify_cache(void)
+    {
+    ops_keyring_t keyring;
+    ops_validate_result_t *result;
+    ops_validate_result_t *cresult;
+    char filename[MAXBUF+1];
+    unsigned long hits, misses, first_misses;
+    ops_boolean_t status;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    keyring.verify_cache=ops_verify_cache_new(0);
+
+    result=ops_mallocz(sizeof(*result));
+    cresult=ops_mallocz(sizeof(*cresult));
+
+    // the first pass fills the cache, the second is answered from it
+    status=ops_validate_all_signatures(result, &keyring, NULL);
+    ops_verify_cache_get_stats(keyring.verify_cache, &hits, &first_misses);
+    CU_ASSERT(hits == 0);
+    CU_ASSERT(first_misses > 0);
+
+    CU_ASSERT(ops_validate_all_signatures(cresult, &keyring, NULL) == status);
+    ops_verify_cache_get_stats(keyring.verify_cache, &hits, &misses);
+    CU_ASSERT(hits == first_misses);
+    CU_ASSERT(misses == first_misses);
+    CU_ASSERT(result->valid_count == cresult->valid_count);
+    CU_ASSERT(result->invalid_count == cresult->invalid_count);
+
+    ops_validate_result_free(result);
+    ops_validate_result_free(cresult);
+    ops_verify_cache_free(keyring.verify_cache);
+    ops_keyring_free(&keyring);
+    }
+
+static void test_rsa_keys_serialised(void)
+    {
+    ops_keyring_t keyring;
+    char filename[MAXBUF+1];
+    int n;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+
+    for (n=0 ; n < keyring.nkeys ; ++n)
+	{
+	const ops_keydata_t *key=ops_keyring_get_key_by_index(&keyring, n);
+	const ops_public_key_t *pkey=ops_get_public_key_from_data(key);
+	ops_public_key_t copy=*pkey;
+	ops_fingerprint_t fp;
+
+	CU_ASSERT_FATAL(pkey->serialised != NULL);
+	CU_ASSERT(pkey->serialised[0] == 0x99);
+
+	// without the cached form, the key must hash the same
+	copy.serialised=NULL;
+	ops_fingerprint(&fp, &copy);
+	CU_ASSERT(fp.length == key->fingerprint.length);
+	CU_ASSERT(memcmp(fp.fingerprint, key->fingerprint.fingerprint,
+			 fp.length) == 0);
+	}
+
+    ops_keyring_free(&keyring);
+    }
+
+static void test_rsa_keys_import(void)
+    {
+    ops_keyring_t keyring;
+    ops_keyring_import_result_t result;
+    char filename[MAXBUF+1];
+    int nkeys;
+    int n;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+
+    CU_ASSERT(ops_keyring_import_from_file(&keyring, OPS_UNARMOURED,
+					   filename, &result));
+    CU_ASSERT(result.new_keys == (unsigned)keyring.nkeys);
+    nkeys=keyring.nkeys;
+
+    // importing the same keys again must not change anything
+    CU_ASSERT(ops_keyring_import_from_file(&keyring, OPS_UNARMOURED,
+					   filename, &result));
+    CU_ASSERT(keyring.nkeys == nkeys);
+    CU_ASSERT(result.new_keys == 0);
+    CU_ASSERT(result.updated_keys == 0);
+    CU_ASSERT(result.unchanged_keys == (unsigned)nkeys);
+
+    for (n=0 ; n < keyring.nkeys ; ++n)
+	{
+	const ops_keydata_t *key=ops_keyring_get_key_by_index(&keyring, n);
+
+	CU_ASSERT(ops_keyring_find_key_by_id(&keyring, key->key_id) == key);
+	}
+
+    ops_keyring_free(&keyring);
+    }
+
+static void test_rsa_keys_unknown_key_id(void)
+    {
+    ops_keyring_t keyring;
+    char filename[MAXBUF+1];
+    int n;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    CU_ASSERT_FATAL(keyring.nkeys > 0);
+
+    for (n=0 ; n < keyring.nkeys ; ++n)
+	{
+	const ops_keydata_t *key=ops_keyring_get_key_by_index(&keyring, n);
+	unsigned char keyid[OPS_KEY_ID_SIZE];
+	int i;
+
+	CU_ASSERT(ops_keyring_find_key_by_id(&keyring, key->key_id) == key);
+
+	// IDs a bit away from a key's must be rejected, wherever they differ
+	for (i=0 ; i < OPS_KEY_ID_SIZE ; ++i)
+	    {
+	    memcpy(keyid, key->key_id, OPS_KEY_ID_SIZE);
+	    keyid[i]^=0x10;
+	    CU_ASSERT(ops_keyring_find_key_by_id(&keyring, keyid) == NULL);
+	    }
+	}
+
+    ops_keyring_free(&keyring);
+    }
+
+typedef struct
+    {
+    unsigned nsigs;
+    unsigned nissuers;
+    unsigned ncreated;
+    unsigned nsubpackets;
+    } scan_arg_t;
+
+static ops_parse_cb_return_t
+scan_cb(const ops_parser_content_t *content_, ops_parse_cb_info_t *cbinfo)
+    {
+    const ops_signature_info_t *info=&content_->content.signature.info;
+    scan_arg_t *arg=ops_parse_cb_get_arg(cbinfo);
+
+    if (content_->tag == OPS_PTAG_CT_SIGNATURE_FOOTER)
+	{
+	++arg->nsigs;
+	if (info->signer_id_set)
+	    ++arg->nissuers;
+	if (info->creation_time_set)
+	    ++arg->ncreated;
+	}
+    else if (content_->tag >= OPS_PTAG_SIGNATURE_SUBPACKET_BASE
+	     && content_->tag < OPS_PTAG_SIGNATURE_SUBPACKET_BASE+0x100)
+	++arg->nsubpackets;
+
+    return OPS_RELEASE_MEMORY;
+    }
+
+static void scan_keyring(scan_arg_t *arg, ops_memory_t *mem,
+			 ops_boolean_t keys_only)
+    {
+    ops_parse_info_t *pinfo=ops_parse_info_new();
+
+    memset(arg, '\0', sizeof *arg);
+    ops_parse_options(pinfo, OPS_PTAG_SS_ALL, OPS_PARSE_PARSED);
+    ops_parse_keys_only(pinfo, keys_only);
+    ops_reader_set_memory(pinfo, ops_memory_get_data(mem),
+			  ops_memory_get_length(mem));
+    ops_parse_cb_set(pinfo, scan_cb, arg);
+    CU_ASSERT(ops_parse(pinfo));
+    ops_parse_info_delete(pinfo);
+    }
+
+static void test_rsa_keys_keys_only(void)
+    {
+    ops_keyring_t keyring;
+    ops_validate_result_t *result;
+    ops_memory_t *mem;
+    scan_arg_t full;
+    scan_arg_t scan;
+    char filename[MAXBUF+1];
+    int errnum;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    mem=ops_write_mem_from_file(filename, &errnum);
+    CU_ASSERT_FATAL(errnum == 0);
+
+    // a scan finds the same issuers and creation times, but passes on no
+    // subpackets
+    scan_keyring(&full, mem, ops_false);
+    scan_keyring(&scan, mem, ops_true);
+    CU_ASSERT(full.nsigs > 0);
+    CU_ASSERT(full.nsubpackets > 0);
+    CU_ASSERT(scan.nsigs == full.nsigs);
+    CU_ASSERT(scan.nissuers == full.nissuers);
+    CU_ASSERT(scan.ncreated == full.ncreated);
+    CU_ASSERT(scan.nsubpackets == 0);
+
+    // keyrings are read that way, and their signatures are still fully
+    // decoded when they are checked
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_mem(&keyring, OPS_UNARMOURED, mem));
+    result=ops_mallocz(sizeof *result);
+    CU_ASSERT(ops_validate_all_signatures(result, &keyring, NULL));
+    CU_ASSERT(result->valid_count > 0);
+    CU_ASSERT(result->invalid_count == 0);
+    ops_validate_result_free(result);
+
+    ops_keyring_free(&keyring);
+    ops_memory_free(mem);
+    }
+
+typedef struct
+    {
+    unsigned count;
+    unsigned long order;
+    } order_arg_t;
+
+static ops_parse_cb_return_t
+order_cb(const ops_parser_content_t *content_, ops_parse_cb_info_t *cbinfo)
+    {
+    order_arg_t *arg=ops_parse_cb_get_arg(cbinfo);
+    unsigned i;
+
+    // weight each tag by where it comes, so a reordering shows
+    ++arg->count;
+    arg->order=arg->order*31+content_->tag;
+    if (content_->tag == OPS_PTAG_CT_SIGNATURE_FOOTER)
+	for (i=0 ; i < OPS_KEY_ID_SIZE ; ++i)
+	    arg->order=arg->order*31
+		+content_->content.signature.info.signer_id[i];
+
+    return OPS_RELEASE_MEMORY;
+    }
+
+static void test_rsa_keys_parallel(void)
+    {
+    ops_parse_info_t *pinfo;
+    ops_memory_t *mem;
+    order_arg_t serial;
+    order_arg_t parallel;
+    // 1 makes every packet a span; 0 is the default, a single span here
+    size_t span_sizes[]={ 1, 512, 4096, 0 };
+    char filename[MAXBUF+1];
+    int errnum;
+    int n;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    mem=ops_write_mem_from_file(filename, &errnum);
+    CU_ASSERT_FATAL(errnum == 0);
+
+    memset(&serial, '\0', sizeof serial);
+    pinfo=ops_parse_info_new();
+    ops_parse_options(pinfo, OPS_PTAG_SS_ALL, OPS_PARSE_PARSED);
+    ops_reader_set_memory(pinfo, ops_memory_get_data(mem),
+			  ops_memory_get_length(mem));
+    ops_parse_cb_set(pinfo, order_cb, &serial);
+    CU_ASSERT(ops_parse(pinfo));
+    ops_parse_info_delete(pinfo);
+
+    CU_ASSERT(serial.count > 0);
+
+    // the callback sees the same packets in the same order, whether
+    // the input is one span or each packet is a span of its own
+    for (n=0 ; n < (int)(sizeof span_sizes/sizeof *span_sizes) ; ++n)
+	{
+	memset(&parallel, '\0', sizeof parallel);
+	pinfo=ops_parse_info_new();
+	ops_parse_options(pinfo, OPS_PTAG_SS_ALL, OPS_PARSE_PARSED);
+	ops_parse_cb_set(pinfo, order_cb, &parallel);
+	CU_ASSERT(ops_parse_parallel(pinfo, ops_memory_get_data(mem),
+				     ops_memory_get_length(mem), 4,
+				     span_sizes[n]));
+	ops_parse_info_delete(pinfo);
+
+	CU_ASSERT(parallel.count == serial.count);
+	CU_ASSERT(parallel.order == serial.order);
+	}
+
+    ops_memory_free(mem);
+    }
+
+static void test_rsa_keys_shared_keyring(void)
+    {
+    ops_keyring_t keyring;
+    ops_keyring_handle_t *handle;
+    ops_keyring_reader_t *reader;
+    const ops_keyring_t *snapshot;
+    const ops_keyring_t *old;
+    unsigned char keyid[OPS_KEY_ID_SIZE];
+    char filename[MAXBUF+1];
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    CU_ASSERT_FATAL(keyring.nkeys > 0);
+    memcpy(keyid, ops_get_key_id(ops_keyring_get_key_by_index(&keyring, 0)),
+	   OPS_KEY_ID_SIZE);
+
+    handle=ops_keyring_handle_new(&keyring);
+    CU_ASSERT(keyring.nkeys == 0);
+    reader=ops_keyring_reader_new(handle);
+
+    old=ops_keyring_reader_enter(reader);
+    CU_ASSERT(ops_keyring_find_key_by_id(old, keyid) != NULL);
+
+    // a reload mustn't disturb a read in progress
+    CU_ASSERT(ops_keyring_handle_reload_from_file(handle, OPS_UNARMOURED,
+						  filename));
+    CU_ASSERT(ops_keyring_find_key_by_id(old, keyid) != NULL);
+    CU_ASSERT(ops_keyring_handle_collect(handle) == 0);
+    ops_keyring_reader_exit(reader);
+    CU_ASSERT(ops_keyring_handle_collect(handle) == 1);
+
+    snapshot=ops_keyring_reader_enter(reader);
+    CU_ASSERT(snapshot != old);
+    CU_ASSERT(ops_keyring_find_key_by_id(snapshot, keyid) != NULL);
+    ops_keyring_reader_exit(reader);
+
+    ops_keyring_reader_free(reader);
+    ops_keyring_handle_free(handle);
+    }
+
+// The public part of key, as it would be exported
+static ops_memory_t *public_key_mem(const ops_keydata_t *key)
+    {
+    ops_create_info_t *cinfo;
+    ops_memory_t *mem;
+
+    ops_setup_memory_write(&cinfo, &mem, 128);
+    CU_ASSERT(ops_write_transferable_public_key(key, ops_false, cinfo));
+    ops_writer_close(cinfo);
+    ops_create_info_delete(cinfo);
+
+    return mem;
+    }
+
+static void handle_import_key(ops_keyring_handle_t *handle,
+			      const ops_keydata_t *key,
+			      ops_keyring_import_result_t *result)
+    {
+    ops_keyring_t from;
+    ops_memory_t *mem=public_key_mem(key);
+
+    memset(&from, '\0', sizeof from);
+    CU_ASSERT(ops_keyring_read_from_mem(&from, OPS_UNARMOURED, mem));
+    CU_ASSERT(ops_keyring_handle_import(handle, &from, result));
+    ops_memory_free(mem);
+    }
+
+static void test_rsa_keys_shared_import(void)
+    {
+    ops_keyring_t keyring;
+    ops_keyring_handle_t *handle;
+    ops_keyring_reader_t *reader;
+    ops_keyring_import_result_t result;
+    const ops_keyring_t *old;
+    const ops_keyring_t *snapshot;
+    const ops_keydata_t *was;
+    const ops_keydata_t *key;
+    ops_keydata_t *keydata;
+    ops_user_id_t uid;
+    char filename[MAXBUF+1];
+    int n;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    handle=ops_keyring_handle_new(&keyring);
+    reader=ops_keyring_reader_new(handle);
+
+    uid.user_id=(unsigned char *)"Shared User <shared@nowhere.com>";
+    keydata=ops_rsa_create_selfsigned_keypair(1024, 65537, &uid);
+    CU_ASSERT_FATAL(keydata != NULL);
+
+    // a new key is added to a snapshot sharing the existing keys
+    old=ops_keyring_reader_enter(reader);
+    handle_import_key(handle, keydata, &result);
+    CU_ASSERT(result.new_keys == 1);
+    CU_ASSERT(ops_keyring_find_key_by_id(old, keydata->key_id) == NULL);
+    ops_keyring_reader_exit(reader);
+
+    snapshot=ops_keyring_reader_enter(reader);
+    CU_ASSERT(snapshot != old);
+    CU_ASSERT_FATAL(snapshot->nkeys > 1);
+    was=ops_keyring_find_key_by_id(snapshot, keydata->key_id);
+    CU_ASSERT_FATAL(was != NULL);
+    ops_keyring_reader_exit(reader);
+
+    // an updated key is copied, and only it
+    uid.user_id=(unsigned char *)"Second Shared User <shared2@nowhere.com>";
+    CU_ASSERT(ops_add_selfsigned_userid_to_keydata(keydata, &uid));
+    old=ops_keyring_reader_enter(reader);
+    handle_import_key(handle, keydata, &result);
+    CU_ASSERT(result.updated_keys == 1);
+    CU_ASSERT(result.new_user_ids == 1);
+    ops_keyring_reader_exit(reader);
+
+    snapshot=ops_keyring_reader_enter(reader);
+    CU_ASSERT(snapshot != old);
+    CU_ASSERT_FATAL(snapshot->nkeys == old->nkeys);
+    key=ops_keyring_find_key_by_id(snapshot, keydata->key_id);
+    CU_ASSERT_FATAL(key != NULL);
+    CU_ASSERT(key != was);
+    CU_ASSERT(key->nuids == 2);
+    CU_ASSERT(was->nuids == 1);
+    for (n=0 ; n < snapshot->nkeys ; ++n)
+	if (old->keys[n] != was)
+	    CU_ASSERT(snapshot->keys[n] == old->keys[n]);
+    ops_keyring_reader_exit(reader);
+
+    // importing it again changes nothing
+    handle_import_key(handle, keydata, &result);
+    CU_ASSERT(result.unchanged_keys == 1);
+    CU_ASSERT(ops_keyring_reader_enter(reader) == snapshot);
+    ops_keyring_reader_exit(reader);
+
+    ops_keyring_reader_free(reader);
+    ops_keyring_handle_free(handle);
+    ops_keydata_free(keydata);
+    }
+
+// Import key's public part into keyring, writing what changes to journal
+static void import_key(ops_keyring_t *keyring, const ops_keydata_t *key,
+		       ops_create_info_t *journal,
+		       ops_keyring_import_result_t *result)
+    {
+    ops_memory_t *mem=public_key_mem(key);
+
+    CU_ASSERT(ops_keyring_import_from_mem(keyring, OPS_UNARMOURED, mem,
+					  journal, result));
+    ops_memory_free(mem);
+    }
+
+static void test_rsa_keys_import_journal(void)
+    {
+    ops_keyring_t keyring;
+    ops_keyring_t replayed;
+    ops_keyring_import_result_t result;
+    ops_create_info_t *cinfo;
+    ops_memory_t *mem;
+    ops_memory_t *rmem;
+    ops_keydata_t *keydata;
+    const ops_keydata_t *key;
+    const ops_keydata_t *rkey;
+    ops_user_id_t uid;
+    char filename[MAXBUF+1];
+    char journal[MAXBUF+1];
+    size_t length;
+    int errnum;
+    int nkeys;
+    int fd;
+
+    // start the journal off as a copy of the keyring
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+    snprintf(journal, MAXBUF, "%s/%s", dir, "journal.gpg");
+    mem=ops_write_mem_from_file(filename, &errnum);
+    CU_ASSERT_FATAL(errnum == 0);
+    fd=ops_setup_file_write(&cinfo, journal, ops_true);
+    CU_ASSERT_FATAL(fd >= 0);
+    ops_write(ops_memory_get_data(mem), ops_memory_get_length(mem), cinfo);
+    ops_teardown_file_write(cinfo, fd);
+    ops_memory_free(mem);
+
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_import_from_file(&keyring, OPS_UNARMOURED,
+					   journal, &result));
+    nkeys=keyring.nkeys;
+
+    uid.user_id=(unsigned char *)"Journal User <journal@nowhere.com>";
+    keydata=ops_rsa_create_selfsigned_keypair(1024, 65537, &uid);
+    CU_ASSERT_FATAL(keydata != NULL);
+
+    fd=ops_setup_file_append(&cinfo, journal);
+    CU_ASSERT_FATAL(fd >= 0);
+
+    // a new key is added, and written to the journal
+    import_key(&keyring, keydata, cinfo, &result);
+    CU_ASSERT(result.new_keys == 1);
+    CU_ASSERT(keyring.nkeys == nkeys+1);
+
+    // an updated copy of it is merged in, and written again
+    uid.user_id=(unsigned char *)"Second Journal User <journal2@nowhere.com>";
+    CU_ASSERT(ops_add_selfsigned_userid_to_keydata(keydata, &uid));
+    import_key(&keyring, keydata, cinfo, &result);
+    CU_ASSERT(result.new_keys == 0);
+    CU_ASSERT(result.updated_keys == 1);
+    CU_ASSERT(result.new_user_ids == 1);
+    CU_ASSERT(result.new_packets > 0);
+    CU_ASSERT(keyring.nkeys == nkeys+1);
+    key=ops_keyring_find_key_by_id(&keyring, keydata->key_id);
+    CU_ASSERT_FATAL(key != NULL);
+    CU_ASSERT(key->nuids == 2);
+    CU_ASSERT(strcmp((char *)key->uids[1].user_id, (char *)uid.user_id) == 0);
+
+    // and importing it once more neither changes the keyring nor
+    // lengthens the journal
+    mem=ops_write_mem_from_file(journal, &errnum);
+    length=ops_memory_get_length(mem);
+    ops_memory_free(mem);
+    import_key(&keyring, keydata, cinfo, &result);
+    CU_ASSERT(result.unchanged_keys == 1);
+    CU_ASSERT(result.new_packets == 0);
+    ops_teardown_file_append(cinfo, fd);
+    mem=ops_write_mem_from_file(journal, &errnum);
+    CU_ASSERT(ops_memory_get_length(mem) == length);
+    ops_memory_free(mem);
+
+    // replaying the journal merges the repeated key into what was
+    // imported
+    memset(&replayed, '\0', sizeof replayed);
+    CU_ASSERT(ops_keyring_import_from_file(&replayed, OPS_UNARMOURED,
+					   journal, &result));
+    CU_ASSERT(replayed.nkeys == nkeys+1);
+    CU_ASSERT(result.new_keys == (unsigned)nkeys+1);
+    CU_ASSERT(result.updated_keys == 1);
+    rkey=ops_keyring_find_key_by_id(&replayed, keydata->key_id);
+    CU_ASSERT_FATAL(rkey != NULL);
+    CU_ASSERT(rkey->nuids == 2);
+
+    mem=public_key_mem(key);
+    rmem=public_key_mem(rkey);
+    CU_ASSERT_FATAL(ops_memory_get_length(mem)
+		    == ops_memory_get_length(rmem));
+    CU_ASSERT(memcmp(ops_memory_get_data(mem), ops_memory_get_data(rmem),
+		     ops_memory_get_length(mem)) == 0);
+    ops_memory_free(mem);
+    ops_memory_free(rmem);
+
+    ops_keydata_free(keydata);
+    ops_keyring_free(&keyring);
+    ops_keyring_free(&replayed);
+    }
+
+// key's public part, then nsubkeys public subkeys made from subkey's
+// public key, each with its own creation time and so its own ID
+static ops_memory_t *key_with_subkeys_mem(const ops_keydata_t *key,
+					  const ops_keydata_t *subkey,
+					  unsigned nsubkeys)
+    {
+    ops_memory_t *mem=public_key_mem(key);
+    ops_create_info_t *cinfo;
+    ops_memory_t *kmem;
+    unsigned char *raw;
+    size_t length;
+    size_t hlen;
+    unsigned n;
+
+    ops_setup_memory_write(&cinfo, &kmem, 128);
+    CU_ASSERT(ops_write_struct_public_key(ops_get_public_key_from_data(subkey),
+					  cinfo));
+    ops_writer_close(cinfo);
+    ops_create_info_delete(cinfo);
+
+    // a new format packet, as ops_write_ptag() writes them
+    raw=ops_memory_get_data(kmem);
+    length=ops_memory_get_length(kmem);
+    hlen=raw[1] < 192 ? 2 : raw[1] < 224 ? 3 : 6;
+    raw[0]=0xc0|OPS_PTAG_CT_PUBLIC_SUBKEY;
+
+    for (n=0 ; n < nsubkeys ; ++n)
+	{
+	raw[hlen+1]=n >> 24;
+	raw[hlen+2]=n >> 16;
+	raw[hlen+3]=n >> 8;
+	raw[hlen+4]=n;
+	ops_memory_add(mem, raw, length);
+	}
+    ops_memory_free(kmem);
+
+    return mem;
+    }
+
+// Every subkey ID of key leads to it, and to no key of its own
+static void check_subkey_ids(const ops_keyring_t *keyring,
+			     const ops_keydata_t *key, unsigned nsubkeys)
+    {
+    unsigned n;
+
+    CU_ASSERT(key->nsubkey_ids == nsubkeys);
+    for (n=0 ; n < key->nsubkey_ids ; ++n)
+	{
+	CU_ASSERT(ops_keyring_find_key_by_subkey_id(keyring,
+						    key->subkey_ids[n].id)
+		  == key);
+	CU_ASSERT(ops_keyring_find_key_by_id(keyring, key->subkey_ids[n].id)
+		  == NULL);
+	}
+    CU_ASSERT(ops_keyring_find_key_by_subkey_id(keyring, key->key_id)
+	      == NULL);
+    }
+
+static void test_rsa_keys_subkey_ids(void)
+    {
+    ops_keyring_t keyring;
+    ops_keyring_t ckeyring;
+    ops_keyring_handle_t *handle;
+    ops_keyring_reader_t *reader;
+    ops_keyring_reader_t *reader2;
+    ops_keyring_import_result_t result;
+    const ops_keyring_t *old;
+    const ops_keyring_t *snapshot;
+    const ops_keydata_t *key;
+    ops_keydata_t *keydata;
+    ops_keydata_t *subkeydata;
+    ops_keyring_t from;
+    ops_memory_t *mem;
+    ops_user_id_t uid;
+    char filename[MAXBUF+1];
+    unsigned size;
+
+    snprintf(filename, MAXBUF, "%s/%s", dir, "pubring.gpg");
+
+    uid.user_id=(unsigned char *)"Subkey User <subkey@nowhere.com>";
+    keydata=ops_rsa_create_selfsigned_keypair(1024, 65537, &uid);
+    CU_ASSERT_FATAL(keydata != NULL);
+    subkeydata=ops_rsa_create_selfsigned_keypair(1024, 65537, &uid);
+    CU_ASSERT_FATAL(subkeydata != NULL);
+
+    // subkeys read with a key are indexed with it
+    mem=key_with_subkeys_mem(keydata, subkeydata, 3);
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_mem(&keyring, OPS_UNARMOURED, mem));
+    CU_ASSERT_FATAL(keyring.nkeys == 1);
+    check_subkey_ids(&keyring, keyring.keys[0], 3);
+    ops_keyring_free(&keyring);
+
+    // and kept by a compact key
+    memset(&ckeyring, '\0', sizeof ckeyring);
+    ckeyring.compact=ops_true;
+    CU_ASSERT(ops_keyring_read_from_mem(&ckeyring, OPS_UNARMOURED, mem));
+    CU_ASSERT_FATAL(ckeyring.nkeys == 1);
+    CU_ASSERT(ckeyring.keys[0]->compact);
+    check_subkey_ids(&ckeyring, ckeyring.keys[0], 3);
+    ops_keyring_free(&ckeyring);
+    ops_memory_free(mem);
+
+    // subkeys merged into a key are indexed as they are added, even when
+    // there are enough of them to make the index grow
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    import_key(&keyring, keydata, NULL, &result);
+    CU_ASSERT(result.new_keys == 1);
+    key=ops_keyring_find_key_by_id(&keyring, keydata->key_id);
+    CU_ASSERT_FATAL(key != NULL);
+    check_subkey_ids(&keyring, key, 0);
+
+    mem=key_with_subkeys_mem(keydata, subkeydata, 1);
+    CU_ASSERT(ops_keyring_import_from_mem(&keyring, OPS_UNARMOURED, mem,
+					  NULL, &result));
+    ops_memory_free(mem);
+    CU_ASSERT(result.updated_keys == 1);
+    check_subkey_ids(&keyring, key, 1);
+
+    size=keyring.id_index_size;
+    mem=key_with_subkeys_mem(keydata, subkeydata, size);
+    CU_ASSERT(ops_keyring_import_from_mem(&keyring, OPS_UNARMOURED, mem,
+					  NULL, &result));
+    ops_memory_free(mem);
+    CU_ASSERT(result.updated_keys == 1);
+    CU_ASSERT(keyring.id_index_size > size);
+    check_subkey_ids(&keyring, key, size);
+    ops_keyring_free(&keyring);
+
+    // a shared key that gains subkeys is copied, and the copy's subkeys
+    // are indexed at its place in the new snapshot alone
+    memset(&keyring, '\0', sizeof keyring);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED, filename));
+    handle=ops_keyring_handle_new(&keyring);
+    reader=ops_keyring_reader_new(handle);
+    reader2=ops_keyring_reader_new(handle);
+    handle_import_key(handle, keydata, &result);
+    CU_ASSERT(result.new_keys == 1);
+
+    old=ops_keyring_reader_enter(reader);
+    mem=key_with_subkeys_mem(keydata, subkeydata, 2);
+    memset(&from, '\0', sizeof from);
+    CU_ASSERT(ops_keyring_read_from_mem(&from, OPS_UNARMOURED, mem));
+    CU_ASSERT(ops_keyring_handle_import(handle, &from, &result));
+    ops_memory_free(mem);
+    CU_ASSERT(result.updated_keys == 1);
+
+    // the old snapshot is still in use
+    snapshot=ops_keyring_reader_enter(reader2);
+    CU_ASSERT(snapshot != old);
+    key=ops_keyring_find_key_by_id(snapshot, keydata->key_id);
+    CU_ASSERT_FATAL(key != NULL);
+    CU_ASSERT(key != ops_keyring_find_key_by_id(old, keydata->key_id));
+    check_subkey_ids(snapshot, key, 2);
+    CU_ASSERT(ops_keyring_find_key_by_subkey_id(old, key->subkey_ids[0].id)
+	      == NULL);
+    ops_keyring_reader_exit(reader2);
+    ops_keyring_reader_exit(reader);
+
+    ops_keyring_reader_free(reader2);
+    ops_keyring_reader_free(reader);
+    ops_keyring_handle_free(handle);
+    ops_keydata_free(keydata);
+    ops_keydata_free(subkeydata);
+    }
+
 static void test_rsa_keys_verify_armoured_keypair(void)
     {
     verify_keypair(OPS_ARMOURED);
@@ -392,6 +1314,62 @@ CU_pSuite suite_rsa_keys()
 			    test_rsa_keys_read_from_file))
         return NULL;
 
+    if (NULL == CU_add_test(suite, "Read keyring from file in parallel",
+			    test_rsa_keys_read_from_file_parallel))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Read keyring from memory",
+			    test_rsa_keys_read_from_mem))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Read keyring in compact form",
+			    test_rsa_keys_read_compact))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Validate keyring in parallel",
+			    test_rsa_keys_validate_parallel))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Serialised public key is cached",
+			    test_rsa_keys_serialised))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Cache signature verification results",
+			    test_rsa_keys_verify_cache))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Import keyring without duplicates",
+			    test_rsa_keys_import))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Merge updated key and replay journal",
+			    test_rsa_keys_import_journal))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Look up unknown key IDs",
+			    test_rsa_keys_unknown_key_id))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Look up keys by subkey ID",
+			    test_rsa_keys_subkey_ids))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Shared keyring snapshots",
+			    test_rsa_keys_shared_keyring))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Import into shared keyring",
+			    test_rsa_keys_shared_import))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Scan keyring signatures only",
+			    test_rsa_keys_keys_only))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Keyring parsed on several threads",
+			    test_rsa_keys_parallel))
+        return NULL;
+
     /*
     if (NULL == CU_add_test(suite, "TODO", test_rsa_keys_todo))
         return NULL;
@@ -31,11 +31,14 @@
 #include <openpgpsdk/create.h>
 #include "openpgpsdk/packet.h"
 #include "openpgpsdk/packet-parse.h"
+#include "openpgpsdk/push-parse.h"
 #include "openpgpsdk/packet-show.h"
 #include "openpgpsdk/util.h"
 #include "openpgpsdk/std_print.h"
 #include "openpgpsdk/readerwriter.h"
 #include "openpgpsdk/validate.h"
+#include "openpgpsdk/signature.h"
+#include "openpgpsdk/verifier.h"
 
 // \todo change this once we know it works
 #include "../src/lib/parse_local.h"
@@ -330,6 +333,620 @@ static void test_rsa_signature_clearsign_buf_passphrase(void)
     test_rsa_signature_clearsign_buf(filename_rsa_clearsign_buf_passphrase,
 				     bravo_skey);
     }
+
+static void test_rsa_signature_many_chunks(void)
+    {
+    unsigned char testdata[3*8192+100];
+    ops_memory_t *mem=NULL;
+    ops_validate_result_t *result=NULL;
+    unsigned char *signed_data;
+
+    assert(pub_keyring.nkeys);
+    create_testdata("test_rsa_signature_many_chunks", testdata,
+		    sizeof testdata);
+    mem=ops_sign_buf(testdata, sizeof testdata, OPS_SIG_BINARY, alpha_skey,
+		     OPS_UNARMOURED);
+
+    // every chunk of the body is covered, not just the last one
+    // (ops_validate_mem() frees mem)
+    result=ops_mallocz(sizeof *result);
+    CU_ASSERT(ops_validate_mem(result, mem, OPS_UNARMOURED, &pub_keyring));
+    CU_ASSERT(result->valid_count == 1);
+    ops_validate_result_free(result);
+
+    mem=ops_sign_buf(testdata, sizeof testdata, OPS_SIG_BINARY, alpha_skey,
+		     OPS_UNARMOURED);
+    signed_data=ops_memory_get_data(mem);
+    signed_data[ops_memory_get_length(mem)/4]^=1;
+    result=ops_mallocz(sizeof *result);
+    CU_ASSERT(!ops_validate_mem(result, mem, OPS_UNARMOURED, &pub_keyring));
+    CU_ASSERT(result->valid_count == 0);
+    ops_validate_result_free(result);
+    }
+
+typedef struct
+    {
+    ops_memory_t *body;
+    const unsigned char *input;
+    size_t input_length;
+    unsigned nslices;
+    unsigned nborrowed;
+    } slice_arg_t;
+
+static ops_parse_cb_return_t
+slice_cb(const ops_parser_content_t *content_, ops_parse_cb_info_t *cbinfo)
+    {
+    const ops_literal_data_slice_t *slice
+	=&content_->content.literal_data_slice;
+    slice_arg_t *arg=ops_parse_cb_get_arg(cbinfo);
+
+    // copied bodies mustn't turn up once bodies are borrowed
+    CU_ASSERT(content_->tag != OPS_PTAG_CT_LITERAL_DATA_BODY);
+    if (content_->tag == OPS_PTAG_CT_LITERAL_DATA_SLICE)
+	{
+	++arg->nslices;
+	if (slice->ptr >= arg->input
+	    && slice->ptr+slice->len <= arg->input+arg->input_length)
+	    ++arg->nborrowed;
+	ops_memory_add(arg->body, slice->ptr, slice->len);
+	}
+
+    return OPS_RELEASE_MEMORY;
+    }
+
+static void test_rsa_signature_borrowed_bodies(void)
+    {
+    unsigned char testdata[3*8192+100];
+    ops_memory_t *mem=NULL;
+    ops_parse_info_t *pinfo=NULL;
+    slice_arg_t arg;
+
+    create_testdata("test_rsa_signature_borrowed_bodies", testdata,
+		    sizeof testdata);
+    mem=ops_sign_buf(testdata, sizeof testdata, OPS_SIG_BINARY, alpha_skey,
+		     OPS_UNARMOURED);
+
+    memset(&arg, '\0', sizeof arg);
+    arg.body=ops_memory_new();
+    ops_memory_init(arg.body, sizeof testdata);
+    arg.input=ops_memory_get_data(mem);
+    arg.input_length=ops_memory_get_length(mem);
+
+    // straight from memory, the whole body is one slice of the input
+    ops_setup_memory_read(&pinfo, mem, &arg, slice_cb, ops_false);
+    ops_parse_borrow_bodies(pinfo, ops_true);
+    CU_ASSERT(ops_parse(pinfo));
+    ops_teardown_memory_read(pinfo, mem);
+
+    CU_ASSERT(arg.nslices == 1);
+    CU_ASSERT(arg.nborrowed == 1);
+    CU_ASSERT(ops_memory_get_length(arg.body) == sizeof testdata);
+    CU_ASSERT(memcmp(ops_memory_get_data(arg.body), testdata,
+		     sizeof testdata) == 0);
+    ops_memory_free(arg.body);
+    }
+
+typedef struct
+    {
+    ops_memory_t *body;
+    unsigned nbodies;
+    unsigned longest;
+    } body_arg_t;
+
+static ops_parse_cb_return_t
+body_cb(const ops_parser_content_t *content_, ops_parse_cb_info_t *cbinfo)
+    {
+    const ops_literal_data_body_t *body=&content_->content.literal_data_body;
+    body_arg_t *arg=ops_parse_cb_get_arg(cbinfo);
+
+    if (content_->tag == OPS_PTAG_CT_LITERAL_DATA_BODY)
+	{
+	++arg->nbodies;
+	if (body->length > arg->longest)
+	    arg->longest=body->length;
+	ops_memory_add(arg->body, body->data, body->length);
+	}
+
+    return OPS_RELEASE_MEMORY;
+    }
+
+static void body_size_check(ops_memory_t *mem, const unsigned char *testdata,
+			    size_t length, size_t body_size, unsigned nbodies)
+    {
+    ops_parse_info_t *pinfo=NULL;
+    body_arg_t arg;
+
+    memset(&arg, '\0', sizeof arg);
+    arg.body=ops_memory_new();
+    ops_memory_init(arg.body, length);
+
+    ops_setup_memory_read(&pinfo, mem, &arg, body_cb, ops_false);
+    ops_parse_set_body_size(pinfo, body_size);
+    CU_ASSERT(ops_parse(pinfo));
+    ops_parse_info_delete(pinfo);
+
+    CU_ASSERT(arg.nbodies == nbodies);
+    CU_ASSERT(arg.longest <= body_size);
+    CU_ASSERT(ops_memory_get_length(arg.body) == length);
+    CU_ASSERT(memcmp(ops_memory_get_data(arg.body), testdata, length) == 0);
+    ops_memory_free(arg.body);
+    }
+
+static void test_rsa_signature_body_size(void)
+    {
+    unsigned char testdata[3*8192+100];
+    ops_memory_t *mem=NULL;
+
+    create_testdata("test_rsa_signature_body_size", testdata,
+		    sizeof testdata);
+    mem=ops_sign_buf(testdata, sizeof testdata, OPS_SIG_BINARY, alpha_skey,
+		     OPS_UNARMOURED);
+
+    body_size_check(mem, testdata, sizeof testdata, OPS_DEFAULT_BODY_SIZE, 4);
+    body_size_check(mem, testdata, sizeof testdata, 1000, 25);
+    body_size_check(mem, testdata, sizeof testdata, 1024*1024, 1);
+    ops_memory_free(mem);
+    }
+
+static void push_check(ops_memory_t *mem, const unsigned char *testdata,
+		       size_t length, size_t piece)
+    {
+    const unsigned char *p=ops_memory_get_data(mem);
+    size_t left=ops_memory_get_length(mem);
+    ops_push_parser_t *push;
+    body_arg_t arg;
+
+    memset(&arg, '\0', sizeof arg);
+    arg.body=ops_memory_new();
+    ops_memory_init(arg.body, length);
+
+    push=ops_push_parser_new(body_cb, &arg);
+    while (left)
+	{
+	size_t n=left < piece ? left : piece;
+
+	CU_ASSERT(ops_push_parser_feed(push, p, n));
+	p+=n;
+	left-=n;
+	}
+    CU_ASSERT(ops_push_parser_finish(push));
+    ops_push_parser_free(push);
+
+    CU_ASSERT(arg.longest <= OPS_DEFAULT_BODY_SIZE);
+    CU_ASSERT(ops_memory_get_length(arg.body) == length);
+    CU_ASSERT(memcmp(ops_memory_get_data(arg.body), testdata, length) == 0);
+    ops_memory_free(arg.body);
+    }
+
+static void test_rsa_signature_push_parser(void)
+    {
+    unsigned char testdata[3*8192+100];
+    ops_memory_t *mem=NULL;
+    ops_push_parser_t *push;
+    body_arg_t arg;
+
+    create_testdata("test_rsa_signature_push_parser", testdata,
+		    sizeof testdata);
+    mem=ops_sign_buf(testdata, sizeof testdata, OPS_SIG_BINARY, alpha_skey,
+		     OPS_UNARMOURED);
+
+    push_check(mem, testdata, sizeof testdata, 1);
+    push_check(mem, testdata, sizeof testdata, 7);
+    push_check(mem, testdata, sizeof testdata, 5000);
+    push_check(mem, testdata, sizeof testdata, ops_memory_get_length(mem));
+
+    // literal data reaches the callback before its packet is all here
+    memset(&arg, '\0', sizeof arg);
+    arg.body=ops_memory_new();
+    ops_memory_init(arg.body, sizeof testdata);
+    push=ops_push_parser_new(body_cb, &arg);
+    CU_ASSERT(ops_push_parser_feed(push, ops_memory_get_data(mem),
+				   ops_memory_get_length(mem)/2));
+    CU_ASSERT(ops_memory_get_length(arg.body) > 0);
+    CU_ASSERT(memcmp(ops_memory_get_data(arg.body), testdata,
+		     ops_memory_get_length(arg.body)) == 0);
+    ops_push_parser_free(push);
+    ops_memory_free(arg.body);
+
+    // input that stops inside a packet doesn't finish
+    memset(&arg, '\0', sizeof arg);
+    arg.body=ops_memory_new();
+    push=ops_push_parser_new(body_cb, &arg);
+    CU_ASSERT(ops_push_parser_feed(push, ops_memory_get_data(mem),
+				   ops_memory_get_length(mem)-10));
+    CU_ASSERT(!ops_push_parser_finish(push));
+    ops_push_parser_free(push);
+    ops_memory_free(arg.body);
+
+    ops_memory_free(mem);
+    }
+
+typedef struct
+    {
+    BIGNUM *sigs[3];
+    unsigned nsigs;
+    } mpi_arg_t;
+
+static ops_parse_cb_return_t
+mpi_cb(const ops_parser_content_t *content_, ops_parse_cb_info_t *cbinfo)
+    {
+    const ops_signature_t *sig=&content_->content.signature;
+    mpi_arg_t *arg=ops_parse_cb_get_arg(cbinfo);
+
+    if (content_->tag == OPS_PTAG_CT_SIGNATURE_FOOTER && arg->nsigs < 3)
+	arg->sigs[arg->nsigs++]=BN_dup(sig->info.signature.rsa.sig);
+
+    return OPS_RELEASE_MEMORY;
+    }
+
+static void mpi_parse(mpi_arg_t *arg, ops_memory_t *mem)
+    {
+    ops_parse_info_t *pinfo=NULL;
+
+    ops_setup_memory_read(&pinfo, mem, arg, mpi_cb, ops_false);
+    CU_ASSERT(ops_parse(pinfo));
+    ops_parse_info_delete(pinfo);
+    }
+
+static void test_rsa_signature_reused_mpis(void)
+    {
+    unsigned char testdata[3][100];
+    ops_memory_t *all=ops_memory_new();
+    mpi_arg_t one;
+    mpi_arg_t three;
+    unsigned n;
+
+    // Each signature in a run must read into the MPIs released by the
+    // one before without keeping any of its value
+    memset(&one, '\0', sizeof one);
+    memset(&three, '\0', sizeof three);
+    for (n=0 ; n < 3 ; ++n)
+	{
+	ops_memory_t *mem;
+
+	create_testdata("test_rsa_signature_reused_mpis", testdata[n],
+			sizeof testdata[n]);
+	testdata[n][0]=n;
+	mem=ops_sign_buf(testdata[n], sizeof testdata[n], OPS_SIG_BINARY,
+			 alpha_skey, OPS_UNARMOURED);
+	mpi_parse(&one, mem);
+	ops_memory_add(all, ops_memory_get_data(mem),
+		       ops_memory_get_length(mem));
+	ops_memory_free(mem);
+	}
+    mpi_parse(&three, all);
+
+    CU_ASSERT(one.nsigs == 3);
+    CU_ASSERT(three.nsigs == 3);
+    for (n=0 ; n < 3 ; ++n)
+	{
+	CU_ASSERT(BN_cmp(one.sigs[n], three.sigs[n]) == 0);
+	BN_free(one.sigs[n]);
+	BN_free(three.sigs[n]);
+	}
+    ops_memory_free(all);
+    }
+
+static void test_rsa_signature_several_signers(void)
+    {
+    const ops_secret_key_t *skeys[3];
+    ops_create_signature_t *sigs[3];
+    unsigned char testdata[2*8192+10];
+    unsigned char keyid[OPS_KEY_ID_SIZE];
+    ops_create_info_t *cinfo=NULL;
+    ops_memory_t *mem=NULL;
+    ops_validate_result_t *result=NULL;
+    int n;
+
+    // the one-pass signatures share a single running SHA-1, and each
+    // signature still gets the whole of the data
+    skeys[0]=alpha_skey;
+    skeys[1]=bravo_skey;
+    skeys[2]=alpha_skey;
+    create_testdata("test_rsa_signature_several_signers", testdata,
+		    sizeof testdata);
+    ops_setup_memory_write(&cinfo, &mem, sizeof testdata);
+    for (n=0 ; n < 3 ; ++n)
+	{
+	sigs[n]=ops_create_signature_new();
+	ops_signature_start_message_signature(sigs[n], skeys[n], OPS_HASH_SHA1,
+					      OPS_SIG_BINARY);
+	ops_write_one_pass_sig(skeys[n], OPS_HASH_SHA1, OPS_SIG_BINARY, cinfo);
+	ops_signature_get_hash(sigs[n])->add(ops_signature_get_hash(sigs[n]),
+					     testdata, sizeof testdata);
+	}
+    ops_write_literal_data_from_buf(testdata, sizeof testdata, OPS_LDT_BINARY,
+				    cinfo);
+    for (n=2 ; n >= 0 ; --n)
+	{
+	ops_signature_add_creation_time(sigs[n], time(NULL));
+	ops_keyid(keyid, &skeys[n]->public_key);
+	ops_signature_add_issuer_key_id(sigs[n], keyid);
+	ops_signature_hashed_subpackets_end(sigs[n]);
+	ops_write_signature(sigs[n], &skeys[n]->public_key, skeys[n], cinfo);
+	ops_create_signature_delete(sigs[n]);
+	}
+    ops_writer_close(cinfo);
+    ops_create_info_delete(cinfo);
+
+    result=ops_mallocz(sizeof *result);
+    CU_ASSERT(ops_validate_mem(result, mem, OPS_UNARMOURED, &pub_keyring));
+    CU_ASSERT(result->valid_count == 3);
+    CU_ASSERT(result->invalid_count == 0);
+    ops_validate_result_free(result);
+    }
+
+static void test_rsa_signature_concatenated(void)
+    {
+    const ops_secret_key_t *skeys[3];
+    unsigned char testdata[8192+10];
+    ops_memory_t *all=NULL;
+    ops_memory_t *mem=NULL;
+    ops_validate_result_t *result=NULL;
+    int n;
+
+    // each message's one-pass signature hashes its own literal data, not
+    // that of the messages before it
+    skeys[0]=alpha_skey;
+    skeys[1]=alpha_skey;
+    skeys[2]=bravo_skey;
+    all=ops_memory_new();
+    ops_memory_init(all, 3*sizeof testdata);
+    for (n=0 ; n < 3 ; ++n)
+	{
+	create_testdata("test_rsa_signature_concatenated", testdata,
+			sizeof testdata);
+	testdata[0]=n;
+	mem=ops_sign_buf(testdata, sizeof testdata, OPS_SIG_BINARY, skeys[n],
+			 OPS_UNARMOURED);
+	ops_memory_add(all, ops_memory_get_data(mem),
+		       ops_memory_get_length(mem));
+	ops_memory_free(mem);
+	}
+
+    // ops_validate_mem() frees all
+    result=ops_mallocz(sizeof *result);
+    CU_ASSERT(ops_validate_mem(result, all, OPS_UNARMOURED, &pub_keyring));
+    CU_ASSERT(result->valid_count == 3);
+    CU_ASSERT(result->invalid_count == 0);
+    ops_validate_result_free(result);
+    }
+
+// Write a detached signature over data by skey to cinfo
+static void write_detached_signature(ops_create_info_t *cinfo,
+				     const unsigned char *data, size_t length,
+				     const ops_secret_key_t *skey)
+    {
+    ops_create_signature_t *sig=ops_create_signature_new();
+    unsigned char keyid[OPS_KEY_ID_SIZE];
+
+    ops_signature_start_cleartext_signature(sig, skey, OPS_HASH_SHA1,
+					    OPS_SIG_BINARY);
+    ops_signature_add_data(sig, data, length);
+    ops_signature_add_creation_time(sig, time(NULL));
+    ops_keyid(keyid, &skey->public_key);
+    ops_signature_add_issuer_key_id(sig, keyid);
+    ops_signature_hashed_subpackets_end(sig);
+    ops_write_signature(sig, &skey->public_key, skey, cinfo);
+    ops_create_signature_delete(sig);
+    }
+
+static void test_rsa_signature_detached_batch(void)
+    {
+    unsigned char testdata[8192+10];
+    unsigned char tampered[sizeof testdata];
+    char datafile[MAXBUF];
+    char keyring_name[MAXBUF];
+    ops_keyring_t keyring;
+    ops_verifier_t *verifier;
+    ops_create_info_t *cinfo=NULL;
+    ops_memory_t *sig=NULL;
+    ops_memory_t *sigs=NULL;
+    ops_verify_job_t jobs[5];
+    int n;
+
+    create_testdata("test_rsa_signature_detached_batch", testdata,
+		    sizeof testdata);
+    memcpy(tampered, testdata, sizeof tampered);
+    tampered[100]^=1;
+    snprintf(datafile, sizeof datafile, "%s/detached_batch.dat", dir);
+    ops_write_file_from_buf(datafile, (char *)testdata, sizeof testdata,
+			    ops_true);
+
+    ops_setup_memory_write(&cinfo, &sig, 1024);
+    write_detached_signature(cinfo, testdata, sizeof testdata, alpha_skey);
+    ops_writer_close(cinfo);
+    ops_create_info_delete(cinfo);
+
+    // two signatures in one file
+    ops_setup_memory_write(&cinfo, &sigs, 1024);
+    write_detached_signature(cinfo, testdata, sizeof testdata, alpha_skey);
+    write_detached_signature(cinfo, testdata, sizeof testdata, bravo_skey);
+    ops_writer_close(cinfo);
+    ops_create_info_delete(cinfo);
+
+    memset(jobs, '\0', sizeof jobs);
+    for (n=0 ; n < 5 ; ++n)
+	{
+	jobs[n].data.buffer=testdata;
+	jobs[n].data.length=sizeof testdata;
+	jobs[n].data.fd=-1;
+	jobs[n].signature.buffer=ops_memory_get_data(sig);
+	jobs[n].signature.length=ops_memory_get_length(sig);
+	jobs[n].signature.fd=-1;
+	}
+    jobs[1].data.buffer=tampered;
+    jobs[2].data_filename=datafile;
+    jobs[3].data_filename="/nonexistent/detached_batch.dat";
+    jobs[4].signature.buffer=ops_memory_get_data(sigs);
+    jobs[4].signature.length=ops_memory_get_length(sigs);
+
+    memset(&keyring, '\0', sizeof keyring);
+    snprintf(keyring_name, sizeof keyring_name, "%s/pubring.gpg", dir);
+    CU_ASSERT(ops_keyring_read_from_file(&keyring, OPS_UNARMOURED,
+					 keyring_name));
+    verifier=ops_verifier_new(&keyring, 3);
+    CU_ASSERT(keyring.nkeys == 0);
+    ops_verifier_run(verifier, jobs, 5);
+
+    CU_ASSERT(jobs[0].valid);
+    CU_ASSERT(jobs[0].result->valid_count == 1);
+    CU_ASSERT(!jobs[1].valid);
+    CU_ASSERT(jobs[1].result->invalid_count == 1);
+    CU_ASSERT(jobs[2].valid);
+    CU_ASSERT(!jobs[3].valid);
+    CU_ASSERT(jobs[3].sys_errno == ENOENT);
+    CU_ASSERT(jobs[4].valid);
+    CU_ASSERT(jobs[4].result->valid_count == 2);
+    for (n=0 ; n < 5 ; ++n)
+	ops_validate_result_free(jobs[n].result);
+
+    ops_verifier_free(verifier);
+    ops_memory_free(sig);
+    ops_memory_free(sigs);
+    }
+
+static void test_rsa_signature_detached_file(void)
+    {
+    unsigned char testdata[3*8192+10];
+    char datafile[MAXBUF];
+    char sigfile[MAXBUF];
+    ops_create_info_t *cinfo=NULL;
+    ops_validate_result_t *result=NULL;
+    int fd;
+
+    create_testdata("test_rsa_signature_detached_file", testdata,
+		    sizeof testdata);
+    snprintf(datafile, sizeof datafile, "%s/detached_file.dat", dir);
+    snprintf(sigfile, sizeof sigfile, "%s/detached_file.sig", dir);
+    ops_write_file_from_buf(datafile, (char *)testdata, sizeof testdata,
+			    ops_true);
+    fd=ops_setup_file_write(&cinfo, sigfile, ops_true);
+    write_detached_signature(cinfo, testdata, sizeof testdata, alpha_skey);
+    ops_teardown_file_write(cinfo, fd);
+
+    result=ops_mallocz(sizeof *result);
+    CU_ASSERT(ops_validate_detached_file(result, datafile, sigfile,
+					 OPS_UNARMOURED, &pub_keyring));
+    CU_ASSERT(result->valid_count == 1);
+    ops_validate_result_free(result);
+
+    testdata[sizeof testdata-1]^=1;
+    ops_write_file_from_buf(datafile, (char *)testdata, sizeof testdata,
+			    ops_true);
+    result=ops_mallocz(sizeof *result);
+    CU_ASSERT(!ops_validate_detached_file(result, datafile, sigfile,
+					  OPS_UNARMOURED, &pub_keyring));
+    CU_ASSERT(result->invalid_count == 1);
+    ops_validate_result_free(result);
+    }
+
+static void test_rsa_signature_detached_context(void)
+    {
+    unsigned char testdata[8192+10];
+    unsigned char tampered[sizeof testdata];
+    ops_create_info_t *cinfo=NULL;
+    ops_memory_t *sig=NULL;
+    ops_validate_source_t signature;
+    ops_validate_source_t data;
+    ops_validate_context_t *context;
+    ops_validate_result_t *result=NULL;
+    ops_hash_t hash;
+    unsigned char out[OPS_MAX_HASH_SIZE];
+    int n;
+
+    create_testdata("test_rsa_signature_detached_context", testdata,
+		    sizeof testdata);
+    memcpy(tampered, testdata, sizeof tampered);
+    tampered[10]^=1;
+
+    ops_setup_memory_write(&cinfo, &sig, 1024);
+    write_detached_signature(cinfo, testdata, sizeof testdata, alpha_skey);
+    ops_writer_close(cinfo);
+    ops_create_info_delete(cinfo);
+
+    memset(&signature, '\0', sizeof signature);
+    signature.buffer=ops_memory_get_data(sig);
+    signature.length=ops_memory_get_length(sig);
+    signature.fd=-1;
+    context=ops_validate_context_new(&signature, OPS_UNARMOURED,
+				     &pub_keyring);
+
+    // the same signature, against several copies of the data
+    memset(&data, '\0', sizeof data);
+    data.length=sizeof testdata;
+    data.fd=-1;
+    for (n=0 ; n < 3 ; ++n)
+	{
+	data.buffer=n == 1 ? tampered : testdata;
+	result=ops_mallocz(sizeof *result);
+	CU_ASSERT(ops_validate_context_check(result, context, &data)
+		  == (n != 1));
+	CU_ASSERT(result->valid_count == (n != 1));
+	ops_validate_result_free(result);
+	}
+
+    // and against data the caller has hashed
+    ops_hash_sha1(&hash);
+    hash.init(&hash);
+    hash.add(&hash, testdata, sizeof testdata);
+    for (n=0 ; n < 2 ; ++n)
+	{
+	result=ops_mallocz(sizeof *result);
+	CU_ASSERT(ops_validate_context_check_hash(result, context, &hash));
+	ops_validate_result_free(result);
+	}
+    hash.finish(&hash, out);
+
+    ops_validate_context_free(context);
+    ops_memory_free(sig);
+    }
+
+static void pipelined_sign(int use_armour, const char *suffix)
+    {
+    char myfile[MAXBUF];
+    char signed_file[MAXBUF];
+    ops_validate_result_t *result=NULL;
+
+    // small buffers, so the files take many trips round the ring
+    set_up_file_names(myfile, signed_file,
+		      filename_rsa_large_noarmour_nopassphrase, suffix);
+    CU_ASSERT(ops_sign_file_pipelined(myfile, signed_file, alpha_skey,
+				      use_armour, ops_true, 2, 1024));
+    check_sig(signed_file, use_armour);
+
+    result=ops_mallocz(sizeof *result);
+    CU_ASSERT(ops_validate_file_pipelined(result, signed_file, use_armour,
+					  &pub_keyring, 2, 1024));
+    CU_ASSERT(result->valid_count == 1);
+    ops_validate_result_free(result);
+    }
+
+static void test_rsa_signature_pipelined(void)
+    {
+    char myfile[MAXBUF];
+    char out_file[MAXBUF];
+    ops_create_info_t *cinfo=NULL;
+    unsigned char buf[4096];
+    int fd;
+    int n;
+
+    pipelined_sign(OPS_UNARMOURED, "pipelined.gpg");
+    pipelined_sign(OPS_ARMOURED, "pipelined.asc");
+
+    // a writer torn down before it is closed waits for its thread
+    set_up_file_names(myfile, out_file,
+		      filename_rsa_large_noarmour_nopassphrase, "reset");
+    fd=ops_setup_file_write_pipelined(&cinfo, out_file, ops_true, 2, 1024);
+    CU_ASSERT_FATAL(fd >= 0);
+    memset(buf, 'x', sizeof buf);
+    for (n=0 ; n < 8 ; ++n)
+	ops_write(buf, sizeof buf, cinfo);
+    ops_create_info_reset(cinfo);
+    ops_create_info_delete(cinfo);
+    close(fd);
+    }
+
 /*
 static void test_todo(void)
     {
@@ -383,6 +1000,50 @@ static int add_tests(CU_pSuite suite)
     if (NULL == CU_add_test(suite, "Large, armour, no passphrase",
 			    test_rsa_signature_large_armour_nopassphrase))
 	    return 0;
+
+    if (NULL == CU_add_test(suite, "Body of many chunks",
+			    test_rsa_signature_many_chunks))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Borrowed literal data bodies",
+			    test_rsa_signature_borrowed_bodies))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Literal data body size",
+			    test_rsa_signature_body_size))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Fed a piece at a time",
+			    test_rsa_signature_push_parser))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Signature MPIs read into spares",
+			    test_rsa_signature_reused_mpis))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Several signers, one pass",
+			    test_rsa_signature_several_signers))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Concatenated signed messages",
+			    test_rsa_signature_concatenated))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Detached, batch verifier",
+			    test_rsa_signature_detached_batch))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Detached, file",
+			    test_rsa_signature_detached_file))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Detached, reused context",
+			    test_rsa_signature_detached_context))
+	    return 0;
+
+    if (NULL == CU_add_test(suite, "Large, pipelined I/O",
+			    test_rsa_signature_pipelined))
+	    return 0;
     /*
     if (NULL == CU_add_test(suite, "Tests to be implemented", test_todo))
 	    return 0;
@@ -104,6 +104,7 @@ callback_verify_example(const ops_parser_content_t *content_,
 
 void reset_vars();
 int file_compare(char* file1, char* file2);
+void corrupt_signed_text(const char *name, const char *suffix);
 
 ops_keyring_t pub_keyring;
 ops_keyring_t sec_keyring;